@@ -0,0 +1,81 @@
+// --------------------------------------------------------------------------------
+// Memory footprint of models with many fields
+// --------------------------------------------------------------------------------
+#include <restful_mapper/model.h>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+using namespace restful_mapper;
+
+// --------------------------------------------------------------------------------
+// Declarations
+// --------------------------------------------------------------------------------
+#define FIELDS_20(type, prefix) \
+  type prefix##0;  type prefix##1;  type prefix##2;  type prefix##3;  type prefix##4; \
+  type prefix##5;  type prefix##6;  type prefix##7;  type prefix##8;  type prefix##9; \
+  type prefix##10; type prefix##11; type prefix##12; type prefix##13; type prefix##14; \
+  type prefix##15; type prefix##16; type prefix##17; type prefix##18; type prefix##19;
+
+// 80 fields, 20 of each common type
+class Wide : public Model<Wide>
+{
+public:
+  FIELDS_20(Field<int>, i)
+  FIELDS_20(Field<double>, d)
+  FIELDS_20(Field<bool>, b)
+  FIELDS_20(Field<string>, s)
+};
+
+// Field layout before the flags were packed: a vtable and one bool per flag
+template <class T>
+class UnpackedField
+{
+public:
+  UnpackedField() : is_dirty_(false), is_null_(true), is_loaded_(true) {}
+  virtual ~UnpackedField() {}
+  virtual const T &get() const { return value_; }
+
+protected:
+  T value_;
+  mutable bool is_dirty_;
+  bool is_null_;
+  bool is_loaded_;
+};
+
+class UnpackedWide : public Model<UnpackedWide>
+{
+public:
+  FIELDS_20(UnpackedField<int>, i)
+  FIELDS_20(UnpackedField<double>, d)
+  FIELDS_20(UnpackedField<bool>, b)
+  FIELDS_20(UnpackedField<string>, s)
+};
+
+// --------------------------------------------------------------------------------
+// Definitions
+// --------------------------------------------------------------------------------
+template <class T>
+void report(const char *name, const size_t &count)
+{
+  vector<T> models(count);
+
+  cout << name << ": " << sizeof(T) << " bytes per model, "
+       << (sizeof(T) * models.size()) / (1024 * 1024) << " MiB for " << models.size() << " models" << endl;
+}
+
+int main()
+{
+  const size_t count = 100000;
+
+  cout << "Field<int>: " << sizeof(Field<int>) << " bytes (unpacked " << sizeof(UnpackedField<int>) << ")" << endl;
+  cout << "Field<double>: " << sizeof(Field<double>) << " bytes (unpacked " << sizeof(UnpackedField<double>) << ")" << endl;
+  cout << "Field<bool>: " << sizeof(Field<bool>) << " bytes (unpacked " << sizeof(UnpackedField<bool>) << ")" << endl;
+  cout << "Field<string>: " << sizeof(Field<string>) << " bytes (unpacked " << sizeof(UnpackedField<string>) << ")" << endl;
+  cout << "Primary: " << sizeof(Primary) << " bytes" << endl;
+
+  report<Wide>("packed", count);
+  report<UnpackedWide>("unpacked", count);
+
+  return 0;
+}
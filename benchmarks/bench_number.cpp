@@ -0,0 +1,94 @@
+// --------------------------------------------------------------------------------
+// Number formatting in the emitter, compared to yajl's printf based generator
+// --------------------------------------------------------------------------------
+#include <restful_mapper/json.h>
+#include <ctime>
+#include <iostream>
+#include <vector>
+
+extern "C" {
+#include <yajl/yajl_gen.h>
+}
+
+using namespace std;
+using namespace restful_mapper;
+
+// --------------------------------------------------------------------------------
+// Declarations
+// --------------------------------------------------------------------------------
+
+// Sensor style readings: a few significant digits and the occasional integer
+vector<double> readings(const size_t &count)
+{
+  vector<double> values;
+  values.reserve(count);
+
+  for (size_t i = 0; i < count; i++)
+  {
+    values.push_back((i % 7 == 0) ? double(i) : (i * 0.731) - 1000.0);
+  }
+
+  return values;
+}
+
+// --------------------------------------------------------------------------------
+// Definitions
+// --------------------------------------------------------------------------------
+double measure_emitter(const vector<double> &values, const size_t &iterations)
+{
+  clock_t start = clock();
+
+  for (size_t i = 0; i < iterations; i++)
+  {
+    Json::Emitter emitter;
+    emitter.emit(values);
+  }
+
+  return double(clock() - start) / CLOCKS_PER_SEC;
+}
+
+double measure_yajl(const vector<double> &values, const size_t &iterations)
+{
+  clock_t start = clock();
+
+  for (size_t i = 0; i < iterations; i++)
+  {
+    yajl_gen generator = yajl_gen_alloc(NULL);
+    yajl_gen_array_open(generator);
+
+    for (size_t j = 0; j < values.size(); j++)
+    {
+      yajl_gen_double(generator, values[j]);
+    }
+
+    yajl_gen_array_close(generator);
+    yajl_gen_free(generator);
+  }
+
+  return double(clock() - start) / CLOCKS_PER_SEC;
+}
+
+double measure_encode(const size_t &iterations)
+{
+  clock_t start = clock();
+  size_t length = 0;
+
+  for (size_t i = 0; i < iterations; i++)
+  {
+    length += Json::encode(static_cast<long long>(i)).size();
+  }
+
+  return double(clock() - start) / CLOCKS_PER_SEC + (length ? 0 : 1);
+}
+
+int main()
+{
+  vector<double> values = readings(10000);
+
+  cout << "10000 doubles x 200:" << endl;
+  cout << "  yajl_gen_double: " << measure_yajl(values, 200) << " s" << endl;
+  cout << "  Json::Emitter: " << measure_emitter(values, 200) << " s" << endl;
+  cout << "Json::encode of 1000000 integers: " << measure_encode(1000000) << " s" << endl;
+
+  return 0;
+}
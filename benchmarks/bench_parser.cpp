@@ -0,0 +1,87 @@
+// --------------------------------------------------------------------------------
+// JSON parse time of the available parser engines
+// --------------------------------------------------------------------------------
+#include <restful_mapper/json.h>
+#include <ctime>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+using namespace std;
+using namespace restful_mapper;
+
+// --------------------------------------------------------------------------------
+// Declarations
+// --------------------------------------------------------------------------------
+
+// A collection response, as returned by find_all
+string collection_payload(const size_t &count)
+{
+  ostringstream s;
+  s.precision(17);
+
+  s << "{\"objects\":[";
+
+  for (size_t i = 0; i < count; i++)
+  {
+    if (i) s << ",";
+
+    s << "{\"id\":" << i + 1
+      << ",\"name\":\"Item number " << i + 1 << "\""
+      << ",\"description\":\"A somewhat longer text, with \\\"quotes\\\" and a line break\\n\""
+      << ",\"amount\":" << (i * 1.37)
+      << ",\"is_active\":" << ((i % 2) ? "true" : "false")
+      << ",\"parent_id\":" << (i % 3 ? "null" : "7")
+      << ",\"created_on\":\"2013-03-14T12:34:56\""
+      << ",\"tags\":[\"alpha\",\"beta\",\"gamma\"]"
+      << ",\"owner\":{\"id\":" << (i % 10) << ",\"email\":\"owner@example.com\"}}";
+  }
+
+  s << "],\"num_results\":" << count << ",\"page\":1,\"total_pages\":1}";
+
+  return s.str();
+}
+
+// A single object, as returned by find
+string object_payload()
+{
+  return "{\"id\":1,\"name\":\"Item\",\"amount\":3.1415926535897931,\"is_active\":true,"
+         "\"parent_id\":null,\"created_on\":\"2013-03-14T12:34:56\"}";
+}
+
+// --------------------------------------------------------------------------------
+// Definitions
+// --------------------------------------------------------------------------------
+double measure(const Json::ParserEngine &engine, const string &payload, const size_t &iterations)
+{
+  Json::set_parser_engine(engine);
+
+  clock_t start = clock();
+
+  for (size_t i = 0; i < iterations; i++)
+  {
+    Json::Parser parser(payload);
+  }
+
+  return double(clock() - start) / CLOCKS_PER_SEC;
+}
+
+void report(const char *name, const string &payload, const size_t &iterations)
+{
+  double yajl       = measure(Json::YAJL_ENGINE, payload, iterations);
+  double structural = measure(Json::STRUCTURAL_ENGINE, payload, iterations);
+  double megabytes  = double(payload.size()) * iterations / (1024 * 1024);
+
+  cout << name << " (" << payload.size() << " bytes x " << iterations << "):" << endl;
+  cout << "  yajl: " << yajl << " s, " << megabytes / yajl << " MiB/s" << endl;
+  cout << "  structural: " << structural << " s, " << megabytes / structural << " MiB/s" << endl;
+}
+
+int main()
+{
+  report("object", object_payload(), 200000);
+  report("collection of 10", collection_payload(10), 20000);
+  report("collection of 1000", collection_payload(1000), 200);
+
+  return 0;
+}
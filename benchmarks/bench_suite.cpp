@@ -0,0 +1,510 @@
+// --------------------------------------------------------------------------------
+// Microbenchmarks of the mapper hot paths, reported as JSON
+//
+// Usage: bench_suite [output.json]
+//
+// Inputs are generated deterministically and every benchmark runs a fixed
+// number of iterations, so results are comparable between runs. Each benchmark
+// is run once to warm up and then timed REPETITIONS times; the best and median
+// wall time per iteration are reported.
+// --------------------------------------------------------------------------------
+#include <restful_mapper.h>
+#include <restful_mapper/internal/iso8601.h>
+#include <restful_mapper/internal/utf8.h>
+#include <restful_mapper/meta.h>
+#include "mock_webservice.h"
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/time.h>
+#endif
+
+using namespace std;
+using namespace restful_mapper;
+
+// --------------------------------------------------------------------------------
+// Declarations
+// --------------------------------------------------------------------------------
+#define WIDE_FIELDS_8(type, prefix) \
+  type prefix##0; type prefix##1; type prefix##2; type prefix##3; \
+  type prefix##4; type prefix##5; type prefix##6; type prefix##7;
+
+#define WIDE_MAP_8(prefix) \
+  (#prefix "0", prefix##0) (#prefix "1", prefix##1) (#prefix "2", prefix##2) (#prefix "3", prefix##3) \
+  (#prefix "4", prefix##4) (#prefix "5", prefix##5) (#prefix "6", prefix##6) (#prefix "7", prefix##7)
+
+// 32 fields, 8 of each common type
+class Wide : public Model<Wide>
+{
+public:
+  Primary id;
+  WIDE_FIELDS_8(Field<int>, i)
+  WIDE_FIELDS_8(Field<double>, d)
+  WIDE_FIELDS_8(Field<bool>, b)
+  WIDE_FIELDS_8(Field<string>, s)
+
+  RESTFUL_MAPPER_FIELDS
+  {
+    map("id", id) WIDE_MAP_8(i) WIDE_MAP_8(d) WIDE_MAP_8(b) WIDE_MAP_8(s);
+  }
+
+  virtual std::string endpoint() const
+  {
+    return "/wide";
+  }
+
+  virtual const Primary &primary() const
+  {
+    return id;
+  }
+};
+
+// Three levels of one-to-many relationships
+class Trunk;
+class Leaf;
+
+class Branch : public Model<Branch>
+{
+public:
+  Primary id;
+  Foreign<Trunk> trunk_id;
+  Field<string> name;
+  HasMany<Leaf> leaves;
+
+  RESTFUL_MAPPER_FIELDS
+  {
+    map("id", id)
+       ("trunk_id", trunk_id)
+       ("name", name)
+       ("leaves", leaves);
+  }
+
+  virtual std::string endpoint() const
+  {
+    return "/branch";
+  }
+
+  virtual const Primary &primary() const
+  {
+    return id;
+  }
+};
+
+class Leaf : public Model<Leaf>
+{
+public:
+  Primary id;
+  Foreign<Branch> branch_id;
+  Field<double> area;
+  Field<time_t> grown_on;
+
+  RESTFUL_MAPPER_FIELDS
+  {
+    map("id", id)
+       ("branch_id", branch_id)
+       ("area", area)
+       ("grown_on", grown_on);
+  }
+
+  virtual std::string endpoint() const
+  {
+    return "/leaf";
+  }
+
+  virtual const Primary &primary() const
+  {
+    return id;
+  }
+};
+
+class Trunk : public Model<Trunk>
+{
+public:
+  Primary id;
+  Field<string> name;
+  HasMany<Branch> branches;
+
+  RESTFUL_MAPPER_FIELDS
+  {
+    map("id", id)
+       ("name", name)
+       ("branches", branches);
+  }
+
+  virtual std::string endpoint() const
+  {
+    return "/trunk";
+  }
+
+  virtual const Primary &primary() const
+  {
+    return id;
+  }
+};
+
+typedef void (*BenchmarkFunction)(const size_t &iterations);
+
+struct Benchmark
+{
+  const char *name;
+  BenchmarkFunction function;
+  size_t iterations;
+};
+
+struct Result
+{
+  string name;
+  size_t iterations;
+  double best_ns;
+  double median_ns;
+};
+
+const size_t REPETITIONS = 5;
+
+// Keeps the compiler from discarding the measured work
+volatile size_t sink = 0;
+
+// Inputs shared by the benchmarks, generated once
+string wide_object_json;
+string wide_collection_json;
+string nested_json;
+Wide wide_object;
+Trunk nested_object;
+Wide::Collection wide_collection;
+vector<double> emitter_values;
+vector<string> timestamps;
+string latin1_text;
+
+double wall_time()
+{
+#ifdef _WIN32
+  LARGE_INTEGER frequency, counter;
+  QueryPerformanceFrequency(&frequency);
+  QueryPerformanceCounter(&counter);
+
+  return double(counter.QuadPart) / double(frequency.QuadPart);
+#else
+  timeval now;
+  gettimeofday(&now, NULL);
+
+  return now.tv_sec + now.tv_usec * 1e-6;
+#endif
+}
+
+string wide_json(const size_t &id)
+{
+  ostringstream s;
+  s.precision(17);
+
+  s << "{\"id\":" << id;
+
+  for (size_t i = 0; i < 8; i++) s << ",\"i" << i << "\":" << (id * 31 + i) % 1000;
+  for (size_t i = 0; i < 8; i++) s << ",\"d" << i << "\":" << (id + i) * 0.731;
+  for (size_t i = 0; i < 8; i++) s << ",\"b" << i << "\":" << (((id + i) % 2) ? "true" : "false");
+  for (size_t i = 0; i < 8; i++) s << ",\"s" << i << "\":\"Value " << id << "-" << i << "\"";
+
+  s << "}";
+
+  return s.str();
+}
+
+// A trunk with 8 branches of 16 leaves each
+string nested_payload()
+{
+  ostringstream s;
+
+  s << "{\"id\":1,\"name\":\"Trunk\",\"branches\":[";
+
+  for (size_t b = 0; b < 8; b++)
+  {
+    if (b) s << ",";
+
+    s << "{\"id\":" << b + 1 << ",\"trunk_id\":1,\"name\":\"Branch " << b + 1 << "\",\"leaves\":[";
+
+    for (size_t l = 0; l < 16; l++)
+    {
+      if (l) s << ",";
+
+      s << "{\"id\":" << b * 16 + l + 1 << ",\"branch_id\":" << b + 1
+        << ",\"area\":" << (l + 1) * 1.25 << ",\"grown_on\":\"2013-03-14T12:34:56\"}";
+    }
+
+    s << "]}";
+  }
+
+  s << "]}";
+
+  return s.str();
+}
+
+void prepare()
+{
+  wide_object_json = wide_json(1);
+
+  ostringstream collection;
+  collection << "{\"objects\":[";
+
+  for (size_t i = 0; i < 100; i++)
+  {
+    if (i) collection << ",";
+    collection << wide_json(i + 1);
+  }
+
+  collection << "],\"num_results\":100,\"page\":1,\"total_pages\":1}";
+  wide_collection_json = collection.str();
+
+  nested_json = nested_payload();
+
+  wide_object.from_json(wide_object_json);
+  nested_object.from_json(nested_json);
+
+  for (size_t i = 0; i < 1000; i++)
+  {
+    Wide item;
+    item.from_json(wide_json(i + 1));
+    wide_collection.push_back(item);
+
+    emitter_values.push_back((i % 7 == 0) ? double(i) : (i * 0.731) - 100.0);
+    timestamps.push_back(to_iso8601(static_cast<time_t>(1363264496 + i * 86413), i % 2 == 0));
+  }
+
+  for (size_t i = 0; i < 1024; i++)
+  {
+    latin1_text += (i % 16 == 0) ? '\xF8' : static_cast<char>('a' + i % 26);
+  }
+}
+
+// --------------------------------------------------------------------------------
+// Benchmarks
+// --------------------------------------------------------------------------------
+void parse_with(const Json::ParserEngine &engine, const size_t &iterations)
+{
+  Json::ParserEngine previous_engine = Json::parser_engine();
+  Json::set_parser_engine(engine);
+
+  for (size_t i = 0; i < iterations; i++)
+  {
+    Json::Parser parser(wide_collection_json);
+    sink += parser.is_loaded();
+  }
+
+  Json::set_parser_engine(previous_engine);
+}
+
+void json_parse_yajl(const size_t &iterations)
+{
+  parse_with(Json::YAJL_ENGINE, iterations);
+}
+
+void json_parse_structural(const size_t &iterations)
+{
+  parse_with(Json::STRUCTURAL_ENGINE, iterations);
+}
+
+void json_emit(const size_t &iterations)
+{
+  for (size_t i = 0; i < iterations; i++)
+  {
+    Json::Emitter emitter;
+    emitter.emit_array_open();
+
+    for (size_t j = 0; j < emitter_values.size(); j++)
+    {
+      emitter.emit_map_open();
+      emitter.emit("id", static_cast<long long>(j));
+      emitter.emit("value", emitter_values[j]);
+      emitter.emit("label", "reading");
+      emitter.emit_map_close();
+    }
+
+    emitter.emit_array_close();
+    sink += emitter.dump().size();
+  }
+}
+
+void model_from_json_wide(const size_t &iterations)
+{
+  for (size_t i = 0; i < iterations; i++)
+  {
+    Wide model;
+    model.from_json(wide_object_json);
+    sink += model.i0.get();
+  }
+}
+
+void model_to_json_wide(const size_t &iterations)
+{
+  for (size_t i = 0; i < iterations; i++)
+  {
+    sink += wide_object.to_json(KEEP_FIELDS_DIRTY | IGNORE_DIRTY_FLAG).size();
+  }
+}
+
+void model_from_json_nested(const size_t &iterations)
+{
+  for (size_t i = 0; i < iterations; i++)
+  {
+    Trunk model;
+    model.from_json(nested_json);
+    sink += model.branches.size();
+  }
+}
+
+void model_to_json_nested(const size_t &iterations)
+{
+  for (size_t i = 0; i < iterations; i++)
+  {
+    sink += nested_object.to_json(KEEP_FIELDS_DIRTY | IGNORE_DIRTY_FLAG).size();
+  }
+}
+
+void collection_find(const size_t &iterations)
+{
+  for (size_t i = 0; i < iterations; i++)
+  {
+    sink += wide_collection.find("i0", static_cast<int>(i % 1000)).size();
+  }
+}
+
+void iconv_to_utf8(const size_t &iterations)
+{
+  for (size_t i = 0; i < iterations; i++)
+  {
+    sink += iconv_string(latin1_text, "UTF-8", "ISO-8859-1").size();
+  }
+}
+
+void iso8601_parse(const size_t &iterations)
+{
+  for (size_t i = 0; i < iterations; i++)
+  {
+    sink += static_cast<size_t>(from_iso8601(timestamps[i % timestamps.size()]));
+  }
+}
+
+void api_find(const size_t &iterations)
+{
+  for (size_t i = 0; i < iterations; i++)
+  {
+    sink += Wide::find(static_cast<int>(i % 100 + 1)).i0.get();
+  }
+}
+
+void api_find_all(const size_t &iterations)
+{
+  for (size_t i = 0; i < iterations; i++)
+  {
+    sink += Wide::find_all().size();
+  }
+}
+
+// --------------------------------------------------------------------------------
+// Definitions
+// --------------------------------------------------------------------------------
+Result run(const Benchmark &benchmark)
+{
+  vector<double> times;
+
+  benchmark.function(benchmark.iterations);
+
+  for (size_t i = 0; i < REPETITIONS; i++)
+  {
+    double start = wall_time();
+    benchmark.function(benchmark.iterations);
+    times.push_back((wall_time() - start) * 1e9 / benchmark.iterations);
+  }
+
+  sort(times.begin(), times.end());
+
+  Result result;
+  result.name       = benchmark.name;
+  result.iterations = benchmark.iterations;
+  result.best_ns    = times.front();
+  result.median_ns  = times[times.size() / 2];
+
+  return result;
+}
+
+string report(const vector<Result> &results)
+{
+  Json::Emitter emitter;
+
+  emitter.emit_map_open();
+  emitter.emit("version", VERSION);
+  emitter.emit("repetitions", static_cast<long long>(REPETITIONS));
+  emitter.emit_key("benchmarks");
+  emitter.emit_array_open();
+
+  for (size_t i = 0; i < results.size(); i++)
+  {
+    emitter.emit_map_open();
+    emitter.emit("name", results[i].name);
+    emitter.emit("iterations", static_cast<long long>(results[i].iterations));
+    emitter.emit("best_ns", results[i].best_ns);
+    emitter.emit("median_ns", results[i].median_ns);
+    emitter.emit_map_close();
+  }
+
+  emitter.emit_array_close();
+  emitter.emit_map_close();
+
+  return emitter.dump();
+}
+
+int main(int argc, char **argv)
+{
+  prepare();
+
+  MockWebservice server;
+  Api::set_url(server.url());
+  Api::set_proxy("");
+
+  for (size_t i = 0; i < 100; i++)
+  {
+    server.insert("wide", wide_json(i + 1));
+  }
+
+  const Benchmark benchmarks[] =
+  {
+    { "json/parse/yajl", json_parse_yajl, 200 },
+    { "json/parse/structural", json_parse_structural, 200 },
+    { "json/emit", json_emit, 100 },
+    { "model/from_json/wide", model_from_json_wide, 5000 },
+    { "model/to_json/wide", model_to_json_wide, 5000 },
+    { "model/from_json/nested", model_from_json_nested, 200 },
+    { "model/to_json/nested", model_to_json_nested, 200 },
+    { "collection/find", collection_find, 200 },
+    { "iconv/to_utf8", iconv_to_utf8, 20000 },
+    { "iso8601/parse", iso8601_parse, 200000 },
+    { "api/find", api_find, 2000 },
+    { "api/find_all", api_find_all, 100 }
+  };
+
+  vector<Result> results;
+
+  for (size_t i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); i++)
+  {
+    results.push_back(run(benchmarks[i]));
+
+    cerr << results.back().name << ": " << fixed << setprecision(0) << results.back().median_ns << " ns" << endl;
+  }
+
+  string json = report(results);
+
+  if (argc > 1)
+  {
+    ofstream output(argv[1]);
+    output << json << endl;
+  }
+  else
+  {
+    cout << json << endl;
+  }
+
+  return 0;
+}
@@ -5,16 +5,90 @@
 #include <string>
 #include <algorithm>
 #include <map>
+#include <vector>
 #include <cctype>
 #include <restful_mapper/json.h>
+#include <restful_mapper/deadline.h>
+#include <restful_mapper/metrics.h>
+#include <restful_mapper/profile.h>
+#include <restful_mapper/internal/response_cache.h>
+#include <restful_mapper/internal/buffer_pool.h>
+#include <restful_mapper/internal/rate_limiter.h>
+#include <restful_mapper/internal/circuit_breaker.h>
+#include <restful_mapper/internal/load_balancer.h>
+#include <restful_mapper/internal/thread_local.h>
 
 namespace restful_mapper
 {
 
 enum RequestType { GET, POST, PUT, DEL };
 
+/**
+ * @brief When and how often Api repeats a request which failed transiently
+ *
+ * Connection failures, timeouts and 408, 429, 502, 503 and 504 responses are
+ * transient. GET, PUT and DELETE requests are idempotent and replayed
+ * automatically; POST requests only if retry_posts is set, or if the
+ * connection could not be established at all.
+ *
+ * Retry n waits initial_delay * multiplier^n seconds, at most max_delay, of
+ * which the jitter fraction is random. A Retry-After header takes precedence,
+ * up to max_delay.
+ *
+ * Every retry spends a token from the retry budget, and every successful
+ * request earns budget_refill tokens, up to budget. A server which keeps
+ * failing therefore only receives a fraction of retried requests.
+ */
+struct RetryPolicy
+{
+  RetryPolicy()
+    : max_retries(0), initial_delay(0.1), multiplier(2.0), max_delay(5.0),
+      jitter(0.5), budget(10.0), budget_refill(0.1), retry_posts(false) {}
+
+  // Retries per request, 0 disables retrying
+  unsigned int max_retries;
+
+  double initial_delay;
+  double multiplier;
+  double max_delay;
+  double jitter;
+
+  double budget;
+  double budget_refill;
+
+  bool retry_posts;
+};
+
+/**
+ * @brief When Api sends a second, identical GET request to a slow endpoint
+ *
+ * If the first request has not completed within the percentile of the recent
+ * response times of the endpoint, the request is sent again and whichever
+ * completes first is used. The latest window response times are kept per
+ * endpoint key, as grouped by RequestStatistics, and hedging starts once
+ * min_samples responses have been timed.
+ *
+ * Hedging only applies to GET requests, and spends a request of the rate
+ * limits of the endpoint; no second request is sent if that would have to
+ * wait.
+ */
+struct HedgingPolicy
+{
+  HedgingPolicy()
+    : enabled(false), percentile(95.0), min_samples(20), window(100) {}
+
+  bool enabled;
+  double percentile;
+  unsigned int min_samples;
+  unsigned int window;
+};
+
 /**
  * Lazy evaluated singleton class holding global API configuration.
+ *
+ * Further clients, each with their own configuration, connections, cache and
+ * limits, can be created and bound to the requests of a thread with ApiScope,
+ * or to the requests of a model class with Model<T>::set_api.
  */
 class Api
 {
@@ -27,6 +101,16 @@ public:
     return instance().get_(endpoint);
   }
 
+  /**
+   * @brief GET request whose response is parsed into the parser while it
+   * is downloaded, if incremental parsing is enabled; otherwise the parser is
+   * left unloaded, for the caller to load from the response
+   */
+  static std::string get(const std::string &endpoint, Json::Parser &parser)
+  {
+    return instance().get_(endpoint, parser);
+  }
+
   static std::string post(const std::string &endpoint, const std::string &body)
   {
     return instance().post_(endpoint, body);
@@ -52,6 +136,11 @@ public:
     return instance().query_param_(url, param, value);
   }
 
+  static std::string escaped_query_param(const std::string &url, const std::string &param, const std::string &escaped_value)
+  {
+    return instance().escaped_query_param_(url, param, escaped_value);
+  }
+
   static std::string url()
   {
     return instance().url_;
@@ -64,9 +153,63 @@ public:
 
   static std::string set_url(const std::string &url)
   {
+    instance().balancer_->set_urls(std::vector<std::string>(1, url));
     return instance().url_ = url;
   }
 
+  /**
+   * @brief Spread requests over replicas of the web service
+   *
+   * Every request is sent to the replica chosen by the load balancing policy.
+   * A request which fails transiently is sent to another replica right away,
+   * before any retries. url() returns the first URL, which also identifies
+   * responses in the cache.
+   */
+  static void set_urls(const std::vector<std::string> &urls)
+  {
+    instance().balancer_->set_urls(urls.empty() ? std::vector<std::string>(1, "") : urls);
+    instance().url_ = urls.empty() ? "" : urls.front();
+  }
+
+  static std::vector<std::string> urls()
+  {
+    return instance().balancer_->urls();
+  }
+
+  static LoadBalancingPolicy load_balancing_policy()
+  {
+    return instance().balancer_->policy();
+  }
+
+  static void set_load_balancing_policy(const LoadBalancingPolicy &policy)
+  {
+    instance().balancer_->set_policy(policy);
+  }
+
+  /**
+   * @brief Share the replicas, their load and their health with other clients
+   *
+   * Clients using the same balancer spread their requests together, e.g. a
+   * pool of clients on several threads does not send every request to the
+   * same replica. set_url() and set_urls() replace the replicas for all of
+   * them. The balancer must outlive the clients using it. NULL restores the
+   * client's own balancer.
+   */
+  static void set_load_balancer(LoadBalancer *balancer)
+  {
+    Api &api = instance();
+
+    api.balancer_ = balancer ? balancer : &api.own_balancer_;
+
+    std::vector<std::string> urls = api.balancer_->urls();
+    api.url_ = urls.empty() ? "" : urls.front();
+  }
+
+  static LoadBalancer *load_balancer()
+  {
+    return instance().balancer_;
+  }
+
   static std::string proxy()
   {
     return instance().proxy_;
@@ -89,6 +232,7 @@ public:
 
   static std::string set_username(const std::string &username)
   {
+    instance().cache_.clear();
     return instance().username_ = username;
   }
 
@@ -99,17 +243,293 @@ public:
 
   static std::string set_password(const std::string &password)
   {
+    instance().cache_.clear();
     return instance().password_ = password;
   }
 
+  /**
+   * @brief Maximum duration of a request in seconds, 0 for no limit
+   *
+   * An active Deadline shortens the timeout further.
+   */
+  static double timeout()
+  {
+    return instance().timeout_;
+  }
+
+  static double set_timeout(const double &seconds)
+  {
+    return instance().timeout_ = seconds;
+  }
+
+  /**
+   * @brief Maximum time to establish a connection in seconds, 0 for the
+   * libcurl default
+   */
+  static double connect_timeout()
+  {
+    return instance().connect_timeout_;
+  }
+
+  static double set_connect_timeout(const double &seconds)
+  {
+    return instance().connect_timeout_ = seconds;
+  }
+
+  /**
+   * @brief Abort transfers slower than bytes_per_second for the specified
+   * number of seconds, detecting stalled servers without limiting the
+   * duration of large transfers. A rate of 0 disables the check.
+   */
+  static void set_low_speed_limit(const long &bytes_per_second, const long &seconds)
+  {
+    instance().low_speed_limit_ = bytes_per_second;
+    instance().low_speed_time_  = seconds;
+  }
+
+  static long low_speed_limit()
+  {
+    return instance().low_speed_limit_;
+  }
+
+  static long low_speed_time()
+  {
+    return instance().low_speed_time_;
+  }
+
+  /**
+   * @brief Pace requests to endpoints starting with the prefix, e.g. "/todo"
+   *
+   * Allows bursts of up to burst requests, after which requests wait to keep
+   * to the rate. A rate of 0 removes the limit.
+   */
+  static void set_rate_limit(const std::string &prefix, const double &requests_per_second, const double &burst = 1.0)
+  {
+    instance().limiter_->set_rate(prefix, requests_per_second, burst);
+  }
+
+  /**
+   * @brief Limit the number of concurrent requests to endpoints starting with
+   * the prefix; further requests wait for one to finish. 0 removes the limit.
+   */
+  static void set_max_in_flight(const std::string &prefix, const unsigned int &requests)
+  {
+    instance().limiter_->set_max_in_flight(prefix, requests);
+  }
+
+  static void clear_limits()
+  {
+    instance().limiter_->clear();
+  }
+
+  /**
+   * @brief Share the limits of the limiter with other clients
+   *
+   * Clients using the same limiter count their requests against the same
+   * limits, e.g. a pool of clients on several threads keeps to one rate. The
+   * limiter must outlive the clients using it. NULL restores the client's own
+   * limiter.
+   */
+  static void set_rate_limiter(RateLimiter *limiter)
+  {
+    Api &api = instance();
+
+    api.limiter_ = limiter ? limiter : &api.own_limiter_;
+  }
+
+  static RateLimiter *rate_limiter()
+  {
+    return instance().limiter_;
+  }
+
+  /**
+   * @brief Memory budget in bytes for cached GET responses
+   *
+   * Cached responses are revalidated using If-None-Match and
+   * If-Modified-Since, and served from memory when the server replies with
+   * 304 Not Modified. The cache is disabled by default (size 0).
+   */
+  static size_t cache_size()
+  {
+    return instance().cache_.capacity();
+  }
+
+  static size_t set_cache_size(const size_t &bytes)
+  {
+    instance().cache_.set_capacity(bytes);
+    return bytes;
+  }
+
+  static void clear_cache()
+  {
+    instance().cache_.clear();
+  }
+
+  /**
+   * @brief Whether the server answered the latest GET request with 304, so
+   * the cached response was returned
+   */
+  static bool response_unchanged()
+  {
+    return instance().response_unchanged_;
+  }
+
+  /**
+   * @brief The ETag, or else the Last-Modified date, of the latest response
+   * if it is cached, or an empty string
+   */
+  static std::string response_version()
+  {
+    return instance().response_version_;
+  }
+
+  /**
+   * @brief Keep the buffers of up to max_buffers decoded responses of at
+   * most max_capacity bytes, to receive later responses into. Models hand
+   * their responses back once decoded; 0 buffers disables reuse.
+   */
+  static void set_buffer_pool(const size_t &max_buffers, const size_t &max_capacity)
+  {
+    instance().buffers_.set_limits(max_buffers, max_capacity);
+  }
+
+  static size_t pooled_buffers()
+  {
+    return instance().buffers_.size();
+  }
+
+  /**
+   * @brief Hands a response back for its buffer to be reused, leaving the
+   * string empty
+   */
+  static void recycle(std::string &response)
+  {
+    instance().buffers_.give(response);
+  }
+
+  /**
+   * @brief Parse JSON responses of GET requests for collections as they
+   * arrive, so parsing overlaps the download; disabled by default.
+   * Incremental parsing always uses yajl, whatever the parser engine.
+   */
+  static bool incremental_parsing()
+  {
+    return instance().incremental_parsing_;
+  }
+
+  static void set_incremental_parsing(const bool &enabled)
+  {
+    instance().incremental_parsing_ = enabled;
+  }
+
+  /**
+   * @brief Policy for retrying transient failures, disabled by default
+   */
+  static const RetryPolicy &retry_policy()
+  {
+    return instance().retry_policy_;
+  }
+
+  static void set_retry_policy(const RetryPolicy &policy)
+  {
+    instance().retry_policy_ = policy;
+    instance().retry_tokens_ = policy.budget;
+  }
+
+  /**
+   * @brief Policy for hedging slow GET requests, disabled by default
+   */
+  static const HedgingPolicy &hedging_policy()
+  {
+    return instance().hedging_policy_;
+  }
+
+  static void set_hedging_policy(const HedgingPolicy &policy)
+  {
+    instance().hedging_policy_ = policy;
+    instance().latencies_.clear();
+  }
+
+  /**
+   * @brief Policy for failing fast on failing endpoints, disabled by default
+   *
+   * Requests to an endpoint whose circuit is open fail with a
+   * CircuitOpenError, without being sent.
+   */
+  static const CircuitBreakerPolicy &circuit_breaker_policy()
+  {
+    return instance().breaker_.policy();
+  }
+
+  static void set_circuit_breaker_policy(const CircuitBreakerPolicy &policy)
+  {
+    instance().breaker_.set_policy(policy);
+  }
+
+  /**
+   * @brief State of the circuit of an endpoint key, e.g. "GET /todo/:id"
+   */
+  static CircuitBreaker::State circuit_state(const std::string &key)
+  {
+    return instance().breaker_.state(key);
+  }
+
+  /**
+   * @brief Observer to receive the metrics of every request, or NULL
+   *
+   * The observer is not owned, and must outlive its registration.
+   */
+  static RequestObserver *observer()
+  {
+    return instance().observer_;
+  }
+
+  static RequestObserver *set_observer(RequestObserver *observer)
+  {
+    return instance().observer_ = observer;
+  }
+
+  /**
+   * @brief Reports the time a model spent decoding the latest response
+   */
+  static void report_decode(const std::string &model, const double &seconds)
+  {
+    if (instance().observer_)
+    {
+      instance().observer_->response_decoded(instance().last_request_, model, seconds);
+    }
+  }
+
 private:
   std::string url_;
   std::string proxy_;
   std::string username_;
   std::string password_;
+  double timeout_;
+  double connect_timeout_;
+  long low_speed_limit_;
+  long low_speed_time_;
   static const char *user_agent_;
   static const char *content_type_;
   void *curl_handle_;
+  void *multi_handle_;
+  mutable ResponseCache cache_;
+  mutable bool response_unchanged_;
+  mutable std::string response_version_;
+  mutable BufferPool buffers_;
+  bool incremental_parsing_;
+  RateLimiter own_limiter_;
+  RateLimiter *limiter_;
+  RequestObserver *observer_;
+  mutable RequestMetrics last_request_;
+  RetryPolicy retry_policy_;
+  mutable double retry_tokens_;
+  mutable unsigned long random_state_;
+  HedgingPolicy hedging_policy_;
+  mutable std::map<std::string, LatencyWindow> latencies_;
+  mutable CircuitBreaker breaker_;
+  LoadBalancer own_balancer_;
+  LoadBalancer *balancer_;
 
   // Dont forget to declare these two. You want to make sure they
   // are unaccessable otherwise you may accidently get copies of
@@ -118,17 +538,38 @@ private:
   void operator=(Api const &); // Don't implement
 
   /**
-   * Return the singleton instance
+   * Return the client bound to the current thread, or the singleton instance
    */
   static Api &instance()
   {
       static Api instance;  // Guaranteed to be destroyed, instantiated on first use
 
-      return instance;
+      Api *bound = current();
+
+      return bound ? *bound : instance;
   }
 
-  // Curl read callback function
-  std::string send_request(const RequestType &type, const std::string &endpoint, const std::string &body) const;
+  static Api *&current()
+  {
+    static RESTFUL_MAPPER_THREAD_LOCAL Api *api = NULL;
+
+    return api;
+  }
+
+  friend class ApiScope;
+
+  // Perform a request, retrying transient failures
+  std::string send_request(const RequestType &type, const std::string &endpoint, const std::string &body,
+      Json::Parser *parser = NULL) const;
+
+  // Perform a single attempt of a request, to the specified replica, into the
+  // response body
+  void perform_request(const RequestType &type, const std::string &endpoint, const std::string &body,
+      const std::size_t &replica, const unsigned int &attempts, bool &replayable, double &retry_after,
+      Json::Parser *parser, std::string &response_body) const;
+
+  // Seconds to wait before the specified retry
+  double retry_delay(const unsigned int &retries, const double &retry_after) const;
 
   // Curl write callback function
   static size_t write_callback(void *ptr, size_t size, size_t nmemb, void *userdata);
@@ -136,6 +577,20 @@ private:
   // Curl read callback function
   static size_t read_callback(void *ptr, size_t size, size_t nmemb, void *userdata);
 
+  // Curl header callback function
+  static size_t header_callback(void *ptr, size_t size, size_t nmemb, void *userdata);
+
+  // Apply the timeouts and the active deadline to the request, returning the
+  // effective timeout
+  double set_timeouts(const std::string &endpoint) const;
+
+  // Seconds after which to hedge a GET request, or 0 not to hedge it
+  double hedge_delay(const std::string &key) const;
+
+  // Collect metrics of the finished request and notify the observer
+  void finish_request(void *handle, const RequestType &type, const std::string &endpoint, const long &http_code,
+      const char *error, const bool &from_cache, const unsigned int &retries, const bool &hedged) const;
+
   // Check whether an error occurred
   static void check_http_error(const RequestType &type, const std::string &endpoint, long &http_code, const std::string &response_body);
 
@@ -144,6 +599,7 @@ private:
 
   // Request methods
   std::string get_(const std::string &endpoint) const;
+  std::string get_(const std::string &endpoint, Json::Parser &parser) const;
   std::string post_(const std::string &endpoint, const std::string &body) const;
   std::string put_(const std::string &endpoint, const std::string &body) const;
   std::string del_(const std::string &endpoint) const;
@@ -151,6 +607,103 @@ private:
   // String methods
   std::string escape_(const std::string &value) const;
   std::string query_param_(const std::string &url, const std::string &param, const std::string &value) const;
+  std::string escaped_query_param_(const std::string &url, const std::string &param, const std::string &escaped_value) const;
+};
+
+/**
+ * @brief Binds the requests made on the current thread while it is alive to
+ * a client other than the global one
+ *
+ *   Api tenant;
+ *
+ *   {
+ *     ApiScope scope(tenant);
+ *     Api::set_url("http://tenant.example.com/api");
+ *   }
+ *
+ *   {
+ *     ApiScope scope(tenant);
+ *     Todo::find_all();
+ *   }
+ *
+ * The static functions of Api, including the configuration, apply to the
+ * bound client. Scopes nest like sessions; binding NULL keeps the current
+ * client. A model class bound with Model<T>::set_api uses its own client
+ * regardless.
+ */
+class ApiScope
+{
+public:
+  explicit ApiScope(Api &api) : previous_(Api::current())
+  {
+    Api::current() = &api;
+  }
+
+  explicit ApiScope(Api *api) : previous_(Api::current())
+  {
+    if (api) Api::current() = api;
+  }
+
+  ~ApiScope()
+  {
+    Api::current() = previous_;
+  }
+
+  /**
+   * @brief The bound client, or NULL if requests use the global one
+   */
+  static Api *active()
+  {
+    return Api::current();
+  }
+
+private:
+  Api *previous_;
+
+  // Disallow copy
+  ApiScope(ApiScope const &);       // Don't Implement
+  void operator=(ApiScope const &); // Don't implement
+};
+
+/**
+ * @brief Reports the time from construction to destruction to the request
+ *        observer, as the decode time of the latest response
+ *
+ * The model name is not copied, pass Model<T>::class_name(). If the response
+ * is passed, it is recycled on destruction, so it must outlive the timer.
+ */
+class DecodeTimer
+{
+public:
+  explicit DecodeTimer(const std::string &model, std::string *response = NULL)
+    : model_(model), response_(response), start_(Api::observer() ? monotonic_seconds() : 0.0)
+#ifdef RESTFUL_MAPPER_PROFILE
+    , profile_(model, PROFILE_DECODE)
+#endif
+    {}
+
+  ~DecodeTimer()
+  {
+    if (Api::observer())
+    {
+      Api::report_decode(model_, monotonic_seconds() - start_);
+    }
+
+    if (response_)
+    {
+      Api::recycle(*response_);
+    }
+  }
+
+private:
+  const std::string &model_;
+  std::string *response_;
+  double start_;
+
+#ifdef RESTFUL_MAPPER_PROFILE
+  // Attributes parsing the whole response, e.g. a collection, to the model
+  ProfileScope profile_;
+#endif
 };
 
 class ApiError : public std::runtime_error
@@ -193,6 +746,30 @@ private:
   std::string details_;
 };
 
+class TimeoutError : public ResponseError
+{
+public:
+  explicit TimeoutError(const std::string &what, const std::string &details)
+    : ResponseError(what, 28, details) {} // CURLE_OPERATION_TIMEDOUT
+  virtual ~TimeoutError() throw() {}
+};
+
+class CancelledError : public ResponseError
+{
+public:
+  explicit CancelledError(const std::string &what)
+    : ResponseError(what, 42, "") {} // CURLE_ABORTED_BY_CALLBACK
+  virtual ~CancelledError() throw() {}
+};
+
+class CircuitOpenError : public ResponseError
+{
+public:
+  explicit CircuitOpenError(const std::string &what)
+    : ResponseError(what, 503, "") {}
+  virtual ~CircuitOpenError() throw() {}
+};
+
 class BadRequestError : public ApiError
 {
 public:
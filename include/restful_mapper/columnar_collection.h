@@ -0,0 +1,508 @@
+#ifndef RESTFUL_MAPPER_COLUMNAR_COLLECTION_H
+#define RESTFUL_MAPPER_COLUMNAR_COLLECTION_H
+
+#include <map>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <stdexcept>
+#include <restful_mapper/mapper.h>
+#include <restful_mapper/model_collection.h>
+
+namespace restful_mapper
+{
+
+class ColumnBase
+{
+public:
+  virtual ~ColumnBase() {}
+  virtual ColumnBase *clone() const = 0;
+  virtual void reserve(const size_t &n) = 0;
+  virtual void truncate(const size_t &n) = 0;
+};
+
+// std::vector<bool> is not contiguous, so booleans are stored as bytes
+template <class V> struct ColumnStorage { typedef V type; };
+template <> struct ColumnStorage<bool> { typedef unsigned char type; };
+
+// Integers are summed exactly, a double would round beyond 2^53
+template <class V> struct ColumnSum { typedef long long type; };
+template <> struct ColumnSum<float> { typedef double type; };
+template <> struct ColumnSum<double> { typedef double type; };
+
+/**
+ * @brief Values of one field for all rows of a ColumnarCollection, stored
+ * contiguously with a null bitmap
+ *
+ * Null values are stored as a default constructed value, i.e. zero for
+ * numbers, so sums need not check the bitmap. Integer columns are summed as
+ * long long, others as double.
+ */
+template <class V>
+class Column : public ColumnBase
+{
+public:
+  typedef typename ColumnStorage<V>::type value_type;
+  typedef typename ColumnSum<V>::type sum_type;
+
+  Column() : null_count_(0) {}
+
+  virtual ColumnBase *clone() const
+  {
+    return new Column<V>(*this);
+  }
+
+  size_t size() const
+  {
+    return values_.size();
+  }
+
+  const std::vector<value_type> &values() const
+  {
+    return values_;
+  }
+
+  const value_type &operator[](const size_t &row) const
+  {
+    return values_[row];
+  }
+
+  bool is_null(const size_t &row) const
+  {
+    return (nulls_[row / 8] & (1 << (row % 8))) != 0;
+  }
+
+  const size_t &null_count() const
+  {
+    return null_count_;
+  }
+
+  /**
+   * @brief Number of rows which are not null
+   */
+  size_t count() const
+  {
+    return values_.size() - null_count_;
+  }
+
+  sum_type sum() const
+  {
+    sum_type total = 0;
+    size_t i, i_end = values_.size();
+
+    for (i = 0; i < i_end; ++i)
+    {
+      total += values_[i];
+    }
+
+    return total;
+  }
+
+  /**
+   * @brief Smallest value which is not null, throws if there is none
+   */
+  value_type min() const
+  {
+    return extreme(true);
+  }
+
+  /**
+   * @brief Largest value which is not null, throws if there is none
+   */
+  value_type max() const
+  {
+    return extreme(false);
+  }
+
+  /**
+   * @brief Rows which are not null and match the predicate
+   */
+  template <class Predicate>
+  std::vector<size_t> where(Predicate predicate) const
+  {
+    std::vector<size_t> rows;
+    size_t i, i_end = values_.size();
+
+    for (i = 0; i < i_end; ++i)
+    {
+      if (predicate(values_[i]) && (null_count_ == 0 || !is_null(i)))
+      {
+        rows.push_back(i);
+      }
+    }
+
+    return rows;
+  }
+
+  void push_back(const V &value, const bool &is_null)
+  {
+    size_t row = values_.size();
+
+    if (row % 8 == 0)
+    {
+      nulls_.push_back(0);
+    }
+
+    if (is_null)
+    {
+      values_.push_back(value_type());
+      nulls_[row / 8] |= (1 << (row % 8));
+      null_count_++;
+    }
+    else
+    {
+      values_.push_back(value);
+    }
+  }
+
+  virtual void reserve(const size_t &n)
+  {
+    values_.reserve(n);
+    nulls_.reserve((n + 7) / 8);
+  }
+
+  /**
+   * @brief Remove the rows from the nth on
+   */
+  virtual void truncate(const size_t &n)
+  {
+    while (values_.size() > n)
+    {
+      size_t row = values_.size() - 1;
+
+      if (is_null(row))
+      {
+        nulls_[row / 8] &= ~(1 << (row % 8));
+        null_count_--;
+      }
+
+      values_.pop_back();
+    }
+
+    nulls_.resize((values_.size() + 7) / 8);
+  }
+
+private:
+  std::vector<value_type> values_;
+  std::vector<unsigned char> nulls_;
+  size_t null_count_;
+
+  value_type extreme(const bool &smallest) const
+  {
+    size_t i, i_end = values_.size();
+    const value_type *result = NULL;
+
+    for (i = 0; i < i_end; ++i)
+    {
+      if (null_count_ && is_null(i)) continue;
+
+      if (!result || (smallest ? values_[i] < *result : *result < values_[i]))
+      {
+        result = &values_[i];
+      }
+    }
+
+    if (!result)
+    {
+      throw std::out_of_range("Column has no values");
+    }
+
+    return *result;
+  }
+};
+
+/**
+ * @brief Collection storing each field of its models in a separate Column,
+ * for fast scans and aggregates over single fields
+ *
+ * Only supports models which declare their fields with RESTFUL_MAPPER_FIELDS.
+ * Relationships are not stored.
+ */
+template <class T>
+class ColumnarCollection
+{
+public:
+  ColumnarCollection() : size_(0), reserve_(0) {}
+
+  ColumnarCollection(const ModelCollection<T> &items) : size_(0), reserve_(0)
+  {
+    reserve(items.size());
+
+    typename ModelCollection<T>::const_iterator i, i_end = items.end();
+
+    for (i = items.begin(); i != i_end; ++i)
+    {
+      push_back(*i);
+    }
+  }
+
+  ColumnarCollection(const ColumnarCollection &other) : size_(0), reserve_(0)
+  {
+    *this = other;
+  }
+
+  ~ColumnarCollection()
+  {
+    clear();
+  }
+
+  const ColumnarCollection &operator=(const ColumnarCollection &other)
+  {
+    if (this == &other) return *this;
+
+    clear();
+
+    std::vector<std::string>::const_iterator i, i_end = other.names_.end();
+
+    for (i = other.names_.begin(); i != i_end; ++i)
+    {
+      ColumnBase *column = other.columns_.find(*i)->second->clone();
+
+      names_.push_back(*i);
+      columns_[*i] = column;
+      order_.push_back(column);
+    }
+
+    size_ = other.size_;
+
+    return *this;
+  }
+
+  size_t size() const
+  {
+    return size_;
+  }
+
+  bool empty() const
+  {
+    return size_ == 0;
+  }
+
+  /**
+   * @brief Names of the columns, in the order the fields are declared
+   */
+  const std::vector<std::string> &names() const
+  {
+    return names_;
+  }
+
+  template <class V> const Column<V> &column(const std::string &name) const
+  {
+    typename ColumnMap::const_iterator i = columns_.find(name);
+
+    if (i == columns_.end())
+    {
+      std::ostringstream s;
+      s << "Cannot find column " << name;
+      throw std::out_of_range(s.str());
+    }
+
+    const Column<V> *column = dynamic_cast<const Column<V> *>(i->second);
+
+    if (!column)
+    {
+      std::ostringstream s;
+      s << "Column " << name << " is not of type " << type_info_name(typeid(V));
+      throw std::runtime_error(s.str());
+    }
+
+    return *column;
+  }
+
+  void push_back(const T &item)
+  {
+    Appender appender(*this);
+    mutable_self(&item).map_fields(appender);
+
+    size_++;
+  }
+
+  /**
+   * @brief Append the objects of a parsed result set, reading each field from
+   * the JSON straight into its column
+   *
+   * The values are converted using the fields of a single scratch object, so
+   * no object is constructed or copied per row. Relationships are skipped.
+   */
+  void decode(const Json::Node &objects)
+  {
+    std::vector<Json::Node> rows = objects.to_array();
+
+    if (rows.empty()) return;
+
+    reserve(size_ + rows.size());
+
+    T scratch;
+    Mapper mapper(rows.front());
+    Decoder decoder(*this, mapper);
+
+    std::vector<Json::Node>::const_iterator i, i_end = rows.end();
+
+    try
+    {
+      for (i = rows.begin(); i != i_end; ++i)
+      {
+        mapper.read_from(*i);
+        decoder.rewind();
+        scratch.map_fields(decoder);
+
+        size_++;
+      }
+    }
+    catch (...)
+    {
+      // Drop the fields of the row which failed, so the columns stay aligned
+      std::vector<ColumnBase *>::iterator j, j_end = order_.end();
+
+      for (j = order_.begin(); j != j_end; ++j)
+      {
+        (*j)->truncate(size_);
+      }
+
+      throw;
+    }
+  }
+
+  void reserve(const size_t &n)
+  {
+    reserve_ = n;
+
+    std::vector<ColumnBase *>::iterator i, i_end = order_.end();
+
+    for (i = order_.begin(); i != i_end; ++i)
+    {
+      (*i)->reserve(n);
+    }
+  }
+
+  void clear()
+  {
+    std::vector<ColumnBase *>::iterator i, i_end = order_.end();
+
+    for (i = order_.begin(); i != i_end; ++i)
+    {
+      delete *i;
+    }
+
+    order_.clear();
+    columns_.clear();
+    names_.clear();
+    size_ = 0;
+  }
+
+private:
+  typedef std::map<std::string, ColumnBase *> ColumnMap;
+
+  ColumnMap columns_;
+  std::vector<std::string> names_;
+  std::vector<ColumnBase *> order_; // Columns in field order, for appending
+  size_t size_;
+  size_t reserve_;
+
+  template <class V> Column<V> &column_at(const size_t &index, const char *key)
+  {
+    // Fields are visited in the same order for every row, so columns are
+    // only looked up by name for the first row
+    if (index < order_.size())
+    {
+      return *static_cast<Column<V> *>(order_[index]);
+    }
+
+    Column<V> *column = new Column<V>();
+    column->reserve(reserve_);
+
+    names_.push_back(key);
+    columns_[key] = column;
+    order_.push_back(column);
+
+    return *column;
+  }
+
+  class Appender;
+  friend class Appender;
+
+  class Appender
+  {
+  public:
+    explicit Appender(ColumnarCollection &collection) : collection_(collection), index_(0) {}
+
+    template <class V> Appender &operator()(const char *key, const Field<V> &attr)
+    {
+      collection_.template column_at<V>(index_++, key).push_back(attr.get(), attr.is_null());
+      return *this;
+    }
+
+    Appender &operator()(const char *key, const Primary &attr)
+    {
+      collection_.template column_at<long long>(index_++, key).push_back(attr.get(), attr.is_null());
+      return *this;
+    }
+
+    template <class U> Appender &operator()(const char *key, const Foreign<U> &attr)
+    {
+      collection_.template column_at<long long>(index_++, key).push_back(attr.get(), attr.is_null());
+      return *this;
+    }
+
+    // Relationships are not stored
+    template <class R> Appender &operator()(const char *, const R &)
+    {
+      return *this;
+    }
+
+  private:
+    ColumnarCollection &collection_;
+    size_t index_;
+  };
+
+  class Decoder;
+  friend class Decoder;
+
+  class Decoder
+  {
+  public:
+    Decoder(ColumnarCollection &collection, const Mapper &mapper)
+      : collection_(collection), mapper_(mapper), index_(0) {}
+
+    void rewind()
+    {
+      index_ = 0;
+    }
+
+    template <class V> Decoder &operator()(const char *key, Field<V> &attr)
+    {
+      mapper_.get(key, attr);
+      collection_.template column_at<V>(index_++, key).push_back(attr.get(), attr.is_null());
+      return *this;
+    }
+
+    Decoder &operator()(const char *key, Primary &attr)
+    {
+      mapper_.get(key, attr);
+      collection_.template column_at<long long>(index_++, key).push_back(attr.get(), attr.is_null());
+      return *this;
+    }
+
+    template <class U> Decoder &operator()(const char *key, Foreign<U> &attr)
+    {
+      mapper_.get(key, attr);
+      collection_.template column_at<long long>(index_++, key).push_back(attr.get(), attr.is_null());
+      return *this;
+    }
+
+    // Relationships are not decoded
+    template <class R> Decoder &operator()(const char *, R &)
+    {
+      return *this;
+    }
+
+  private:
+    ColumnarCollection &collection_;
+    const Mapper &mapper_;
+    size_t index_;
+  };
+};
+
+}
+
+#endif // RESTFUL_MAPPER_COLUMNAR_COLLECTION_H
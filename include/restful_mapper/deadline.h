@@ -0,0 +1,144 @@
+#ifndef RESTFUL_MAPPER_DEADLINE_H
+#define RESTFUL_MAPPER_DEADLINE_H
+
+#include <restful_mapper/metrics.h>
+#include <restful_mapper/internal/thread_local.h>
+
+namespace restful_mapper
+{
+
+/**
+ * @brief Flag to abort the requests of a Deadline, from any thread
+ */
+class CancellationToken
+{
+public:
+  CancellationToken() : cancelled_(false) {}
+
+  void cancel()
+  {
+    cancelled_ = true;
+  }
+
+  void reset()
+  {
+    cancelled_ = false;
+  }
+
+  bool is_cancelled() const
+  {
+    return cancelled_;
+  }
+
+private:
+  volatile bool cancelled_;
+
+  // Disallow copy, deadlines hold a pointer to the token
+  CancellationToken(CancellationToken const &); // Don't Implement
+  void operator=(CancellationToken const &);    // Don't implement
+};
+
+/**
+ * @brief Time limit for all requests made while it is alive
+ *
+ * Applies to every request made through Api, including those made by find,
+ * find_all, save and the reloading of relations:
+ *
+ *   Deadline deadline(0.5);
+ *   Todo::find_all();
+ *
+ * Requests which are started after the deadline has passed, or would run past
+ * it, fail with a TimeoutError. Transfers in progress are aborted with a
+ * CancelledError when the token is cancelled, within about a second.
+ *
+ * Deadlines are scoped like sessions, per thread; a nested deadline never
+ * extends the deadline it shadows, and is cancelled along with it.
+ */
+class Deadline
+{
+public:
+  explicit Deadline(const double &seconds, const CancellationToken *token = NULL)
+    : token_(token), previous_(current())
+  {
+    limited_    = true;
+    expires_at_ = monotonic_seconds() + seconds;
+
+    if (previous_ && previous_->limited_ && previous_->expires_at_ < expires_at_)
+    {
+      expires_at_ = previous_->expires_at_;
+    }
+
+    current() = this;
+  }
+
+  /**
+   * @brief Only allow cancelling, without a time limit of its own
+   */
+  explicit Deadline(const CancellationToken &token)
+    : token_(&token), previous_(current())
+  {
+    limited_    = previous_ && previous_->limited_;
+    expires_at_ = limited_ ? previous_->expires_at_ : 0.0;
+
+    current() = this;
+  }
+
+  ~Deadline()
+  {
+    current() = previous_;
+  }
+
+  static Deadline *active()
+  {
+    return current();
+  }
+
+  bool is_limited() const
+  {
+    return limited_;
+  }
+
+  /**
+   * @brief Seconds left, only meaningful if the deadline is limited
+   */
+  double remaining() const
+  {
+    return expires_at_ - monotonic_seconds();
+  }
+
+  bool has_expired() const
+  {
+    return limited_ && remaining() <= 0.0;
+  }
+
+  bool is_cancelled() const
+  {
+    return (token_ && token_->is_cancelled()) || (previous_ && previous_->is_cancelled());
+  }
+
+  bool is_cancellable() const
+  {
+    return token_ || (previous_ && previous_->is_cancellable());
+  }
+
+private:
+  bool limited_;
+  double expires_at_;
+  const CancellationToken *token_;
+  Deadline *previous_;
+
+  static Deadline *&current()
+  {
+    static RESTFUL_MAPPER_THREAD_LOCAL Deadline *deadline = NULL;
+
+    return deadline;
+  }
+
+  // Disallow copy
+  Deadline(Deadline const &);       // Don't Implement
+  void operator=(Deadline const &); // Don't implement
+};
+
+}
+
+#endif // RESTFUL_MAPPER_DEADLINE_H
@@ -10,52 +10,68 @@
 namespace restful_mapper
 {
 
+/**
+ * @brief Value with dirty and null tracking, the base of all fields
+ *
+ * Accessors are not virtual and the state is packed into a single byte, since
+ * models hold many fields and many models are kept in memory at a time.
+ */
 template <class T>
 class FieldBase
 {
 public:
-  FieldBase() : is_dirty_(false), is_null_(true) {}
+  FieldBase() : flags_(NULL_VALUE) {}
 
-  virtual const T &get() const
+  const T &get() const
   {
     return value_;
   }
 
-  virtual const T &set(const T &value, const bool &keep_clean = false)
+  const T &set(const T &value, const bool &keep_clean = false)
   {
-    if (!keep_clean && (is_null_ || value != value_))
+    if (!keep_clean && (is_null() || value != value_))
     {
       touch();
     }
 
-    is_null_ = false;
+    flags_ &= ~(NULL_VALUE | UNLOADED);
 
     return value_ = value;
   }
 
-  virtual void touch() const
+  void touch() const
   {
-    is_dirty_ = true;
+    flags_ |= DIRTY;
   }
 
-  virtual void clean() const
+  void clean() const
   {
-    is_dirty_ = false;
+    flags_ &= ~DIRTY;
   }
 
-  virtual void clear(const bool &keep_clean = false) = 0;
+  bool is_dirty() const
+  {
+    return (flags_ & DIRTY) != 0;
+  }
 
-  virtual const bool &is_dirty() const
+  bool is_null() const
   {
-    return is_dirty_;
+    return (flags_ & NULL_VALUE) != 0;
   }
 
-  virtual const bool &is_null() const
+  /**
+   * @brief Whether the field was received from the server, false if it was
+   * left out of a projection
+   */
+  bool is_loaded() const
   {
-    return is_null_;
+    return (flags_ & UNLOADED) == 0;
   }
 
-  virtual std::string name() = 0;
+  void unload()
+  {
+    flags_ |= UNLOADED;
+  }
 
   operator T() const
   {
@@ -63,16 +79,34 @@ public:
   }
 
 protected:
+  enum Flags
+  {
+    DIRTY      = 1,
+    NULL_VALUE = 2,
+    UNLOADED   = 4,
+    ASSIGNED   = 8 // Used by Primary
+  };
+
   T value_;
-  mutable bool is_dirty_;
-  bool is_null_;
+  mutable unsigned char flags_;
 
-  virtual void clear_(const T &null_value, const bool &keep_clean = false)
+  void set_null(const bool &is_null)
   {
-    set(null_value, keep_clean);
-    is_null_ = true;
+    if (is_null)
+    {
+      flags_ |= NULL_VALUE;
+    }
+    else
+    {
+      flags_ &= ~NULL_VALUE;
+    }
   }
 
+  void clear_(const T &null_value, const bool &keep_clean = false)
+  {
+    set(null_value, keep_clean);
+    flags_ |= NULL_VALUE;
+  }
 };
 
 template <class T>
@@ -91,9 +125,9 @@ public:
   // Inherit from FieldBase
   Field() : FieldBase<bool>() { value_ = false; }
   const bool &operator=(const bool &value) { return set(value); }
-  const Field<bool> &operator=(const FieldBase<bool> &value) { set(value); is_null_ = value.is_null(); return *this; }
-  virtual std::string name() { return type_info_name(typeid(bool)); }
-  virtual void clear(const bool &keep_clean = false) { clear_(false, keep_clean); };
+  const Field<bool> &operator=(const FieldBase<bool> &value) { set(value); set_null(value.is_null()); return *this; }
+  std::string name() const { return type_info_name(typeid(bool)); }
+  void clear(const bool &keep_clean = false) { clear_(false, keep_clean); };
 };
 
 template <>
@@ -103,10 +137,10 @@ public:
   // Inherit from FieldBase
   Field() : FieldBase<int>() { value_ = 0; }
   const int &operator=(const int &value) { return set(value); }
-  const Field<int> &operator=(const FieldBase<int> &value) { set(value); is_null_ = value.is_null(); return *this; }
-  const Field<int> &operator=(const FieldBase<long long> &value) { set(value); is_null_ = value.is_null(); return *this; }
-  virtual std::string name() { return type_info_name(typeid(int)); }
-  virtual void clear(const bool &keep_clean = false) { clear_(0, keep_clean); };
+  const Field<int> &operator=(const FieldBase<int> &value) { set(value); set_null(value.is_null()); return *this; }
+  const Field<int> &operator=(const FieldBase<long long> &value) { set(value); set_null(value.is_null()); return *this; }
+  std::string name() const { return type_info_name(typeid(int)); }
+  void clear(const bool &keep_clean = false) { clear_(0, keep_clean); };
 };
 
 template <>
@@ -116,10 +150,10 @@ public:
   // Inherit from FieldBase
   Field() : FieldBase<long long>() { value_ = 0; }
   const long long &operator=(const long long &value) { return set(value); }
-  const Field<long long> &operator=(const FieldBase<long long> &value) { set(value); is_null_ = value.is_null(); return *this; }
-  const Field<long long> &operator=(const FieldBase<int> &value) { set(value); is_null_ = value.is_null(); return *this; }
-  virtual std::string name() { return type_info_name(typeid(long long)); }
-  virtual void clear(const bool &keep_clean = false) { clear_(0, keep_clean); };
+  const Field<long long> &operator=(const FieldBase<long long> &value) { set(value); set_null(value.is_null()); return *this; }
+  const Field<long long> &operator=(const FieldBase<int> &value) { set(value); set_null(value.is_null()); return *this; }
+  std::string name() const { return type_info_name(typeid(long long)); }
+  void clear(const bool &keep_clean = false) { clear_(0, keep_clean); };
 };
 
 template <>
@@ -129,9 +163,9 @@ public:
   // Inherit from FieldBase
   Field() : FieldBase<double>() { value_ = 0.0; }
   const double &operator=(const double &value) { return set(value); }
-  const Field<double> &operator=(const FieldBase<double> &value) { set(value); is_null_ = value.is_null(); return *this; }
-  virtual std::string name() { return type_info_name(typeid(double)); }
-  virtual void clear(const bool &keep_clean = false) { clear_(0.0, keep_clean); };
+  const Field<double> &operator=(const FieldBase<double> &value) { set(value); set_null(value.is_null()); return *this; }
+  std::string name() const { return type_info_name(typeid(double)); }
+  void clear(const bool &keep_clean = false) { clear_(0.0, keep_clean); };
 };
 
 template <>
@@ -141,9 +175,9 @@ public:
   // Inherit from FieldBase
   Field() : FieldBase<std::string>() { value_ = ""; }
   const std::string &operator=(const std::string &value) { return set(value); }
-  const Field<std::string> &operator=(const FieldBase<std::string> &value) { set(value); is_null_ = value.is_null(); return *this; }
-  virtual std::string name() { return type_info_name(typeid(std::string)); }
-  virtual void clear(const bool &keep_clean = false) { clear_("", keep_clean); };
+  const Field<std::string> &operator=(const FieldBase<std::string> &value) { set(value); set_null(value.is_null()); return *this; }
+  std::string name() const { return type_info_name(typeid(std::string)); }
+  void clear(const bool &keep_clean = false) { clear_("", keep_clean); };
 
   // Reimplement std::string
   typedef std::string::value_type             value_type;
@@ -289,9 +323,9 @@ public:
   // Inherit from FieldBase
   Field() : FieldBase<std::time_t>() { value_ = 0; }
   const std::time_t &operator=(const std::time_t &value) { return set(value); }
-  const Field<std::time_t> &operator=(const FieldBase<std::time_t> &value) { set(value); is_null_ = value.is_null(); return *this; }
-  virtual std::string name() { return type_info_name(typeid(std::time_t)); }
-  virtual void clear(const bool &keep_clean = false) { clear_(0, keep_clean); };
+  const Field<std::time_t> &operator=(const FieldBase<std::time_t> &value) { set(value); set_null(value.is_null()); return *this; }
+  std::string name() const { return type_info_name(typeid(std::time_t)); }
+  void clear(const bool &keep_clean = false) { clear_(0, keep_clean); };
 
   const std::time_t &set(const std::string &value, const bool &keep_clean = false)
   {
@@ -306,7 +340,7 @@ public:
 
   std::string to_local(const std::string &format) const
   {
-    std::tm exploded_time(*std::localtime(&get()));
+    std::tm exploded_time(local_exploded());
 
     char buf[1024];
     std::strftime(buf, sizeof buf, format.c_str(), &exploded_time);
@@ -314,6 +348,31 @@ public:
     return std::string(buf);
   }
 
+  /**
+   * @brief All local calendar fields at once
+   *
+   * Prefer this over several local_* calls, each of which converts the
+   * timestamp separately.
+   */
+  std::tm local_exploded() const
+  {
+    std::tm value;
+    local_explode(get(), value);
+
+    return value;
+  }
+
+  /**
+   * @brief All UTC calendar fields at once
+   */
+  std::tm utc_exploded() const
+  {
+    std::tm value;
+    utc_explode(get(), value);
+
+    return value;
+  }
+
   operator std::string() const
   {
     return to_iso8601();
@@ -326,84 +385,84 @@ public:
 
   int local_year() const
   {
-    std::tm value(*std::localtime(&get()));
+    std::tm value(local_exploded());
 
     return value.tm_year + 1900;
   }
 
   int local_month() const
   {
-    std::tm value(*std::localtime(&get()));
+    std::tm value(local_exploded());
 
     return value.tm_mon + 1;
   }
 
   int local_day() const
   {
-    std::tm value(*std::localtime(&get()));
+    std::tm value(local_exploded());
 
     return value.tm_mday;
   }
 
   int local_hour() const
   {
-    std::tm value(*std::localtime(&get()));
+    std::tm value(local_exploded());
 
     return value.tm_hour;
   }
 
   int local_minute() const
   {
-    std::tm value(*std::localtime(&get()));
+    std::tm value(local_exploded());
 
     return value.tm_min;
   }
 
   int local_second() const
   {
-    std::tm value(*std::localtime(&get()));
+    std::tm value(local_exploded());
 
     return value.tm_sec;
   }
 
   int utc_year() const
   {
-    std::tm value(*std::gmtime(&get()));
+    std::tm value(utc_exploded());
 
     return value.tm_year + 1900;
   }
 
   int utc_month() const
   {
-    std::tm value(*std::gmtime(&get()));
+    std::tm value(utc_exploded());
 
     return value.tm_mon + 1;
   }
 
   int utc_day() const
   {
-    std::tm value(*std::gmtime(&get()));
+    std::tm value(utc_exploded());
 
     return value.tm_mday;
   }
 
   int utc_hour() const
   {
-    std::tm value(*std::gmtime(&get()));
+    std::tm value(utc_exploded());
 
     return value.tm_hour;
   }
 
   int utc_minute() const
   {
-    std::tm value(*std::gmtime(&get()));
+    std::tm value(utc_exploded());
 
     return value.tm_min;
   }
 
   int utc_second() const
   {
-    std::tm value(*std::gmtime(&get()));
+    std::tm value(utc_exploded());
 
     return value.tm_sec;
   }
@@ -418,10 +477,10 @@ class Primary : public FieldBase<long long>
 {
 public:
   // Inherit from FieldBase
-  Primary() : FieldBase<long long>(), is_assigned_(false) { value_ = 0; }
+  Primary() : FieldBase<long long>() { value_ = 0; }
   const long long &operator=(const long long &value) { return set(value); }
-  virtual std::string name() { return type_info_name(typeid(long long)); }
-  virtual void clear(const bool &keep_clean = false) { clear_(0, keep_clean); };
+  std::string name() const { return type_info_name(typeid(long long)); }
+  void clear(const bool &keep_clean = false) { set(0, keep_clean); set_null(true); };
 
   operator std::string() const
   {
@@ -432,17 +491,14 @@ public:
 
   const long long &set(const long long &value, const bool &keep_clean = false)
   {
-    if (is_assigned_ && value != value_)
+    if ((flags_ & ASSIGNED) && value != value_)
     {
       throw std::runtime_error("Primary field is read-only");
     }
 
-    is_assigned_ = true;
+    flags_ |= ASSIGNED;
     return FieldBase<long long>::set(value, keep_clean);
   }
-
-protected:
-  bool is_assigned_;
 };
 
 /**
@@ -455,10 +511,10 @@ public:
   // Inherit from FieldBase
   Foreign() : FieldBase<long long>() { value_ = 0; }
   const long long &operator=(const long long &value) { return set(value); }
-  const Foreign &operator=(const FieldBase<long long> &value) { set(value); is_null_ = value.is_null(); return *this; }
-  const Foreign &operator=(const FieldBase<int> &value) { set(value); is_null_ = value.is_null(); return *this; }
-  virtual std::string name() { return type_info_name(typeid(long long)); }
-  virtual void clear(const bool &keep_clean = false) { clear_(0, keep_clean); };
+  const Foreign &operator=(const FieldBase<long long> &value) { set(value); set_null(value.is_null()); return *this; }
+  const Foreign &operator=(const FieldBase<int> &value) { set(value); set_null(value.is_null()); return *this; }
+  std::string name() const { return type_info_name(typeid(long long)); }
+  void clear(const bool &keep_clean = false) { clear_(0, keep_clean); };
 
   const std::string &class_name() const
   {
@@ -0,0 +1,96 @@
+#ifndef RESTFUL_MAPPER_BUFFER_POOL_H_20131018
+#define RESTFUL_MAPPER_BUFFER_POOL_H_20131018
+
+#include <string>
+#include <list>
+
+namespace restful_mapper
+{
+
+/**
+ * @brief Spare string buffers, so responses are received into memory which
+ * is already allocated and paged in, instead of growing a new string for
+ * every request
+ *
+ * Keeps up to max_buffers buffers, of at most max_capacity bytes each; larger
+ * buffers are freed instead. A maximum of zero buffers disables the pool.
+ */
+class BufferPool
+{
+public:
+  BufferPool() : max_buffers_(4), max_capacity_(16 * 1024 * 1024) {}
+
+  const size_t &max_buffers() const
+  {
+    return max_buffers_;
+  }
+
+  const size_t &max_capacity() const
+  {
+    return max_capacity_;
+  }
+
+  void set_limits(const size_t &max_buffers, const size_t &max_capacity)
+  {
+    max_buffers_  = max_buffers;
+    max_capacity_ = max_capacity;
+
+    while (buffers_.size() > max_buffers_)
+    {
+      buffers_.pop_back();
+    }
+
+    std::list<std::string>::iterator i = buffers_.begin();
+
+    while (i != buffers_.end())
+    {
+      i = (i->capacity() > max_capacity_) ? buffers_.erase(i) : ++i;
+    }
+  }
+
+  size_t size() const
+  {
+    return buffers_.size();
+  }
+
+  /**
+   * @brief Swaps a spare buffer, if any, into the empty string
+   */
+  void take(std::string &buffer)
+  {
+    if (!buffers_.empty())
+    {
+      buffer.swap(buffers_.back());
+      buffers_.pop_back();
+    }
+  }
+
+  /**
+   * @brief Keeps the storage of the string for reuse, leaving it empty
+   */
+  void give(std::string &buffer)
+  {
+    buffer.clear();
+
+    if (buffers_.size() < max_buffers_ && buffer.capacity() > 0 && buffer.capacity() <= max_capacity_)
+    {
+      // Strings in a list are never copied, which would lose their capacity
+      buffers_.push_back(std::string());
+      buffers_.back().swap(buffer);
+    }
+  }
+
+  void clear()
+  {
+    buffers_.clear();
+  }
+
+private:
+  size_t max_buffers_;
+  size_t max_capacity_;
+  std::list<std::string> buffers_;
+};
+
+}
+
+#endif // RESTFUL_MAPPER_BUFFER_POOL_H_20131018
@@ -0,0 +1,84 @@
+#ifndef RESTFUL_MAPPER_CIRCUIT_BREAKER_H_20131018
+#define RESTFUL_MAPPER_CIRCUIT_BREAKER_H_20131018
+
+#include <string>
+#include <map>
+
+namespace restful_mapper
+{
+
+/**
+ * @brief When a circuit opens, and for how long
+ *
+ * A circuit opens after failure_threshold consecutive failures, i.e.
+ * connection failures, timeouts and 5xx, 408 and 429 responses. While open,
+ * requests fail right away. After open_seconds a single trial request is let
+ * through, which closes the circuit if it succeeds, and opens it again if not.
+ */
+struct CircuitBreakerPolicy
+{
+  CircuitBreakerPolicy()
+    : failure_threshold(0), open_seconds(5.0) {}
+
+  // Consecutive failures to open a circuit, 0 disables the breaker
+  unsigned int failure_threshold;
+
+  double open_seconds;
+};
+
+/**
+ * @brief Tracks the health of endpoints, to fail fast while one is failing
+ *
+ * Circuits are kept per endpoint key, as grouped by RequestStatistics, e.g.
+ * "GET /todo/:id". The breaker is not thread-safe.
+ */
+class CircuitBreaker
+{
+public:
+  enum State { CLOSED, OPEN, HALF_OPEN };
+
+  const CircuitBreakerPolicy &policy() const
+  {
+    return policy_;
+  }
+
+  /**
+   * @brief Replaces the policy and closes all circuits
+   */
+  void set_policy(const CircuitBreakerPolicy &policy);
+
+  /**
+   * @brief Whether a request may be sent, letting through a trial request
+   * once an open circuit has waited long enough
+   */
+  bool allow(const std::string &key);
+
+  void record_success(const std::string &key);
+  void record_failure(const std::string &key);
+
+  State state(const std::string &key) const;
+
+  void clear();
+
+private:
+  struct Circuit
+  {
+    Circuit()
+      : state(CLOSED), failures(0), opened_at(0.0) {}
+
+    State state;
+    unsigned int failures;
+
+    // Time the circuit opened, or the trial request was let through
+    double opened_at;
+  };
+
+  typedef std::map<std::string, Circuit> CircuitMap;
+
+  CircuitBreakerPolicy policy_;
+  CircuitMap circuits_;
+};
+
+}
+
+#endif // RESTFUL_MAPPER_CIRCUIT_BREAKER_H_20131018
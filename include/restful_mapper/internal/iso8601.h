@@ -1,12 +1,108 @@
 #ifndef RESTFUL_MAPPER_ISO8601_H_20130314
 #define RESTFUL_MAPPER_ISO8601_H_20130314
 
-#include <cstdio>
-#include <cctype>
+#include <cstddef>
 #include <ctime>
 #include <string>
 #include <stdexcept>
 
+/**
+ * @brief Counts the days from 1970-01-01 to a date in the proleptic Gregorian
+ *        calendar
+ *
+ * @param year the year
+ * @param month the month, 1-12
+ * @param day the day of the month, 1-31
+ *
+ * @return the number of days, negative for dates before the epoch
+ */
+inline long days_from_civil(int year, const int &month, const int &day)
+{
+  // Years start in March, so the leap day is the last day of the year
+  year -= (month <= 2);
+
+  long era = (year >= 0 ? year : year - 399) / 400;
+  long year_of_era = year - era * 400;
+  long day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+  long day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+
+  return era * 146097 + day_of_era - 719468;
+}
+
+/**
+ * @brief Converts a day count from 1970-01-01 to a date in the proleptic
+ *        Gregorian calendar
+ */
+inline void civil_from_days(long days, int &year, int &month, int &day)
+{
+  days += 719468;
+
+  long era = (days >= 0 ? days : days - 146096) / 146097;
+  long day_of_era = days - era * 146097;
+  long year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+  long day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+  long shifted_month = (5 * day_of_year + 2) / 153;
+
+  day   = static_cast<int>(day_of_year - (153 * shifted_month + 2) / 5 + 1);
+  month = static_cast<int>(shifted_month < 10 ? shifted_month + 3 : shifted_month - 9);
+  year  = static_cast<int>(year_of_era + era * 400 + (month <= 2));
+}
+
+/**
+ * @brief Breaks a timestamp down into UTC calendar fields
+ *
+ * Unlike std::gmtime, the result is written to the caller's structure, so it is
+ * safe to use from several threads.
+ *
+ * @param timestamp the epoch time in seconds
+ * @param exploded_time receives the calendar fields
+ */
+inline void utc_explode(const std::time_t &timestamp, std::tm &exploded_time)
+{
+  long days = static_cast<long>(timestamp / 86400);
+  long seconds = static_cast<long>(timestamp % 86400);
+
+  if (seconds < 0)
+  {
+    seconds += 86400;
+    days--;
+  }
+
+  int year, month, day;
+  civil_from_days(days, year, month, day);
+
+  exploded_time.tm_year  = year - 1900;
+  exploded_time.tm_mon   = month - 1;
+  exploded_time.tm_mday  = day;
+  exploded_time.tm_hour  = static_cast<int>(seconds / 3600);
+  exploded_time.tm_min   = static_cast<int>(seconds / 60 % 60);
+  exploded_time.tm_sec   = static_cast<int>(seconds % 60);
+  exploded_time.tm_wday  = static_cast<int>(((days % 7) + 11) % 7); // 1970-01-01 was a Thursday
+  exploded_time.tm_yday  = static_cast<int>(days - days_from_civil(year, 1, 1));
+  exploded_time.tm_isdst = 0;
+}
+
+/**
+ * @brief Breaks a timestamp down into local calendar fields
+ *
+ * Uses the reentrant localtime_r (localtime_s with Visual C++), so the result
+ * is not shared with other threads as with std::localtime. Other Windows
+ * runtimes keep the std::localtime buffer per thread already.
+ *
+ * @param timestamp the epoch time in seconds
+ * @param exploded_time receives the calendar fields
+ */
+inline void local_explode(const std::time_t &timestamp, std::tm &exploded_time)
+{
+#if defined(_MSC_VER)
+  localtime_s(&exploded_time, &timestamp);
+#elif defined(_WIN32)
+  exploded_time = *std::localtime(&timestamp);
+#else
+  localtime_r(&timestamp, &exploded_time);
+#endif
+}
+
 /**
  * @brief Calculate the current UTC time stamp
  *
@@ -16,218 +112,226 @@ inline std::time_t utc_time()
 {
   std::time_t now = std::time(NULL);
 
-  std::tm tm_local(*std::localtime(&now));
-  std::time_t t_local = std::mktime(&tm_local);
-
-  std::tm tm_utc(*std::gmtime(&t_local));
+  // Reading the UTC fields back as local standard time yields the offset
+  std::tm tm_utc;
+  utc_explode(now, tm_utc);
   std::time_t t_utc = std::mktime(&tm_utc);
 
-  return now - (t_utc - t_local);
+  return now - (t_utc - now);
 }
 
 /**
- * @brief Produces an ISO-8601 string representation of the timestamp
+ * @brief Writes an ISO-8601 representation of the timestamp
  *
  * @param timestamp the epoch time in seconds
+ * @param buffer receives the text, which is not zero terminated and is at most
+ *   32 characters long
  * @param include_timezone appends Z UTC flag at end of string if true
  *
- * @return a string representing the timestamp in UTC
+ * @return the number of characters written
  */
-inline std::string to_iso8601(std::time_t timestamp, const bool &include_timezone = true)
+inline std::size_t format_iso8601(const std::time_t &timestamp, char *buffer, const bool &include_timezone = true)
 {
-  std::tm exploded_time(*std::gmtime(&timestamp));
-  std::string ret;
+  std::tm t;
+  utc_explode(timestamp, t);
+
+  char *c  = buffer;
+  int year = t.tm_year + 1900;
+
+  if (year < 0)
+  {
+    *c++ = '-';
+    year = -year;
+  }
+
+  // At least four digits, as strftime's %Y
+  char digits[12];
+  int count = 0;
+
+  do
+  {
+    digits[count++] = static_cast<char>('0' + year % 10);
+    year /= 10;
+  }
+  while (year || count < 4);
+
+  while (count)
+  {
+    *c++ = digits[--count];
+  }
+
+  const int fields[] = { t.tm_mon + 1, t.tm_mday, t.tm_hour, t.tm_min, t.tm_sec };
+  const char separators[] = { '-', '-', 'T', ':', ':' };
+
+  for (std::size_t i = 0; i < 5; i++)
+  {
+    *c++ = separators[i];
+    *c++ = static_cast<char>('0' + fields[i] / 10);
+    *c++ = static_cast<char>('0' + fields[i] % 10);
+  }
 
   if (include_timezone)
   {
-    char buf[sizeof "1970-01-01T00:00:00Z"];
-    std::strftime(buf, sizeof buf, "%Y-%m-%dT%H:%M:%SZ", &exploded_time);
-    ret = buf;
+    *c++ = 'Z';
   }
-  else
+
+  return c - buffer;
+}
+
+/**
+ * @brief Produces an ISO-8601 string representation of the timestamp
+ *
+ * @param timestamp the epoch time in seconds
+ * @param include_timezone appends Z UTC flag at end of string if true
+ *
+ * @return a string representing the timestamp in UTC
+ */
+inline std::string to_iso8601(std::time_t timestamp, const bool &include_timezone = true)
+{
+  char buf[32];
+
+  return std::string(buf, format_iso8601(timestamp, buf, include_timezone));
+}
+
+/**
+ * @brief Reads a fixed number of decimal digits
+ *
+ * @return false, leaving the position unchanged, if fewer digits are present
+ */
+inline bool read_iso8601_digits(const char *&c, const int &count, int &result)
+{
+  int value = 0;
+
+  for (int i = 0; i < count; i++)
   {
-    char buf[sizeof "1970-01-01T00:00:00"];
-    std::strftime(buf, sizeof buf, "%Y-%m-%dT%H:%M:%S", &exploded_time);
-    ret = buf;
+    if (c[i] < '0' || c[i] > '9')
+    {
+      return false;
+    }
+
+    value = value * 10 + (c[i] - '0');
   }
 
-  return ret;
+  c += count;
+  result = value;
+
+  return true;
 }
 
 /**
  * @brief Parses an ISO-8601 formatted string into epoch time
  *
+ * Both the extended (2013-03-14T09:33:59) and basic (20130314T093359) formats
+ * are accepted. Seconds are optional, fractional seconds are dropped, and a Z
+ * and/or numeric offset may follow.
+ *
  * @param descriptor the ISO-8601
  *
  * @return the UTC timestamp
  */
-inline std::time_t from_iso8601(std::string descriptor)
+inline std::time_t from_iso8601(const char *descriptor)
 {
-  // Parse according to ISO 8601
-  std::tm t;
-
-  const char *value = descriptor.c_str();
-  const char *c     = value;
-  int year          = 0;
-  int month         = 0;
-  int seconds       = 0;
-  int minutes       = 0;
-  int hours         = 0;
-  int days          = 0;
-
-  // NOTE: we have to check for the extended format first,
-  // because otherwise the separting '-' will be interpreted
-  // by std::sscanf as signs of a 1 digit integer .... :-(
-  if (std::sscanf(value, "%4u-%2u-%2u", &year, &month, &days) == 3)
-  {
-    c += 10;
-  }
-  else if (std::sscanf(value, "%4u%2u%2u", &year, &month, &days) == 3)
+  const char *c = descriptor;
+  int year      = 0;
+  int month     = 0;
+  int days      = 0;
+  int hours     = 0;
+  int minutes   = 0;
+  int seconds   = 0;
+  bool valid    = read_iso8601_digits(c, 4, year);
+
+  // Date part
+  if (valid)
   {
-    c += 8;
-  }
-  else
-  {
-    throw std::runtime_error(std::string("Invalid date format: ") + value);
-  }
+    bool extended = (*c == '-');
 
-  t.tm_year = year - 1900;
-  t.tm_mon  = month - 1;
-  t.tm_mday = days;
+    if (extended) c++;
 
-  // Check if time is supplied
-  if (*c == '\0')
-  {
-    t.tm_hour = 0;
-    t.tm_sec  = 0;
-    t.tm_min  = 0;
+    valid = read_iso8601_digits(c, 2, month);
+
+    if (valid && extended)
+    {
+      valid = (*c == '-');
+
+      if (valid) c++;
+    }
+
+    valid = valid && read_iso8601_digits(c, 2, days);
   }
-  else if (*c == 'T')
+
+  // Time of day part
+  if (valid && *c == 'T')
   {
-    // Time of day part
     c++;
+    valid = read_iso8601_digits(c, 2, hours);
 
-    if (std::sscanf(c, "%2d%2d", &hours, &minutes) == 2)
-    {
-      c += 4;
-    }
-    else if (std::sscanf(c, "%2d:%2d", &hours, &minutes) == 2)
-    {
-      c += 5;
-    }
-    else
+    if (valid && *c == ':') c++;
+
+    valid = valid && read_iso8601_digits(c, 2, minutes);
+
+    if (valid && *c == ':') c++;
+
+    if (valid && *c >= '0' && *c <= '9')
     {
-      throw std::runtime_error(std::string("Invalid date format: ") + value);
+      valid = read_iso8601_digits(c, 2, seconds);
     }
 
-    if (*c == ':')
+    // Drop microsecond information
+    if (valid && *c == '.')
     {
       c++;
-    }
 
-    if (*c != '\0')
-    {
-      if (std::sscanf(c, "%2d", &seconds) == 1)
-      {
-        c += 2;
-      }
-      else
+      while (*c >= '0' && *c <= '9')
       {
-        throw std::runtime_error(std::string("Invalid date format: ") + value);
+        c++;
       }
     }
-
-    t.tm_hour = hours;
-    t.tm_min  = minutes;
-    t.tm_sec  = seconds;
   }
-  else
+  else if (valid && *c != '\0')
   {
-    throw std::runtime_error(std::string("Invalid date format: ") + value);
-  }
-
-  // Drop microsecond information
-  if (*c == '.')
-  {
-    c++;
-
-    while (std::isdigit(*c) && *c != '\0')
-    {
-      c++;
-    }
+    valid = false;
   }
 
   // Parse time zone information
   int tz_offset = 0;
 
-  if (*c == 'Z')
+  if (valid && *c == 'Z')
   {
     c++;
   }
 
-  if (*c != '\0')
+  if (valid && (*c == '+' || *c == '-'))
   {
-    int tz_direction = 0;
-
-    if (*c == '+')
-    {
-      tz_direction = 1;
-    }
-    else if (*c == '-')
-    {
-      tz_direction = -1;
-    }
-    else
-    {
-      throw std::runtime_error(std::string("Invalid date format: ") + value);
-    }
-
-    // Offset part
-    int tz_hours   = 0;
-    int tz_minutes = 0;
-
-    c++;
+    int tz_direction = (*c++ == '+') ? 1 : -1;
+    int tz_hours     = 0;
+    int tz_minutes   = 0;
 
-    if (std::sscanf(c, "%2d", &tz_hours) == 1)
-    {
-      c += 2;
-    }
-    else
-    {
-      throw std::runtime_error(std::string("Invalid date format: ") + value);
-    }
+    valid = read_iso8601_digits(c, 2, tz_hours);
 
-    if (*c == ':')
-    {
-      c++;
-    }
+    if (valid && *c == ':') c++;
 
-    if (*c != '\0')
+    if (valid && *c != '\0')
     {
-      if (std::sscanf(c, "%2d", &tz_minutes) == 1)
-      {
-        c += 2;
-      }
-      else
-      {
-        throw std::runtime_error(std::string("Invalid date format: ") + value);
-      }
+      valid = read_iso8601_digits(c, 2, tz_minutes);
     }
 
     tz_offset = tz_direction * (tz_hours * 3600 + tz_minutes * 60);
   }
 
-  // Determine DST automatically
-  t.tm_isdst = -1;
+  if (!valid || *c != '\0' || month < 1 || month > 12 || days < 1 || days > 31 ||
+      hours > 24 || minutes > 59 || seconds > 60)
+  {
+    throw std::runtime_error(std::string("Invalid date format: ") + descriptor);
+  }
 
-  // Correct for local time zone
-  std::time_t t_local = std::mktime(&t);
-  std::tm tm_utc(*std::gmtime(&t_local));
-  std::time_t t_utc = std::mktime(&tm_utc);
-  tz_offset += (t_utc - t_local);
+  std::time_t days_since_epoch = days_from_civil(year, month, days);
 
-  return std::mktime(&t) - tz_offset;
+  return days_since_epoch * 86400 + hours * 3600 + minutes * 60 + seconds - tz_offset;
 }
 
-#endif // RESTFUL_MAPPER_ISO8601_H_20130314
+inline std::time_t from_iso8601(const std::string &descriptor)
+{
+  return from_iso8601(descriptor.c_str());
+}
 
+#endif // RESTFUL_MAPPER_ISO8601_H_20130314
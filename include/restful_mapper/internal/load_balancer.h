@@ -0,0 +1,135 @@
+#ifndef RESTFUL_MAPPER_LOAD_BALANCER_H_20131018
+#define RESTFUL_MAPPER_LOAD_BALANCER_H_20131018
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace restful_mapper
+{
+
+enum BalancingStrategy
+{
+  LEAST_OUTSTANDING,   // The least loaded of all replicas
+  POWER_OF_TWO_CHOICES // The less loaded of two random replicas
+};
+
+/**
+ * @brief How requests are spread over replicas, and when a replica is taken
+ * out of rotation
+ *
+ * The load of a replica is its number of requests in flight plus one, times
+ * its smoothed response time, so slow replicas receive fewer requests. Ties
+ * and near-ties, i.e. loads within 20% of the least, are broken at random, so
+ * equally fast replicas share the requests.
+ *
+ * A replica is ejected after failure_threshold consecutive failures, i.e.
+ * connection failures, timeouts and 5xx, 408 and 429 responses, and receives
+ * no requests for ejection_seconds. It is ejected again after its next failure,
+ * until a request to it succeeds.
+ */
+struct LoadBalancingPolicy
+{
+  LoadBalancingPolicy()
+    : strategy(LEAST_OUTSTANDING), failure_threshold(3), ejection_seconds(10.0) {}
+
+  BalancingStrategy strategy;
+
+  // Consecutive failures to eject a replica, 0 never ejects replicas
+  unsigned int failure_threshold;
+
+  double ejection_seconds;
+};
+
+/**
+ * @brief Chooses a replica of the web service for every request
+ *
+ * If every replica is excluded or ejected, the one due back the soonest is
+ * used anyway. The balancer is thread-safe, and may be shared by several
+ * clients using Api::set_load_balancer, which then count their requests in
+ * flight and the health of the replicas together.
+ */
+class LoadBalancer
+{
+public:
+  LoadBalancer();
+  ~LoadBalancer();
+
+  LoadBalancingPolicy policy() const;
+  void set_policy(const LoadBalancingPolicy &policy);
+
+  /**
+   * @brief Replaces the replicas, forgetting their load and health
+   */
+  void set_urls(const std::vector<std::string> &urls);
+
+  std::vector<std::string> urls() const;
+
+  std::size_t size() const;
+
+  /**
+   * @brief The URL of the replica, or an empty string if the replicas have
+   * been replaced by fewer since it was chosen
+   */
+  std::string url(const std::size_t &replica) const;
+
+  /**
+   * @brief Chooses the replica for a request
+   *
+   * @param excluded replicas not to choose if possible, e.g. because they
+   *        failed the request already; may be empty
+   */
+  std::size_t choose(const std::vector<bool> &excluded);
+
+  /**
+   * @brief Whether a replica which is not excluded is in rotation
+   */
+  bool has_available(const std::vector<bool> &excluded) const;
+
+  bool is_ejected(const std::size_t &replica) const;
+
+  unsigned int in_flight(const std::size_t &replica) const;
+
+  // Outcome of a request to a replica, after start()
+  void start(const std::size_t &replica);
+  void succeed(const std::size_t &replica, const double &seconds);
+  void fail(const std::size_t &replica);
+  void abandon(const std::size_t &replica);
+
+private:
+  struct Replica
+  {
+    Replica()
+      : in_flight(0), response_time(0.0), failures(0), ejected_until(0.0) {}
+
+    std::string url;
+    unsigned int in_flight;
+
+    // Exponentially weighted moving average, 0 until the first response
+    double response_time;
+
+    unsigned int failures;
+    double ejected_until;
+  };
+
+  LoadBalancingPolicy policy_;
+  std::vector<Replica> replicas_;
+  unsigned long random_state_;
+  void *mutex_;
+
+  // Disallow copy
+  LoadBalancer(LoadBalancer const &);   // Don't Implement
+  void operator=(LoadBalancer const &); // Don't implement
+
+  void lock() const;
+  void unlock() const;
+
+  std::size_t choose_locked(const std::vector<bool> &excluded);
+  bool is_available(const std::size_t &replica, const std::vector<bool> &excluded, const double &now) const;
+  double load(const std::size_t &replica) const;
+  std::size_t random(const std::size_t &count);
+};
+
+}
+
+#endif // RESTFUL_MAPPER_LOAD_BALANCER_H_20131018
@@ -0,0 +1,33 @@
+#ifndef RESTFUL_MAPPER_NUMBER_FORMAT_H_20131018
+#define RESTFUL_MAPPER_NUMBER_FORMAT_H_20131018
+
+#include <cstddef>
+
+/**
+ * @brief Writes the decimal representation of an integer
+ *
+ * @param value the integer to format
+ * @param buffer receives the text, which is not zero terminated and is at
+ *   most 20 characters long
+ *
+ * @return the number of characters written
+ */
+std::size_t format_integer(const long long &value, char *buffer);
+
+/**
+ * @brief Writes the shortest decimal representation of a double that parses
+ *        back to the same value
+ *
+ * Digits are generated with the Grisu2 algorithm. The layout matches
+ * yajl_gen_double: fixed notation for decimal exponents from -4 to 19,
+ * scientific notation otherwise, and a ".0" suffix on integral values.
+ *
+ * @param value the double to format
+ * @param buffer receives the text, which is not zero terminated and is at
+ *   most 25 characters long
+ *
+ * @return the number of characters written, or 0 if the value is infinite or NaN
+ */
+std::size_t format_double(const double &value, char *buffer);
+
+#endif // RESTFUL_MAPPER_NUMBER_FORMAT_H_20131018
@@ -0,0 +1,119 @@
+#ifndef RESTFUL_MAPPER_RATE_LIMITER_H_20131018
+#define RESTFUL_MAPPER_RATE_LIMITER_H_20131018
+
+#include <string>
+#include <map>
+#include <restful_mapper/deadline.h>
+
+namespace restful_mapper
+{
+
+/**
+ * @brief Paces requests and caps the number of requests in flight, per
+ * endpoint prefix
+ *
+ * A prefix such as "/todo" applies to "/todo", "/todo/1" and "/todo?q=..."
+ * but not to "/todos". Each endpoint is governed by the longest matching
+ * prefix only; the empty prefix matches every endpoint.
+ *
+ * The rate is enforced by a token bucket holding up to burst requests, which
+ * is refilled at the specified rate. Requests over a limit wait until they may
+ * start. The limiter is thread-safe, and may be shared by several clients
+ * using Api::set_rate_limiter.
+ */
+class RateLimiter
+{
+public:
+  /**
+   * @brief The limit a request was counted against, by which it is released
+   *
+   * The request is released from the same limit even if a longer prefix
+   * matching its endpoint is added while it is in flight.
+   */
+  class Slot
+  {
+  public:
+    Slot() : limit_(NULL) {}
+
+  private:
+    friend class RateLimiter;
+
+    void *limit_;
+  };
+
+  RateLimiter();
+  ~RateLimiter();
+
+  /**
+   * @brief Limit the rate of requests, a rate of 0 removes the limit
+   */
+  void set_rate(const std::string &prefix, const double &requests_per_second, const double &burst);
+
+  /**
+   * @brief Limit the number of concurrent requests, 0 removes the limit
+   */
+  void set_max_in_flight(const std::string &prefix, const unsigned int &max_in_flight);
+
+  void clear();
+
+  /**
+   * @brief Waits until a request to the endpoint may start, and counts it as
+   * in flight until it is released
+   *
+   * @param endpoint the endpoint of the request
+   * @param deadline the active deadline, or NULL
+   * @param slot set to the limit the request is counted against
+   *
+   * @return false if the deadline would pass or is cancelled while waiting
+   */
+  bool acquire(const std::string &endpoint, const Deadline *deadline, Slot &slot);
+
+  /**
+   * @brief Counts a request as in flight only if it may start right away
+   */
+  bool try_acquire(const std::string &endpoint, Slot &slot);
+
+  /**
+   * @brief Ends a request, leaving the slot empty
+   */
+  void release(Slot &slot);
+
+  unsigned int in_flight(const std::string &prefix) const;
+
+private:
+  struct Limit
+  {
+    Limit()
+      : rate(0.0), burst(1.0), tokens(1.0), updated(0.0), max_in_flight(0), in_flight(0) {}
+
+    double rate;
+    double burst;
+    double tokens;
+    double updated;
+
+    unsigned int max_in_flight;
+    unsigned int in_flight;
+  };
+
+  // Limits are never erased, so slots may point into the map
+  typedef std::map<std::string, Limit> LimitMap;
+
+  LimitMap limits_;
+  void *mutex_;
+
+  // Disallow copy
+  RateLimiter(RateLimiter const &);    // Don't Implement
+  void operator=(RateLimiter const &); // Don't implement
+
+  void lock() const;
+  void unlock() const;
+
+  // Counts a request as in flight, or sets the time to wait before trying again
+  bool take(const std::string &endpoint, double &wait, Slot &slot);
+
+  Limit *find(const std::string &endpoint);
+};
+
+}
+
+#endif // RESTFUL_MAPPER_RATE_LIMITER_H_20131018
@@ -0,0 +1,141 @@
+#ifndef RESTFUL_MAPPER_RESPONSE_CACHE_H_20131018
+#define RESTFUL_MAPPER_RESPONSE_CACHE_H_20131018
+
+#include <string>
+#include <list>
+#include <map>
+
+namespace restful_mapper
+{
+
+struct CachedResponse
+{
+  std::string body;
+  std::string etag;
+  std::string last_modified;
+};
+
+/**
+ * @brief Memory bounded LRU store for GET responses, keyed by URL
+ *
+ * A capacity of zero disables the cache.
+ */
+class ResponseCache
+{
+public:
+  ResponseCache() : capacity_(0), size_(0) {}
+
+  const size_t &capacity() const
+  {
+    return capacity_;
+  }
+
+  void set_capacity(const size_t &capacity)
+  {
+    capacity_ = capacity;
+    evict();
+  }
+
+  const size_t &size() const
+  {
+    return size_;
+  }
+
+  size_t count() const
+  {
+    return entries_.size();
+  }
+
+  /**
+   * @brief Look up a response and mark it as most recently used
+   *
+   * @return the cached response, or NULL if the URL is not cached
+   */
+  const CachedResponse *find(const std::string &url)
+  {
+    EntryMap::iterator i = entries_.find(url);
+
+    if (i == entries_.end())
+    {
+      return NULL;
+    }
+
+    order_.splice(order_.begin(), order_, i->second.position);
+
+    return &i->second.response;
+  }
+
+  void store(const std::string &url, const CachedResponse &response)
+  {
+    erase(url);
+
+    size_t cost = entry_cost(url, response);
+
+    if (cost > capacity_)
+    {
+      return;
+    }
+
+    order_.push_front(url);
+
+    Entry &entry = entries_[url];
+    entry.response = response;
+    entry.position = order_.begin();
+
+    size_ += cost;
+    evict();
+  }
+
+  void erase(const std::string &url)
+  {
+    EntryMap::iterator i = entries_.find(url);
+
+    if (i != entries_.end())
+    {
+      size_ -= entry_cost(i->first, i->second.response);
+      order_.erase(i->second.position);
+      entries_.erase(i);
+    }
+  }
+
+  void clear()
+  {
+    entries_.clear();
+    order_.clear();
+    size_ = 0;
+  }
+
+private:
+  typedef std::list<std::string> Order;
+
+  struct Entry
+  {
+    CachedResponse response;
+    Order::iterator position;
+  };
+
+  typedef std::map<std::string, Entry> EntryMap;
+
+  EntryMap entries_;
+  Order order_; // Most recently used first
+  size_t capacity_;
+  size_t size_;
+
+  static size_t entry_cost(const std::string &url, const CachedResponse &response)
+  {
+    return url.size() + response.body.size() + response.etag.size() + response.last_modified.size();
+  }
+
+  void evict()
+  {
+    while (size_ > capacity_ && !order_.empty())
+    {
+      std::string url = order_.back();
+      erase(url);
+    }
+  }
+};
+
+}
+
+#endif // RESTFUL_MAPPER_RESPONSE_CACHE_H_20131018
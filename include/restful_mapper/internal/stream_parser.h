@@ -0,0 +1,96 @@
+#ifndef RESTFUL_MAPPER_STREAM_PARSER_H_20131018
+#define RESTFUL_MAPPER_STREAM_PARSER_H_20131018
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace restful_mapper
+{
+
+/**
+ * @brief Parses JSON text which arrives in parts, e.g. as it is downloaded
+ *
+ * Every part is passed to yajl as soon as it is fed, and the value tree is
+ * built from the parser callbacks, so little work is left once the last part
+ * has arrived.
+ *
+ * The tree has the same layout as one produced by yajl_tree_parse, and must be
+ * released using yajl_tree_free.
+ */
+class StreamParser
+{
+public:
+  StreamParser();
+  ~StreamParser();
+
+  /**
+   * @brief Parses the next part of the text
+   *
+   * @return false if the text is known to be invalid, after which further
+   *         parts are ignored
+   */
+  bool feed(const char *data, const std::size_t &length);
+
+  /**
+   * @brief Parses the end of the text
+   *
+   * @return the root of the value tree, owned by the caller, or NULL if the
+   *         text is not valid JSON
+   */
+  void *finish();
+
+  bool failed() const
+  {
+    return failed_;
+  }
+
+  const std::string &error() const
+  {
+    return error_;
+  }
+
+private:
+  void *handle_;
+  bool failed_;
+  std::string error_;
+
+  // Completed values and keys of the containers being parsed
+  std::vector<void *> values_;
+  std::vector<char *> keys_;
+
+  struct Frame
+  {
+    bool object;
+    std::size_t first_value;
+    std::size_t first_key;
+  };
+
+  std::vector<Frame> frames_;
+
+  void fail(const char *data, const std::size_t &length);
+  void clear();
+
+  int add(void *value);
+  int open(const bool &object);
+  int close();
+
+  // yajl callbacks
+  static int on_null(void *ctx);
+  static int on_boolean(void *ctx, int value);
+  static int on_number(void *ctx, const char *value, std::size_t length);
+  static int on_string(void *ctx, const unsigned char *value, std::size_t length);
+  static int on_start_map(void *ctx);
+  static int on_map_key(void *ctx, const unsigned char *key, std::size_t length);
+  static int on_end_map(void *ctx);
+  static int on_start_array(void *ctx);
+  static int on_end_array(void *ctx);
+
+  // Disallow copy
+  StreamParser(StreamParser const &);  // Don't Implement
+  void operator=(StreamParser const &); // Don't implement
+};
+
+}
+
+#endif // RESTFUL_MAPPER_STREAM_PARSER_H_20131018
@@ -0,0 +1,27 @@
+#ifndef RESTFUL_MAPPER_STRUCTURAL_PARSER_H_20131018
+#define RESTFUL_MAPPER_STRUCTURAL_PARSER_H_20131018
+
+#include <cstddef>
+
+/**
+ * @brief Parses JSON text using a structural index
+ *
+ * The input is first scanned 64 bytes at a time, using word-wide bit
+ * operations, to locate every structural character, opening quote and start
+ * of a literal outside of strings. The resulting index is then walked to build
+ * the value tree, so whitespace and string contents are only visited when they
+ * are decoded.
+ *
+ * The tree has the same layout as one produced by yajl_tree_parse, and must be
+ * released using yajl_tree_free.
+ *
+ * @param json the JSON text, which need not be zero terminated
+ * @param length the length of the JSON text in bytes
+ * @param error_buffer buffer receiving an error description on failure
+ * @param error_buffer_size size of the error buffer
+ *
+ * @return the root of the value tree, or NULL if the text is not valid JSON
+ */
+void *structural_parse(const char *json, std::size_t length, char *error_buffer, std::size_t error_buffer_size);
+
+#endif // RESTFUL_MAPPER_STRUCTURAL_PARSER_H_20131018
@@ -0,0 +1,12 @@
+#ifndef RESTFUL_MAPPER_THREAD_LOCAL_H_20131018
+#define RESTFUL_MAPPER_THREAD_LOCAL_H_20131018
+
+// Storage duration of one variable per thread, for the scoped clients,
+// sessions and deadlines, which apply to the thread that created them
+#if defined(_MSC_VER) || defined(__BORLANDC__)
+#define RESTFUL_MAPPER_THREAD_LOCAL __declspec(thread)
+#else
+#define RESTFUL_MAPPER_THREAD_LOCAL __thread
+#endif
+
+#endif // RESTFUL_MAPPER_THREAD_LOCAL_H_20131018
@@ -1,6 +1,7 @@
 #ifndef RESTFUL_MAPPER_JSON_H
 #define RESTFUL_MAPPER_JSON_H
 
+#include <cstddef>
 #include <string>
 #include <vector>
 #include <map>
@@ -14,10 +15,10 @@ public:
   Json();
   ~Json();
 
-  static std::string encode(const int &value) { Emitter e; e.emit(value); return e.dump(); }
-  static std::string encode(const long long &value) { Emitter e; e.emit(value); return e.dump(); }
-  static std::string encode(const double &value) { Emitter e; e.emit(value); return e.dump(); }
-  static std::string encode(const bool &value) { Emitter e; e.emit(value); return e.dump(); }
+  static std::string encode(const int &value);
+  static std::string encode(const long long &value);
+  static std::string encode(const double &value);
+  static std::string encode(const bool &value);
   static std::string encode(const std::string &value) { Emitter e; e.emit(value); return e.dump(); }
   static std::string encode(const char *value) { Emitter e; e.emit(value); return e.dump(); }
 
@@ -33,6 +34,22 @@ public:
   static std::string encode(const std::map<std::string, bool> &value) { Emitter e; e.emit(value); return e.dump(); }
   static std::string encode(const std::map<std::string, std::string> &value) { Emitter e; e.emit(value); return e.dump(); }
 
+  /**
+   * @brief Implementations used to parse JSON text into a value tree
+   *
+   * The structural engine indexes the text in word sized blocks before building
+   * the tree, and is typically faster than yajl on larger documents. Both build
+   * the same tree, so the choice is invisible to Node and Parser.
+   */
+  enum ParserEngine
+  {
+    YAJL_ENGINE,
+    STRUCTURAL_ENGINE
+  };
+
+  static void set_parser_engine(const ParserEngine &engine);
+  static ParserEngine parser_engine();
+
   static void not_found(const std::string &name);
 
   template <class T> static T decode(const std::string &json_struct) { Parser p(json_struct); return p.root(); }
@@ -84,6 +101,8 @@ public:
     void emit(const std::string &key, const std::map<std::string, bool> &value);
     void emit(const std::string &key, const std::map<std::string, std::string> &value);
 
+    void emit_key(const char *key);
+
     void emit_tree(void *json_tree);
 
     void emit_json(const std::string &value);
@@ -121,6 +140,10 @@ public:
     std::vector<std::string> dump_array() const;
     std::map<std::string, std::string> dump_map() const;
 
+    bool exists(const std::string &key) const;
+    Node find(const std::string &key) const;
+    void *find_tree(const char *key) const;
+
     bool is_null() const;
     bool is_string() const;
     bool is_int() const;
@@ -183,11 +206,24 @@ public:
 
     bool is_loaded() const;
     void load(const std::string &json_struct);
+
+    /**
+     * @brief Loads JSON text which arrives in parts, parsing every part as it
+     * is fed, e.g. while the text is being downloaded
+     *
+     * Parts are always parsed by yajl, whatever the parser engine. finish()
+     * throws like load() if the text is invalid; feed() returns false as soon
+     * as it is known to be, after which further parts are ignored.
+     */
+    void begin();
+    bool feed(const char *data, const std::size_t &length);
+    void finish();
     Node root() const;
     bool exists(const std::string &key) const;
     bool empty(const std::string &key) const;
     Node find(const std::string &key) const;
     Node find(const char **key) const;
+    void *find_tree(const char *key) const;
 
     void *json_tree_ptr() const
     {
@@ -196,6 +232,9 @@ public:
 
   private:
     void *json_tree_ptr_;
+    void *stream_ptr_;
+
+    void clear();
 
     // Disallow copy
     Parser(Parser const &);        // Don't Implement
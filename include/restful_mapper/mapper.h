@@ -4,6 +4,8 @@
 #include <restful_mapper/field.h>
 #include <restful_mapper/json.h>
 #include <restful_mapper/relation.h>
+#include <restful_mapper/projection.h>
+#include <restful_mapper/profile.h>
 
 namespace restful_mapper
 {
@@ -23,28 +25,74 @@ enum MapperConfig
 class Mapper
 {
 public:
-  Mapper(const int &flags = 0)
+  Mapper(const int &flags = 0) : emitter_(new Json::Emitter()), owns_emitter_(true), node_(NULL), primary_key_(NULL), projection_(NULL)
   {
     flags_ = flags;
 
     if (!should_output_single_field())
     {
-      emitter_.emit_map_open();
+      emitter_->emit_map_open();
     }
   }
 
-  Mapper(std::string json_struct, const int &flags = 0)
+  Mapper(std::string json_struct, const int &flags = 0) : emitter_(new Json::Emitter()), owns_emitter_(true), node_(NULL), primary_key_(NULL), projection_(NULL)
   {
     flags_ = flags;
 
     if (!should_output_single_field())
     {
-      emitter_.emit_map_open();
+      emitter_->emit_map_open();
     }
 
     parser_.load(json_struct);
   }
 
+  /**
+   * @brief Read from a value of a parsed document, e.g. a nested object,
+   * which must outlive the mapper
+   */
+  Mapper(const Json::Node &node, const int &flags = 0) : emitter_(new Json::Emitter()), owns_emitter_(true), node_(&node), primary_key_(NULL), projection_(NULL)
+  {
+    flags_ = flags;
+
+    if (!should_output_single_field())
+    {
+      emitter_->emit_map_open();
+    }
+  }
+
+  /**
+   * @brief Output into an existing emitter, used when nesting related objects
+   *
+   * Call finish() once all fields are set.
+   */
+  Mapper(Json::Emitter &emitter, const int &flags = 0) : emitter_(&emitter), owns_emitter_(false), node_(NULL), primary_key_(NULL), projection_(NULL)
+  {
+    flags_ = flags;
+
+    if (!should_output_single_field())
+    {
+      emitter_->emit_map_open();
+    }
+  }
+
+  /**
+   * @brief Read further values from another node, e.g. the next object of a
+   * result set
+   */
+  void read_from(const Json::Node &node)
+  {
+    node_ = &node;
+  }
+
+  ~Mapper()
+  {
+    if (owns_emitter_)
+    {
+      delete emitter_;
+    }
+  }
+
   const int &flags() const
   {
     return flags_;
@@ -65,19 +113,33 @@ public:
     field_filter_ = field_filter;
   }
 
-  std::string dump()
+  /**
+   * @brief Only read the fields in the projection, the primary key is always
+   * read. Other fields are marked as not loaded.
+   */
+  void set_projection(const Projection *projection)
+  {
+    projection_ = projection;
+  }
+
+  void finish()
   {
     if (!should_output_single_field())
     {
-      emitter_.emit_map_close();
+      emitter_->emit_map_close();
     }
+  }
 
-    return emitter_.dump();
+  std::string dump()
+  {
+    finish();
+
+    return emitter_->dump();
   }
 
   std::string get(const char *key) const
   {
-    return parser_.find(key).dump();
+    return node_ ? node_->find(key).dump() : parser_.find(key).dump();
   }
 
   void set(const char *key, std::string json_struct)
@@ -86,17 +148,26 @@ public:
 
     if (!should_output_single_field())
     {
-      emitter_.emit(key);
+      emitter_->emit_key(key);
     }
 
-    emitter_.emit_json(json_struct);
+    emitter_->emit_json(json_struct);
   }
 
   template <class T> void get(const char *key, Field<T> &attr) const
   {
-    if (parser_.exists(key))
+    if (!is_projected(key))
+    {
+      attr.unload();
+      return;
+    }
+
+    void *value = find_tree(key);
+
+    if (value)
     {
-      Json::Node node = parser_.find(key);
+      RESTFUL_MAPPER_PROFILE_COUNT(PROFILE_FIELDS_DECODED, 1);
+      Json::Node node(key, value);
 
       if (node.is_null())
       {
@@ -121,20 +192,23 @@ public:
   template <class T> void set(const char *key, const Field<T> &attr)
   {
     if (should_output_single_field() && field_filter_ != key) return;
+    if (!attr.is_loaded()) return;
     if (!should_ignore_dirty_flag() && !attr.is_dirty()) return;
 
     if (!should_output_single_field())
     {
-      emitter_.emit(key);
+      emitter_->emit_key(key);
     }
 
+    RESTFUL_MAPPER_PROFILE_COUNT(PROFILE_FIELDS_ENCODED, 1);
+
     if (attr.is_null())
     {
-      emitter_.emit_null();
+      emitter_->emit_null();
     }
     else
     {
-      emitter_.emit(attr);
+      emitter_->emit(attr);
     }
 
     if (!should_keep_fields_dirty()) attr.clean();
@@ -142,9 +216,18 @@ public:
 
   void get(const char *key, Field<std::time_t> &attr) const
   {
-    if (parser_.exists(key))
+    if (!is_projected(key))
     {
-      Json::Node node = parser_.find(key);
+      attr.unload();
+      return;
+    }
+
+    void *value = find_tree(key);
+
+    if (value)
+    {
+      RESTFUL_MAPPER_PROFILE_COUNT(PROFILE_FIELDS_DECODED, 1);
+      Json::Node node(key, value);
 
       if (node.is_null())
       {
@@ -169,20 +252,23 @@ public:
   void set(const char *key, const Field<std::time_t> &attr)
   {
     if (should_output_single_field() && field_filter_ != key) return;
+    if (!attr.is_loaded()) return;
     if (!should_ignore_dirty_flag() && !attr.is_dirty()) return;
 
     if (!should_output_single_field())
     {
-      emitter_.emit(key);
+      emitter_->emit_key(key);
     }
 
+    RESTFUL_MAPPER_PROFILE_COUNT(PROFILE_FIELDS_ENCODED, 1);
+
     if (attr.is_null())
     {
-      emitter_.emit_null();
+      emitter_->emit_null();
     }
     else
     {
-      emitter_.emit(attr.to_iso8601(true));
+      emitter_->emit(attr.to_iso8601(true));
     }
 
     if (!should_keep_fields_dirty()) attr.clean();
@@ -190,9 +276,12 @@ public:
 
   void get(const char *key, Primary &attr) const
   {
-    if (parser_.exists(key))
+    void *value = find_tree(key);
+
+    if (value)
     {
-      Json::Node node = parser_.find(key);
+      RESTFUL_MAPPER_PROFILE_COUNT(PROFILE_FIELDS_DECODED, 1);
+      Json::Node node(key, value);
 
       attr = Primary();
 
@@ -218,24 +307,36 @@ public:
 
   void set(const char *key, const Primary &attr)
   {
+    primary_key_ = key;
+
     if (should_output_single_field() && field_filter_ != key) return;
     if (!should_include_primary_key() || attr.is_null()) return;
 
     if (!should_output_single_field())
     {
-      emitter_.emit(key);
+      emitter_->emit_key(key);
     }
 
-    emitter_.emit(attr.get());
+    RESTFUL_MAPPER_PROFILE_COUNT(PROFILE_FIELDS_ENCODED, 1);
+    emitter_->emit(attr.get());
 
     if (!should_keep_fields_dirty()) attr.clean();
   }
 
   template <class T> void get(const char *key, Foreign<T> &attr) const
   {
-    if (parser_.exists(key))
+    if (!is_projected(key))
     {
-      Json::Node node = parser_.find(key);
+      attr.unload();
+      return;
+    }
+
+    void *value = find_tree(key);
+
+    if (value)
+    {
+      RESTFUL_MAPPER_PROFILE_COUNT(PROFILE_FIELDS_DECODED, 1);
+      Json::Node node(key, value);
 
       if (node.is_null())
       {
@@ -260,21 +361,24 @@ public:
   template <class T> void set(const char *key, const Foreign<T> &attr)
   {
     if (should_output_single_field() && field_filter_ != key) return;
+    if (!attr.is_loaded()) return;
     if (!should_ignore_dirty_flag() && !attr.is_dirty()) return;
     if (should_omit_parent_keys() && parent_model_ == attr.class_name()) return;
 
     if (!should_output_single_field())
     {
-      emitter_.emit(key);
+      emitter_->emit_key(key);
     }
 
+    RESTFUL_MAPPER_PROFILE_COUNT(PROFILE_FIELDS_ENCODED, 1);
+
     if (attr.is_null())
     {
-      emitter_.emit_null();
+      emitter_->emit_null();
     }
     else
     {
-      emitter_.emit(attr);
+      emitter_->emit(attr);
     }
 
     if (!should_keep_fields_dirty()) attr.clean();
@@ -282,62 +386,134 @@ public:
 
   template <class T> void get(const char *key, BelongsTo<T> &attr) const
   {
-    if (parser_.empty(key)) return;
+    if (!is_projected(key)) return;
+
+    void *value = find_tree(key);
+
+    if (!value)
+    {
+      defer(key, attr);
+      return;
+    }
 
-    attr.from_json(get(key), (flags_ | INCLUDE_PRIMARY_KEY) & ~TOUCH_FIELDS);
+    Json::Node node(key, value);
+    if (node.is_null()) return;
+
+    attr.from_json(node, (flags_ | INCLUDE_PRIMARY_KEY) & ~TOUCH_FIELDS);
   }
 
   template <class T> void set(const char *key, const BelongsTo<T> &attr)
   {
     if (should_output_shallow()) return;
+    if (!attr.is_loaded()) return;
     if (should_output_single_field() && field_filter_ != key) return;
     if (!should_ignore_dirty_flag() && !attr.is_dirty()) return;
     if (should_omit_parent_keys() && parent_model_ == attr.class_name()) return;
 
-    set(key, attr.to_json((flags_ | INCLUDE_PRIMARY_KEY | OMIT_PARENT_KEYS) & ~OUTPUT_SINGLE_FIELD,
-        current_model_));
+    if (!should_output_single_field())
+    {
+      emitter_->emit_key(key);
+    }
+
+    attr.to_json(*emitter_, (flags_ | INCLUDE_PRIMARY_KEY | OMIT_PARENT_KEYS) & ~OUTPUT_SINGLE_FIELD,
+        current_model_);
 
     if (!should_keep_fields_dirty()) attr.clean();
   }
 
   template <class T> void get(const char *key, HasOne<T> &attr) const
   {
-    if (parser_.empty(key)) return;
+    if (!is_projected(key)) return;
 
-    attr.from_json(get(key), (flags_ | INCLUDE_PRIMARY_KEY) & ~TOUCH_FIELDS);
+    void *value = find_tree(key);
+
+    if (!value)
+    {
+      defer(key, attr);
+      return;
+    }
+
+    Json::Node node(key, value);
+    if (node.is_null()) return;
+
+    attr.from_json(node, (flags_ | INCLUDE_PRIMARY_KEY) & ~TOUCH_FIELDS);
   }
 
   template <class T> void set(const char *key, const HasOne<T> &attr)
   {
     if (should_output_shallow()) return;
+    if (!attr.is_loaded()) return;
     if (should_output_single_field() && field_filter_ != key) return;
     if (!should_ignore_dirty_flag() && !attr.is_dirty()) return;
 
-    set(key, attr.to_json((flags_ | INCLUDE_PRIMARY_KEY | OMIT_PARENT_KEYS) & ~OUTPUT_SINGLE_FIELD,
-        current_model_));
+    if (!should_output_single_field())
+    {
+      emitter_->emit_key(key);
+    }
+
+    attr.to_json(*emitter_, (flags_ | INCLUDE_PRIMARY_KEY | OMIT_PARENT_KEYS) & ~OUTPUT_SINGLE_FIELD,
+        current_model_);
 
     if (!should_keep_fields_dirty()) attr.clean();
   }
 
   template <class T> void get(const char *key, HasMany<T> &attr) const
   {
-    if (parser_.empty(key)) return;
+    if (!is_projected(key)) return;
+
+    void *value = find_tree(key);
 
-    attr.from_json(get(key), (flags_ | INCLUDE_PRIMARY_KEY) & ~TOUCH_FIELDS);
+    if (!value)
+    {
+      defer(key, attr);
+      return;
+    }
+
+    Json::Node node(key, value);
+    if (node.is_null()) return;
+
+    attr.from_json(node, (flags_ | INCLUDE_PRIMARY_KEY) & ~TOUCH_FIELDS);
   }
 
   template <class T> void set(const char *key, const HasMany<T> &attr)
   {
     if (should_output_shallow()) return;
+    if (!attr.is_loaded()) return;
     if (should_output_single_field() && field_filter_ != key) return;
     if (!should_ignore_dirty_flag() && !attr.is_dirty()) return;
 
-    set(key, attr.to_json((flags_ | INCLUDE_PRIMARY_KEY | OMIT_PARENT_KEYS) & ~OUTPUT_SINGLE_FIELD,
-        current_model_));
+    if (!should_output_single_field())
+    {
+      emitter_->emit_key(key);
+    }
+
+    attr.to_json(*emitter_, (flags_ | INCLUDE_PRIMARY_KEY | OMIT_PARENT_KEYS) & ~OUTPUT_SINGLE_FIELD,
+        current_model_);
 
     if (!should_keep_fields_dirty()) attr.clean();
   }
 
+  typedef std::vector<std::pair<const char *, LazyRelation *> > DeferredRelations;
+
+  /**
+   * @brief Lazy relationships which were missing from the input, by key
+   *
+   * The owner of the relationships is responsible for pointing them at their
+   * URL, as the mapper does not know it.
+   */
+  const DeferredRelations &deferred() const
+  {
+    return deferred_;
+  }
+
+  /**
+   * @brief Key of the primary field, known once it has been passed to set()
+   */
+  const char *primary_key() const
+  {
+    return primary_key_;
+  }
+
   const std::string &current_model() const
   {
     return current_model_;
@@ -359,14 +535,41 @@ public:
   }
 
 private:
-  Json::Emitter emitter_;
+  Json::Emitter *emitter_;
+  bool owns_emitter_;
   Json::Parser parser_;
+  const Json::Node *node_;
+  const char *primary_key_;
+  mutable DeferredRelations deferred_;
+  const Projection *projection_;
 
   int flags_;
   std::string field_filter_;
   std::string current_model_;
   std::string parent_model_;
 
+  // Disallow copy
+  Mapper(Mapper const &);         // Don't Implement
+  void operator=(Mapper const &); // Don't implement
+
+  inline void *find_tree(const char *key) const
+  {
+    return node_ ? node_->find_tree(key) : parser_.find_tree(key);
+  }
+
+  inline bool is_projected(const char *key) const
+  {
+    return !projection_ || projection_->empty() || projection_->contains(key);
+  }
+
+  void defer(const char *key, LazyRelation &attr) const
+  {
+    // Partial input, such as a save response, leaves relationships alone
+    if (!attr.is_lazy() || should_ignore_missing_fields()) return;
+
+    deferred_.push_back(std::make_pair(key, &attr));
+  }
+
   inline bool should_ignore_missing_fields() const
   {
     return (flags_ & IGNORE_MISSING_FIELDS) == IGNORE_MISSING_FIELDS;
@@ -408,7 +611,73 @@ private:
   }
 };
 
+/**
+ * @brief Reads fields from a mapper, used by RESTFUL_MAPPER_FIELDS
+ */
+class MapperInput
+{
+public:
+  explicit MapperInput(const Mapper &mapper) : mapper_(mapper) {}
+
+  template <class T> MapperInput &operator()(const char *key, T &attr)
+  {
+    mapper_.get(key, attr);
+    return *this;
+  }
+
+private:
+  const Mapper &mapper_;
+};
+
+/**
+ * @brief Writes fields to a mapper, used by RESTFUL_MAPPER_FIELDS
+ */
+class MapperOutput
+{
+public:
+  explicit MapperOutput(Mapper &mapper) : mapper_(mapper) {}
+
+  template <class T> MapperOutput &operator()(const char *key, const T &attr)
+  {
+    mapper_.set(key, attr);
+    return *this;
+  }
+
+private:
+  Mapper &mapper_;
+};
+
+template <class T> T &mutable_self(const T *self)
+{
+  return *const_cast<T *>(self);
 }
 
+}
+
+/**
+ * Declares the fields of a model once, instead of repeating them in map_set
+ * and map_get. Defines both of them, followed by the field list:
+ *
+ * @code
+ * RESTFUL_MAPPER_FIELDS
+ * {
+ *   map("id", id)
+ *      ("task", task);
+ * }
+ * @endcode
+ */
+#define RESTFUL_MAPPER_FIELDS \
+  virtual void map_set(restful_mapper::Mapper &mapper) const \
+  { \
+    restful_mapper::MapperOutput output(mapper); \
+    restful_mapper::mutable_self(this).map_fields(output); \
+  } \
+  virtual void map_get(const restful_mapper::Mapper &mapper) \
+  { \
+    restful_mapper::MapperInput input(mapper); \
+    map_fields(input); \
+  } \
+  template <class Map> void map_fields(Map &map)
+
 #endif // RESTFUL_MAPPER_MAPPER_H
 
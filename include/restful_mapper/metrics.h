@@ -0,0 +1,230 @@
+#ifndef RESTFUL_MAPPER_METRICS_H
+#define RESTFUL_MAPPER_METRICS_H
+
+#include <cstddef>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace restful_mapper
+{
+
+/**
+ * @brief Seconds from an arbitrary, fixed point in time, which is not affected
+ *        by changes to the system clock
+ */
+double monotonic_seconds();
+
+/**
+ * @brief Suspends the calling thread
+ */
+void sleep_seconds(const double &seconds);
+
+/**
+ * @brief Everything known about a single request, as reported by libcurl
+ *
+ * Times are in seconds and, as in libcurl, measured from the start of the
+ * request, so first_byte_time includes the time spent connecting.
+ */
+struct RequestMetrics
+{
+  RequestMetrics()
+    : status(0), name_lookup_time(0.0), connect_time(0.0), tls_time(0.0),
+      first_byte_time(0.0), total_time(0.0), bytes_sent(0.0), bytes_received(0.0),
+      retries(0), hedged(false), from_cache(false) {}
+
+  std::string method;
+  std::string endpoint;
+
+  // HTTP status, or 0 if no response was received
+  long status;
+
+  // Transfer error reported by libcurl, if any
+  std::string error;
+
+  double name_lookup_time;
+  double connect_time;
+  double tls_time;
+  double first_byte_time;
+  double total_time;
+
+  double bytes_sent;
+  double bytes_received;
+
+  // Failed attempts made before this one, which were reported separately
+  unsigned int retries;
+
+  // True if a second request was sent as the first was slow, the metrics are
+  // those of the request which completed first
+  bool hedged;
+
+  // True if the server answered 304 and the cached response was used
+  bool from_cache;
+};
+
+/**
+ * @brief Receives the metrics of every request made by Api
+ *
+ * Register an observer with Api::set_observer. It is called on the thread that
+ * made the request.
+ */
+class RequestObserver
+{
+public:
+  virtual ~RequestObserver() {}
+
+  /**
+   * @brief Called when a request has finished, before any error is thrown
+   */
+  virtual void request_finished(const RequestMetrics &metrics) {}
+
+  /**
+   * @brief Called when a model has decoded the response of a request
+   *
+   * @param request the request which returned the response
+   * @param model the class name of the decoded model
+   * @param seconds the time spent parsing and mapping the response
+   */
+  virtual void response_decoded(const RequestMetrics &request, const std::string &model, const double &seconds) {}
+};
+
+/**
+ * @brief Distribution of durations, in buckets of powers of two microseconds
+ */
+class Histogram
+{
+public:
+  static const std::size_t BUCKETS = 32;
+
+  Histogram();
+
+  void add(const double &seconds);
+
+  const std::size_t &count() const
+  {
+    return count_;
+  }
+
+  double mean() const
+  {
+    return count_ ? sum_ / count_ : 0.0;
+  }
+
+  const double &max() const
+  {
+    return max_;
+  }
+
+  /**
+   * @brief Estimates a percentile as the upper bound of the bucket it falls in
+   *
+   * @param percent the percentile, 0-100
+   */
+  double percentile(const double &percent) const;
+
+  /**
+   * @brief Number of durations of at least 2^(bucket - 1) microseconds, and
+   *        less than 2^bucket microseconds
+   */
+  const std::size_t &bucket(const std::size_t &index) const
+  {
+    return buckets_[index];
+  }
+
+private:
+  std::size_t buckets_[BUCKETS];
+  std::size_t count_;
+  double sum_;
+  double max_;
+};
+
+/**
+ * @brief The latest durations, up to a fixed number, of which percentiles are
+ *        exact
+ */
+class LatencyWindow
+{
+public:
+  explicit LatencyWindow(const std::size_t &size = 100);
+
+  /**
+   * @brief Adds a duration, replacing the oldest one once the window is full
+   */
+  void add(const double &seconds);
+
+  std::size_t count() const
+  {
+    return samples_.size();
+  }
+
+  /**
+   * @brief The smallest duration in the window which is at least as long as
+   *        the percentage of the durations
+   *
+   * @param percent the percentile, 0-100
+   */
+  double percentile(const double &percent) const;
+
+private:
+  std::vector<double> samples_;
+  std::size_t size_;
+  std::size_t next_;
+};
+
+struct EndpointStatistics
+{
+  EndpointStatistics()
+    : requests(0), errors(0), retries(0), hedges(0), bytes_sent(0.0), bytes_received(0.0) {}
+
+  std::size_t requests;
+  std::size_t errors;
+  std::size_t retries;
+  std::size_t hedges;
+  double bytes_sent;
+  double bytes_received;
+  std::map<long, std::size_t> status_codes;
+
+  Histogram connect_time;
+  Histogram first_byte_time;
+  Histogram total_time;
+  Histogram decode_time;
+};
+
+/**
+ * @brief Observer aggregating request metrics per endpoint
+ *
+ * Endpoints are grouped by method and path, with numeric path segments
+ * replaced by ":id" and the query string removed, e.g. "GET /todo/:id".
+ */
+class RequestStatistics : public RequestObserver
+{
+public:
+  typedef std::map<std::string, EndpointStatistics> EndpointMap;
+
+  virtual void request_finished(const RequestMetrics &metrics);
+  virtual void response_decoded(const RequestMetrics &request, const std::string &model, const double &seconds);
+
+  const EndpointMap &endpoints() const
+  {
+    return endpoints_;
+  }
+
+  void clear()
+  {
+    endpoints_.clear();
+  }
+
+  /**
+   * @brief Summarizes the statistics as a JSON object by endpoint
+   */
+  std::string to_json() const;
+
+  static std::string endpoint_key(const std::string &method, const std::string &endpoint);
+
+private:
+  EndpointMap endpoints_;
+};
+
+}
+
+#endif // RESTFUL_MAPPER_METRICS_H
@@ -3,7 +3,9 @@
 
 #include <restful_mapper/api.h>
 #include <restful_mapper/mapper.h>
+#include <restful_mapper/columnar_collection.h>
 #include <restful_mapper/query.h>
+#include <restful_mapper/session.h>
 
 namespace restful_mapper
 {
@@ -13,6 +15,7 @@ class Model
 {
 public:
   typedef ModelCollection<T> Collection;
+  typedef ColumnarCollection<T> Columns;
 
   Model() : exists_(false) {}
 
@@ -23,6 +26,25 @@ public:
     return class_name;
   }
 
+  /**
+   * @brief Client for the requests of the model class, or NULL to use the
+   * client of the caller
+   *
+   * The client is not owned, and must outlive its binding. It is shared by
+   * every thread using the model class, which then use its connection, cache
+   * and buffer pool without synchronisation; only bind a client which is used
+   * by one thread at a time.
+   */
+  static Api *api()
+  {
+    return bound_api();
+  }
+
+  static void set_api(Api *api)
+  {
+    bound_api() = api;
+  }
+
   virtual void map_set(Mapper &mapper) const
   {
     throw std::logic_error(std::string("map_set not implemented for ") + class_name());
@@ -43,10 +65,26 @@ public:
     throw std::logic_error(std::string("primary not implemented for ") + class_name());
   }
 
+  /**
+   * @brief JSON key of the primary field, as mapped in map_set
+   *
+   * @return the key, or an empty string if no primary field is mapped
+   */
+  static const std::string &primary_key()
+  {
+    static std::string primary_key = discover_primary_key();
+
+    return primary_key;
+  }
+
   void from_json(std::string values, const int &flags = 0)
   {
+    RESTFUL_MAPPER_PROFILE_SCOPE(class_name(), PROFILE_DECODE);
     Mapper mapper(values, flags);
     map_get(mapper);
+
+    defer_relations(mapper.deferred());
+    version_.clear();
   }
 
   void from_json(std::string values, const int &flags, const bool &exists)
@@ -55,8 +93,52 @@ public:
     exists_ = exists;
   }
 
+  void from_json(std::string values, const int &flags, const Projection &fields)
+  {
+    RESTFUL_MAPPER_PROFILE_SCOPE(class_name(), PROFILE_DECODE);
+    Mapper mapper(values, flags);
+    mapper.set_projection(&fields);
+    map_get(mapper);
+
+    defer_relations(mapper.deferred());
+    version_.clear();
+  }
+
+  /**
+   * @brief Decode a value of a parsed document, such as a nested object
+   *
+   * While a session is active, an object which is in the session already is
+   * copied from it instead of being decoded. Otherwise it is decoded and
+   * added to the session as a partial object, as nested objects may lack
+   * their own relationships.
+   */
+  void from_json(const Json::Node &values, const int &flags, const bool &exists)
+  {
+    Session *session = Session::active();
+    long long id = 0;
+
+    if (!session || !session_id(values, id))
+    {
+      decode(values, flags, exists);
+      return;
+    }
+
+    const T *cached = session->template find<T>(id);
+
+    if (cached)
+    {
+      static_cast<T &>(*this) = *cached;
+    }
+    else
+    {
+      decode(values, flags, exists);
+      session->store(id, static_cast<const T &>(*this), false);
+    }
+  }
+
   std::string to_json(const int &flags = 0, const std::string &parent_model = "") const
   {
+    RESTFUL_MAPPER_PROFILE_SCOPE(class_name(), PROFILE_ENCODE);
     Mapper mapper(flags);
     mapper.set_current_model(class_name());
     mapper.set_parent_model(parent_model);
@@ -66,6 +148,18 @@ public:
     return mapper.dump();
   }
 
+  void to_json(Json::Emitter &emitter, const int &flags = 0, const std::string &parent_model = "") const
+  {
+    RESTFUL_MAPPER_PROFILE_SCOPE(class_name(), PROFILE_ENCODE);
+    Mapper mapper(emitter, flags);
+    mapper.set_current_model(class_name());
+    mapper.set_parent_model(parent_model);
+
+    map_set(mapper);
+
+    mapper.finish();
+  }
+
   std::string read_field(const std::string &field) const
   {
     Mapper mapper(OUTPUT_SINGLE_FIELD | KEEP_FIELDS_DIRTY | IGNORE_DIRTY_FLAG);
@@ -84,7 +178,21 @@ public:
   {
     if (exists())
     {
-      from_json(Api::get(url()));
+      ApiScope scope(api());
+      std::string response = Api::get(url());
+      std::string version = Api::response_version();
+
+      // The server confirmed the response the object was decoded from, so
+      // there is nothing to decode unless local changes are to be discarded
+      if (Api::response_unchanged() && !version_.empty() && version == version_ && !is_dirty())
+      {
+        Api::recycle(response);
+        return;
+      }
+
+      DecodeTimer timer(class_name(), &response);
+      from_json(response);
+      version_ = version;
     }
   }
 
@@ -92,8 +200,16 @@ public:
   {
     if (exists())
     {
+      ApiScope scope(api());
       Api::del(url());
 
+      Session *session = Session::active();
+
+      if (session)
+      {
+        session->template erase<T>(primary().get());
+      }
+
       // Reload all attributes
       emplace_clone();
     }
@@ -101,16 +217,21 @@ public:
 
   void save()
   {
-    if (exists())
-    {
-      from_json(Api::put(url(), to_json()), IGNORE_MISSING_FIELDS);
-    }
-    else
-    {
-      from_json(Api::post(url(), to_json()), IGNORE_MISSING_FIELDS);
-    }
+    ApiScope scope(api());
+    std::string response = exists() ? Api::put(url(), to_json()) : Api::post(url(), to_json());
+    DecodeTimer timer(class_name(), &response);
+
+    from_json(response, IGNORE_MISSING_FIELDS);
 
     exists_ = true;
+
+    // Later finds in the session return the saved object
+    Session *session = Session::active();
+
+    if (session && !primary().is_null())
+    {
+      session->store(primary().get(), static_cast<const T &>(*this));
+    }
   }
 
   virtual T clone() const
@@ -135,10 +256,13 @@ public:
   {
     if (exists())
     {
+      ApiScope scope(api());
+      std::string response = Api::get(url(relationship));
+      DecodeTimer timer(class_name(), &response);
       Json::Emitter emitter;
 
       emitter.emit_map_open();
-      emitter.emit_json(relationship, Api::get(url(relationship)));
+      emitter.emit_json(relationship, response);
       emitter.emit_map_close();
 
       from_json(emitter.dump(), IGNORE_MISSING_FIELDS);
@@ -149,7 +273,11 @@ public:
   {
     if (exists())
     {
-      Json::Parser parser(Api::get(url(relationship)));
+      ApiScope scope(api());
+      Json::Parser parser;
+      std::string response = Api::get(url(relationship), parser);
+      DecodeTimer timer(class_name(), &response);
+      if (!parser.is_loaded()) parser.load(response);
 
       Json::Emitter emitter;
 
@@ -162,66 +290,269 @@ public:
     }
   }
 
+  /**
+   * @brief Load a lazy one-to-many relationship for a whole collection using a
+   * single query per batch of objects, instead of one request per object
+   *
+   * @param objects the parent objects
+   * @param relationship the relationship to load, e.g. &User::todos
+   * @param foreign_key the field in the related model referring to the parent
+   */
+  template <class R>
+  static void load_all(Collection &objects, HasMany<R> T::*relationship, const std::string &foreign_key)
+  {
+    std::vector<long long> ids;
+    typename Collection::iterator i, i_end = objects.end();
+
+    for (i = objects.begin(); i != i_end; ++i)
+    {
+      if (!((*i).*relationship).is_loaded())
+      {
+        ids.push_back(i->primary().get());
+      }
+    }
+
+    if (ids.empty()) return;
+
+    typename R::Collection related = find_all_in<R>(foreign_key, ids);
+    typename R::Collection::const_iterator j, j_end = related.end();
+
+    // Group by the JSON encoded foreign key
+    std::map<std::string, typename R::Collection> groups;
+
+    for (j = related.begin(); j != j_end; ++j)
+    {
+      groups[j->read_field(foreign_key)].push_back(*j);
+    }
+
+    for (i = objects.begin(); i != i_end; ++i)
+    {
+      HasMany<R> &relation = (*i).*relationship;
+
+      if (!relation.is_loaded())
+      {
+        relation.fill(groups[Json::encode(i->primary().get())]);
+      }
+    }
+  }
+
+  /**
+   * @brief Load a lazy many-to-one relationship for a whole collection using a
+   * single query per batch of objects, instead of one request per object
+   *
+   * @param objects the child objects
+   * @param relationship the relationship to load, e.g. &Todo::user
+   * @param foreign_key the field in this model referring to the related model
+   */
+  template <class R>
+  static void load_all(Collection &objects, BelongsTo<R> T::*relationship, const std::string &foreign_key)
+  {
+    std::vector<long long> ids;
+    typename Collection::iterator i, i_end = objects.end();
+
+    for (i = objects.begin(); i != i_end; ++i)
+    {
+      if (!((*i).*relationship).is_loaded())
+      {
+        Json::Parser key(i->read_field(foreign_key));
+
+        if (key.root().is_int())
+        {
+          ids.push_back(key.root().to_int());
+        }
+      }
+    }
+
+    if (ids.empty()) return;
+
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+
+    typename R::Collection related = find_all_in<R>(R::primary_key(), ids);
+    typename R::Collection::const_iterator j, j_end = related.end();
+
+    std::map<std::string, const R *> index;
+
+    for (j = related.begin(); j != j_end; ++j)
+    {
+      index[Json::encode(j->primary().get())] = &*j;
+    }
+
+    for (i = objects.begin(); i != i_end; ++i)
+    {
+      BelongsTo<R> &relation = (*i).*relationship;
+
+      if (!relation.is_loaded())
+      {
+        relation.fill(index[i->read_field(foreign_key)]);
+      }
+    }
+  }
+
   static T find(const int &id)
   {
+    Session *session = Session::active();
+
+    if (session)
+    {
+      const T *cached = session->template find<T>(id, true);
+
+      if (cached)
+      {
+        return *cached;
+      }
+    }
+
     T instance;
     const_cast<Primary &>(instance.primary()).set(id, true);
     instance.exists_ = true;
 
     instance.reload();
 
+    if (session)
+    {
+      session->store((long long) id, instance);
+    }
+
     return instance;
   }
 
-  static Collection find_all()
+  /**
+   * @brief Find an object, only requesting and decoding the given fields
+   */
+  static T find(const int &id, const Projection &fields)
   {
-    Collection objects;
+    if (fields.empty()) return find(id);
 
-    Json::Parser collector(Api::get(T().url()));
+    T instance;
+    const_cast<Primary &>(instance.primary()).set(id, true);
+    instance.exists_ = true;
 
-    std::vector<std::string> partials = collector.find("objects").dump_array();
-    std::vector<std::string>::const_iterator i, i_end = partials.end();
+    ApiScope scope(api());
+    std::string response = Api::get(projected_url(instance.url(), fields));
+    DecodeTimer timer(class_name(), &response);
 
-    for (i = partials.begin(); i != i_end; ++i)
-    {
-      T instance;
-      instance.from_json(*i, 0, true);
+    instance.from_json(response, 0, fields);
 
-      objects.push_back(instance);
-    }
+    return instance;
+  }
 
-    return objects;
+  static Collection find_all()
+  {
+    ApiScope scope(api());
+    Json::Parser collector;
+    std::string response = Api::get(T().url(), collector);
+    DecodeTimer timer(class_name(), &response);
+    if (!collector.is_loaded()) collector.load(response);
+
+    return collect(collector.find("objects"));
+  }
+
+  static Collection find_all(const Projection &fields)
+  {
+    ApiScope scope(api());
+    Json::Parser collector;
+    std::string response = Api::get(projected_url(T().url(), fields), collector);
+    DecodeTimer timer(class_name(), &response);
+    if (!collector.is_loaded()) collector.load(response);
+
+    return collect(collector.find("objects"), fields);
   }
 
   static T find(Query &query)
   {
     T instance;
 
+    ApiScope scope(api());
     std::string url = Api::query_param(instance.url(), "q", query.single().dump());
-    instance.from_json(Api::get(url), 0, true);
+    std::string response = Api::get(url);
+    DecodeTimer timer(class_name(), &response);
+
+    instance.from_json(response, 0, true);
 
     return instance;
   }
 
   static Collection find_all(Query &query)
   {
-    Collection objects;
-
+    ApiScope scope(api());
     std::string url = Api::query_param(T().url(), "q", query.dump());
-    Json::Parser collector(Api::get(url));
+    Json::Parser collector;
+    std::string response = Api::get(url, collector);
+    DecodeTimer timer(class_name(), &response);
+    if (!collector.is_loaded()) collector.load(response);
 
-    std::vector<std::string> partials = collector.find("objects").dump_array();
-    std::vector<std::string>::const_iterator i, i_end = partials.end();
+    return collect(collector.find("objects"));
+  }
 
-    for (i = partials.begin(); i != i_end; ++i)
-    {
-      T instance;
-      instance.from_json(*i, 0, true);
+  /**
+   * @brief Find an object with a prepared query, which must have been
+   * prepared from a single() query
+   */
+  static T find(const PreparedQuery &query)
+  {
+    T instance;
 
-      objects.push_back(instance);
-    }
+    ApiScope scope(api());
+    std::string url = Api::escaped_query_param(instance.url(), "q", query.escaped());
+    std::string response = Api::get(url);
+    DecodeTimer timer(class_name(), &response);
 
-    return objects;
+    instance.from_json(response, 0, true);
+
+    return instance;
+  }
+
+  static Collection find_all(const PreparedQuery &query)
+  {
+    ApiScope scope(api());
+    std::string url = Api::escaped_query_param(T().url(), "q", query.escaped());
+    Json::Parser collector;
+    std::string response = Api::get(url, collector);
+    DecodeTimer timer(class_name(), &response);
+    if (!collector.is_loaded()) collector.load(response);
+
+    return collect(collector.find("objects"));
+  }
+
+  /**
+   * @brief Find all objects, storing them by column instead of by object
+   *
+   * Requires the model to declare its fields with RESTFUL_MAPPER_FIELDS.
+   */
+  static Columns find_all_columns()
+  {
+    ApiScope scope(api());
+    Json::Parser collector;
+    std::string response = Api::get(T().url(), collector);
+    DecodeTimer timer(class_name(), &response);
+    if (!collector.is_loaded()) collector.load(response);
+
+    return collect_columns(collector.find("objects"));
+  }
+
+  static Columns find_all_columns(Query &query)
+  {
+    ApiScope scope(api());
+    std::string url = Api::query_param(T().url(), "q", query.dump());
+    Json::Parser collector;
+    std::string response = Api::get(url, collector);
+    DecodeTimer timer(class_name(), &response);
+    if (!collector.is_loaded()) collector.load(response);
+
+    return collect_columns(collector.find("objects"));
+  }
+
+  static Collection find_all(Query &query, const Projection &fields)
+  {
+    ApiScope scope(api());
+    std::string url = Api::query_param(T().url(), "q", query.dump());
+    Json::Parser collector;
+    std::string response = Api::get(projected_url(url, fields), collector);
+    DecodeTimer timer(class_name(), &response);
+    if (!collector.is_loaded()) collector.load(response);
+
+    return collect(collector.find("objects"), fields);
   }
 
   std::string url(std::string nested_endpoint = "") const
@@ -266,6 +597,180 @@ protected:
     const_cast<Primary &>(primary()) = Primary();
     const_cast<Primary &>(primary()).clear();
   }
+
+  void decode(const Json::Node &values, const int &flags, const bool &exists)
+  {
+    RESTFUL_MAPPER_PROFILE_SCOPE(class_name(), PROFILE_DECODE);
+    Mapper mapper(values, flags);
+    map_get(mapper);
+
+    defer_relations(mapper.deferred());
+    version_.clear();
+    exists_ = exists;
+  }
+
+  // The primary key of a decoded object, if it has an integer one
+  static bool session_id(const Json::Node &values, long long &id)
+  {
+    if (primary_key().empty() || !values.is_map()) return false;
+
+    void *value = values.find_tree(primary_key().c_str());
+    if (!value) return false;
+
+    Json::Node id_node(primary_key(), value);
+    if (!id_node.is_int()) return false;
+
+    id = id_node.to_int();
+
+    return true;
+  }
+
+  void defer_relations(const Mapper::DeferredRelations &deferred) const
+  {
+    if (deferred.empty() || primary().is_null()) return;
+
+    std::string base = endpoint() + "/" + std::string(primary()) + "/";
+    Mapper::DeferredRelations::const_iterator i, i_end = deferred.end();
+
+    for (i = deferred.begin(); i != i_end; ++i)
+    {
+      i->second->defer(base + i->first);
+    }
+  }
+
+  static Collection collect(const Json::Node &partials)
+  {
+    Collection objects;
+
+    std::vector<Json::Node> nodes = partials.to_array();
+    std::vector<Json::Node>::const_iterator i, i_end = nodes.end();
+
+    objects.reserve(nodes.size());
+
+    Session *session = Session::active();
+
+    for (i = nodes.begin(); i != i_end; ++i)
+    {
+      T instance;
+      instance.decode(*i, 0, true);
+
+      // A response for the collection is as complete as one for the object,
+      // and newer than what the session holds
+      if (session && !instance.primary().is_null())
+      {
+        session->store(instance.primary().get(), instance);
+      }
+
+      objects.push_back(instance);
+    }
+
+    return objects;
+  }
+
+  static Collection collect(const Json::Node &partials, const Projection &fields)
+  {
+    if (fields.empty()) return collect(partials);
+
+    Collection objects;
+
+    std::vector<Json::Node> nodes = partials.to_array();
+    std::vector<Json::Node>::const_iterator i, i_end = nodes.end();
+
+    objects.reserve(nodes.size());
+
+    for (i = nodes.begin(); i != i_end; ++i)
+    {
+      T instance;
+      instance.from_json(i->dump(), 0, fields);
+      instance.exists_ = true;
+
+      objects.push_back(instance);
+    }
+
+    return objects;
+  }
+
+  static Columns collect_columns(const Json::Node &partials)
+  {
+    RESTFUL_MAPPER_PROFILE_SCOPE(class_name(), PROFILE_DECODE);
+    Columns columns;
+    columns.decode(partials);
+
+    return columns;
+  }
+
+  /**
+   * @brief Ask the server to only include the projected fields, in the style
+   * of Flask-Restless include_columns. The primary key is always included.
+   */
+  static std::string projected_url(const std::string &url, const Projection &fields)
+  {
+    if (fields.empty()) return url;
+
+    Projection included(fields);
+
+    if (!primary_key().empty())
+    {
+      included(primary_key());
+    }
+
+    return Api::query_param(url, "include", included.dump());
+  }
+
+private:
+  // Ids per request when loading relationships in a batch, to bound the URL
+  enum { LOAD_ALL_BATCH_SIZE = 200 };
+
+  // Version of the cached response the object was last reloaded from
+  std::string version_;
+
+  /**
+   * @brief Find the objects of R whose field is one of the ids, using one
+   * request per batch of ids
+   */
+  template <class R>
+  static typename R::Collection find_all_in(const std::string &field, const std::vector<long long> &ids)
+  {
+    typename R::Collection related;
+
+    for (std::size_t first = 0; first < ids.size(); first += LOAD_ALL_BATCH_SIZE)
+    {
+      std::size_t last = std::min(ids.size(), first + static_cast<std::size_t>(LOAD_ALL_BATCH_SIZE));
+      std::vector<long long> batch(ids.begin() + first, ids.begin() + last);
+
+      Query query;
+      query(field).in(batch);
+
+      typename R::Collection found = R::find_all(query);
+      related.insert(related.end(), found.begin(), found.end());
+    }
+
+    return related;
+  }
+
+  static Api *&bound_api()
+  {
+    static Api *api = NULL;
+
+    return api;
+  }
+
+  static std::string discover_primary_key()
+  {
+    T instance;
+    Mapper mapper(OUTPUT_SHALLOW | KEEP_FIELDS_DIRTY);
+
+    try
+    {
+      instance.map_set(mapper);
+    }
+    catch (std::logic_error &e)
+    {
+      // Read-only model without map_set
+    }
+
+    return mapper.primary_key() ? mapper.primary_key() : "";
+  }
 };
 
 }
@@ -0,0 +1,124 @@
+#ifndef RESTFUL_MAPPER_PROFILE_H
+#define RESTFUL_MAPPER_PROFILE_H
+
+#include <cstddef>
+#include <map>
+#include <string>
+
+namespace restful_mapper
+{
+
+enum ProfilePhase
+{
+  PROFILE_PARSE,  // Building the value tree from JSON text
+  PROFILE_DECODE, // Mapping the value tree onto a model
+  PROFILE_ENCODE, // Emitting a model as JSON text
+  PROFILE_PHASES
+};
+
+enum ProfileCounter
+{
+  PROFILE_BYTES_PARSED,      // JSON text passed to the parser
+  PROFILE_BYTES_EMITTED,     // JSON text generated by the emitter
+  PROFILE_NODES_VISITED,     // Json::Node objects created to read values
+  PROFILE_FIELDS_DECODED,    // Fields read from JSON
+  PROFILE_FIELDS_ENCODED,    // Fields written to JSON
+  PROFILE_ICONV_CONVERSIONS, // Strings converted between character sets
+  PROFILE_ALLOCATIONS,       // Heap blocks for value trees, emitters and conversions
+  PROFILE_COUNTERS
+};
+
+struct ModelProfile
+{
+  ModelProfile();
+
+  std::size_t counters[PROFILE_COUNTERS];
+
+  // Times exclude nested phases, so a model's decode time does not include
+  // parsing or the decoding of its related models
+  std::size_t calls[PROFILE_PHASES];
+  double seconds[PROFILE_PHASES];
+};
+
+/**
+ * @brief Counters and timings of the mapping work, per model class
+ *
+ * Only collected when the library and the application are built with
+ * RESTFUL_MAPPER_PROFILE defined; otherwise the instrumentation compiles to
+ * nothing and no models are ever reported.
+ *
+ * Work is attributed to the innermost model being decoded or encoded, work
+ * outside of any model to the empty model name. Profiling is not thread-safe.
+ */
+class Profile
+{
+public:
+  typedef std::map<std::string, ModelProfile> ModelMap;
+
+  static bool enabled();
+
+  static void count(const ProfileCounter &counter, const std::size_t &amount);
+
+  static const ModelMap &models();
+
+  /**
+   * @brief Zeroes all counters and timings
+   */
+  static void reset();
+
+  /**
+   * @brief Summarizes the profile as a JSON object by model class
+   */
+  static std::string to_json();
+
+  static const char *counter_name(const ProfileCounter &counter);
+  static const char *phase_name(const ProfilePhase &phase);
+};
+
+/**
+ * @brief Attributes the work done during its lifetime to a model and phase
+ */
+class ProfileScope
+{
+public:
+  ProfileScope(const std::string &model, const ProfilePhase &phase);
+
+  /**
+   * @brief Continues the model of the enclosing scope in another phase
+   */
+  explicit ProfileScope(const ProfilePhase &phase);
+
+  ~ProfileScope();
+
+private:
+  ModelProfile *profile_;
+  ProfilePhase phase_;
+  ProfileScope *parent_;
+  double start_;
+  double nested_;
+
+  void enter();
+
+  friend class Profile;
+
+  // Disallow copy
+  ProfileScope(ProfileScope const &);  // Don't Implement
+  void operator=(ProfileScope const &); // Don't implement
+};
+
+}
+
+#ifdef RESTFUL_MAPPER_PROFILE
+#define RESTFUL_MAPPER_PROFILE_COUNT(counter, amount) \
+  ::restful_mapper::Profile::count(::restful_mapper::counter, (amount))
+#define RESTFUL_MAPPER_PROFILE_SCOPE(model, phase) \
+  ::restful_mapper::ProfileScope profile_scope_((model), ::restful_mapper::phase)
+#define RESTFUL_MAPPER_PROFILE_PHASE(phase) \
+  ::restful_mapper::ProfileScope profile_scope_(::restful_mapper::phase)
+#else
+#define RESTFUL_MAPPER_PROFILE_COUNT(counter, amount) ((void)0)
+#define RESTFUL_MAPPER_PROFILE_SCOPE(model, phase) ((void)0)
+#define RESTFUL_MAPPER_PROFILE_PHASE(phase) ((void)0)
+#endif
+
+#endif // RESTFUL_MAPPER_PROFILE_H
@@ -0,0 +1,62 @@
+#ifndef RESTFUL_MAPPER_PROJECTION_H
+#define RESTFUL_MAPPER_PROJECTION_H
+
+#include <string>
+#include <set>
+
+namespace restful_mapper
+{
+
+/**
+ * @brief Set of fields to request from the server and decode
+ *
+ * Fields that are left out are marked as not loaded. An empty projection
+ * includes all fields.
+ */
+class Projection
+{
+public:
+  Projection() {}
+
+  Projection &operator()(const std::string &name)
+  {
+    fields_.insert(name);
+    return *this;
+  }
+
+  bool empty() const
+  {
+    return fields_.empty();
+  }
+
+  bool contains(const std::string &name) const
+  {
+    return fields_.find(name) != fields_.end();
+  }
+
+  std::string dump() const
+  {
+    std::string output;
+    std::set<std::string>::const_iterator i, i_end = fields_.end();
+
+    for (i = fields_.begin(); i != i_end; ++i)
+    {
+      if (!output.empty()) output += ",";
+      output += *i;
+    }
+
+    return output;
+  }
+
+private:
+  std::set<std::string> fields_;
+};
+
+inline Projection fields(const std::string &name)
+{
+  return Projection()(name);
+}
+
+}
+
+#endif // RESTFUL_MAPPER_PROJECTION_H
@@ -1,6 +1,9 @@
 #ifndef RESTFUL_MAPPER_QUERY_H
 #define RESTFUL_MAPPER_QUERY_H
 
+#include <sstream>
+#include <stdexcept>
+#include <restful_mapper/api.h>
 #include <restful_mapper/json.h>
 
 // Some macros. For the sake of brevity...
@@ -14,14 +17,16 @@
   Query &op(const bool        &value) { return filter(cur_field_, #op, Json::encode(value)); } \
   Query &op(const std::string &value) { return filter(cur_field_, #op, Json::encode(value)); } \
   Query &op(const char        *value) { return filter(cur_field_, #op, Json::encode(value)); } \
-  Query &op(const Query       &value) { return filter(cur_field_, #op, value);         }
+  Query &op(const Query       &value) { return filter(cur_field_, #op, value);         } \
+  Query &op(const QueryParam  &value) { return filter(cur_field_, #op, value);         }
 
 #define _OP_PAR_LIST(op) \
   Query &op(const std::vector<int>         &value) { return filter(cur_field_, #op, Json::encode(value)); } \
   Query &op(const std::vector<long long>   &value) { return filter(cur_field_, #op, Json::encode(value)); } \
   Query &op(const std::vector<double>      &value) { return filter(cur_field_, #op, Json::encode(value)); } \
   Query &op(const std::vector<bool>        &value) { return filter(cur_field_, #op, Json::encode(value)); } \
-  Query &op(const std::vector<std::string> &value) { return filter(cur_field_, #op, Json::encode(value)); }
+  Query &op(const std::vector<std::string> &value) { return filter(cur_field_, #op, Json::encode(value)); } \
+  Query &op(const QueryParam               &value) { return filter(cur_field_, #op, value);         }
 
 namespace restful_mapper
 {
@@ -33,6 +38,8 @@ struct QueryFilter
   std::string value;
   bool has_value;
   bool is_reference;
+  bool is_param;
+  size_t param;
 };
 
 struct QueryOrderBy
@@ -41,6 +48,33 @@ struct QueryOrderBy
   std::string direction;
 };
 
+/**
+ * @brief Placeholder for a value that is bound later, see PreparedQuery
+ */
+class QueryParam
+{
+public:
+  explicit QueryParam(const size_t &index) : index_(index) {}
+
+  const size_t &index() const
+  {
+    return index_;
+  }
+
+private:
+  size_t index_;
+};
+
+/**
+ * @brief Where a parameter appears in the generated query: the offset of the
+ * null emitted in its place, and the index of the parameter
+ */
+struct QueryParamSlot
+{
+  size_t offset;
+  size_t index;
+};
+
 class Query
 {
 public:
@@ -67,6 +101,16 @@ public:
           {
             json_.emit("field", i->value);
           }
+          else if (i->is_param)
+          {
+            json_.emit_null("val");
+
+            QueryParamSlot slot;
+            slot.offset = json_.dump().size() - 4;
+            slot.index  = i->param;
+
+            slots_.push_back(slot);
+          }
           else if (i->has_value)
           {
             json_.emit_json("val", i->value);
@@ -120,6 +164,16 @@ public:
     return output_;
   }
 
+  /**
+   * @brief Parameters in the generated query, by position, see PreparedQuery
+   */
+  const std::vector<QueryParamSlot> &param_slots()
+  {
+    dump();
+
+    return slots_;
+  }
+
   Query &operator()(const std::string &name)
   {
     cur_field_ = name;
@@ -141,6 +195,8 @@ public:
     filter.value        = "";
     filter.has_value    = false;
     filter.is_reference = false;
+    filter.is_param     = false;
+    filter.param        = 0;
 
     filters_.push_back(filter);
 
@@ -156,6 +212,8 @@ public:
     filter.value        = value;
     filter.has_value    = true;
     filter.is_reference = false;
+    filter.is_param     = false;
+    filter.param        = 0;
 
     filters_.push_back(filter);
 
@@ -171,6 +229,25 @@ public:
     filter.value        = value.cur_reference_;
     filter.has_value    = true;
     filter.is_reference = true;
+    filter.is_param     = false;
+    filter.param        = 0;
+
+    filters_.push_back(filter);
+
+    return *this;
+  }
+
+  Query &filter(std::string name, std::string operation, const QueryParam &value)
+  {
+    QueryFilter filter;
+
+    filter.field        = name;
+    filter.operation    = operation;
+    filter.value        = "";
+    filter.has_value    = true;
+    filter.is_reference = false;
+    filter.is_param     = true;
+    filter.param        = value.index();
 
     filters_.push_back(filter);
 
@@ -223,6 +300,7 @@ public:
   {
     json_.reset();
     output_.clear();
+    slots_.clear();
     cur_field_.clear();
     cur_reference_.clear();
     filters_.clear();
@@ -253,6 +331,7 @@ public:
 private:
   Json::Emitter json_;
   std::string output_;
+  std::vector<QueryParamSlot> slots_;
 
   std::string cur_field_;
   std::string cur_reference_;
@@ -264,6 +343,163 @@ private:
   std::vector<bool> single_;
 };
 
+/**
+ * @brief A query which is generated and URL encoded once, and executed many
+ * times with different values bound to its parameters
+ *
+ * @code
+ * Query q;
+ * q("user_id").eq(QueryParam(0));
+ *
+ * PreparedQuery prepared(q);
+ * prepared.bind(0, 5);
+ * @endcode
+ */
+class PreparedQuery
+{
+public:
+  explicit PreparedQuery(Query &query)
+  {
+    const std::string &json = query.dump();
+    const std::vector<QueryParamSlot> &slots = query.param_slots();
+
+    // Split the query into literal segments around the nulls emitted in place
+    // of the parameters
+    size_t begin = 0;
+    std::vector<QueryParamSlot>::const_iterator i, i_end = slots.end();
+
+    for (i = slots.begin(); i != i_end; ++i)
+    {
+      segments_.push_back(Api::escape(json.substr(begin, i->offset - begin)));
+      slots_.push_back(i->index);
+      begin = i->offset + 4;
+
+      if (i->index >= params_.size())
+      {
+        params_.resize(i->index + 1);
+      }
+    }
+
+    segments_.push_back(Api::escape(json.substr(begin)));
+  }
+
+  size_t size() const
+  {
+    return params_.size();
+  }
+
+  PreparedQuery &bind(const size_t &index, const int &value)
+  {
+    // Numbers need no URL encoding
+    return bind_escaped(index, Json::encode(value));
+  }
+
+  PreparedQuery &bind(const size_t &index, const long long &value)
+  {
+    return bind_escaped(index, Json::encode(value));
+  }
+
+  PreparedQuery &bind(const size_t &index, const double &value)
+  {
+    return bind_escaped(index, Api::escape(Json::encode(value)));
+  }
+
+  PreparedQuery &bind(const size_t &index, const bool &value)
+  {
+    return bind_escaped(index, Json::encode(value));
+  }
+
+  PreparedQuery &bind(const size_t &index, const std::string &value)
+  {
+    return bind_escaped(index, Api::escape(Json::encode(value)));
+  }
+
+  PreparedQuery &bind(const size_t &index, const char *value)
+  {
+    return bind_escaped(index, Api::escape(Json::encode(value)));
+  }
+
+  PreparedQuery &bind(const size_t &index, const std::vector<int> &value)
+  {
+    return bind_escaped(index, Api::escape(Json::encode(value)));
+  }
+
+  PreparedQuery &bind(const size_t &index, const std::vector<long long> &value)
+  {
+    return bind_escaped(index, Api::escape(Json::encode(value)));
+  }
+
+  PreparedQuery &bind(const size_t &index, const std::vector<double> &value)
+  {
+    return bind_escaped(index, Api::escape(Json::encode(value)));
+  }
+
+  PreparedQuery &bind(const size_t &index, const std::vector<bool> &value)
+  {
+    return bind_escaped(index, Api::escape(Json::encode(value)));
+  }
+
+  PreparedQuery &bind(const size_t &index, const std::vector<std::string> &value)
+  {
+    return bind_escaped(index, Api::escape(Json::encode(value)));
+  }
+
+  /**
+   * @brief The URL encoded query with the currently bound values
+   */
+  std::string escaped() const
+  {
+    std::string output(segments_.front());
+    std::vector<size_t>::const_iterator i, i_end = slots_.end();
+    size_t segment = 1;
+
+    for (i = slots_.begin(); i != i_end; ++i, ++segment)
+    {
+      const Param &param = params_[*i];
+
+      if (!param.is_bound)
+      {
+        std::ostringstream s;
+        s << "Query parameter " << *i << " is not bound";
+        throw std::runtime_error(s.str());
+      }
+
+      output += param.value;
+      output += segments_[segment];
+    }
+
+    return output;
+  }
+
+private:
+  struct Param
+  {
+    Param() : is_bound(false) {}
+
+    std::string value;
+    bool is_bound;
+  };
+
+  std::vector<std::string> segments_;
+  std::vector<size_t> slots_;
+  std::vector<Param> params_;
+
+  PreparedQuery &bind_escaped(const size_t &index, const std::string &value)
+  {
+    if (index >= params_.size())
+    {
+      std::ostringstream s;
+      s << "Query has no parameter " << index;
+      throw std::out_of_range(s.str());
+    }
+
+    params_[index].value = value;
+    params_[index].is_bound = true;
+
+    return *this;
+  }
+};
+
 }
 
 #endif // RESTFUL_MAPPER_QUERY_H
@@ -1,13 +1,110 @@
 #ifndef RESTFUL_MAPPER_RELATION_H
 #define RESTFUL_MAPPER_RELATION_H
 
+#include <restful_mapper/api.h>
 #include <restful_mapper/model_collection.h>
 
 namespace restful_mapper
 {
 
+template <class T> class Model;
+
+/**
+ * @brief Determines whether T derives from Model, in which case it can emit
+ * itself directly into a parent emitter instead of producing a string that
+ * has to be parsed again.
+ */
+template <class T>
+struct IsModel
+{
+  typedef char Yes;
+  typedef struct { char c[2]; } No;
+
+  static No check(const void *);
+  template <class U> static Yes check(const Model<U> *);
+
+  enum { value = sizeof(check(static_cast<T *>(0))) == sizeof(Yes) };
+};
+
+template <bool> struct ModelTag {};
+
+template <class T>
+void emit_related(Json::Emitter &emitter, const T &item, const int &flags, const std::string &parent_model, ModelTag<true>)
+{
+  item.to_json(emitter, flags, parent_model);
+}
+
+template <class T>
+void emit_related(Json::Emitter &emitter, const T &item, const int &flags, const std::string &parent_model, ModelTag<false>)
+{
+  emitter.emit_json(item.to_json(flags, parent_model));
+}
+
+template <class T>
+void decode_related(T &item, const Json::Node &node, const int &flags, ModelTag<true>)
+{
+  item.from_json(node, flags, true);
+}
+
+template <class T>
+void decode_related(T &item, const Json::Node &node, const int &flags, ModelTag<false>)
+{
+  item.from_json(node.dump(), flags, true);
+}
+
+/**
+ * @brief Deferred loading of a relationship
+ *
+ * A lazy relationship which is not embedded in its parent's JSON is not left
+ * empty, but remembers the URL of the relationship and requests it the first
+ * time it is accessed. Until then, it is left out of its parent's JSON, like a
+ * field which was not projected, and is not null.
+ */
+class LazyRelation
+{
+public:
+  LazyRelation() : pending_api_(NULL), is_lazy_(false) {}
+  virtual ~LazyRelation() {}
+
+  const bool &is_lazy() const
+  {
+    return is_lazy_;
+  }
+
+  void set_lazy(const bool &value = true)
+  {
+    is_lazy_ = value;
+  }
+
+  bool is_loaded() const
+  {
+    return pending_url_.empty();
+  }
+
+  const std::string &pending_url() const
+  {
+    return pending_url_;
+  }
+
+  void defer(const std::string &url)
+  {
+    pending_url_ = url;
+    pending_api_ = ApiScope::active();
+  }
+
+protected:
+  mutable std::string pending_url_;
+
+  // Client bound while deferring, which is to load the relation as well
+  Api *pending_api_;
+
+
+private:
+  bool is_lazy_;
+};
+
 template <class T>
-class HasMany : public ModelCollection<T>
+class HasMany : public ModelCollection<T>, public LazyRelation
 {
 public:
   HasMany() : ModelCollection<T>(), is_dirty_(false) {}
@@ -20,6 +117,7 @@ public:
   void from_json(std::string values, const int &flags = 0)
   {
     ModelCollection<T>::clear();
+    pending_url_.clear();
 
     Json::Parser collector(values);
 
@@ -37,22 +135,49 @@ public:
     clean();
   }
 
+  void from_json(const Json::Node &values, const int &flags = 0)
+  {
+    ModelCollection<T>::clear();
+    pending_url_.clear();
+
+    std::vector<Json::Node> partials = values.to_array();
+    std::vector<Json::Node>::const_iterator i, i_end = partials.end();
+
+    ModelCollection<T>::reserve(partials.size());
+
+    for (i = partials.begin(); i != i_end; ++i)
+    {
+      T instance;
+      decode_related(instance, *i, flags, ModelTag<IsModel<T>::value>());
+
+      ModelCollection<T>::push_back(instance);
+    }
+
+    clean();
+  }
+
   std::string to_json(const int &flags = 0, const std::string &parent_model = "") const
   {
-    std::ostringstream s;
-    s << "[";
+    Json::Emitter emitter;
+    to_json(emitter, flags, parent_model);
+
+    return emitter.dump();
+  }
+
+  void to_json(Json::Emitter &emitter, const int &flags = 0, const std::string &parent_model = "") const
+  {
+    load();
+
+    emitter.emit_array_open();
 
     const_iterator i, i_end = ModelCollection<T>::end();
 
     for (i = ModelCollection<T>::begin(); i != i_end; ++i)
     {
-      s << i->to_json(flags, parent_model);
-      if ((i + 1) != i_end) s << ",";
+      emit_related(emitter, *i, flags, parent_model, ModelTag<IsModel<T>::value>());
     }
 
-    s << "]";
-
-    return s.str();
+    emitter.emit_array_close();
   }
 
   T &build()
@@ -86,11 +211,53 @@ public:
   const HasMany<T> &operator=(const ModelCollection<T> &other)
   {
     this->items_ = other.items();
+    pending_url_.clear();
     touch();
 
     return *this;
   }
 
+  /**
+   * @brief Request the relationship now, if it is lazy and not yet loaded
+   */
+  void load() const
+  {
+    if (is_loaded()) return;
+
+    // Keep the URL until the relationship is decoded, so a failed request is
+    // made again on the next access
+    ApiScope scope(pending_api_);
+    std::string url = pending_url();
+    std::string response = Api::get(url);
+    DecodeTimer timer(T::class_name(), &response);
+    Json::Parser collector(response);
+    HasMany<T> *self = const_cast<HasMany<T> *>(this);
+
+    try
+    {
+      self->from_json(collector.find("objects"), 0);
+    }
+    catch (...)
+    {
+      self->ModelCollection<T>::clear();
+      pending_url_ = url;
+      clean();
+
+      throw;
+    }
+  }
+
+  /**
+   * @brief Replace the items with ones that were loaded elsewhere, e.g. in a
+   * batch, without marking the relationship as dirty
+   */
+  void fill(const ModelCollection<T> &items)
+  {
+    this->items_ = items.items();
+    pending_url_.clear();
+    clean();
+  }
+
   // Inherit typedefs
   typedef typename ModelCollection<T>::value_type value_type;
   typedef typename ModelCollection<T>::allocator_type allocator_type;
@@ -105,30 +272,61 @@ public:
   typedef typename ModelCollection<T>::difference_type difference_type;
   typedef typename ModelCollection<T>::size_type size_type;
 
-  void resize(size_type n, value_type val = value_type()) { touch(); ModelCollection<T>::resize(n, val); }
-  template <class InputIterator> void assign(InputIterator first, InputIterator last) { touch(); ModelCollection<T>::assign(first, last); }
-  void assign(size_type n, const value_type val) { touch(); ModelCollection<T>::assign(n, val); }
-  void push_back(const value_type val) { touch(); ModelCollection<T>::push_back(val); }
-  void pop_back() { touch(); ModelCollection<T>::pop_back(); }
+  // Load lazy relationship before access
+  const std::vector<T> &items() const { load(); return ModelCollection<T>::items(); }
+  ModelCollection<T> clone() const { load(); return ModelCollection<T>::clone(); }
+  template <class K> T &find(const K &id) { load(); return ModelCollection<T>::find(id); }
+  template <class K> const T &find(const K &id) const { load(); return ModelCollection<T>::find(id); }
+  template <class V> ModelCollection<T> find(const std::string &field, const V &value) const { load(); return ModelCollection<T>::find(field, value); }
+  template <class V> T &find_first(const std::string &field, const V &value) { load(); return ModelCollection<T>::find_first(field, value); }
+  template <class V> const T &find_first(const std::string &field, const V &value) const { load(); return ModelCollection<T>::find_first(field, value); }
+  template <class K> bool contains(const K &id) const { load(); return ModelCollection<T>::contains(id); }
+  template <class V> bool contains(const std::string &field, const V &value) const { load(); return ModelCollection<T>::contains(field, value); }
+
+  iterator begin() { load(); return ModelCollection<T>::begin(); }
+  const_iterator begin() const { load(); return ModelCollection<T>::begin(); }
+  iterator end() { load(); return ModelCollection<T>::end(); }
+  const_iterator end() const { load(); return ModelCollection<T>::end(); }
+  reverse_iterator rbegin() { load(); return ModelCollection<T>::rbegin(); }
+  const_reverse_iterator rbegin() const { load(); return ModelCollection<T>::rbegin(); }
+  reverse_iterator rend() { load(); return ModelCollection<T>::rend(); }
+  const_reverse_iterator rend() const { load(); return ModelCollection<T>::rend(); }
+  size_type size() const { load(); return ModelCollection<T>::size(); }
+  size_type capacity() const { load(); return ModelCollection<T>::capacity(); }
+  bool empty() const { load(); return ModelCollection<T>::empty(); }
+  reference operator[](size_type n) { load(); return ModelCollection<T>::operator[](n); }
+  const_reference operator[](size_type n) const { load(); return ModelCollection<T>::operator[](n); }
+  reference at(size_type n) { load(); return ModelCollection<T>::at(n); }
+  const_reference at(size_type n) const { load(); return ModelCollection<T>::at(n); }
+  reference front() { load(); return ModelCollection<T>::front(); }
+  const_reference front() const { load(); return ModelCollection<T>::front(); }
+  reference back() { load(); return ModelCollection<T>::back(); }
+  const_reference back() const { load(); return ModelCollection<T>::back(); }
+
+  void resize(size_type n, value_type val = value_type()) { load(); touch(); ModelCollection<T>::resize(n, val); }
+  template <class InputIterator> void assign(InputIterator first, InputIterator last) { pending_url_.clear(); touch(); ModelCollection<T>::assign(first, last); }
+  void assign(size_type n, const value_type val) { pending_url_.clear(); touch(); ModelCollection<T>::assign(n, val); }
+  void push_back(const value_type val) { load(); touch(); ModelCollection<T>::push_back(val); }
+  void pop_back() { load(); touch(); ModelCollection<T>::pop_back(); }
   iterator insert(iterator position, const value_type val) { touch(); return ModelCollection<T>::insert(position, val); }
   void insert(iterator position, size_type n, const value_type val) { touch(); ModelCollection<T>::insert(position, n, val); }
   template <class InputIterator> void insert(iterator position, InputIterator first, InputIterator last) { touch(); ModelCollection<T>::insert(position, first, last); }
   iterator erase(iterator position) { touch(); return ModelCollection<T>::erase(position); }
   iterator erase(iterator first, iterator last) { touch(); return ModelCollection<T>::erase(first, last); }
   void swap(HasMany& x) { touch(); ModelCollection<T>::swap(x); }
-  void clear() { touch(); ModelCollection<T>::clear(); }
+  void clear() { pending_url_.clear(); touch(); ModelCollection<T>::clear(); }
 
 private:
   mutable bool is_dirty_;
 };
 
 template <class T>
-class SingleRelationshipBase
+class SingleRelationshipBase : public LazyRelation
 {
 public:
   SingleRelationshipBase() : item_(NULL), is_dirty_(false) {}
 
-  SingleRelationshipBase(const SingleRelationshipBase &other) : item_(NULL), is_dirty_(other.is_dirty_)
+  SingleRelationshipBase(const SingleRelationshipBase &other) : LazyRelation(other), item_(NULL), is_dirty_(other.is_dirty_)
   {
     if (other.item_)
     {
@@ -148,7 +346,7 @@ public:
 
   bool is_null() const
   {
-    return !item_;
+    return is_loaded() && !item_;
   }
 
   bool is_dirty() const
@@ -211,9 +409,66 @@ public:
       item_ = NULL;
     }
 
+    pending_url_.clear();
     touch();
   }
 
+  /**
+   * @brief Request the relationship now, if it is lazy and not yet loaded
+   */
+  void load() const
+  {
+    if (is_loaded()) return;
+
+    // Keep the URL until the relationship is decoded, so a failed request is
+    // made again on the next access
+    ApiScope scope(pending_api_);
+    std::string url = pending_url();
+    std::string response = Api::get(url);
+    DecodeTimer timer(T::class_name(), &response);
+    Json::Parser parser(response);
+    SingleRelationshipBase<T> *self = const_cast<SingleRelationshipBase<T> *>(this);
+
+    try
+    {
+      if (parser.root().is_null())
+      {
+        self->clear();
+        self->clean();
+      }
+      else
+      {
+        self->from_json(parser.root());
+      }
+    }
+    catch (...)
+    {
+      self->clear();
+      pending_url_ = url;
+      clean();
+
+      throw;
+    }
+  }
+
+  /**
+   * @brief Set an item that was loaded elsewhere, e.g. in a batch, without
+   * marking the relationship as dirty
+   */
+  void fill(const T *item)
+  {
+    if (item)
+    {
+      set(*item);
+    }
+    else
+    {
+      clear();
+    }
+
+    clean();
+  }
+
   void from_json(std::string values, const int &flags = 0)
   {
     build();
@@ -222,8 +477,18 @@ public:
     item_->from_json(values, flags, true);
   }
 
+  void from_json(const Json::Node &values, const int &flags = 0)
+  {
+    build();
+    clean();
+
+    decode_related(*item_, values, flags, ModelTag<IsModel<T>::value>());
+  }
+
   std::string to_json(const int &flags = 0, const std::string &parent_model = "") const
   {
+    load();
+
     if (item_)
     {
       return item_->to_json(flags, parent_model);
@@ -234,6 +499,20 @@ public:
     }
   }
 
+  void to_json(Json::Emitter &emitter, const int &flags = 0, const std::string &parent_model = "") const
+  {
+    load();
+
+    if (item_)
+    {
+      emit_related(emitter, *item_, flags, parent_model, ModelTag<IsModel<T>::value>());
+    }
+    else
+    {
+      emitter.emit_null();
+    }
+  }
+
   T *operator->()
   {
     check_null();
@@ -264,15 +543,17 @@ public:
 
   const SingleRelationshipBase &operator=(const SingleRelationshipBase &value)
   {
-    if (value.is_null())
+    // Copy a pending relationship as is, without loading it
+    if (value.item_)
     {
-      clear();
+      set(*value.item_);
     }
     else
     {
-      set(value.get());
+      clear();
     }
 
+    LazyRelation::operator=(value);
     is_dirty_ = value.is_dirty_;
 
     return *this;
@@ -284,6 +565,8 @@ private:
 
   void check_null() const
   {
+    load();
+
     if (!item_)
     {
       std::ostringstream s;
@@ -0,0 +1,149 @@
+#ifndef RESTFUL_MAPPER_SESSION_H
+#define RESTFUL_MAPPER_SESSION_H
+
+#include <string>
+#include <map>
+#include <utility>
+#include <restful_mapper/internal/thread_local.h>
+
+namespace restful_mapper
+{
+
+/**
+ * @brief Identity map for a unit of work.
+ *
+ * While a Session is alive, every object decoded by the mapper is remembered
+ * by its class and primary key. Nested decodes of the same object, such as a
+ * parent shared by many children, are served as copies of the entry instead
+ * of being parsed again. As objects are copied, a session saves decoding work,
+ * not memory.
+ *
+ * Objects decoded from a nested position are stored as partial, as the web
+ * service may leave out their relationships. A find only returns complete
+ * entries, i.e. those stored by a find, find_all or save, and replaces
+ * partial ones. Responses for collections refresh the entries of the objects
+ * they contain, but nested objects keep the entry they were first decoded
+ * into, so changes made on the server during the session are not seen there.
+ *
+ * Saving an object replaces its entry, and destroying it removes the entry.
+ *
+ * Sessions are scoped; creating a new one shadows the current session until it
+ * is destroyed. A session only applies to the thread that created it.
+ */
+class Session
+{
+public:
+  Session() : previous_(current())
+  {
+    current() = this;
+  }
+
+  ~Session()
+  {
+    clear();
+    current() = previous_;
+  }
+
+  static Session *active()
+  {
+    return current();
+  }
+
+  /**
+   * @brief The entry of an object, or NULL if there is none, or if complete
+   * is set and the entry is partial
+   */
+  template <class T> const T *find(const long long &id, const bool &complete = false) const
+  {
+    EntryMap::const_iterator i = entries_.find(Key(&T::class_name(), id));
+
+    if (i == entries_.end() || (complete && !i->second->complete))
+    {
+      return NULL;
+    }
+
+    return &static_cast<Entry<T> *>(i->second)->item;
+  }
+
+  template <class T> void store(const long long &id, const T &item, const bool &complete = true)
+  {
+    Key key(&T::class_name(), id);
+    EntryMap::iterator i = entries_.find(key);
+
+    if (i != entries_.end())
+    {
+      delete i->second;
+      i->second = new Entry<T>(item, complete);
+    }
+    else
+    {
+      entries_.insert(std::make_pair(key, static_cast<EntryBase *>(new Entry<T>(item, complete))));
+    }
+  }
+
+  template <class T> void erase(const long long &id)
+  {
+    EntryMap::iterator i = entries_.find(Key(&T::class_name(), id));
+
+    if (i != entries_.end())
+    {
+      delete i->second;
+      entries_.erase(i);
+    }
+  }
+
+  size_t size() const
+  {
+    return entries_.size();
+  }
+
+  void clear()
+  {
+    EntryMap::iterator i, i_end = entries_.end();
+
+    for (i = entries_.begin(); i != i_end; ++i)
+    {
+      delete i->second;
+    }
+
+    entries_.clear();
+  }
+
+private:
+  struct EntryBase
+  {
+    explicit EntryBase(const bool &is_complete) : complete(is_complete) {}
+    virtual ~EntryBase() {}
+
+    bool complete;
+  };
+
+  template <class T>
+  struct Entry : public EntryBase
+  {
+    Entry(const T &value, const bool &is_complete) : EntryBase(is_complete), item(value) {}
+    T item;
+  };
+
+  // Class names are unique static strings, so their address identifies the class
+  typedef std::pair<const std::string *, long long> Key;
+  typedef std::map<Key, EntryBase *> EntryMap;
+
+  EntryMap entries_;
+  Session *previous_;
+
+  static Session *&current()
+  {
+    static RESTFUL_MAPPER_THREAD_LOCAL Session *session = NULL;
+
+    return session;
+  }
+
+  // Disallow copy
+  Session(Session const &);        // Don't Implement
+  void operator=(Session const &); // Don't implement
+};
+
+}
+
+#endif // RESTFUL_MAPPER_SESSION_H
@@ -2,8 +2,10 @@
 #include <restful_mapper/meta.h>
 #include <curl/curl.h>
 #include <sstream>
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <ctime>
 
 using namespace std;
 using namespace restful_mapper;
@@ -19,18 +21,307 @@ typedef struct
 {
   const char *data;
   size_t length;
+  const string *body;
 } RequestBody;
 
+// Struct used for collecting cache validators, and sizing the response body
+typedef struct
+{
+  string etag;
+  string last_modified;
+  string retry_after;
+  string *body;
+} ResponseHeaders;
+
+// Struct used for receiving the response body, and parsing it as it arrives
+typedef struct
+{
+  string *body;
+  Json::Parser *parser;
+} ResponseBody;
+
+// Counts a request as in flight for as long as it is alive
+class RequestSlot
+{
+public:
+  RequestSlot(RateLimiter &limiter, const RateLimiter::Slot &slot) : limiter_(limiter), slot_(slot) {}
+
+  ~RequestSlot()
+  {
+    limiter_.release(slot_);
+  }
+
+private:
+  RateLimiter &limiter_;
+  RateLimiter::Slot slot_;
+};
+
+// Second attempt of a slow GET request, sent while the first is in progress
+class Hedge
+{
+public:
+  Hedge(RateLimiter &limiter, const string &endpoint)
+    : handle(NULL), attempted(false), limiter_(limiter), endpoint_(endpoint) {}
+
+  ~Hedge()
+  {
+    if (handle)
+    {
+      curl_easy_cleanup(handle);
+      limiter_.release(slot_);
+    }
+  }
+
+  // Copies the first request, collecting the response separately
+  bool start(CURL *primary, const double &timeout)
+  {
+    attempted = true;
+
+    if (!limiter_.try_acquire(endpoint_, slot_))
+    {
+      return false;
+    }
+
+    handle = curl_easy_duphandle(primary);
+
+    if (!handle)
+    {
+      limiter_.release(slot_);
+      return false;
+    }
+
+    headers.body = &body;
+    sink.body    = &body;
+    sink.parser  = NULL;
+
+    curl_easy_setopt(handle, CURLOPT_WRITEDATA, &sink);
+    curl_easy_setopt(handle, CURLOPT_HEADERDATA, &headers);
+    curl_easy_setopt(handle, CURLOPT_ERRORBUFFER, errors);
+
+    if (timeout > 0.0)
+    {
+      curl_easy_setopt(handle, CURLOPT_TIMEOUT_MS, static_cast<long>(timeout * 1000.0) + 1L);
+    }
+
+    return true;
+  }
+
+  CURL *handle;
+  bool attempted;
+  string body;
+  ResponseBody sink;
+  ResponseHeaders headers;
+  char errors[CURL_ERROR_SIZE];
+
+private:
+  RateLimiter &limiter_;
+  RateLimiter::Slot slot_;
+  const string &endpoint_;
+};
+
 // Helper macros
 #define MAKE_HEADER(name, value) (std::string(name) + ": " + std::string(value)).c_str()
-#define CURL_HANDLE static_cast<CURL *>(instance().curl_handle_)
+#define CURL_HANDLE static_cast<CURL *>(curl_handle_)
+#define MULTI_HANDLE static_cast<CURLM *>(multi_handle_)
+
+// Largest body to allocate up front, trusting the Content-Length header
+static const unsigned long MAX_PREALLOCATION = 64 * 1024 * 1024;
+
+// Method names, by RequestType
+static const char *request_methods[] = { "GET", "POST", "PUT", "DELETE" };
+
+// Longest time to wait for activity on the transfers of a hedged request
+static const long HEDGE_POLL_MILLISECONDS = 100;
+
+// Helper functions
+static bool is_transient_error(const CURLcode &code)
+{
+  switch (code)
+  {
+    case CURLE_COULDNT_CONNECT:
+    case CURLE_OPERATION_TIMEDOUT:
+    case CURLE_SEND_ERROR:
+    case CURLE_RECV_ERROR:
+    case CURLE_GOT_NOTHING:
+    case CURLE_PARTIAL_FILE:
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+static bool is_transient_status(const long &http_code)
+{
+  return http_code == 408 || http_code == 429 || http_code == 502 || http_code == 503 || http_code == 504;
+}
+
+/**
+ * @brief seek callback function for libcurl, used to rewind the request body
+ *
+ * @param userdata pointer to user data to read data from
+ * @param offset the offset to seek to
+ * @param origin SEEK_SET, SEEK_CUR or SEEK_END
+ *
+ * @return CURL_SEEKFUNC_OK, or CURL_SEEKFUNC_FAIL if out of range
+ */
+static int seek_callback(void *userdata, curl_off_t offset, int origin)
+{
+  RequestBody *body = reinterpret_cast<RequestBody *>(userdata);
+
+  size_t position = body->body->size() - body->length;
+  curl_off_t target = offset;
+
+  if (origin == SEEK_CUR) target += position;
+  if (origin == SEEK_END) target += body->body->size();
+
+  if (target < 0 || static_cast<size_t>(target) > body->body->size())
+  {
+    return CURL_SEEKFUNC_FAIL;
+  }
+
+  body->data   = body->body->data() + target;
+  body->length = body->body->size() - static_cast<size_t>(target);
+
+  return CURL_SEEKFUNC_OK;
+}
+
+// Progress callback, aborting the transfer once the deadline is cancelled
+#if LIBCURL_VERSION_NUM >= 0x072000
+static int progress_callback(void *userdata, curl_off_t, curl_off_t, curl_off_t, curl_off_t)
+#else
+static int progress_callback(void *userdata, double, double, double, double)
+#endif
+{
+  return static_cast<const Deadline *>(userdata)->is_cancelled() ? 1 : 0;
+}
+
+/**
+ * @brief Performs a request, sending a copy of it once the delay has passed
+ * without a response
+ *
+ * @param multi the multi handle to run the transfers on
+ * @param primary the prepared request
+ * @param delay seconds to wait before sending the copy
+ * @param timeout the timeout of the request, or 0
+ * @param hedge the copy of the request
+ * @param winner set to the handle of the transfer to use
+ *
+ * @return the result of the first transfer to succeed, or of the primary
+ * request if both failed
+ */
+static CURLcode perform_hedged(CURLM *multi, CURL *primary, const double &delay, const double &timeout,
+    Hedge &hedge, CURL *&winner)
+{
+  double start = monotonic_seconds();
+  bool primary_done = false, hedge_done = false;
+  CURLcode primary_result = CURLE_OK, hedge_result = CURLE_OK;
+
+  curl_multi_add_handle(multi, primary);
+  winner = NULL;
+
+  while (!winner)
+  {
+    int running = 0;
+    curl_multi_perform(multi, &running);
+
+    int queued = 0;
+    CURLMsg *message;
+
+    while ((message = curl_multi_info_read(multi, &queued)))
+    {
+      if (message->msg != CURLMSG_DONE) continue;
+
+      if (message->easy_handle == primary)
+      {
+        primary_done   = true;
+        primary_result = message->data.result;
+      }
+      else
+      {
+        hedge_done   = true;
+        hedge_result = message->data.result;
+      }
+    }
+
+    // A failed transfer waits for the other one, if it is still running
+    if (primary_done && (primary_result == CURLE_OK || !hedge.handle || hedge_done))
+    {
+      winner = primary;
+      break;
+    }
+
+    if (hedge_done && (hedge_result == CURLE_OK || primary_done))
+    {
+      winner = hedge.handle;
+      break;
+    }
+
+    long wait = HEDGE_POLL_MILLISECONDS;
+
+    if (!hedge.attempted)
+    {
+      double elapsed = monotonic_seconds() - start;
+
+      if (elapsed < delay)
+      {
+        wait = min(wait, static_cast<long>((delay - elapsed) * 1000.0) + 1L);
+      }
+      else if ((timeout <= 0.0 || timeout > elapsed) && hedge.start(primary, timeout - elapsed))
+      {
+        curl_multi_add_handle(multi, hedge.handle);
+        continue;
+      }
+    }
+
+    curl_multi_wait(multi, NULL, 0, wait, NULL);
+  }
+
+  curl_multi_remove_handle(multi, primary);
+
+  if (hedge.handle)
+  {
+    curl_multi_remove_handle(multi, hedge.handle);
+  }
+
+  return (winner == primary) ? primary_result : hedge_result;
+}
+
+// Initializes libcurl, which is not thread-safe, once for all clients
+static bool initialize_curl()
+{
+  static bool initialized = false;
+
+  if (!initialized)
+  {
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+    initialized = true;
+  }
+
+  return initialized;
+}
+
+// Initialize libcurl as the program starts, before any threads are created
+static const bool curl_initialized = initialize_curl();
 
 // Initialize curl
 Api::Api()
+  : timeout_(0.0), connect_timeout_(0.0), low_speed_limit_(0), low_speed_time_(0),
+    response_unchanged_(false), incremental_parsing_(false), limiter_(&own_limiter_), observer_(NULL), retry_tokens_(retry_policy_.budget),
+    balancer_(&own_balancer_)
 {
-  curl_handle_ = static_cast<void *>(curl_easy_init());
+  // Seed the jitter of retry delays, separately from rand()
+  random_state_ = static_cast<unsigned long>(time(NULL)) ^ static_cast<unsigned long>(reinterpret_cast<size_t>(this));
+
+  balancer_->set_urls(vector<string>(1, url_));
+
+  // In case the client is created during static initialization
+  initialize_curl();
+
+  curl_handle_  = static_cast<void *>(curl_easy_init());
+  multi_handle_ = static_cast<void *>(curl_multi_init());
 
-  if (!curl_handle_)
+  if (!curl_handle_ || !multi_handle_)
   {
     throw ApiError("Unable to initialize libcurl", 0);
   }
@@ -46,6 +337,11 @@ Api::~Api()
   {
     curl_easy_cleanup(CURL_HANDLE);
   }
+
+  if (multi_handle_)
+  {
+    curl_multi_cleanup(MULTI_HANDLE);
+  }
 }
 
 /**
@@ -60,6 +356,20 @@ string Api::get_(const string &endpoint) const
   return send_request(GET, endpoint, "");
 }
 
+/**
+ * @brief HTTP GET method, parsing the response while it is downloaded if
+ * incremental parsing is enabled
+ *
+ * @param endpoint url to query
+ * @param parser parser to load with the response
+ *
+ * @return response body
+ */
+string Api::get_(const string &endpoint, Json::Parser &parser) const
+{
+  return send_request(GET, endpoint, "", incremental_parsing_ ? &parser : NULL);
+}
+
 /**
  * @brief HTTP POST method
  *
@@ -124,6 +434,20 @@ string Api::escape_(const string &value) const
  * @return the new URL that includes the query parameter
  */
 string Api::query_param_(const string &url, const string &param, const string &value) const
+{
+  return escaped_query_param_(url, param, escape_(value));
+}
+
+/**
+ * @brief Add an already URL encoded query parameter to the specified URL
+ *
+ * @param url the URL to add the parameter to
+ * @param param the parameter name
+ * @param escaped_value the URL encoded parameter value
+ *
+ * @return the new URL that includes the query parameter
+ */
+string Api::escaped_query_param_(const string &url, const string &param, const string &escaped_value) const
 {
   string query_part;
 
@@ -143,35 +467,204 @@ string Api::query_param_(const string &url, const string &param, const string &v
 
   query_part += param;
   query_part += "=";
-  query_part += escape_(value);
+  query_part += escaped_value;
 
   return url + query_part;
 }
 
 /**
- * @brief wrapper to perform curl request
+ * @brief wrapper to perform curl request, failing over to other replicas and
+ * retrying transient failures as specified by the retry policy
  *
  * @param type the request type
  * @param endpoint url to query
  * @param data HTTP PUT body
+ * @param parser parser to load with the response as it arrives, or NULL
  *
  * @return
  */
-string Api::send_request(const RequestType &type, const string &endpoint, const string &body) const
+string Api::send_request(const RequestType &type, const string &endpoint, const string &body,
+    Json::Parser *parser) const
 {
+  // Replicas which failed the request, not to be tried again before the others
+  vector<bool> failed(balancer_->size(), false);
+  unsigned int attempts = 0;
+
+  // The only value returned, so that it is never copied
+  string response_body;
+
+  for (unsigned int retries = 0; ; )
+  {
+    bool replayable = false;
+    double retry_after = 0.0;
+    double delay = 0.0;
+
+    size_t replica = balancer_->choose(failed);
+
+    try
+    {
+      perform_request(type, endpoint, body, replica, attempts++, replayable, retry_after, parser, response_body);
+
+      retry_tokens_ = min(retry_policy_.budget, retry_tokens_ + retry_policy_.budget_refill);
+
+      break;
+    }
+    catch (ResponseError &)
+    {
+      // Fail over to another replica right away, without spending a retry
+      if (replayable && replica < failed.size())
+      {
+        failed[replica] = true;
+
+        if (balancer_->has_available(failed))
+        {
+          continue;
+        }
+      }
+
+      if (!replayable || retries >= retry_policy_.max_retries || retry_tokens_ < 1.0)
+      {
+        throw;
+      }
+
+      delay = retry_delay(retries, retry_after);
+
+      // Give up rather than wait past the deadline
+      Deadline *deadline = Deadline::active();
+
+      if (deadline && (deadline->is_cancelled() || (deadline->is_limited() && deadline->remaining() <= delay)))
+      {
+        throw;
+      }
+    }
+
+    retries++;
+    retry_tokens_ -= 1.0;
+    sleep_seconds(delay);
+  }
+
+  return response_body;
+}
+
+/**
+ * @brief Seconds to wait before retrying a request
+ *
+ * @param retries the number of retries made so far
+ * @param retry_after the delay requested by the server, or 0
+ *
+ * @return the delay, including jitter
+ */
+double Api::retry_delay(const unsigned int &retries, const double &retry_after) const
+{
+  if (retry_after > 0.0)
+  {
+    return min(retry_after, retry_policy_.max_delay);
+  }
+
+  double delay = retry_policy_.initial_delay;
+
+  for (unsigned int i = 0; i < retries && delay < retry_policy_.max_delay; i++)
+  {
+    delay *= retry_policy_.multiplier;
+  }
+
+  delay = min(delay, retry_policy_.max_delay);
+
+  // Linear congruential generator, good enough to spread out clients
+  random_state_ = random_state_ * 1103515245UL + 12345UL;
+  double random = ((random_state_ >> 16) & 0x7FFF) / 32768.0;
+
+  return delay * (1.0 - retry_policy_.jitter * random);
+}
+
+/**
+ * @brief Performs a single attempt of a request
+ *
+ * @param type the request type
+ * @param endpoint url to query
+ * @param data HTTP PUT body
+ * @param replica the replica to send the request to
+ * @param attempts the number of failed attempts before this one
+ * @param replayable set if the attempt failed transiently and may be repeated
+ * @param retry_after set to the delay requested by the server, if any
+ * @param parser parser to load with the response as it arrives, or NULL
+ * @param response_body set to the response body
+ */
+void Api::perform_request(const RequestType &type, const string &endpoint, const string &body,
+    const size_t &replica, const unsigned int &attempts, bool &replayable, double &retry_after,
+    Json::Parser *parser, string &response_body) const
+{
+  // Wait for the rate limits of the endpoint
+  Deadline *deadline = Deadline::active();
+
+  RateLimiter::Slot taken;
+
+  if (!limiter_->acquire(endpoint, deadline, taken))
+  {
+    if (deadline->is_cancelled())
+    {
+      throw CancelledError("Request to \"" + url_ + endpoint + "\" was cancelled");
+    }
+
+    throw TimeoutError("Deadline passed while waiting to send request to \"" + url_ + endpoint + "\"", "");
+  }
+
+  RequestSlot slot(*limiter_, taken);
+
+  // Fail fast while the endpoint is failing
+  string key = RequestStatistics::endpoint_key(request_methods[type], endpoint);
+
+  if (!breaker_.allow(key))
+  {
+    throw CircuitOpenError("Circuit open for \"" + key + "\", request to \"" + url_ + endpoint + "\" not sent");
+  }
+
   curl_slist *header = NULL;
 
   // Create return struct
-  string response_body;
+  ResponseHeaders response_headers;
+  response_headers.body = &response_body;
+
+  // Receive the response into the buffer of an earlier one, or into that of
+  // the previous attempt
+  response_body.clear();
+
+  if (attempts == 0)
+  {
+    buffers_.take(response_body);
+  }
+
+  // Parse the response as it arrives, starting over on every attempt
+  ResponseBody response_sink;
+  response_sink.body   = &response_body;
+  response_sink.parser = parser;
+
+  if (parser)
+  {
+    parser->begin();
+  }
+
+  // Look up cached response, to be revalidated by the server
+  string cache_url = url_ + endpoint;
+  string request_url = balancer_->url(replica) + endpoint;
+  bool use_cache = (type == GET && cache_.capacity() > 0);
+  const CachedResponse *cached = use_cache ? cache_.find(cache_url) : NULL;
+
+  response_unchanged_ = false;
+  response_version_.clear();
 
   // Initialize request body
   RequestBody request_body;
   request_body.data   = body.c_str();
   request_body.length = body.size();
+  request_body.body   = &body;
 
   // Reset libcurl
   curl_easy_reset(CURL_HANDLE);
 
+  // Set timeouts, or fail right away if the deadline has passed
+  double timeout = set_timeouts(endpoint);
+
   // Debug output
   //curl_easy_setopt(CURL_HANDLE, CURLOPT_VERBOSE, 1);
 
@@ -179,7 +672,7 @@ string Api::send_request(const RequestType &type, const string &endpoint, const
   curl_easy_setopt(CURL_HANDLE, CURLOPT_USERAGENT, Api::user_agent_);
 
   // Set query URL
-  curl_easy_setopt(CURL_HANDLE, CURLOPT_URL, url(endpoint).c_str());
+  curl_easy_setopt(CURL_HANDLE, CURLOPT_URL, request_url.c_str());
 
   // Set proxy
   curl_easy_setopt(CURL_HANDLE, CURLOPT_PROXY, proxy_.c_str());
@@ -222,6 +715,10 @@ string Api::send_request(const RequestType &type, const string &endpoint, const
       // Set data object to pass to callback function
       curl_easy_setopt(CURL_HANDLE, CURLOPT_READDATA, &request_body);
 
+      // Allow libcurl to send the body again, e.g. on a stale connection
+      curl_easy_setopt(CURL_HANDLE, CURLOPT_SEEKFUNCTION, seek_callback);
+      curl_easy_setopt(CURL_HANDLE, CURLOPT_SEEKDATA, &request_body);
+
       // Set content-type header
       header = curl_slist_append(header, MAKE_HEADER("Content-Type", content_type_));
 
@@ -232,14 +729,29 @@ string Api::send_request(const RequestType &type, const string &endpoint, const
   curl_easy_setopt(CURL_HANDLE, CURLOPT_WRITEFUNCTION, Api::write_callback);
 
   // Set data object to pass to callback function
-  curl_easy_setopt(CURL_HANDLE, CURLOPT_WRITEDATA, &response_body);
+  curl_easy_setopt(CURL_HANDLE, CURLOPT_WRITEDATA, &response_sink);
 
   // Specify authentication information
-  if (!username().empty())
+  if (!username_.empty())
   {
     curl_easy_setopt(CURL_HANDLE, CURLOPT_HTTPAUTH, CURLAUTH_BASIC);
-    curl_easy_setopt(CURL_HANDLE, CURLOPT_USERNAME, username().c_str());
-    curl_easy_setopt(CURL_HANDLE, CURLOPT_PASSWORD, password().c_str());
+    curl_easy_setopt(CURL_HANDLE, CURLOPT_USERNAME, username_.c_str());
+    curl_easy_setopt(CURL_HANDLE, CURLOPT_PASSWORD, password_.c_str());
+  }
+
+  // Collect cache validators and retry delays from the response headers
+  curl_easy_setopt(CURL_HANDLE, CURLOPT_HEADERFUNCTION, Api::header_callback);
+  curl_easy_setopt(CURL_HANDLE, CURLOPT_HEADERDATA, &response_headers);
+
+  // Make the request conditional on the cached response
+  if (cached && !cached->etag.empty())
+  {
+    header = curl_slist_append(header, MAKE_HEADER("If-None-Match", cached->etag));
+  }
+
+  if (cached && !cached->last_modified.empty())
+  {
+    header = curl_slist_append(header, MAKE_HEADER("If-Modified-Since", cached->last_modified));
   }
 
   // Set content negotiation header
@@ -250,25 +762,296 @@ string Api::send_request(const RequestType &type, const string &endpoint, const
   char errors[CURL_ERROR_SIZE];
   curl_easy_setopt(CURL_HANDLE, CURLOPT_ERRORBUFFER, &errors);
 
-  // Perform the actual query
-  CURLcode res = curl_easy_perform(CURL_HANDLE);
+  // Perform the actual query, hedged if the endpoint is slow to answer
+  double start = monotonic_seconds();
+  double delay = (type == GET) ? hedge_delay(key) : 0.0;
+
+  CURL *handle = CURL_HANDLE;
+  Hedge hedge(*limiter_, endpoint);
+  CURLcode res;
+
+  balancer_->start(replica);
+
+  if (delay > 0.0)
+  {
+    res = perform_hedged(MULTI_HANDLE, CURL_HANDLE, delay, timeout, hedge, handle);
+  }
+  else
+  {
+    res = curl_easy_perform(CURL_HANDLE);
+  }
 
   // Free header list
   curl_slist_free_all(header);
 
+  if (handle == hedge.handle)
+  {
+    response_body.swap(hedge.body);
+    swap(response_headers, hedge.headers);
+    memcpy(errors, hedge.errors, CURL_ERROR_SIZE);
+  }
+
   // Handle unexpected internal errors
   if (res != 0)
   {
+    finish_request(handle, type, endpoint, 0, errors, false, attempts, hedge.handle != NULL);
+
+    if (res != CURLE_ABORTED_BY_CALLBACK)
+    {
+      breaker_.record_failure(key);
+      balancer_->fail(replica);
+    }
+    else
+    {
+      balancer_->abandon(replica);
+    }
+
+    if (res == CURLE_ABORTED_BY_CALLBACK)
+    {
+      throw CancelledError("Request to \"" + url_ + endpoint + "\" was cancelled");
+    }
+
+    // A POST which never reached the server can safely be sent again
+    replayable = is_transient_error(res) &&
+      (type != POST || retry_policy_.retry_posts || res == CURLE_COULDNT_CONNECT);
+
+    if (res == CURLE_OPERATION_TIMEDOUT)
+    {
+      throw TimeoutError(curl_easy_strerror(res), errors);
+    }
+
     throw ResponseError(curl_easy_strerror(res), res, errors);
   }
 
   // Handle server-side erros
   long http_code = 0;
-  curl_easy_getinfo(CURL_HANDLE, CURLINFO_RESPONSE_CODE, &http_code);
+  curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &http_code);
+
+  finish_request(handle, type, endpoint, http_code, "", cached && http_code == 304, attempts, hedge.handle != NULL);
+
+  if (http_code >= 500 || is_transient_status(http_code))
+  {
+    breaker_.record_failure(key);
+    balancer_->fail(replica);
+  }
+  else
+  {
+    breaker_.record_success(key);
+    balancer_->succeed(replica, monotonic_seconds() - start);
+
+    // Time successful responses as seen by the caller, to hedge the slow ones
+    if (type == GET && hedging_policy_.enabled)
+    {
+      map<string, LatencyWindow>::iterator i = latencies_.find(key);
+
+      if (i == latencies_.end())
+      {
+        i = latencies_.insert(make_pair(key, LatencyWindow(hedging_policy_.window))).first;
+      }
+
+      i->second.add(monotonic_seconds() - start);
+    }
+  }
+
+  // Serve the cached response if it is still valid
+  if (cached && http_code == 304)
+  {
+    response_body = cached->body;
+
+    response_unchanged_ = true;
+    response_version_   = cached->etag.empty() ? cached->last_modified : cached->etag;
+
+    if (parser)
+    {
+      parser->load(response_body);
+    }
+
+    return;
+  }
+
+  if (is_transient_status(http_code))
+  {
+    replayable  = (type != POST || retry_policy_.retry_posts);
+    retry_after = strtod(response_headers.retry_after.c_str(), NULL);
+  }
 
   check_http_error(type, endpoint, http_code, response_body);
 
-  return response_body;
+  if (use_cache && (!response_headers.etag.empty() || !response_headers.last_modified.empty()))
+  {
+    CachedResponse response;
+    response.body          = response_body;
+    response.etag          = response_headers.etag;
+    response.last_modified = response_headers.last_modified;
+
+    cache_.store(cache_url, response);
+
+    response_version_ = response.etag.empty() ? response.last_modified : response.etag;
+  }
+  else
+  {
+    cache_.erase(cache_url);
+  }
+
+  // Complete parsing, unless the second request of a hedge won the race
+  if (parser && handle == CURL_HANDLE)
+  {
+    parser->finish();
+  }
+  else if (parser)
+  {
+    parser->load(response_body);
+  }
+}
+
+/**
+ * @brief Applies the configured timeouts to the next request, shortened to
+ * the active deadline
+ *
+ * @param endpoint the requested endpoint, for error messages
+ *
+ * @return the timeout of the request in seconds, or 0 if it is unlimited
+ */
+double Api::set_timeouts(const string &endpoint) const
+{
+  double timeout = timeout_;
+  Deadline *deadline = Deadline::active();
+
+  if (deadline)
+  {
+    if (deadline->is_cancelled())
+    {
+      throw CancelledError("Request to \"" + url_ + endpoint + "\" was cancelled");
+    }
+
+    if (deadline->is_limited())
+    {
+      double remaining = deadline->remaining();
+
+      if (remaining <= 0.0)
+      {
+        throw TimeoutError("Deadline passed before request to \"" + url_ + endpoint + "\"", "");
+      }
+
+      if (timeout <= 0.0 || remaining < timeout)
+      {
+        timeout = remaining;
+      }
+    }
+
+    if (deadline->is_cancellable())
+    {
+#if LIBCURL_VERSION_NUM >= 0x072000
+      curl_easy_setopt(CURL_HANDLE, CURLOPT_XFERINFOFUNCTION, progress_callback);
+      curl_easy_setopt(CURL_HANDLE, CURLOPT_XFERINFODATA, deadline);
+#else
+      curl_easy_setopt(CURL_HANDLE, CURLOPT_PROGRESSFUNCTION, progress_callback);
+      curl_easy_setopt(CURL_HANDLE, CURLOPT_PROGRESSDATA, deadline);
+#endif
+      curl_easy_setopt(CURL_HANDLE, CURLOPT_NOPROGRESS, 0L);
+    }
+  }
+
+  // Round up, as a timeout of 0 means no limit
+  if (timeout > 0.0)
+  {
+    curl_easy_setopt(CURL_HANDLE, CURLOPT_TIMEOUT_MS, static_cast<long>(timeout * 1000.0) + 1L);
+  }
+
+  if (connect_timeout_ > 0.0)
+  {
+    curl_easy_setopt(CURL_HANDLE, CURLOPT_CONNECTTIMEOUT_MS, static_cast<long>(connect_timeout_ * 1000.0) + 1L);
+  }
+
+  if (low_speed_limit_ > 0)
+  {
+    curl_easy_setopt(CURL_HANDLE, CURLOPT_LOW_SPEED_LIMIT, low_speed_limit_);
+    curl_easy_setopt(CURL_HANDLE, CURLOPT_LOW_SPEED_TIME, low_speed_time_);
+  }
+
+  // Timeouts must not be implemented with signals in threaded programs
+  curl_easy_setopt(CURL_HANDLE, CURLOPT_NOSIGNAL, 1L);
+
+  return timeout > 0.0 ? timeout : 0.0;
+}
+
+/**
+ * @brief Seconds after which a GET request is sent a second time, being the
+ * configured percentile of the recent response times of the endpoint
+ *
+ * @param key the endpoint key of the request
+ *
+ * @return the delay, or 0 if the request is not to be hedged
+ */
+double Api::hedge_delay(const string &key) const
+{
+  if (!hedging_policy_.enabled)
+  {
+    return 0.0;
+  }
+
+  map<string, LatencyWindow>::const_iterator i = latencies_.find(key);
+
+  if (i == latencies_.end() || i->second.count() < hedging_policy_.min_samples)
+  {
+    return 0.0;
+  }
+
+  return i->second.percentile(hedging_policy_.percentile);
+}
+
+/**
+ * @brief Collects the timings and sizes of the finished request from libcurl,
+ * and passes them to the observer
+ *
+ * @param handle the handle of the transfer
+ * @param type the request type
+ * @param endpoint the requested endpoint
+ * @param http_code the HTTP status, or 0 if the transfer failed
+ * @param error the libcurl error message, if the transfer failed
+ * @param from_cache whether the cached response is used
+ * @param retries the number of failed attempts before this one
+ * @param hedged whether a second request was sent
+ */
+void Api::finish_request(void *handle, const RequestType &type, const string &endpoint, const long &http_code,
+    const char *error, const bool &from_cache, const unsigned int &retries, const bool &hedged) const
+{
+  if (!observer_)
+  {
+    return;
+  }
+
+  RequestMetrics &metrics = last_request_;
+  metrics = RequestMetrics();
+
+  metrics.method     = request_methods[type];
+  metrics.endpoint   = endpoint;
+  metrics.status     = http_code;
+  metrics.error      = error;
+  metrics.from_cache = from_cache;
+  metrics.retries    = retries;
+  metrics.hedged     = hedged;
+
+  CURL *curl = static_cast<CURL *>(handle);
+
+  curl_easy_getinfo(curl, CURLINFO_NAMELOOKUP_TIME, &metrics.name_lookup_time);
+  curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME, &metrics.connect_time);
+  curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME, &metrics.tls_time);
+  curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME, &metrics.first_byte_time);
+  curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME, &metrics.total_time);
+#if LIBCURL_VERSION_NUM >= 0x073700
+  curl_off_t bytes_sent = 0, bytes_received = 0;
+  curl_easy_getinfo(curl, CURLINFO_SIZE_UPLOAD_T, &bytes_sent);
+  curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &bytes_received);
+
+  metrics.bytes_sent     = static_cast<double>(bytes_sent);
+  metrics.bytes_received = static_cast<double>(bytes_received);
+#else
+  curl_easy_getinfo(curl, CURLINFO_SIZE_UPLOAD, &metrics.bytes_sent);
+  curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD, &metrics.bytes_received);
+#endif
+
+  observer_->request_finished(metrics);
 }
 
 /**
@@ -277,14 +1060,20 @@ string Api::send_request(const RequestType &type, const string &endpoint, const
  * @param data returned data of size (size*nmemb)
  * @param size size parameter
  * @param nmemb memblock parameter
- * @param userdata pointer to user data to save/work with return data
+ * @param userdata pointer to the ResponseBody struct to fill
  *
  * @return (size * nmemb)
  */
 size_t Api::write_callback(void *data, size_t size, size_t nmemb, void *userdata)
 {
-  string *r = reinterpret_cast<string *>(userdata);
-  r->append(reinterpret_cast<char *>(data), size * nmemb);
+  ResponseBody *r = reinterpret_cast<ResponseBody *>(userdata);
+  r->body->append(reinterpret_cast<char *>(data), size * nmemb);
+
+  // Invalid text, e.g. an error page, stops parsing but not the transfer
+  if (r->parser)
+  {
+    r->parser->feed(reinterpret_cast<char *>(data), size * nmemb);
+  }
 
   return (size * nmemb);
 }
@@ -319,6 +1108,60 @@ size_t Api::read_callback(void *data, size_t size, size_t nmemb, void *userdata)
   return copy_size;
 }
 
+/**
+ * @brief header callback function for libcurl
+ *
+ * @param data a single header line of size (size*nmemb)
+ * @param size size parameter
+ * @param nmemb memblock parameter
+ * @param userdata pointer to the ResponseHeaders struct to fill
+ *
+ * @return (size * nmemb)
+ */
+size_t Api::header_callback(void *data, size_t size, size_t nmemb, void *userdata)
+{
+  ResponseHeaders *headers = reinterpret_cast<ResponseHeaders *>(userdata);
+  string line(reinterpret_cast<char *>(data), size * nmemb);
+
+  size_t separator = line.find(':');
+
+  if (separator != string::npos)
+  {
+    string name = line.substr(0, separator);
+    transform(name.begin(), name.end(), name.begin(), ::tolower);
+
+    // Strip whitespace and line endings around the value
+    size_t begin = line.find_first_not_of(" \t", separator + 1);
+    size_t end   = line.find_last_not_of(" \t\r\n");
+    string value = (begin == string::npos || end < begin) ? "" : line.substr(begin, end - begin + 1);
+
+    if (name == "etag")
+    {
+      headers->etag = value;
+    }
+    else if (name == "last-modified")
+    {
+      headers->last_modified = value;
+    }
+    else if (name == "retry-after")
+    {
+      headers->retry_after = value;
+    }
+    else if (name == "content-length")
+    {
+      // Allocate the body once, rather than growing it as data arrives
+      unsigned long length = strtoul(value.c_str(), NULL, 10);
+
+      if (length <= MAX_PREALLOCATION)
+      {
+        headers->body->reserve(length);
+      }
+    }
+  }
+
+  return (size * nmemb);
+}
+
 /**
  * @brief Check whether an error occurred
  *
@@ -0,0 +1,85 @@
+#include <restful_mapper/internal/circuit_breaker.h>
+#include <restful_mapper/metrics.h>
+
+using namespace std;
+using namespace restful_mapper;
+
+void CircuitBreaker::set_policy(const CircuitBreakerPolicy &policy)
+{
+  policy_ = policy;
+  circuits_.clear();
+}
+
+bool CircuitBreaker::allow(const string &key)
+{
+  if (!policy_.failure_threshold)
+  {
+    return true;
+  }
+
+  CircuitMap::iterator i = circuits_.find(key);
+
+  if (i == circuits_.end() || i->second.state == CLOSED)
+  {
+    return true;
+  }
+
+  Circuit &circuit = i->second;
+  double now = monotonic_seconds();
+
+  // Let one trial through per interval; a trial which never reports back,
+  // e.g. as it was cancelled, does not keep the circuit open for good
+  if (now - circuit.opened_at >= policy_.open_seconds)
+  {
+    circuit.state     = HALF_OPEN;
+    circuit.opened_at = now;
+
+    return true;
+  }
+
+  return false;
+}
+
+void CircuitBreaker::record_success(const string &key)
+{
+  if (!policy_.failure_threshold)
+  {
+    return;
+  }
+
+  CircuitMap::iterator i = circuits_.find(key);
+
+  if (i != circuits_.end())
+  {
+    circuits_.erase(i);
+  }
+}
+
+void CircuitBreaker::record_failure(const string &key)
+{
+  if (!policy_.failure_threshold)
+  {
+    return;
+  }
+
+  Circuit &circuit = circuits_[key];
+  circuit.failures++;
+
+  if (circuit.state == HALF_OPEN || circuit.failures >= policy_.failure_threshold)
+  {
+    circuit.state     = OPEN;
+    circuit.opened_at = monotonic_seconds();
+  }
+}
+
+CircuitBreaker::State CircuitBreaker::state(const string &key) const
+{
+  CircuitMap::const_iterator i = circuits_.find(key);
+
+  return (i != circuits_.end()) ? i->second.state : CLOSED;
+}
+
+void CircuitBreaker::clear()
+{
+  circuits_.clear();
+}
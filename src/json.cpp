@@ -1,5 +1,9 @@
 #include <restful_mapper/json.h>
 #include <restful_mapper/internal/utf8.h>
+#include <restful_mapper/internal/structural_parser.h>
+#include <restful_mapper/internal/stream_parser.h>
+#include <restful_mapper/internal/number_format.h>
+#include <restful_mapper/profile.h>
 #include <cstring>
 #include <sstream>
 
@@ -45,6 +49,53 @@ void yajl_gen_error(const yajl_gen_status &status)
   }
 }
 
+// Append generated JSON directly to the emitter's output buffer
+void yajl_print_output(void *ctx, const char *str, size_t len)
+{
+  RESTFUL_MAPPER_PROFILE_COUNT(PROFILE_BYTES_EMITTED, len);
+
+  static_cast<string *>(ctx)->append(str, len);
+}
+
+#ifdef RESTFUL_MAPPER_PROFILE
+// Heap blocks held by a value tree: every value, every string and the
+// element arrays of objects and arrays
+static size_t tree_allocations(yajl_val value)
+{
+  size_t allocations = 1;
+
+  if (YAJL_IS_STRING(value))
+  {
+    allocations++;
+  }
+  else if (YAJL_IS_NUMBER(value))
+  {
+    // The number text is kept alongside the value
+    allocations++;
+  }
+  else if (YAJL_IS_OBJECT(value))
+  {
+    if (YAJL_GET_OBJECT(value)->len) allocations += 2;
+
+    for (size_t i = 0; i < YAJL_GET_OBJECT(value)->len; i++)
+    {
+      allocations += 1 + tree_allocations(YAJL_GET_OBJECT(value)->values[i]);
+    }
+  }
+  else if (YAJL_IS_ARRAY(value))
+  {
+    if (YAJL_GET_ARRAY(value)->len) allocations++;
+
+    for (size_t i = 0; i < YAJL_GET_ARRAY(value)->len; i++)
+    {
+      allocations += tree_allocations(YAJL_GET_ARRAY(value)->values[i]);
+    }
+  }
+
+  return allocations;
+}
+#endif
+
 void yajl_wrong_type(const string &key, yajl_val value, const string &expected_type)
 {
   ostringstream s;
@@ -61,6 +112,53 @@ void yajl_wrong_type(const string &key, yajl_val value, const string &expected_t
   throw runtime_error(s.str());
 }
 
+// Engine used by all parsers, selected at build time unless changed at run time
+#ifdef RESTFUL_MAPPER_STRUCTURAL_PARSER
+static Json::ParserEngine default_parser_engine = Json::STRUCTURAL_ENGINE;
+#else
+static Json::ParserEngine default_parser_engine = Json::YAJL_ENGINE;
+#endif
+
+void Json::set_parser_engine(const ParserEngine &engine)
+{
+  default_parser_engine = engine;
+}
+
+Json::ParserEngine Json::parser_engine()
+{
+  return default_parser_engine;
+}
+
+string Json::encode(const int &value)
+{
+  return encode(static_cast<long long>(value));
+}
+
+string Json::encode(const long long &value)
+{
+  char buffer[32];
+
+  return string(buffer, format_integer(value, buffer));
+}
+
+string Json::encode(const double &value)
+{
+  char buffer[32];
+  size_t length = format_double(value, buffer);
+
+  if (!length)
+  {
+    yajl_gen_error(yajl_gen_invalid_number);
+  }
+
+  return string(buffer, length);
+}
+
+string Json::encode(const bool &value)
+{
+  return value ? "true" : "false";
+}
+
 void Json::not_found(const string &name)
 {
   ostringstream s;
@@ -93,38 +191,44 @@ void Json::Emitter::reset()
   }
 
   // Allocate JSON_GEN_HANDLE
+  RESTFUL_MAPPER_PROFILE_COUNT(PROFILE_ALLOCATIONS, 1);
   json_gen_ptr_ = static_cast<void *>(yajl_gen_alloc(NULL));
   yajl_gen_config(JSON_GEN_HANDLE, yajl_gen_validate_utf8, 1);
+
+  // Write straight into output_, so the generated document is never copied
+  // out of an intermediate yajl buffer
+  yajl_gen_config(JSON_GEN_HANDLE, yajl_gen_print_callback, yajl_print_output, static_cast<void *>(&output_));
 }
 
 const string &Json::Emitter::dump() const
 {
-  if (output_.empty())
-  {
-    const unsigned char *buf;
-    size_t len;
-
-    yajl_gen_error(yajl_gen_get_buf(JSON_GEN_HANDLE, &buf, &len));
-
-    output_ = string(reinterpret_cast<const char *>(buf), len);
-  }
-
   return output_;
 }
 
 void Json::Emitter::emit(const int &value)
 {
-  yajl_gen_error(yajl_gen_integer(JSON_GEN_HANDLE, value));
+  emit(static_cast<long long>(value));
 }
 
 void Json::Emitter::emit(const long long &value)
 {
-  yajl_gen_error(yajl_gen_integer(JSON_GEN_HANDLE, value));
+  char buffer[32];
+  size_t length = format_integer(value, buffer);
+
+  yajl_gen_error(yajl_gen_number(JSON_GEN_HANDLE, buffer, length));
 }
 
 void Json::Emitter::emit(const double &value)
 {
-  yajl_gen_error(yajl_gen_double(JSON_GEN_HANDLE, value));
+  char buffer[32];
+  size_t length = format_double(value, buffer);
+
+  if (!length)
+  {
+    yajl_gen_error(yajl_gen_invalid_number);
+  }
+
+  yajl_gen_error(yajl_gen_number(JSON_GEN_HANDLE, buffer, length));
 }
 
 void Json::Emitter::emit(const bool &value)
@@ -143,6 +247,31 @@ void Json::Emitter::emit(const char *value)
   emit(string(value));
 }
 
+/**
+ * @brief Emit a map key, such as a field name from a model
+ *
+ * Keys are usually plain ASCII, which is emitted as is. Other keys go through
+ * charset conversion, like any other string.
+ */
+void Json::Emitter::emit_key(const char *key)
+{
+  size_t length = 0;
+  bool is_ascii = true;
+
+  for (const char *c = key; *c; c++, length++)
+  {
+    if (static_cast<unsigned char>(*c) >= 0x80) is_ascii = false;
+  }
+
+  if (!is_ascii)
+  {
+    emit(string(key, length));
+    return;
+  }
+
+  yajl_gen_error(yajl_gen_string(JSON_GEN_HANDLE, reinterpret_cast<const unsigned char *>(key), length));
+}
+
 void Json::Emitter::emit(const vector<int> &value)
 {
   emit_array_open();
@@ -468,6 +597,8 @@ void Json::Emitter::emit_array_close()
 
 Json::Node::Node(const string &name, void *json_node)
 {
+  RESTFUL_MAPPER_PROFILE_COUNT(PROFILE_NODES_VISITED, 1);
+
   name_ = name;
   json_tree_ptr_ = json_node;
 
@@ -515,6 +646,30 @@ map<string, string> Json::Node::dump_map() const
   return r;
 }
 
+bool Json::Node::exists(const string &key) const
+{
+  const char *path[] = { key.c_str(), (const char *) 0 };
+  return yajl_tree_get(JSON_TREE_HANDLE, path, yajl_t_any) != NULL;
+}
+
+Json::Node Json::Node::find(const string &key) const
+{
+  const char *path[] = { key.c_str(), (const char *) 0 };
+  return Node(key, static_cast<void *>(yajl_tree_get(JSON_TREE_HANDLE, path, yajl_t_any)));
+}
+
+/**
+ * @brief Look up a key in the map, without copying the key
+ *
+ * @return the value, or NULL if the key does not exist
+ */
+void *Json::Node::find_tree(const char *key) const
+{
+  const char *path[] = { key, (const char *) 0 };
+
+  return static_cast<void *>(yajl_tree_get(JSON_TREE_HANDLE, path, yajl_t_any));
+}
+
 bool Json::Node::is_null() const
 {
   return YAJL_IS_NULL(JSON_TREE_HANDLE);
@@ -755,22 +910,32 @@ map<string, bool> Json::Node::to_bool_map() const
 Json::Parser::Parser()
 {
   json_tree_ptr_ = NULL;
+  stream_ptr_    = NULL;
 }
 
 Json::Parser::Parser(const string &json_struct)
 {
   json_tree_ptr_ = NULL;
+  stream_ptr_    = NULL;
 
   load(json_struct);
 }
 
 Json::Parser::~Parser()
+{
+  clear();
+}
+
+void Json::Parser::clear()
 {
   if (json_tree_ptr_)
   {
     yajl_tree_free(JSON_TREE_HANDLE);
     json_tree_ptr_ = NULL;
   }
+
+  delete static_cast<StreamParser *>(stream_ptr_);
+  stream_ptr_ = NULL;
 }
 
 bool Json::Parser::is_loaded() const
@@ -780,18 +945,78 @@ bool Json::Parser::is_loaded() const
 
 void Json::Parser::load(const string &json_struct)
 {
-  if (json_tree_ptr_)
+  clear();
+
+  RESTFUL_MAPPER_PROFILE_PHASE(PROFILE_PARSE);
+  RESTFUL_MAPPER_PROFILE_COUNT(PROFILE_BYTES_PARSED, json_struct.size());
+
+  char errors[1024];
+
+  if (default_parser_engine == STRUCTURAL_ENGINE)
   {
-    yajl_tree_free(JSON_TREE_HANDLE);
+    json_tree_ptr_ = structural_parse(json_struct.data(), json_struct.size(), errors, sizeof(errors));
+  }
+  else
+  {
+    json_tree_ptr_ = static_cast<void *>(yajl_tree_parse(json_struct.c_str(), errors, sizeof(errors)));
   }
 
-  char errors[1024];
-  json_tree_ptr_ = static_cast<void *>(yajl_tree_parse(json_struct.c_str(), errors, sizeof(errors)));
+  if (json_tree_ptr_ == NULL)
+  {
+    throw runtime_error(string("JSON parse error:\n") + errors);
+  }
+
+#ifdef RESTFUL_MAPPER_PROFILE
+  RESTFUL_MAPPER_PROFILE_COUNT(PROFILE_ALLOCATIONS, tree_allocations(JSON_TREE_HANDLE));
+#endif
+}
+
+void Json::Parser::begin()
+{
+  clear();
+
+  stream_ptr_ = new StreamParser();
+}
+
+bool Json::Parser::feed(const char *data, const size_t &length)
+{
+  if (!stream_ptr_)
+  {
+    throw runtime_error("No JSON stream begun in parser");
+  }
+
+  RESTFUL_MAPPER_PROFILE_PHASE(PROFILE_PARSE);
+  RESTFUL_MAPPER_PROFILE_COUNT(PROFILE_BYTES_PARSED, length);
+
+  return static_cast<StreamParser *>(stream_ptr_)->feed(data, length);
+}
+
+void Json::Parser::finish()
+{
+  if (!stream_ptr_)
+  {
+    throw runtime_error("No JSON stream begun in parser");
+  }
+
+  StreamParser *stream = static_cast<StreamParser *>(stream_ptr_);
+  stream_ptr_ = NULL;
+
+  {
+    RESTFUL_MAPPER_PROFILE_PHASE(PROFILE_PARSE);
+    json_tree_ptr_ = stream->finish();
+  }
+
+  string errors = stream->error();
+  delete stream;
 
   if (json_tree_ptr_ == NULL)
   {
     throw runtime_error(string("JSON parse error:\n") + errors);
   }
+
+#ifdef RESTFUL_MAPPER_PROFILE
+  RESTFUL_MAPPER_PROFILE_COUNT(PROFILE_ALLOCATIONS, tree_allocations(JSON_TREE_HANDLE));
+#endif
 }
 
 Json::Node Json::Parser::root() const
@@ -840,6 +1065,23 @@ Json::Node Json::Parser::find(const string &key) const
   return find(path);
 }
 
+/**
+ * @brief Look up a key in the root map, without throwing if it is missing
+ *
+ * @return the value, or NULL if the key does not exist
+ */
+void *Json::Parser::find_tree(const char *key) const
+{
+  if (!is_loaded())
+  {
+    throw runtime_error("No JSON loaded in parser");
+  }
+
+  const char *path[] = { key, (const char *) 0 };
+
+  return static_cast<void *>(yajl_tree_get(JSON_TREE_HANDLE, path, yajl_t_any));
+}
+
 Json::Node Json::Parser::find(const char **key) const
 {
   if (!is_loaded())
@@ -0,0 +1,332 @@
+#include <restful_mapper/internal/load_balancer.h>
+#include <restful_mapper/metrics.h>
+#include <ctime>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+using namespace std;
+using namespace restful_mapper;
+
+// Weight of the latest response in the smoothed response time
+static const double RESPONSE_TIME_WEIGHT = 0.3;
+
+// Loads up to this multiple of the least load are chosen from at random
+static const double NEAR_TIE_RATIO = 1.2;
+
+LoadBalancer::LoadBalancer()
+{
+  random_state_ = static_cast<unsigned long>(time(NULL)) ^ static_cast<unsigned long>(reinterpret_cast<size_t>(this));
+
+#ifdef _WIN32
+  CRITICAL_SECTION *mutex = new CRITICAL_SECTION;
+  InitializeCriticalSection(mutex);
+  mutex_ = mutex;
+#else
+  pthread_mutex_t *mutex = new pthread_mutex_t;
+  pthread_mutex_init(mutex, NULL);
+  mutex_ = mutex;
+#endif
+}
+
+LoadBalancer::~LoadBalancer()
+{
+#ifdef _WIN32
+  DeleteCriticalSection(static_cast<CRITICAL_SECTION *>(mutex_));
+  delete static_cast<CRITICAL_SECTION *>(mutex_);
+#else
+  pthread_mutex_destroy(static_cast<pthread_mutex_t *>(mutex_));
+  delete static_cast<pthread_mutex_t *>(mutex_);
+#endif
+}
+
+LoadBalancingPolicy LoadBalancer::policy() const
+{
+  lock();
+  LoadBalancingPolicy policy = policy_;
+  unlock();
+
+  return policy;
+}
+
+void LoadBalancer::set_policy(const LoadBalancingPolicy &policy)
+{
+  lock();
+  policy_ = policy;
+  unlock();
+}
+
+void LoadBalancer::set_urls(const vector<string> &urls)
+{
+  lock();
+
+  replicas_.assign(urls.size(), Replica());
+
+  for (size_t i = 0; i < urls.size(); i++)
+  {
+    replicas_[i].url = urls[i];
+  }
+
+  unlock();
+}
+
+vector<string> LoadBalancer::urls() const
+{
+  vector<string> urls;
+
+  lock();
+
+  vector<Replica>::const_iterator i, i_end = replicas_.end();
+  for (i = replicas_.begin(); i != i_end; ++i)
+  {
+    urls.push_back(i->url);
+  }
+
+  unlock();
+
+  return urls;
+}
+
+size_t LoadBalancer::size() const
+{
+  lock();
+  size_t count = replicas_.size();
+  unlock();
+
+  return count;
+}
+
+string LoadBalancer::url(const size_t &replica) const
+{
+  lock();
+  string url = (replica < replicas_.size()) ? replicas_[replica].url : "";
+  unlock();
+
+  return url;
+}
+
+size_t LoadBalancer::choose(const vector<bool> &excluded)
+{
+  lock();
+  size_t replica = choose_locked(excluded);
+  unlock();
+
+  return replica;
+}
+
+size_t LoadBalancer::choose_locked(const vector<bool> &excluded)
+{
+  if (replicas_.size() < 2)
+  {
+    return 0;
+  }
+
+  double now = monotonic_seconds();
+  vector<size_t> candidates;
+
+  for (size_t i = 0; i < replicas_.size(); i++)
+  {
+    if (is_available(i, excluded, now)) candidates.push_back(i);
+  }
+
+  // Fall back to the replica due back the soonest, preferring those which
+  // are merely excluded
+  if (candidates.empty())
+  {
+    size_t soonest = 0;
+
+    for (size_t i = 1; i < replicas_.size(); i++)
+    {
+      if (replicas_[i].ejected_until < replicas_[soonest].ejected_until) soonest = i;
+    }
+
+    return soonest;
+  }
+
+  if (policy_.strategy == POWER_OF_TWO_CHOICES && candidates.size() > 2)
+  {
+    size_t first  = random(candidates.size());
+    size_t second = random(candidates.size() - 1);
+
+    if (second >= first) second++;
+
+    first  = candidates[first];
+    second = candidates[second];
+
+    return load(second) < load(first) ? second : first;
+  }
+
+  double least = load(candidates[0]);
+
+  for (size_t i = 1; i < candidates.size(); i++)
+  {
+    if (load(candidates[i]) < least) least = load(candidates[i]);
+  }
+
+  // Otherwise the replica which happened to respond fastest would receive
+  // every request
+  vector<size_t> nearest;
+
+  for (size_t i = 0; i < candidates.size(); i++)
+  {
+    if (load(candidates[i]) <= least * NEAR_TIE_RATIO) nearest.push_back(candidates[i]);
+  }
+
+  return nearest[random(nearest.size())];
+}
+
+bool LoadBalancer::has_available(const vector<bool> &excluded) const
+{
+  double now = monotonic_seconds();
+  bool available = false;
+
+  lock();
+
+  for (size_t i = 0; i < replicas_.size() && !available; i++)
+  {
+    available = is_available(i, excluded, now);
+  }
+
+  unlock();
+
+  return available;
+}
+
+bool LoadBalancer::is_ejected(const size_t &replica) const
+{
+  lock();
+  bool ejected = (replica < replicas_.size()) && replicas_[replica].ejected_until > monotonic_seconds();
+  unlock();
+
+  return ejected;
+}
+
+unsigned int LoadBalancer::in_flight(const size_t &replica) const
+{
+  lock();
+  unsigned int count = (replica < replicas_.size()) ? replicas_[replica].in_flight : 0;
+  unlock();
+
+  return count;
+}
+
+void LoadBalancer::start(const size_t &replica)
+{
+  lock();
+
+  if (replica < replicas_.size())
+  {
+    replicas_[replica].in_flight++;
+  }
+
+  unlock();
+}
+
+void LoadBalancer::succeed(const size_t &replica, const double &seconds)
+{
+  lock();
+
+  if (replica >= replicas_.size())
+  {
+    unlock();
+    return;
+  }
+
+  Replica &r = replicas_[replica];
+
+  if (r.in_flight > 0) r.in_flight--;
+
+  r.failures      = 0;
+  r.ejected_until = 0.0;
+
+  if (r.response_time > 0.0)
+  {
+    r.response_time += RESPONSE_TIME_WEIGHT * (seconds - r.response_time);
+  }
+  else
+  {
+    r.response_time = seconds;
+  }
+
+  unlock();
+}
+
+void LoadBalancer::fail(const size_t &replica)
+{
+  lock();
+
+  if (replica >= replicas_.size())
+  {
+    unlock();
+    return;
+  }
+
+  Replica &r = replicas_[replica];
+
+  if (r.in_flight > 0) r.in_flight--;
+
+  r.failures++;
+
+  if (policy_.failure_threshold && r.failures >= policy_.failure_threshold)
+  {
+    r.ejected_until = monotonic_seconds() + policy_.ejection_seconds;
+  }
+
+  unlock();
+}
+
+void LoadBalancer::abandon(const size_t &replica)
+{
+  lock();
+
+  if (replica < replicas_.size() && replicas_[replica].in_flight > 0)
+  {
+    replicas_[replica].in_flight--;
+  }
+
+  unlock();
+}
+
+bool LoadBalancer::is_available(const size_t &replica, const vector<bool> &excluded, const double &now) const
+{
+  if (replica < excluded.size() && excluded[replica])
+  {
+    return false;
+  }
+
+  return replicas_[replica].ejected_until <= now;
+}
+
+double LoadBalancer::load(const size_t &replica) const
+{
+  return (replicas_[replica].in_flight + 1) * replicas_[replica].response_time;
+}
+
+size_t LoadBalancer::random(const size_t &count)
+{
+  // Linear congruential generator, as for the jitter of retry delays
+  random_state_ = random_state_ * 1103515245UL + 12345UL;
+
+  return ((random_state_ >> 16) & 0x7FFF) % count;
+}
+
+void LoadBalancer::lock() const
+{
+#ifdef _WIN32
+  EnterCriticalSection(static_cast<CRITICAL_SECTION *>(mutex_));
+#else
+  pthread_mutex_lock(static_cast<pthread_mutex_t *>(mutex_));
+#endif
+}
+
+void LoadBalancer::unlock() const
+{
+#ifdef _WIN32
+  LeaveCriticalSection(static_cast<CRITICAL_SECTION *>(mutex_));
+#else
+  pthread_mutex_unlock(static_cast<pthread_mutex_t *>(mutex_));
+#endif
+}
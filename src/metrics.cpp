@@ -0,0 +1,241 @@
+#include <restful_mapper/metrics.h>
+#include <restful_mapper/json.h>
+#include <cctype>
+#include <cmath>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#include <sys/time.h>
+#endif
+
+using namespace std;
+using namespace restful_mapper;
+
+double restful_mapper::monotonic_seconds()
+{
+#if defined(_WIN32)
+  LARGE_INTEGER frequency, counter;
+  QueryPerformanceFrequency(&frequency);
+  QueryPerformanceCounter(&counter);
+
+  return double(counter.QuadPart) / double(frequency.QuadPart);
+#elif defined(CLOCK_MONOTONIC)
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return now.tv_sec + now.tv_nsec * 1e-9;
+#else
+  timeval now;
+  gettimeofday(&now, NULL);
+
+  return now.tv_sec + now.tv_usec * 1e-6;
+#endif
+}
+
+void restful_mapper::sleep_seconds(const double &seconds)
+{
+  if (seconds <= 0.0) return;
+
+#ifdef _WIN32
+  Sleep(static_cast<DWORD>(seconds * 1000.0));
+#else
+  timespec duration;
+  duration.tv_sec  = static_cast<time_t>(seconds);
+  duration.tv_nsec = static_cast<long>((seconds - duration.tv_sec) * 1e9);
+  nanosleep(&duration, NULL);
+#endif
+}
+
+Histogram::Histogram() : count_(0), sum_(0.0), max_(0.0)
+{
+  for (size_t i = 0; i < BUCKETS; i++)
+  {
+    buckets_[i] = 0;
+  }
+}
+
+void Histogram::add(const double &seconds)
+{
+  double microseconds = seconds * 1e6;
+  size_t index = 0;
+
+  while (index < BUCKETS - 1 && microseconds >= 1.0)
+  {
+    microseconds /= 2.0;
+    index++;
+  }
+
+  buckets_[index]++;
+  count_++;
+  sum_ += seconds;
+
+  if (seconds > max_) max_ = seconds;
+}
+
+double Histogram::percentile(const double &percent) const
+{
+  if (!count_) return 0.0;
+
+  double rank = count_ * percent / 100.0;
+  size_t seen = 0;
+
+  for (size_t i = 0; i < BUCKETS; i++)
+  {
+    seen += buckets_[i];
+
+    if (seen >= rank && seen > 0)
+    {
+      double upper_bound = double(1UL << i) * 1e-6;
+
+      return upper_bound < max_ ? upper_bound : max_;
+    }
+  }
+
+  return max_;
+}
+
+LatencyWindow::LatencyWindow(const size_t &size) : size_(size ? size : 1), next_(0)
+{
+  samples_.reserve(size_);
+}
+
+void LatencyWindow::add(const double &seconds)
+{
+  if (samples_.size() < size_)
+  {
+    samples_.push_back(seconds);
+    return;
+  }
+
+  samples_[next_] = seconds;
+  next_ = (next_ + 1) % size_;
+}
+
+double LatencyWindow::percentile(const double &percent) const
+{
+  if (samples_.empty()) return 0.0;
+
+  // Nearest rank, on a copy so the order of the samples is kept
+  size_t rank = static_cast<size_t>(ceil(samples_.size() * percent / 100.0));
+
+  if (rank < 1) rank = 1;
+  if (rank > samples_.size()) rank = samples_.size();
+
+  vector<double> sorted(samples_);
+  nth_element(sorted.begin(), sorted.begin() + (rank - 1), sorted.end());
+
+  return sorted[rank - 1];
+}
+
+void RequestStatistics::request_finished(const RequestMetrics &metrics)
+{
+  EndpointStatistics &statistics = endpoints_[endpoint_key(metrics.method, metrics.endpoint)];
+
+  statistics.requests++;
+  statistics.retries += metrics.retries ? 1 : 0;
+  statistics.hedges += metrics.hedged ? 1 : 0;
+  statistics.bytes_sent += metrics.bytes_sent;
+  statistics.bytes_received += metrics.bytes_received;
+  statistics.status_codes[metrics.status]++;
+
+  if (metrics.status == 0 || metrics.status >= 400)
+  {
+    statistics.errors++;
+  }
+
+  statistics.connect_time.add(metrics.connect_time);
+  statistics.first_byte_time.add(metrics.first_byte_time);
+  statistics.total_time.add(metrics.total_time);
+}
+
+void RequestStatistics::response_decoded(const RequestMetrics &request, const string &model, const double &seconds)
+{
+  endpoints_[endpoint_key(request.method, request.endpoint)].decode_time.add(seconds);
+}
+
+static void emit_histogram(Json::Emitter &emitter, const char *name, const Histogram &histogram)
+{
+  emitter.emit_key(name);
+  emitter.emit_map_open();
+  emitter.emit("count", static_cast<long long>(histogram.count()));
+  emitter.emit("mean", histogram.mean());
+  emitter.emit("p50", histogram.percentile(50));
+  emitter.emit("p90", histogram.percentile(90));
+  emitter.emit("p99", histogram.percentile(99));
+  emitter.emit("max", histogram.max());
+  emitter.emit_map_close();
+}
+
+string RequestStatistics::to_json() const
+{
+  Json::Emitter emitter;
+
+  emitter.emit_map_open();
+
+  EndpointMap::const_iterator i, i_end = endpoints_.end();
+  for (i = endpoints_.begin(); i != i_end; ++i)
+  {
+    const EndpointStatistics &statistics = i->second;
+
+    emitter.emit_key(i->first.c_str());
+    emitter.emit_map_open();
+    emitter.emit("requests", static_cast<long long>(statistics.requests));
+    emitter.emit("errors", static_cast<long long>(statistics.errors));
+    emitter.emit("retries", static_cast<long long>(statistics.retries));
+    emitter.emit("hedges", static_cast<long long>(statistics.hedges));
+    emitter.emit("bytes_sent", statistics.bytes_sent);
+    emitter.emit("bytes_received", statistics.bytes_received);
+
+    emitter.emit_key("status_codes");
+    emitter.emit_map_open();
+
+    map<long, size_t>::const_iterator j, j_end = statistics.status_codes.end();
+    for (j = statistics.status_codes.begin(); j != j_end; ++j)
+    {
+      emitter.emit(Json::encode(static_cast<long long>(j->first)), static_cast<long long>(j->second));
+    }
+
+    emitter.emit_map_close();
+
+    emit_histogram(emitter, "connect_time", statistics.connect_time);
+    emit_histogram(emitter, "first_byte_time", statistics.first_byte_time);
+    emit_histogram(emitter, "total_time", statistics.total_time);
+    emit_histogram(emitter, "decode_time", statistics.decode_time);
+    emitter.emit_map_close();
+  }
+
+  emitter.emit_map_close();
+
+  return emitter.dump();
+}
+
+string RequestStatistics::endpoint_key(const string &method, const string &endpoint)
+{
+  string key = method + " ";
+  string path = endpoint.substr(0, endpoint.find('?'));
+
+  size_t start = 0;
+
+  while (start < path.size())
+  {
+    size_t end = path.find('/', start + 1);
+    if (end == string::npos) end = path.size();
+
+    // Segment including its leading slash
+    string segment = path.substr(start, end - start);
+    bool numeric = segment.size() > 1;
+
+    for (size_t i = 1; i < segment.size() && numeric; i++)
+    {
+      numeric = isdigit(static_cast<unsigned char>(segment[i])) != 0;
+    }
+
+    key += numeric ? "/:id" : segment;
+    start = end;
+  }
+
+  return key;
+}
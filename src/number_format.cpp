@@ -0,0 +1,390 @@
+#include <restful_mapper/internal/number_format.h>
+#include <cstring>
+
+using namespace std;
+
+// --------------------------------------------------------------------------------
+// Integers
+// --------------------------------------------------------------------------------
+static const char DIGIT_PAIRS[] =
+  "0001020304050607080910111213141516171819"
+  "2021222324252627282930313233343536373839"
+  "4041424344454647484950515253545556575859"
+  "6061626364656667686970717273747576777879"
+  "8081828384858687888990919293949596979899";
+
+size_t format_integer(const long long &value, char *buffer)
+{
+  unsigned long long magnitude = static_cast<unsigned long long>(value);
+
+  if (value < 0)
+  {
+    magnitude = 0 - magnitude;
+  }
+
+  // Digits are produced two at a time, from the least significant end
+  char digits[20];
+  char *p = digits + sizeof(digits);
+
+  while (magnitude >= 100)
+  {
+    size_t pair = static_cast<size_t>(magnitude % 100) * 2;
+    magnitude /= 100;
+
+    *--p = DIGIT_PAIRS[pair + 1];
+    *--p = DIGIT_PAIRS[pair];
+  }
+
+  if (magnitude >= 10)
+  {
+    size_t pair = static_cast<size_t>(magnitude) * 2;
+
+    *--p = DIGIT_PAIRS[pair + 1];
+    *--p = DIGIT_PAIRS[pair];
+  }
+  else
+  {
+    *--p = static_cast<char>('0' + magnitude);
+  }
+
+  size_t length = 0;
+
+  if (value < 0)
+  {
+    buffer[length++] = '-';
+  }
+
+  size_t count = digits + sizeof(digits) - p;
+  memcpy(buffer + length, p, count);
+
+  return length + count;
+}
+
+// --------------------------------------------------------------------------------
+// Doubles
+// --------------------------------------------------------------------------------
+static const unsigned long long DOUBLE_SIGN_MASK        = 0x8000000000000000ULL;
+static const unsigned long long DOUBLE_EXPONENT_MASK    = 0x7FF0000000000000ULL;
+static const unsigned long long DOUBLE_SIGNIFICAND_MASK = 0x000FFFFFFFFFFFFFULL;
+static const unsigned long long DOUBLE_HIDDEN_BIT       = 0x0010000000000000ULL;
+static const int DOUBLE_SIGNIFICAND_SIZE = 52;
+static const int DOUBLE_EXPONENT_BIAS    = 0x3FF + DOUBLE_SIGNIFICAND_SIZE;
+
+static const unsigned int POWERS_OF_TEN[] = {
+  1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000
+};
+
+// Normalized significands and binary exponents of 10^-348, 10^-340, ..., 10^340
+static const unsigned long long CACHED_POWERS_F[] = {
+  0xfa8fd5a0081c0288ULL, 0xbaaee17fa23ebf76ULL, 0x8b16fb203055ac76ULL, 0xcf42894a5dce35eaULL,
+  0x9a6bb0aa55653b2dULL, 0xe61acf033d1a45dfULL, 0xab70fe17c79ac6caULL, 0xff77b1fcbebcdc4fULL,
+  0xbe5691ef416bd60cULL, 0x8dd01fad907ffc3cULL, 0xd3515c2831559a83ULL, 0x9d71ac8fada6c9b5ULL,
+  0xea9c227723ee8bcbULL, 0xaecc49914078536dULL, 0x823c12795db6ce57ULL, 0xc21094364dfb5637ULL,
+  0x9096ea6f3848984fULL, 0xd77485cb25823ac7ULL, 0xa086cfcd97bf97f4ULL, 0xef340a98172aace5ULL,
+  0xb23867fb2a35b28eULL, 0x84c8d4dfd2c63f3bULL, 0xc5dd44271ad3cdbaULL, 0x936b9fcebb25c996ULL,
+  0xdbac6c247d62a584ULL, 0xa3ab66580d5fdaf6ULL, 0xf3e2f893dec3f126ULL, 0xb5b5ada8aaff80b8ULL,
+  0x87625f056c7c4a8bULL, 0xc9bcff6034c13053ULL, 0x964e858c91ba2655ULL, 0xdff9772470297ebdULL,
+  0xa6dfbd9fb8e5b88fULL, 0xf8a95fcf88747d94ULL, 0xb94470938fa89bcfULL, 0x8a08f0f8bf0f156bULL,
+  0xcdb02555653131b6ULL, 0x993fe2c6d07b7facULL, 0xe45c10c42a2b3b06ULL, 0xaa242499697392d3ULL,
+  0xfd87b5f28300ca0eULL, 0xbce5086492111aebULL, 0x8cbccc096f5088ccULL, 0xd1b71758e219652cULL,
+  0x9c40000000000000ULL, 0xe8d4a51000000000ULL, 0xad78ebc5ac620000ULL, 0x813f3978f8940984ULL,
+  0xc097ce7bc90715b3ULL, 0x8f7e32ce7bea5c70ULL, 0xd5d238a4abe98068ULL, 0x9f4f2726179a2245ULL,
+  0xed63a231d4c4fb27ULL, 0xb0de65388cc8ada8ULL, 0x83c7088e1aab65dbULL, 0xc45d1df942711d9aULL,
+  0x924d692ca61be758ULL, 0xda01ee641a708deaULL, 0xa26da3999aef774aULL, 0xf209787bb47d6b85ULL,
+  0xb454e4a179dd1877ULL, 0x865b86925b9bc5c2ULL, 0xc83553c5c8965d3dULL, 0x952ab45cfa97a0b3ULL,
+  0xde469fbd99a05fe3ULL, 0xa59bc234db398c25ULL, 0xf6c69a72a3989f5cULL, 0xb7dcbf5354e9beceULL,
+  0x88fcf317f22241e2ULL, 0xcc20ce9bd35c78a5ULL, 0x98165af37b2153dfULL, 0xe2a0b5dc971f303aULL,
+  0xa8d9d1535ce3b396ULL, 0xfb9b7cd9a4a7443cULL, 0xbb764c4ca7a44410ULL, 0x8bab8eefb6409c1aULL,
+  0xd01fef10a657842cULL, 0x9b10a4e5e9913129ULL, 0xe7109bfba19c0c9dULL, 0xac2820d9623bf429ULL,
+  0x80444b5e7aa7cf85ULL, 0xbf21e44003acdd2dULL, 0x8e679c2f5e44ff8fULL, 0xd433179d9c8cb841ULL,
+  0x9e19db92b4e31ba9ULL, 0xeb96bf6ebadf77d9ULL, 0xaf87023b9bf0ee6bULL,
+};
+
+static const short CACHED_POWERS_E[] = {
+  -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980,
+  -954, -927, -901, -874, -847, -821, -794, -768, -741, -715,
+  -688, -661, -635, -608, -582, -555, -529, -502, -475, -449,
+  -422, -396, -369, -343, -316, -289, -263, -236, -210, -183,
+  -157, -130, -103, -77, -50, -24, 3, 30, 56, 83,
+  109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+  375, 402, 428, 455, 481, 508, 534, 561, 588, 614,
+  641, 667, 694, 720, 747, 774, 800, 827, 853, 880,
+  907, 933, 960, 986, 1013, 1039, 1066,
+};
+
+// Floating point value with a 64 bit significand, f * 2^e
+struct DiyFp
+{
+  DiyFp() : f(0), e(0) {}
+  DiyFp(const unsigned long long &significand, const int &exponent) : f(significand), e(exponent) {}
+
+  unsigned long long f;
+  int e;
+};
+
+static DiyFp diy_fp_from_bits(const unsigned long long &bits)
+{
+  int biased_exponent = static_cast<int>((bits & DOUBLE_EXPONENT_MASK) >> DOUBLE_SIGNIFICAND_SIZE);
+  unsigned long long significand = bits & DOUBLE_SIGNIFICAND_MASK;
+
+  if (biased_exponent != 0)
+  {
+    return DiyFp(significand + DOUBLE_HIDDEN_BIT, biased_exponent - DOUBLE_EXPONENT_BIAS);
+  }
+
+  // Subnormal
+  return DiyFp(significand, 1 - DOUBLE_EXPONENT_BIAS);
+}
+
+static DiyFp multiply(const DiyFp &x, const DiyFp &y)
+{
+  const unsigned long long mask = 0xFFFFFFFFULL;
+
+  unsigned long long a = x.f >> 32, b = x.f & mask;
+  unsigned long long c = y.f >> 32, d = y.f & mask;
+
+  unsigned long long ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+  unsigned long long middle = (bd >> 32) + (ad & mask) + (bc & mask);
+
+  // Round the discarded low half
+  middle += 1ULL << 31;
+
+  return DiyFp(ac + (ad >> 32) + (bc >> 32) + (middle >> 32), x.e + y.e + 64);
+}
+
+static DiyFp normalize(DiyFp x)
+{
+  while (!(x.f & (1ULL << 63)))
+  {
+    x.f <<= 1;
+    x.e--;
+  }
+
+  return x;
+}
+
+// Scaled neighbours halfway to the adjacent doubles, sharing the exponent of plus
+static void boundaries(const DiyFp &v, DiyFp &minus, DiyFp &plus)
+{
+  plus = normalize(DiyFp((v.f << 1) + 1, v.e - 1));
+
+  // The gap below a power of two is half the gap above it
+  minus = (v.f == DOUBLE_HIDDEN_BIT) ? DiyFp((v.f << 2) - 1, v.e - 2) : DiyFp((v.f << 1) - 1, v.e - 1);
+  minus.f <<= minus.e - plus.e;
+  minus.e = plus.e;
+}
+
+// Cached power of ten c, such that e + c.e + 64 falls within [-60, -32]
+static DiyFp cached_power(const int &e, int &decimal_exponent)
+{
+  double dk = (-61 - e) * 0.30102999566398114 + 347;
+  int k = static_cast<int>(dk);
+
+  if (dk - k > 0.0)
+  {
+    k++;
+  }
+
+  size_t index = static_cast<size_t>((k >> 3) + 1);
+  decimal_exponent = -(-348 + static_cast<int>(index << 3));
+
+  return DiyFp(CACHED_POWERS_F[index], CACHED_POWERS_E[index]);
+}
+
+static void round_weed(char *buffer, const int &length, const unsigned long long &delta, unsigned long long rest,
+                       const unsigned long long &ten_kappa, const unsigned long long &distance)
+{
+  // Move the last digit towards the exact value while staying within the boundaries
+  while (rest < distance && delta - rest >= ten_kappa &&
+         (rest + ten_kappa < distance || distance - rest > rest + ten_kappa - distance))
+  {
+    buffer[length - 1]--;
+    rest += ten_kappa;
+  }
+}
+
+static void generate_digits(const DiyFp &w, const DiyFp &upper, unsigned long long delta,
+                            char *buffer, int &length, int &k)
+{
+  const DiyFp one(1ULL << -upper.e, upper.e);
+  unsigned long long distance = upper.f - w.f;
+
+  unsigned int integral       = static_cast<unsigned int>(upper.f >> -one.e);
+  unsigned long long fraction = upper.f & (one.f - 1);
+
+  int kappa = 10;
+
+  while (kappa > 0 && integral < POWERS_OF_TEN[kappa - 1])
+  {
+    kappa--;
+  }
+
+  length = 0;
+
+  while (kappa > 0)
+  {
+    unsigned int digit = integral / POWERS_OF_TEN[kappa - 1];
+    integral %= POWERS_OF_TEN[kappa - 1];
+
+    if (digit || length)
+    {
+      buffer[length++] = static_cast<char>('0' + digit);
+    }
+
+    kappa--;
+
+    unsigned long long rest = (static_cast<unsigned long long>(integral) << -one.e) + fraction;
+
+    if (rest <= delta)
+    {
+      k += kappa;
+      round_weed(buffer, length, delta, rest, static_cast<unsigned long long>(POWERS_OF_TEN[kappa]) << -one.e, distance);
+      return;
+    }
+  }
+
+  for (;;)
+  {
+    fraction *= 10;
+    delta    *= 10;
+
+    char digit = static_cast<char>(fraction >> -one.e);
+
+    if (digit || length)
+    {
+      buffer[length++] = static_cast<char>('0' + digit);
+    }
+
+    fraction &= one.f - 1;
+    kappa--;
+
+    if (fraction < delta)
+    {
+      k += kappa;
+      round_weed(buffer, length, delta, fraction, one.f, -kappa < 10 ? distance * POWERS_OF_TEN[-kappa] : 0);
+      return;
+    }
+  }
+}
+
+// Shortest digits d and exponent k such that d * 10^k reads back as the value
+static void grisu2(const unsigned long long &bits, char *buffer, int &length, int &k)
+{
+  DiyFp v = diy_fp_from_bits(bits);
+  DiyFp minus, plus;
+  boundaries(v, minus, plus);
+
+  DiyFp c = cached_power(plus.e, k);
+  DiyFp w = multiply(normalize(v), c);
+  DiyFp upper = multiply(plus, c);
+  DiyFp lower = multiply(minus, c);
+
+  // Stay clear of the boundaries, which may be off by one after rounding
+  upper.f--;
+  lower.f++;
+
+  generate_digits(w, upper, upper.f - lower.f, buffer, length, k);
+}
+
+static char *write_exponent(int exponent, char *p)
+{
+  *p++ = 'e';
+  *p++ = exponent < 0 ? '-' : '+';
+
+  if (exponent < 0)
+  {
+    exponent = -exponent;
+  }
+
+  // At least two digits, as printf does
+  if (exponent >= 100)
+  {
+    *p++ = static_cast<char>('0' + exponent / 100);
+    exponent %= 100;
+  }
+
+  *p++ = DIGIT_PAIRS[exponent * 2];
+  *p++ = DIGIT_PAIRS[exponent * 2 + 1];
+
+  return p;
+}
+
+size_t format_double(const double &value, char *buffer)
+{
+  unsigned long long bits;
+  memcpy(&bits, &value, sizeof(bits));
+
+  if ((bits & DOUBLE_EXPONENT_MASK) == DOUBLE_EXPONENT_MASK)
+  {
+    return 0;
+  }
+
+  char *p = buffer;
+
+  if (bits & DOUBLE_SIGN_MASK)
+  {
+    *p++ = '-';
+    bits &= ~DOUBLE_SIGN_MASK;
+  }
+
+  if (bits == 0)
+  {
+    memcpy(p, "0.0", 3);
+    return p + 3 - buffer;
+  }
+
+  char digits[20];
+  int length, k;
+  grisu2(bits, digits, length, k);
+
+  while (length > 1 && digits[length - 1] == '0')
+  {
+    length--;
+    k++;
+  }
+
+  // Decimal exponent of the first digit
+  int exponent = length + k - 1;
+
+  if (exponent < -4 || exponent >= 20)
+  {
+    *p++ = digits[0];
+
+    if (length > 1)
+    {
+      *p++ = '.';
+      memcpy(p, digits + 1, length - 1);
+      p += length - 1;
+    }
+
+    p = write_exponent(exponent, p);
+  }
+  else if (k >= 0)
+  {
+    memcpy(p, digits, length);
+    p += length;
+    memset(p, '0', k);
+    p += k;
+    memcpy(p, ".0", 2);
+    p += 2;
+  }
+  else if (length + k > 0)
+  {
+    memcpy(p, digits, length + k);
+    p += length + k;
+    *p++ = '.';
+    memcpy(p, digits + length + k, -k);
+    p += -k;
+  }
+  else
+  {
+    *p++ = '0';
+    *p++ = '.';
+    memset(p, '0', -(length + k));
+    p += -(length + k);
+    memcpy(p, digits, length);
+    p += length;
+  }
+
+  return p - buffer;
+}
@@ -0,0 +1,167 @@
+#include <restful_mapper/profile.h>
+#include <restful_mapper/metrics.h>
+#include <restful_mapper/json.h>
+
+using namespace std;
+using namespace restful_mapper;
+
+static ProfileScope *profile_current_scope = NULL;
+
+static Profile::ModelMap &profile_models()
+{
+  static Profile::ModelMap models;
+
+  return models;
+}
+
+static ModelProfile &unattributed_profile()
+{
+  static ModelProfile &profile = profile_models()[""];
+
+  return profile;
+}
+
+ModelProfile::ModelProfile()
+{
+  for (size_t i = 0; i < PROFILE_COUNTERS; i++)
+  {
+    counters[i] = 0;
+  }
+
+  for (size_t i = 0; i < PROFILE_PHASES; i++)
+  {
+    calls[i] = 0;
+    seconds[i] = 0.0;
+  }
+}
+
+bool Profile::enabled()
+{
+#ifdef RESTFUL_MAPPER_PROFILE
+  return true;
+#else
+  return false;
+#endif
+}
+
+void Profile::count(const ProfileCounter &counter, const size_t &amount)
+{
+  ModelProfile *profile = profile_current_scope ? profile_current_scope->profile_ : &unattributed_profile();
+
+  profile->counters[counter] += amount;
+}
+
+const Profile::ModelMap &Profile::models()
+{
+  return profile_models();
+}
+
+void Profile::reset()
+{
+  // Entries are zeroed rather than erased, as open scopes point into the map
+  ModelMap::iterator i, i_end = profile_models().end();
+  for (i = profile_models().begin(); i != i_end; ++i)
+  {
+    i->second = ModelProfile();
+  }
+}
+
+string Profile::to_json()
+{
+  // Emitting is profiled too, so work on a copy of the current figures
+  ModelMap models = profile_models();
+  Json::Emitter emitter;
+
+  emitter.emit_map_open();
+
+  ModelMap::const_iterator i, i_end = models.end();
+  for (i = models.begin(); i != i_end; ++i)
+  {
+    const ModelProfile &profile = i->second;
+
+    emitter.emit_key(i->first.c_str());
+    emitter.emit_map_open();
+
+    for (size_t phase = 0; phase < PROFILE_PHASES; phase++)
+    {
+      emitter.emit_key(phase_name(static_cast<ProfilePhase>(phase)));
+      emitter.emit_map_open();
+      emitter.emit("calls", static_cast<long long>(profile.calls[phase]));
+      emitter.emit("seconds", profile.seconds[phase]);
+      emitter.emit_map_close();
+    }
+
+    for (size_t counter = 0; counter < PROFILE_COUNTERS; counter++)
+    {
+      emitter.emit(counter_name(static_cast<ProfileCounter>(counter)), static_cast<long long>(profile.counters[counter]));
+    }
+
+    emitter.emit_map_close();
+  }
+
+  emitter.emit_map_close();
+
+  return emitter.dump();
+}
+
+const char *Profile::counter_name(const ProfileCounter &counter)
+{
+  switch (counter)
+  {
+    case PROFILE_BYTES_PARSED:      return "bytes_parsed";
+    case PROFILE_BYTES_EMITTED:     return "bytes_emitted";
+    case PROFILE_NODES_VISITED:     return "nodes_visited";
+    case PROFILE_FIELDS_DECODED:    return "fields_decoded";
+    case PROFILE_FIELDS_ENCODED:    return "fields_encoded";
+    case PROFILE_ICONV_CONVERSIONS: return "iconv_conversions";
+    case PROFILE_ALLOCATIONS:       return "allocations";
+    default:                        return "";
+  }
+}
+
+const char *Profile::phase_name(const ProfilePhase &phase)
+{
+  switch (phase)
+  {
+    case PROFILE_PARSE:  return "parse";
+    case PROFILE_DECODE: return "decode";
+    case PROFILE_ENCODE: return "encode";
+    default:             return "";
+  }
+}
+
+ProfileScope::ProfileScope(const string &model, const ProfilePhase &phase)
+  : profile_(&profile_models()[model]), phase_(phase)
+{
+  enter();
+}
+
+ProfileScope::ProfileScope(const ProfilePhase &phase)
+  : profile_(profile_current_scope ? profile_current_scope->profile_ : &unattributed_profile()), phase_(phase)
+{
+  enter();
+}
+
+void ProfileScope::enter()
+{
+  parent_ = profile_current_scope;
+  profile_current_scope = this;
+
+  nested_ = 0.0;
+  start_ = monotonic_seconds();
+}
+
+ProfileScope::~ProfileScope()
+{
+  double elapsed = monotonic_seconds() - start_;
+
+  profile_->calls[phase_]++;
+  profile_->seconds[phase_] += elapsed - nested_;
+
+  if (parent_)
+  {
+    parent_->nested_ += elapsed;
+  }
+
+  profile_current_scope = parent_;
+}
@@ -0,0 +1,228 @@
+#include <restful_mapper/internal/rate_limiter.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+using namespace std;
+using namespace restful_mapper;
+
+// Interval at which to check whether a request slot has been released
+static const double IN_FLIGHT_POLL_INTERVAL = 0.001;
+
+// Longest sleep while waiting for a rate limit, so a cancellation is noticed
+static const double CANCEL_POLL_INTERVAL = 0.02;
+
+// Whether the prefix covers the endpoint, on a path segment boundary
+static bool matches_prefix(const string &prefix, const string &endpoint)
+{
+  if (endpoint.compare(0, prefix.size(), prefix) != 0) return false;
+  if (prefix.empty() || endpoint.size() == prefix.size()) return true;
+
+  char next = endpoint[prefix.size()];
+
+  return prefix[prefix.size() - 1] == '/' || next == '/' || next == '?';
+}
+
+RateLimiter::RateLimiter()
+{
+#ifdef _WIN32
+  CRITICAL_SECTION *mutex = new CRITICAL_SECTION;
+  InitializeCriticalSection(mutex);
+  mutex_ = mutex;
+#else
+  pthread_mutex_t *mutex = new pthread_mutex_t;
+  pthread_mutex_init(mutex, NULL);
+  mutex_ = mutex;
+#endif
+}
+
+RateLimiter::~RateLimiter()
+{
+#ifdef _WIN32
+  DeleteCriticalSection(static_cast<CRITICAL_SECTION *>(mutex_));
+  delete static_cast<CRITICAL_SECTION *>(mutex_);
+#else
+  pthread_mutex_destroy(static_cast<pthread_mutex_t *>(mutex_));
+  delete static_cast<pthread_mutex_t *>(mutex_);
+#endif
+}
+
+void RateLimiter::set_rate(const string &prefix, const double &requests_per_second, const double &burst)
+{
+  lock();
+
+  Limit &limit = limits_[prefix];
+  limit.rate    = requests_per_second;
+  limit.burst   = burst < 1.0 ? 1.0 : burst;
+  limit.tokens  = limit.burst;
+  limit.updated = monotonic_seconds();
+
+  unlock();
+}
+
+void RateLimiter::set_max_in_flight(const string &prefix, const unsigned int &max_in_flight)
+{
+  lock();
+  limits_[prefix].max_in_flight = max_in_flight;
+  unlock();
+}
+
+void RateLimiter::clear()
+{
+  lock();
+
+  // Keep the counts of requests in flight, which are still to be released
+  LimitMap::iterator i, i_end = limits_.end();
+  for (i = limits_.begin(); i != i_end; ++i)
+  {
+    i->second.rate          = 0.0;
+    i->second.max_in_flight = 0;
+  }
+
+  unlock();
+}
+
+bool RateLimiter::acquire(const string &endpoint, const Deadline *deadline, Slot &slot)
+{
+  for (;;)
+  {
+    double wait = 0.0;
+
+    if (take(endpoint, wait, slot))
+    {
+      return true;
+    }
+
+    if (deadline && (deadline->is_cancelled() || (deadline->is_limited() && deadline->remaining() <= wait)))
+    {
+      return false;
+    }
+
+    if (deadline && deadline->is_cancellable() && wait > CANCEL_POLL_INTERVAL)
+    {
+      wait = CANCEL_POLL_INTERVAL;
+    }
+
+    sleep_seconds(wait);
+  }
+}
+
+bool RateLimiter::try_acquire(const string &endpoint, Slot &slot)
+{
+  double wait = 0.0;
+
+  return take(endpoint, wait, slot);
+}
+
+void RateLimiter::release(Slot &slot)
+{
+  lock();
+
+  Limit *limit = static_cast<Limit *>(slot.limit_);
+
+  if (limit && limit->in_flight > 0)
+  {
+    limit->in_flight--;
+  }
+
+  slot.limit_ = NULL;
+
+  unlock();
+}
+
+unsigned int RateLimiter::in_flight(const string &prefix) const
+{
+  lock();
+
+  LimitMap::const_iterator i = limits_.find(prefix);
+  unsigned int count = (i != limits_.end()) ? i->second.in_flight : 0;
+
+  unlock();
+
+  return count;
+}
+
+void RateLimiter::lock() const
+{
+#ifdef _WIN32
+  EnterCriticalSection(static_cast<CRITICAL_SECTION *>(mutex_));
+#else
+  pthread_mutex_lock(static_cast<pthread_mutex_t *>(mutex_));
+#endif
+}
+
+void RateLimiter::unlock() const
+{
+#ifdef _WIN32
+  LeaveCriticalSection(static_cast<CRITICAL_SECTION *>(mutex_));
+#else
+  pthread_mutex_unlock(static_cast<pthread_mutex_t *>(mutex_));
+#endif
+}
+
+bool RateLimiter::take(const string &endpoint, double &wait, Slot &slot)
+{
+  lock();
+
+  Limit *limit = find(endpoint);
+
+  if (!limit)
+  {
+    unlock();
+    return true;
+  }
+
+  if (limit->rate > 0.0)
+  {
+    double now = monotonic_seconds();
+
+    limit->tokens += (now - limit->updated) * limit->rate;
+    limit->updated = now;
+
+    if (limit->tokens > limit->burst) limit->tokens = limit->burst;
+  }
+
+  bool taken = false;
+
+  if (limit->max_in_flight && limit->in_flight >= limit->max_in_flight)
+  {
+    wait = IN_FLIGHT_POLL_INTERVAL;
+  }
+  else if (limit->rate > 0.0 && limit->tokens < 1.0)
+  {
+    wait = (1.0 - limit->tokens) / limit->rate;
+  }
+  else
+  {
+    if (limit->rate > 0.0) limit->tokens -= 1.0;
+    limit->in_flight++;
+
+    slot.limit_ = limit;
+    taken = true;
+  }
+
+  unlock();
+
+  return taken;
+}
+
+RateLimiter::Limit *RateLimiter::find(const string &endpoint)
+{
+  Limit *longest = NULL;
+  size_t longest_size = 0;
+
+  LimitMap::iterator i, i_end = limits_.end();
+  for (i = limits_.begin(); i != i_end; ++i)
+  {
+    if (matches_prefix(i->first, endpoint) && (!longest || i->first.size() > longest_size))
+    {
+      longest = &i->second;
+      longest_size = i->first.size();
+    }
+  }
+
+  return longest;
+}
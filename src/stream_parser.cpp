@@ -0,0 +1,337 @@
+#include <restful_mapper/internal/stream_parser.h>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+
+extern "C" {
+#include <yajl/yajl_parse.h>
+#include <yajl/yajl_tree.h>
+}
+
+using namespace std;
+using namespace restful_mapper;
+
+// Helper macros
+#define PARSER_HANDLE static_cast<yajl_handle>(handle_)
+#define STREAM(ctx) static_cast<StreamParser *>(ctx)
+
+// Helper functions
+static yajl_val new_value(const yajl_type &type)
+{
+  yajl_val value = static_cast<yajl_val>(malloc(sizeof(yajl_val_s)));
+
+  if (value)
+  {
+    memset(value, 0, sizeof(yajl_val_s));
+    value->type = type;
+  }
+
+  return value;
+}
+
+static char *copy_string(const char *data, const size_t &length)
+{
+  char *copy = static_cast<char *>(malloc(length + 1));
+
+  if (copy)
+  {
+    memcpy(copy, data, length);
+    copy[length] = '\0';
+  }
+
+  return copy;
+}
+
+StreamParser::StreamParser() : failed_(false)
+{
+  static const yajl_callbacks callbacks = {
+    StreamParser::on_null,
+    StreamParser::on_boolean,
+    NULL,
+    NULL,
+    StreamParser::on_number,
+    StreamParser::on_string,
+    StreamParser::on_start_map,
+    StreamParser::on_map_key,
+    StreamParser::on_end_map,
+    StreamParser::on_start_array,
+    StreamParser::on_end_array
+  };
+
+  handle_ = static_cast<void *>(yajl_alloc(&callbacks, NULL, this));
+
+  // Match yajl_tree_parse
+  yajl_config(PARSER_HANDLE, yajl_allow_comments, 1);
+}
+
+StreamParser::~StreamParser()
+{
+  yajl_free(PARSER_HANDLE);
+  clear();
+}
+
+bool StreamParser::feed(const char *data, const size_t &length)
+{
+  if (failed_)
+  {
+    return false;
+  }
+
+  const unsigned char *text = reinterpret_cast<const unsigned char *>(data);
+
+  if (yajl_parse(PARSER_HANDLE, text, length) != yajl_status_ok)
+  {
+    fail(data, length);
+  }
+
+  return !failed_;
+}
+
+void *StreamParser::finish()
+{
+  if (failed_)
+  {
+    return NULL;
+  }
+
+  if (yajl_complete_parse(PARSER_HANDLE) != yajl_status_ok)
+  {
+    fail(NULL, 0);
+    return NULL;
+  }
+
+  if (values_.size() != 1 || !frames_.empty())
+  {
+    failed_ = true;
+    error_  = "premature EOF";
+    clear();
+
+    return NULL;
+  }
+
+  void *root = values_.back();
+  values_.clear();
+
+  return root;
+}
+
+void StreamParser::fail(const char *data, const size_t &length)
+{
+  const unsigned char *text = reinterpret_cast<const unsigned char *>(data);
+  unsigned char *message = yajl_get_error(PARSER_HANDLE, 0, text, length);
+
+  failed_ = true;
+  error_  = reinterpret_cast<char *>(message);
+
+  yajl_free_error(PARSER_HANDLE, message);
+  clear();
+}
+
+/**
+ * @brief Releases the values parsed so far
+ */
+void StreamParser::clear()
+{
+  for (size_t i = 0; i < values_.size(); i++)
+  {
+    yajl_tree_free(static_cast<yajl_val>(values_[i]));
+  }
+
+  for (size_t i = 0; i < keys_.size(); i++)
+  {
+    free(keys_[i]);
+  }
+
+  values_.clear();
+  keys_.clear();
+  frames_.clear();
+}
+
+int StreamParser::add(void *value)
+{
+  if (!value)
+  {
+    return 0;
+  }
+
+  values_.push_back(value);
+
+  return 1;
+}
+
+int StreamParser::open(const bool &object)
+{
+  Frame frame;
+  frame.object      = object;
+  frame.first_value = values_.size();
+  frame.first_key   = keys_.size();
+
+  frames_.push_back(frame);
+
+  return 1;
+}
+
+/**
+ * @brief Moves the values of the innermost container into it, sized exactly
+ */
+int StreamParser::close()
+{
+  Frame frame = frames_.back();
+  frames_.pop_back();
+
+  size_t count   = values_.size() - frame.first_value;
+  yajl_val value = new_value(frame.object ? yajl_t_object : yajl_t_array);
+
+  if (!value)
+  {
+    return 0;
+  }
+
+  if (count)
+  {
+    yajl_val *values = static_cast<yajl_val *>(malloc(count * sizeof(yajl_val)));
+    const char **keys = frame.object ? static_cast<const char **>(malloc(count * sizeof(char *))) : NULL;
+
+    if (!values || (frame.object && !keys))
+    {
+      free(values);
+      free(keys);
+      yajl_tree_free(value);
+
+      return 0;
+    }
+
+    memcpy(values, &values_[frame.first_value], count * sizeof(yajl_val));
+    values_.resize(frame.first_value);
+
+    if (frame.object)
+    {
+      memcpy(keys, &keys_[frame.first_key], count * sizeof(char *));
+      keys_.resize(frame.first_key);
+
+      value->u.object.keys   = keys;
+      value->u.object.values = values;
+      value->u.object.len    = count;
+    }
+    else
+    {
+      value->u.array.values = values;
+      value->u.array.len    = count;
+    }
+  }
+
+  return add(value);
+}
+
+int StreamParser::on_null(void *ctx)
+{
+  return STREAM(ctx)->add(new_value(yajl_t_null));
+}
+
+int StreamParser::on_boolean(void *ctx, int value)
+{
+  return STREAM(ctx)->add(new_value(value ? yajl_t_true : yajl_t_false));
+}
+
+int StreamParser::on_number(void *ctx, const char *value, size_t length)
+{
+  yajl_val number = new_value(yajl_t_number);
+
+  if (!number)
+  {
+    return 0;
+  }
+
+  number->u.number.r = copy_string(value, length);
+
+  if (!number->u.number.r)
+  {
+    free(number);
+    return 0;
+  }
+
+  const char *text = number->u.number.r;
+  char *end = NULL;
+
+  // Match yajl: the integer is only valid for integral values whose
+  // magnitude is within range, which excludes the smallest integer
+  const long long max_integer = static_cast<long long>(~0ULL >> 1);
+  bool integral = (strpbrk(text, ".eE") == NULL);
+
+  errno = 0;
+  long long integer = strtoll(text, &end, 10);
+
+  if (integral && errno == 0 && *end == '\0' && integer >= -max_integer)
+  {
+    number->u.number.i      = integer;
+    number->u.number.flags |= YAJL_NUMBER_INT_VALID;
+  }
+  else
+  {
+    number->u.number.i = (text[0] == '-') ? -max_integer - 1 : max_integer;
+  }
+
+  errno = 0;
+  number->u.number.d = strtod(text, &end);
+
+  if (errno == 0 && *end == '\0')
+  {
+    number->u.number.flags |= YAJL_NUMBER_DOUBLE_VALID;
+  }
+
+  return STREAM(ctx)->add(number);
+}
+
+int StreamParser::on_string(void *ctx, const unsigned char *value, size_t length)
+{
+  yajl_val text = new_value(yajl_t_string);
+
+  if (!text)
+  {
+    return 0;
+  }
+
+  text->u.string = copy_string(reinterpret_cast<const char *>(value), length);
+
+  if (!text->u.string)
+  {
+    free(text);
+    return 0;
+  }
+
+  return STREAM(ctx)->add(text);
+}
+
+int StreamParser::on_start_map(void *ctx)
+{
+  return STREAM(ctx)->open(true);
+}
+
+int StreamParser::on_map_key(void *ctx, const unsigned char *key, size_t length)
+{
+  char *copy = copy_string(reinterpret_cast<const char *>(key), length);
+
+  if (!copy)
+  {
+    return 0;
+  }
+
+  STREAM(ctx)->keys_.push_back(copy);
+
+  return 1;
+}
+
+int StreamParser::on_end_map(void *ctx)
+{
+  return STREAM(ctx)->close();
+}
+
+int StreamParser::on_start_array(void *ctx)
+{
+  return STREAM(ctx)->open(false);
+}
+
+int StreamParser::on_end_array(void *ctx)
+{
+  return STREAM(ctx)->close();
+}
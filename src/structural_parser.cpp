@@ -0,0 +1,825 @@
+#include <restful_mapper/internal/structural_parser.h>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <new>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <yajl/yajl_tree.h>
+}
+
+using namespace std;
+
+typedef unsigned long long bitmask;
+
+// Containers nested deeper than this are rejected, to bound recursion
+#define STRUCTURAL_MAX_DEPTH 1024
+
+// --------------------------------------------------------------------------------
+// Stage 1: structural index
+// --------------------------------------------------------------------------------
+static const bitmask BYTE_ONES  = 0x0101010101010101ULL;
+static const bitmask BYTE_LOWS  = 0x7f7f7f7f7f7f7f7fULL;
+static const bitmask BYTE_HIGHS = 0x8080808080808080ULL;
+
+// Bit positions of isolated bits, indexed by the de Bruijn product below
+static const unsigned char DEBRUIJN_INDEX[64] = {
+   0,  1, 48,  2, 57, 49, 28,  3, 61, 58, 50, 42, 38, 29, 17,  4,
+  62, 55, 59, 36, 53, 51, 43, 22, 45, 39, 33, 30, 24, 18, 12,  5,
+  63, 47, 56, 27, 60, 41, 37, 16, 54, 35, 52, 21, 44, 32, 23, 11,
+  46, 26, 40, 15, 34, 20, 31, 10, 25, 14, 19,  9, 13,  8,  7,  6
+};
+
+struct StructuralIndex
+{
+  vector<size_t> positions;
+  bool has_non_ascii;
+  bool unterminated_string;
+};
+
+// Loads eight bytes with the first byte lowest, regardless of host byte order
+static inline bitmask load_word(const unsigned char *p)
+{
+  return  (bitmask) p[0]        | ((bitmask) p[1] << 8)  | ((bitmask) p[2] << 16) | ((bitmask) p[3] << 24) |
+         ((bitmask) p[4] << 32) | ((bitmask) p[5] << 40) | ((bitmask) p[6] << 48) | ((bitmask) p[7] << 56);
+}
+
+// Sets the high bit of every byte in the word that equals c
+static inline bitmask match_bytes(const bitmask &word, const unsigned char &c)
+{
+  bitmask x = word ^ (BYTE_ONES * c);
+
+  return ~(((x & BYTE_LOWS) + BYTE_LOWS) | x) & BYTE_HIGHS;
+}
+
+// Gathers the high bit of every byte into one bit per byte, first byte lowest
+static inline bitmask pack_bytes(const bitmask &highs)
+{
+  return ((highs >> 7) * 0x0102040810204080ULL) >> 56;
+}
+
+// Each bit becomes the parity of itself and all lower bits
+static inline bitmask prefix_xor(bitmask x)
+{
+  x ^= x << 1;
+  x ^= x << 2;
+  x ^= x << 4;
+  x ^= x << 8;
+  x ^= x << 16;
+  x ^= x << 32;
+
+  return x;
+}
+
+static inline size_t lowest_bit_index(const bitmask &bit)
+{
+  return DEBRUIJN_INDEX[(bit * 0x03f79d71b4cb0a89ULL) >> 58];
+}
+
+static void build_index(const unsigned char *json, const size_t &length, StructuralIndex &index)
+{
+  bitmask escape_carry = 0, string_carry = 0, scalar_carry = 0, non_ascii = 0;
+  unsigned char padded[64];
+
+  index.positions.reserve(length / 8 + 16);
+
+  for (size_t base = 0; base < length; base += 64)
+  {
+    const unsigned char *block = json + base;
+
+    // The final block is padded with whitespace, which is never structural
+    if (length - base < 64)
+    {
+      memset(padded, ' ', sizeof(padded));
+      memcpy(padded, block, length - base);
+      block = padded;
+    }
+
+    bitmask quote = 0, backslash = 0, op = 0, space = 0;
+
+    for (size_t k = 0; k < 8; k++)
+    {
+      bitmask word = load_word(block + 8 * k);
+
+      // Setting bit 5 folds '[' onto '{' and ']' onto '}'
+      bitmask folded = word | (BYTE_ONES * 0x20);
+      size_t shift   = 8 * k;
+
+      non_ascii |= word;
+      quote     |= pack_bytes(match_bytes(word, '"')) << shift;
+      backslash |= pack_bytes(match_bytes(word, '\\')) << shift;
+      op        |= pack_bytes(match_bytes(folded, '{') | match_bytes(folded, '}') |
+                              match_bytes(word, ':') | match_bytes(word, ',')) << shift;
+      space     |= pack_bytes(match_bytes(word, ' ') | match_bytes(word, '\t') |
+                              match_bytes(word, '\n') | match_bytes(word, '\r')) << shift;
+    }
+
+    // Backslashes are rare, so escapes are resolved one backslash at a time
+    bitmask escaped = escape_carry;
+    escape_carry = 0;
+    backslash &= ~escaped;
+
+    while (backslash)
+    {
+      bitmask bit = backslash & (0 - backslash);
+
+      escaped     |= bit << 1;
+      escape_carry = bit >> 63;
+      backslash   &= ~(bit | (bit << 1));
+    }
+
+    quote &= ~escaped;
+
+    // Covers each opening quote and the string contents, but not the closing quote
+    bitmask in_string = prefix_xor(quote) ^ string_carry;
+    string_carry = 0 - (in_string >> 63);
+
+    // Literals are indexed by their first character
+    bitmask scalar      = ~(op | space | quote | in_string);
+    bitmask structurals = (op & ~in_string) | (quote & in_string) | (scalar & ~((scalar << 1) | scalar_carry));
+    scalar_carry = scalar >> 63;
+
+    while (structurals)
+    {
+      bitmask bit = structurals & (0 - structurals);
+
+      index.positions.push_back(base + lowest_bit_index(bit));
+      structurals ^= bit;
+    }
+  }
+
+  index.has_non_ascii       = (non_ascii & BYTE_HIGHS) != 0;
+  index.unterminated_string = string_carry != 0;
+}
+
+// --------------------------------------------------------------------------------
+// Stage 2: value tree
+// --------------------------------------------------------------------------------
+static void parse_error(const char *message, const size_t &offset)
+{
+  ostringstream s;
+  s << "parse error: " << message << " (at offset " << offset << ")";
+
+  throw runtime_error(s.str());
+}
+
+static inline bool is_delimiter(const unsigned char &c)
+{
+  switch (c)
+  {
+    case ' ': case '\t': case '\n': case '\r':
+    case '{': case '}': case '[': case ']': case ':': case ',': case '"':
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+static inline int hex_value(const unsigned char &c)
+{
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+
+  return -1;
+}
+
+static yajl_val new_value(const yajl_type &type)
+{
+  yajl_val value = static_cast<yajl_val>(malloc(sizeof(yajl_val_s)));
+
+  if (!value)
+  {
+    throw bad_alloc();
+  }
+
+  memset(value, 0, sizeof(yajl_val_s));
+  value->type = type;
+
+  return value;
+}
+
+class TreeBuilder
+{
+public:
+  TreeBuilder(const char *json, const size_t &length, const StructuralIndex &index)
+    : json_(reinterpret_cast<const unsigned char *>(json)), length_(length),
+      positions_(index.positions), validate_utf8_(index.has_non_ascii), next_(0) {}
+
+  yajl_val parse()
+  {
+    try
+    {
+      parse_value(0);
+
+      if (next_ != positions_.size())
+      {
+        parse_error("trailing garbage", positions_[next_]);
+      }
+
+      return values_.back();
+    }
+    catch (...)
+    {
+      release();
+      throw;
+    }
+  }
+
+private:
+  const unsigned char *json_;
+  size_t length_;
+  const vector<size_t> &positions_;
+  bool validate_utf8_;
+  size_t next_;
+
+  // Completed values and object keys not yet owned by a container
+  vector<yajl_val> values_;
+  vector<char *> keys_;
+
+  void release()
+  {
+    for (size_t i = 0; i < values_.size(); i++)
+    {
+      yajl_tree_free(values_[i]);
+    }
+
+    for (size_t i = 0; i < keys_.size(); i++)
+    {
+      free(keys_[i]);
+    }
+
+    values_.clear();
+    keys_.clear();
+  }
+
+  void push(yajl_val value)
+  {
+    try
+    {
+      values_.push_back(value);
+    }
+    catch (...)
+    {
+      yajl_tree_free(value);
+      throw;
+    }
+  }
+
+  size_t next_token()
+  {
+    if (next_ >= positions_.size())
+    {
+      parse_error("premature end of input", length_);
+    }
+
+    return positions_[next_++];
+  }
+
+  void parse_value(const size_t &depth)
+  {
+    size_t offset = next_token();
+
+    switch (json_[offset])
+    {
+      case '{':
+        parse_object(offset, depth + 1);
+        break;
+
+      case '[':
+        parse_array(offset, depth + 1);
+        break;
+
+      case '"':
+        push(new_value(yajl_t_string));
+        values_.back()->u.string = parse_string(offset);
+        break;
+
+      default:
+        parse_literal(offset);
+    }
+  }
+
+  void parse_object(const size_t &offset, const size_t &depth)
+  {
+    if (depth > STRUCTURAL_MAX_DEPTH)
+    {
+      parse_error("maximum nesting depth exceeded", offset);
+    }
+
+    size_t first_value = values_.size();
+    size_t first_key   = keys_.size();
+    size_t token       = next_token();
+
+    if (json_[token] != '}')
+    {
+      for (;;)
+      {
+        if (json_[token] != '"')
+        {
+          parse_error("object key must be a string", token);
+        }
+
+        keys_.push_back(NULL);
+        keys_.back() = parse_string(token);
+
+        token = next_token();
+
+        if (json_[token] != ':')
+        {
+          parse_error("object key and value must be separated by a colon", token);
+        }
+
+        parse_value(depth);
+        token = next_token();
+
+        if (json_[token] == '}') break;
+
+        if (json_[token] != ',')
+        {
+          parse_error("after key and value, inside map, expected ',' or '}'", token);
+        }
+
+        token = next_token();
+      }
+    }
+
+    size_t count    = values_.size() - first_value;
+    yajl_val object = new_value(yajl_t_object);
+
+    if (count)
+    {
+      object->u.object.keys   = static_cast<const char **>(malloc(count * sizeof(char *)));
+      object->u.object.values = static_cast<yajl_val *>(malloc(count * sizeof(yajl_val)));
+
+      if (!object->u.object.keys || !object->u.object.values)
+      {
+        yajl_tree_free(object);
+        throw bad_alloc();
+      }
+
+      memcpy(object->u.object.keys, &keys_[first_key], count * sizeof(char *));
+      memcpy(object->u.object.values, &values_[first_value], count * sizeof(yajl_val));
+      object->u.object.len = count;
+
+      keys_.resize(first_key);
+      values_.resize(first_value);
+    }
+
+    push(object);
+  }
+
+  void parse_array(const size_t &offset, const size_t &depth)
+  {
+    if (depth > STRUCTURAL_MAX_DEPTH)
+    {
+      parse_error("maximum nesting depth exceeded", offset);
+    }
+
+    size_t first_value = values_.size();
+
+    if (next_ < positions_.size() && json_[positions_[next_]] == ']')
+    {
+      next_++;
+    }
+    else
+    {
+      for (;;)
+      {
+        parse_value(depth);
+        size_t token = next_token();
+
+        if (json_[token] == ']') break;
+
+        if (json_[token] != ',')
+        {
+          parse_error("after array element, expected ',' or ']'", token);
+        }
+      }
+    }
+
+    size_t count   = values_.size() - first_value;
+    yajl_val array = new_value(yajl_t_array);
+
+    if (count)
+    {
+      array->u.array.values = static_cast<yajl_val *>(malloc(count * sizeof(yajl_val)));
+
+      if (!array->u.array.values)
+      {
+        yajl_tree_free(array);
+        throw bad_alloc();
+      }
+
+      memcpy(array->u.array.values, &values_[first_value], count * sizeof(yajl_val));
+      array->u.array.len = count;
+
+      values_.resize(first_value);
+    }
+
+    push(array);
+  }
+
+  char *parse_string(const size_t &offset)
+  {
+    const unsigned char *begin = json_ + offset + 1;
+    const unsigned char *end   = json_ + length_;
+    const unsigned char *p     = begin;
+
+    // Plain ASCII strings are copied as is
+    while (p < end && *p != '"' && *p != '\\' && *p >= 0x20 && *p < 0x80) ++p;
+
+    if (p < end && *p == '"')
+    {
+      return copy_string(begin, p - begin);
+    }
+
+    // Escapes only ever shorten a string, so its raw length is an upper bound
+    const unsigned char *close = p;
+
+    while (close < end && *close != '"')
+    {
+      close += (*close == '\\') ? 2 : 1;
+    }
+
+    if (close > end) close = end;
+
+    char *buffer = static_cast<char *>(malloc(close - begin + 1));
+
+    if (!buffer)
+    {
+      throw bad_alloc();
+    }
+
+    try
+    {
+      decode_string(begin, close, buffer);
+    }
+    catch (...)
+    {
+      free(buffer);
+      throw;
+    }
+
+    return buffer;
+  }
+
+  char *copy_string(const unsigned char *begin, const size_t &length)
+  {
+    char *buffer = static_cast<char *>(malloc(length + 1));
+
+    if (!buffer)
+    {
+      throw bad_alloc();
+    }
+
+    memcpy(buffer, begin, length);
+    buffer[length] = '\0';
+
+    return buffer;
+  }
+
+  void decode_string(const unsigned char *p, const unsigned char *end, char *out)
+  {
+    while (p < end)
+    {
+      unsigned char c = *p;
+
+      if (c == '\\')
+      {
+        if (end - p < 2)
+        {
+          parse_error("unterminated escape sequence", p - json_);
+        }
+
+        switch (p[1])
+        {
+          case '"':  *out++ = '"';  break;
+          case '\\': *out++ = '\\'; break;
+          case '/':  *out++ = '/';  break;
+          case 'b':  *out++ = '\b'; break;
+          case 'f':  *out++ = '\f'; break;
+          case 'n':  *out++ = '\n'; break;
+          case 'r':  *out++ = '\r'; break;
+          case 't':  *out++ = '\t'; break;
+
+          case 'u':
+            p = decode_unicode(p, end, out);
+            continue;
+
+          default:
+            parse_error("inside a JSON string, an invalid escape was found", p - json_);
+        }
+
+        p += 2;
+      }
+      else if (c < 0x20)
+      {
+        parse_error("invalid character inside string", p - json_);
+      }
+      else if (c < 0x80 || !validate_utf8_)
+      {
+        *out++ = static_cast<char>(*p++);
+      }
+      else
+      {
+        size_t n = utf8_sequence_length(p, end);
+
+        if (!n)
+        {
+          parse_error("invalid bytes in UTF8 string", p - json_);
+        }
+
+        memcpy(out, p, n);
+        out += n;
+        p   += n;
+      }
+    }
+
+    *out = '\0';
+  }
+
+  // Same acceptance rules as the yajl lexer: lead byte and continuation count
+  static size_t utf8_sequence_length(const unsigned char *p, const unsigned char *end)
+  {
+    size_t n;
+
+    if      ((*p >> 5) == 0x06) n = 2;
+    else if ((*p >> 4) == 0x0e) n = 3;
+    else if ((*p >> 3) == 0x1e) n = 4;
+    else return 0;
+
+    if (static_cast<size_t>(end - p) < n) return 0;
+
+    for (size_t i = 1; i < n; i++)
+    {
+      if ((p[i] >> 6) != 0x02) return 0;
+    }
+
+    return n;
+  }
+
+  unsigned int read_hex(const unsigned char *p, const unsigned char *end)
+  {
+    if (end - p < 6)
+    {
+      parse_error("invalid (non-hex) character occurs after '\\u' inside string", p - json_);
+    }
+
+    unsigned int value = 0;
+
+    for (size_t i = 2; i < 6; i++)
+    {
+      int digit = hex_value(p[i]);
+
+      if (digit < 0)
+      {
+        parse_error("invalid (non-hex) character occurs after '\\u' inside string", p - json_);
+      }
+
+      value = (value << 4) | digit;
+    }
+
+    return value;
+  }
+
+  const unsigned char *decode_unicode(const unsigned char *p, const unsigned char *end, char *&out)
+  {
+    unsigned int codepoint = read_hex(p, end);
+    p += 6;
+
+    if ((codepoint & 0xFC00) == 0xD800)
+    {
+      // A high surrogate must be followed by its low surrogate
+      if (end - p >= 6 && p[0] == '\\' && p[1] == 'u')
+      {
+        unsigned int low = read_hex(p, end);
+
+        if ((low & 0xFC00) == 0xDC00)
+        {
+          codepoint = 0x10000 + ((codepoint & 0x3FF) << 10) + (low & 0x3FF);
+          p += 6;
+        }
+        else
+        {
+          *out++ = '?';
+          return p;
+        }
+      }
+      else
+      {
+        *out++ = '?';
+        return p;
+      }
+    }
+
+    if (codepoint < 0x80)
+    {
+      *out++ = static_cast<char>(codepoint);
+    }
+    else if (codepoint < 0x800)
+    {
+      *out++ = static_cast<char>(0xC0 | (codepoint >> 6));
+      *out++ = static_cast<char>(0x80 | (codepoint & 0x3F));
+    }
+    else if (codepoint < 0x10000)
+    {
+      *out++ = static_cast<char>(0xE0 | (codepoint >> 12));
+      *out++ = static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F));
+      *out++ = static_cast<char>(0x80 | (codepoint & 0x3F));
+    }
+    else
+    {
+      *out++ = static_cast<char>(0xF0 | (codepoint >> 18));
+      *out++ = static_cast<char>(0x80 | ((codepoint >> 12) & 0x3F));
+      *out++ = static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F));
+      *out++ = static_cast<char>(0x80 | (codepoint & 0x3F));
+    }
+
+    return p;
+  }
+
+  void parse_literal(const size_t &offset)
+  {
+    const unsigned char *begin = json_ + offset;
+    const unsigned char *end   = json_ + length_;
+    const unsigned char *p     = begin;
+
+    while (p < end && !is_delimiter(*p)) ++p;
+
+    size_t length = p - begin;
+
+    if (length == 4 && memcmp(begin, "true", 4) == 0)
+    {
+      push(new_value(yajl_t_true));
+    }
+    else if (length == 5 && memcmp(begin, "false", 5) == 0)
+    {
+      push(new_value(yajl_t_false));
+    }
+    else if (length == 4 && memcmp(begin, "null", 4) == 0)
+    {
+      push(new_value(yajl_t_null));
+    }
+    else if (*begin == '-' || (*begin >= '0' && *begin <= '9'))
+    {
+      parse_number(begin, length);
+    }
+    else
+    {
+      parse_error("invalid char in json text", offset);
+    }
+  }
+
+  void parse_number(const unsigned char *begin, const size_t &length)
+  {
+    const unsigned char *end = begin + length;
+    const unsigned char *p   = begin;
+    bool negative = (*p == '-');
+    bool integral = true;
+    unsigned long long magnitude = 0;
+    bool overflow = false;
+
+    if (negative) ++p;
+
+    if (p < end && *p == '0')
+    {
+      ++p;
+    }
+    else if (p < end && *p >= '1' && *p <= '9')
+    {
+      for (; p < end && *p >= '0' && *p <= '9'; ++p)
+      {
+        unsigned long long digit = *p - '0';
+
+        if (magnitude > (~0ULL - digit) / 10) overflow = true;
+
+        magnitude = magnitude * 10 + digit;
+      }
+    }
+    else
+    {
+      parse_error("malformed number, a digit is required", p - json_);
+    }
+
+    if (p < end && *p == '.')
+    {
+      integral = false;
+
+      if (++p == end || *p < '0' || *p > '9')
+      {
+        parse_error("malformed number, a digit is required after the decimal point", p - json_);
+      }
+
+      while (p < end && *p >= '0' && *p <= '9') ++p;
+    }
+
+    if (p < end && (*p == 'e' || *p == 'E'))
+    {
+      integral = false;
+      ++p;
+
+      if (p < end && (*p == '+' || *p == '-')) ++p;
+
+      if (p == end || *p < '0' || *p > '9')
+      {
+        parse_error("malformed number, a digit is required after the exponent", p - json_);
+      }
+
+      while (p < end && *p >= '0' && *p <= '9') ++p;
+    }
+
+    if (p != end)
+    {
+      parse_error("invalid char in json text", p - json_);
+    }
+
+    push(new_value(yajl_t_number));
+
+    yajl_val value = values_.back();
+    value->u.number.r = copy_string(begin, length);
+
+    // Match yajl: the integer is only valid for integral values within range
+    const long long max_integer = static_cast<long long>(~0ULL >> 1);
+
+    if (integral && !overflow && magnitude <= static_cast<unsigned long long>(max_integer))
+    {
+      long long integer = static_cast<long long>(magnitude);
+
+      value->u.number.i      = negative ? -integer : integer;
+      value->u.number.flags |= YAJL_NUMBER_INT_VALID;
+    }
+    else
+    {
+      value->u.number.i = negative ? -max_integer - 1 : max_integer;
+    }
+
+    // Integers up to 2^53 are exact, so only other values go through strtod
+    if (integral && !overflow && magnitude <= (1ULL << 53))
+    {
+      double d = static_cast<double>(magnitude);
+
+      value->u.number.d      = negative ? -d : d;
+      value->u.number.flags |= YAJL_NUMBER_DOUBLE_VALID;
+    }
+    else
+    {
+      char *parsed_end = NULL;
+
+      errno = 0;
+      value->u.number.d = strtod(value->u.number.r, &parsed_end);
+
+      if (errno == 0 && parsed_end != NULL && *parsed_end == '\0')
+      {
+        value->u.number.flags |= YAJL_NUMBER_DOUBLE_VALID;
+      }
+    }
+  }
+};
+
+// --------------------------------------------------------------------------------
+// Entry point
+// --------------------------------------------------------------------------------
+static void write_error(char *error_buffer, const size_t &error_buffer_size, const string &message)
+{
+  if (error_buffer == NULL || error_buffer_size == 0)
+  {
+    return;
+  }
+
+  size_t length = message.copy(error_buffer, error_buffer_size - 1);
+  error_buffer[length] = '\0';
+}
+
+void *structural_parse(const char *json, size_t length, char *error_buffer, size_t error_buffer_size)
+{
+  try
+  {
+    StructuralIndex index;
+    build_index(reinterpret_cast<const unsigned char *>(json), length, index);
+
+    if (index.unterminated_string)
+    {
+      parse_error("premature end of input inside a string", length);
+    }
+
+    TreeBuilder builder(json, length, index);
+
+    return static_cast<void *>(builder.parse());
+  }
+  catch (const bad_alloc &)
+  {
+    write_error(error_buffer, error_buffer_size, "parse error: out of memory");
+  }
+  catch (const runtime_error &e)
+  {
+    write_error(error_buffer, error_buffer_size, e.what());
+  }
+
+  return NULL;
+}
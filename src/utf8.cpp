@@ -1,4 +1,5 @@
 #include <restful_mapper/internal/utf8.h>
+#include <restful_mapper/profile.h>
 #include <sstream>
 #include <iconv.h>
 #include <errno.h>
@@ -9,6 +10,9 @@ string local_charset = "";
 
 string iconv_string(const string &value, const char *to, const char *from)
 {
+  RESTFUL_MAPPER_PROFILE_COUNT(PROFILE_ICONV_CONVERSIONS, 1);
+  RESTFUL_MAPPER_PROFILE_COUNT(PROFILE_ALLOCATIONS, 2);
+
   string out;
 
   // Prepare source buffers
@@ -0,0 +1,44 @@
+#ifndef RESTFUL_MAPPER_MOCK_API_TEST_H
+#define RESTFUL_MAPPER_MOCK_API_TEST_H
+
+#include <gtest/gtest.h>
+#include <restful_mapper/api.h>
+#include "mock_webservice.h"
+
+/**
+ * @brief Fixture pointing the global client at a mock web service
+ *
+ * The policies, limits and observer a test may set are reset after it, also
+ * when an assertion failed halfway through.
+ */
+class MockApiTest : public ::testing::Test
+{
+protected:
+  MockWebservice server;
+
+  virtual void SetUp()
+  {
+    restful_mapper::Api::set_url(server.url());
+    restful_mapper::Api::set_username("");
+    restful_mapper::Api::set_password("");
+    restful_mapper::Api::set_proxy("");
+  }
+
+  virtual void TearDown()
+  {
+    using namespace restful_mapper;
+
+    Api::set_observer(NULL);
+    Api::set_timeout(0.0);
+    Api::set_retry_policy(RetryPolicy());
+    Api::set_hedging_policy(HedgingPolicy());
+    Api::set_circuit_breaker_policy(CircuitBreakerPolicy());
+    Api::set_load_balancing_policy(LoadBalancingPolicy());
+    Api::clear_limits();
+    Api::set_cache_size(0);
+    Api::set_buffer_pool(4, 16 * 1024 * 1024);
+    Api::set_incremental_parsing(false);
+  }
+};
+
+#endif // RESTFUL_MAPPER_MOCK_API_TEST_H
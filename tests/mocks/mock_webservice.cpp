@@ -0,0 +1,807 @@
+#include "mock_webservice.h"
+#include <restful_mapper/json.h>
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+#define SOCKET_OF(handle) static_cast<SOCKET>(handle)
+#define CLOSE_SOCKET closesocket
+#define SHUTDOWN_BOTH SD_BOTH
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#define SOCKET_OF(handle) static_cast<int>(handle)
+#define CLOSE_SOCKET close
+#define SHUTDOWN_BOTH SHUT_RDWR
+#endif
+
+// Clients which gave up on a response must not raise SIGPIPE
+#ifdef MSG_NOSIGNAL
+#define SEND_FLAGS MSG_NOSIGNAL
+#else
+#define SEND_FLAGS 0
+#endif
+
+using namespace std;
+using namespace restful_mapper;
+
+// Helper functions
+static void sleep_milliseconds(const unsigned int &milliseconds)
+{
+#ifdef _WIN32
+  Sleep(milliseconds);
+#else
+  timespec duration;
+  duration.tv_sec  = milliseconds / 1000;
+  duration.tv_nsec = (milliseconds % 1000) * 1000000L;
+  nanosleep(&duration, NULL);
+#endif
+}
+
+static bool send_all(const long long &connection, const string &data)
+{
+  size_t sent = 0;
+
+  while (sent < data.size())
+  {
+    int result = send(SOCKET_OF(connection), data.data() + sent, static_cast<int>(data.size() - sent), SEND_FLAGS);
+
+    if (result <= 0) return false;
+
+    sent += result;
+  }
+
+  return true;
+}
+
+static string base64_encode(const string &value)
+{
+  static const char *alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  string encoded;
+
+  for (size_t i = 0; i < value.size(); i += 3)
+  {
+    unsigned long group = static_cast<unsigned char>(value[i]) << 16;
+
+    if (i + 1 < value.size()) group |= static_cast<unsigned char>(value[i + 1]) << 8;
+    if (i + 2 < value.size()) group |= static_cast<unsigned char>(value[i + 2]);
+
+    encoded += alphabet[(group >> 18) & 0x3F];
+    encoded += alphabet[(group >> 12) & 0x3F];
+    encoded += (i + 1 < value.size()) ? alphabet[(group >> 6) & 0x3F] : '=';
+    encoded += (i + 2 < value.size()) ? alphabet[group & 0x3F] : '=';
+  }
+
+  return encoded;
+}
+
+static const char *status_text(const int &status)
+{
+  switch (status)
+  {
+    case 100: return "CONTINUE";
+    case 200: return "OK";
+    case 201: return "CREATED";
+    case 204: return "NO CONTENT";
+    case 304: return "NOT MODIFIED";
+    case 400: return "BAD REQUEST";
+    case 401: return "UNAUTHORIZED";
+    case 404: return "NOT FOUND";
+    case 405: return "METHOD NOT ALLOWED";
+    case 502: return "BAD GATEWAY";
+    case 503: return "SERVICE UNAVAILABLE";
+    case 504: return "GATEWAY TIMEOUT";
+  }
+
+  return "INTERNAL SERVER ERROR";
+}
+
+// Quoted hash of a document, which changes whenever the document does
+static string entity_tag(const string &document)
+{
+  unsigned long hash = 5381;
+
+  for (size_t i = 0; i < document.size(); i++)
+  {
+    hash = hash * 33 + static_cast<unsigned char>(document[i]);
+  }
+
+  ostringstream s;
+  s << "\"" << hex << (hash & 0xFFFFFFFFUL) << "\"";
+
+  return s.str();
+}
+
+// Parses a non-negative decimal id, which must make up the whole string
+static bool parse_id(const string &value, long long &id)
+{
+  if (value.empty() || value.size() > 18) return false;
+
+  id = 0;
+
+  for (size_t i = 0; i < value.size(); i++)
+  {
+    if (!isdigit(static_cast<unsigned char>(value[i]))) return false;
+
+    id = id * 10 + (value[i] - '0');
+  }
+
+  return true;
+}
+
+// Parses a JSON object into raw JSON values by key
+static bool parse_object(const string &json, map<string, string> &fields)
+{
+  try
+  {
+    Json::Parser parser(json);
+
+    if (!parser.root().is_map()) return false;
+
+    fields = parser.root().dump_map();
+  }
+  catch (runtime_error &e)
+  {
+    return false;
+  }
+
+  return true;
+}
+
+MockWebservice::MockWebservice()
+  : listener_(-1), port_(0), accept_thread_(NULL), mutex_(NULL), stopping_(false),
+    latency_(0), etags_(false), request_count_(0)
+{
+#ifdef _WIN32
+  WSADATA wsa_data;
+  WSAStartup(MAKEWORD(2, 2), &wsa_data);
+#endif
+
+  listener_ = static_cast<long long>(socket(AF_INET, SOCK_STREAM, IPPROTO_TCP));
+
+  sockaddr_in address;
+  memset(&address, 0, sizeof address);
+  address.sin_family      = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port        = 0;
+
+  socklen_t length = sizeof address;
+
+  if (bind(SOCKET_OF(listener_), reinterpret_cast<sockaddr *>(&address), sizeof address) != 0 ||
+      listen(SOCKET_OF(listener_), 64) != 0 ||
+      getsockname(SOCKET_OF(listener_), reinterpret_cast<sockaddr *>(&address), &length) != 0)
+  {
+    CLOSE_SOCKET(SOCKET_OF(listener_));
+    throw runtime_error("Unable to listen on the loopback interface");
+  }
+
+  port_ = ntohs(address.sin_port);
+
+#ifdef _WIN32
+  CRITICAL_SECTION *mutex = new CRITICAL_SECTION;
+  InitializeCriticalSection(mutex);
+  mutex_ = mutex;
+
+  accept_thread_ = CreateThread(NULL, 0, &MockWebservice::accept_main, this, 0, NULL);
+#else
+  pthread_mutex_t *mutex = new pthread_mutex_t;
+  pthread_mutex_init(mutex, NULL);
+  mutex_ = mutex;
+
+  pthread_t *thread = new pthread_t;
+  pthread_create(thread, NULL, &MockWebservice::accept_main, this);
+  accept_thread_ = thread;
+#endif
+}
+
+MockWebservice::~MockWebservice()
+{
+  lock();
+  stopping_ = true;
+  unlock();
+
+  // Wake up the accepting thread
+  shutdown(SOCKET_OF(listener_), SHUTDOWN_BOTH);
+  CLOSE_SOCKET(SOCKET_OF(listener_));
+
+#ifdef _WIN32
+  WaitForSingleObject(static_cast<HANDLE>(accept_thread_), INFINITE);
+  CloseHandle(static_cast<HANDLE>(accept_thread_));
+#else
+  pthread_join(*static_cast<pthread_t *>(accept_thread_), NULL);
+  delete static_cast<pthread_t *>(accept_thread_);
+#endif
+
+  // Wake up the connection threads and wait for them to finish
+  lock();
+
+  set<long long>::const_iterator i, i_end = connections_.end();
+  for (i = connections_.begin(); i != i_end; ++i)
+  {
+    shutdown(SOCKET_OF(*i), SHUTDOWN_BOTH);
+  }
+
+  unlock();
+
+  for (;;)
+  {
+    lock();
+    bool done = connections_.empty();
+    unlock();
+
+    if (done) break;
+
+    sleep_milliseconds(1);
+  }
+
+#ifdef _WIN32
+  DeleteCriticalSection(static_cast<CRITICAL_SECTION *>(mutex_));
+  delete static_cast<CRITICAL_SECTION *>(mutex_);
+#else
+  pthread_mutex_destroy(static_cast<pthread_mutex_t *>(mutex_));
+  delete static_cast<pthread_mutex_t *>(mutex_);
+#endif
+}
+
+string MockWebservice::url() const
+{
+  ostringstream s;
+  s << "http://127.0.0.1:" << port_ << "/api";
+
+  return s.str();
+}
+
+void MockWebservice::set_latency(const unsigned int &milliseconds)
+{
+  lock();
+  latency_ = milliseconds;
+  unlock();
+}
+
+void MockWebservice::set_credentials(const string &username, const string &password)
+{
+  lock();
+  authorization_ = "Basic " + base64_encode(username + ":" + password);
+  unlock();
+}
+
+void MockWebservice::add_column(const string &collection, const string &column)
+{
+  lock();
+  collections_[collection].columns.insert(column);
+  unlock();
+}
+
+void MockWebservice::add_validation_error(const string &collection, const string &field, const string &message)
+{
+  lock();
+  collections_[collection].validation_errors[field] = message;
+  unlock();
+}
+
+void MockWebservice::add_failures(const size_t &count, const int &status, const string &retry_after)
+{
+  lock();
+  failures_.insert(failures_.end(), count, status);
+  retry_after_ = retry_after;
+  unlock();
+}
+
+void MockWebservice::add_delays(const size_t &count, const unsigned int &milliseconds)
+{
+  lock();
+  delays_.insert(delays_.end(), count, milliseconds);
+  unlock();
+}
+
+void MockWebservice::set_etags(const bool &enabled)
+{
+  lock();
+  etags_ = enabled;
+  unlock();
+}
+
+long long MockWebservice::insert(const string &collection, const string &object)
+{
+  Object fields;
+
+  if (!parse_object(object, fields))
+  {
+    throw runtime_error("Mock objects must be JSON objects: " + object);
+  }
+
+  long long id = 0;
+  Object::const_iterator i = fields.find("id");
+
+  if (i != fields.end() && i->second != "null" && !parse_id(i->second, id))
+  {
+    throw runtime_error("Mock object ids must be positive integers: " + object);
+  }
+
+  lock();
+  id = store(collections_[collection], id, fields);
+  unlock();
+
+  return id;
+}
+
+void MockWebservice::fill(const string &collection, const size_t &count, const string &object)
+{
+  for (size_t i = 0; i < count; i++)
+  {
+    insert(collection, object);
+  }
+}
+
+void MockWebservice::clear()
+{
+  lock();
+  collections_.clear();
+  latency_ = 0;
+  authorization_.clear();
+  failures_.clear();
+  retry_after_.clear();
+  delays_.clear();
+  etags_ = false;
+  unlock();
+}
+
+size_t MockWebservice::request_count() const
+{
+  lock();
+  size_t count = request_count_;
+  unlock();
+
+  return count;
+}
+
+void MockWebservice::lock() const
+{
+#ifdef _WIN32
+  EnterCriticalSection(static_cast<CRITICAL_SECTION *>(mutex_));
+#else
+  pthread_mutex_lock(static_cast<pthread_mutex_t *>(mutex_));
+#endif
+}
+
+void MockWebservice::unlock() const
+{
+#ifdef _WIN32
+  LeaveCriticalSection(static_cast<CRITICAL_SECTION *>(mutex_));
+#else
+  pthread_mutex_unlock(static_cast<pthread_mutex_t *>(mutex_));
+#endif
+}
+
+#ifdef _WIN32
+unsigned long __stdcall MockWebservice::accept_main(void *server)
+#else
+void *MockWebservice::accept_main(void *server)
+#endif
+{
+  static_cast<MockWebservice *>(server)->accept_connections();
+
+  return 0;
+}
+
+#ifdef _WIN32
+unsigned long __stdcall MockWebservice::connection_main(void *start)
+#else
+void *MockWebservice::connection_main(void *start)
+#endif
+{
+  ConnectionStart *connection_start = static_cast<ConnectionStart *>(start);
+  MockWebservice *server = connection_start->server;
+  long long connection   = connection_start->connection;
+  delete connection_start;
+
+  server->serve_connection(connection);
+
+  server->lock();
+  CLOSE_SOCKET(SOCKET_OF(connection));
+  server->connections_.erase(connection);
+  server->unlock();
+
+  return 0;
+}
+
+void MockWebservice::accept_connections()
+{
+  for (;;)
+  {
+#ifdef _WIN32
+    SOCKET accepted = accept(SOCKET_OF(listener_), NULL, NULL);
+    if (accepted == INVALID_SOCKET) return;
+#else
+    int accepted = accept(SOCKET_OF(listener_), NULL, NULL);
+    if (accepted < 0) return;
+#endif
+
+    int flag = 1;
+    setsockopt(accepted, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char *>(&flag), sizeof flag);
+
+    lock();
+
+    if (stopping_)
+    {
+      unlock();
+      CLOSE_SOCKET(accepted);
+      return;
+    }
+
+    connections_.insert(static_cast<long long>(accepted));
+    unlock();
+
+    ConnectionStart *start = new ConnectionStart;
+    start->server     = this;
+    start->connection = static_cast<long long>(accepted);
+
+#ifdef _WIN32
+    CloseHandle(CreateThread(NULL, 0, &MockWebservice::connection_main, start, 0, NULL));
+#else
+    pthread_t thread;
+    pthread_create(&thread, NULL, &MockWebservice::connection_main, start);
+    pthread_detach(thread);
+#endif
+  }
+}
+
+void MockWebservice::serve_connection(const long long &connection)
+{
+  string buffer;
+  Request request;
+
+  while (read_request(connection, buffer, request))
+  {
+    lock();
+    bool failing = !failures_.empty();
+    int failure = failing ? failures_.front() : 0;
+    string retry_after = retry_after_;
+    if (failing) failures_.erase(failures_.begin());
+    unlock();
+
+    Response response;
+
+    if (!failing)
+    {
+      response = handle(request);
+    }
+    else if (failure == 0)
+    {
+      // Emulate a connection reset
+      lock();
+      request_count_++;
+      unlock();
+
+      return;
+    }
+    else
+    {
+      response.status = failure;
+      response.body   = "{}";
+    }
+
+    lock();
+    unsigned int latency = latency_;
+    request_count_++;
+
+    if (!delays_.empty())
+    {
+      latency += delays_.front();
+      delays_.erase(delays_.begin());
+    }
+    unlock();
+
+    if (latency) sleep_milliseconds(latency);
+
+    ostringstream s;
+    s << "HTTP/1.1 " << response.status << " " << status_text(response.status) << "\r\n";
+
+    if (response.status == 401)
+    {
+      s << "WWW-Authenticate: Basic realm=\"mock\"\r\n";
+    }
+
+    if (failing && !retry_after.empty())
+    {
+      s << "Retry-After: " << retry_after << "\r\n";
+    }
+
+    if (!response.etag.empty())
+    {
+      s << "ETag: " << response.etag << "\r\n";
+    }
+
+    if (response.status != 204 && response.status != 304)
+    {
+      s << "Content-Type: application/json\r\n"
+        << "Content-Length: " << response.body.size() << "\r\n";
+    }
+
+    s << "\r\n" << response.body;
+
+    if (!send_all(connection, s.str())) return;
+  }
+}
+
+bool MockWebservice::read_request(const long long &connection, string &buffer, Request &request)
+{
+  size_t header_end = string::npos;
+  size_t content_length = 0;
+  bool continue_sent = false;
+  char chunk[16384];
+
+  for (;;)
+  {
+    if (header_end == string::npos && (header_end = buffer.find("\r\n\r\n")) != string::npos)
+    {
+      istringstream headers(buffer.substr(0, header_end));
+      string line;
+
+      getline(headers, line);
+      istringstream request_line(line);
+      request_line >> request.method >> request.path;
+
+      request.authorization.clear();
+      request.if_none_match.clear();
+      bool expect_continue = false;
+
+      while (getline(headers, line))
+      {
+        size_t colon = line.find(':');
+        if (colon == string::npos) continue;
+
+        string name = line.substr(0, colon);
+        transform(name.begin(), name.end(), name.begin(), ::tolower);
+
+        size_t value_start = line.find_first_not_of(' ', colon + 1);
+        size_t value_end   = line.find_last_not_of("\r ");
+        string value = (value_start == string::npos) ? "" : line.substr(value_start, value_end - value_start + 1);
+
+        if (name == "content-length") content_length = strtoul(value.c_str(), NULL, 10);
+        if (name == "authorization") request.authorization = value;
+        if (name == "if-none-match") request.if_none_match = value;
+        if (name == "expect") expect_continue = (value == "100-continue");
+      }
+
+      header_end += 4;
+
+      if (expect_continue && buffer.size() < header_end + content_length && !continue_sent)
+      {
+        if (!send_all(connection, "HTTP/1.1 100 Continue\r\n\r\n")) return false;
+        continue_sent = true;
+      }
+    }
+
+    if (header_end != string::npos && buffer.size() >= header_end + content_length)
+    {
+      request.body = buffer.substr(header_end, content_length);
+      buffer.erase(0, header_end + content_length);
+
+      return true;
+    }
+
+    int received = recv(SOCKET_OF(connection), chunk, sizeof chunk, 0);
+
+    if (received <= 0) return false;
+
+    buffer.append(chunk, received);
+  }
+}
+
+MockWebservice::Response MockWebservice::handle(const Request &request)
+{
+  Response response;
+
+  // Split /api/<collection>[/<id>][?query]
+  string path = request.path.substr(0, request.path.find('?'));
+
+  if (path.size() > 1 && path[path.size() - 1] == '/') path.erase(path.size() - 1);
+
+  if (path.compare(0, 5, "/api/") != 0)
+  {
+    response.status = 404;
+    response.body   = "{}";
+
+    return response;
+  }
+
+  path.erase(0, 5);
+
+  size_t slash = path.find('/');
+  string collection_name = path.substr(0, slash);
+  bool has_id = (slash != string::npos);
+  long long id = 0;
+
+  if (has_id && !parse_id(path.substr(slash + 1), id))
+  {
+    response.status = 404;
+    response.body   = "{}";
+
+    return response;
+  }
+
+  // Parse the request body outside the lock
+  Object fields;
+  bool has_body = (request.method == "POST" || request.method == "PUT");
+
+  if (has_body && !parse_object(request.body, fields))
+  {
+    response.status = 400;
+    response.body   = "{\"message\": \"Unable to decode data\"}";
+
+    return response;
+  }
+
+  lock();
+
+  if (!authorization_.empty() && request.authorization != authorization_)
+  {
+    unlock();
+    response.status = 401;
+
+    return response;
+  }
+
+  Collection &collection = collections_[collection_name];
+  map<long long, string>::const_iterator document = collection.documents.find(id);
+
+  if (request.method == "GET" && !has_id)
+  {
+    ostringstream s;
+    s << "{\"num_results\": " << collection.documents.size() << ", \"objects\": [";
+
+    for (document = collection.documents.begin(); document != collection.documents.end(); ++document)
+    {
+      if (document != collection.documents.begin()) s << ", ";
+      s << document->second;
+    }
+
+    s << "], \"page\": 1, \"total_pages\": 1}";
+    response.body = s.str();
+  }
+  else if ((request.method == "GET" || request.method == "PUT" || request.method == "DELETE") &&
+           (!has_id || document == collection.documents.end()))
+  {
+    response.status = 404;
+    response.body   = "{}";
+  }
+  else if (request.method == "GET")
+  {
+    response.body = document->second;
+
+    if (etags_)
+    {
+      response.etag = entity_tag(response.body);
+
+      if (request.if_none_match == response.etag)
+      {
+        response.status = 304;
+        response.body.clear();
+      }
+    }
+  }
+  else if (request.method == "DELETE")
+  {
+    collection.objects.erase(id);
+    collection.documents.erase(id);
+    response.status = 204;
+  }
+  else if (request.method == "POST" && !has_id)
+  {
+    response = validate(collection, fields);
+
+    if (response.status == 200)
+    {
+      Object::const_iterator field = fields.find("id");
+      long long new_id = 0;
+
+      if (field != fields.end()) parse_id(field->second, new_id);
+
+      new_id = store(collection, new_id, fields);
+      response.status = 201;
+      response.body   = collection.documents[new_id];
+    }
+  }
+  else if (request.method == "PUT")
+  {
+    response = validate(collection, fields);
+
+    if (response.status == 200)
+    {
+      Object merged = collection.objects[id];
+
+      for (Object::const_iterator field = fields.begin(); field != fields.end(); ++field)
+      {
+        merged[field->first] = field->second;
+      }
+
+      store(collection, id, merged);
+      response.body = collection.documents[id];
+    }
+  }
+  else
+  {
+    response.status = 405;
+    response.body   = "{}";
+  }
+
+  unlock();
+
+  return response;
+}
+
+long long MockWebservice::store(Collection &collection, const long long &id, const Object &fields)
+{
+  long long stored_id = id ? id : collection.next_id;
+
+  collection.next_id = max(collection.next_id, stored_id + 1);
+
+  Object &object = collection.objects[stored_id];
+  object = fields;
+  object["id"] = Json::encode(stored_id);
+
+  set<string>::const_iterator i, i_end = collection.columns.end();
+  for (i = collection.columns.begin(); i != i_end; ++i)
+  {
+    if (object.find(*i) == object.end()) object[*i] = "null";
+  }
+
+  collection.documents[stored_id] = serialize(object);
+
+  return stored_id;
+}
+
+MockWebservice::Response MockWebservice::validate(const Collection &collection, const Object &fields) const
+{
+  Response response;
+  string errors;
+
+  map<string, string>::const_iterator i, i_end = collection.validation_errors.end();
+  for (i = collection.validation_errors.begin(); i != i_end; ++i)
+  {
+    if (fields.find(i->first) == fields.end()) continue;
+
+    if (!errors.empty()) errors += ", ";
+    errors += Json::encode(i->first) + ": " + Json::encode(i->second);
+  }
+
+  if (!errors.empty())
+  {
+    response.status = 400;
+    response.body   = "{\"validation_errors\": {" + errors + "}}";
+  }
+
+  return response;
+}
+
+string MockWebservice::serialize(const Object &fields)
+{
+  string document = "{";
+
+  for (Object::const_iterator i = fields.begin(); i != fields.end(); ++i)
+  {
+    if (i != fields.begin()) document += ", ";
+
+    document += Json::encode(i->first);
+    document += ": ";
+    document += i->second;
+  }
+
+  document += "}";
+
+  return document;
+}
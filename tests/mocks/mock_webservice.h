@@ -0,0 +1,185 @@
+#ifndef RESTFUL_MAPPER_MOCK_WEBSERVICE_H
+#define RESTFUL_MAPPER_MOCK_WEBSERVICE_H
+
+#include <cstddef>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+/**
+ * @brief In-process stand-in for the Flask-Restless web service
+ *
+ * Listens on 127.0.0.1 at a free port and serves the conventions Api relies
+ * on, for any collection name below /api:
+ *
+ * - GET /api/<collection> returns {"objects": [...], "num_results": ...}
+ * - GET /api/<collection>/<id> returns the object, or 404
+ * - POST /api/<collection> stores the object and returns it with 201
+ * - PUT /api/<collection>/<id> merges the fields and returns the object
+ * - DELETE /api/<collection>/<id> returns 204
+ *
+ * Query strings are ignored. Every connection is served by its own thread,
+ * so several clients can be run against one server.
+ */
+class MockWebservice
+{
+public:
+  MockWebservice();
+  ~MockWebservice();
+
+  /**
+   * @brief Root URL to pass to Api::set_url
+   */
+  std::string url() const;
+
+  /**
+   * @brief Delay every response, to emulate a remote server
+   */
+  void set_latency(const unsigned int &milliseconds);
+
+  /**
+   * @brief Require HTTP basic authentication, answering 401 otherwise
+   */
+  void set_credentials(const std::string &username, const std::string &password);
+
+  /**
+   * @brief Declare a column, which objects of the collection return as null
+   *        until it is set, as Flask-Restless does
+   */
+  void add_column(const std::string &collection, const std::string &column);
+
+  /**
+   * @brief Answer POST and PUT requests that contain the field with 400 and a
+   *        validation_errors document
+   */
+  void add_validation_error(const std::string &collection, const std::string &field, const std::string &message);
+
+  /**
+   * @brief Answer the next requests with a transient failure, before handling
+   *        any further requests normally
+   *
+   * @param count the number of requests to fail
+   * @param status the status to answer with, e.g. 503, or 0 to close the
+   *        connection without answering
+   * @param retry_after the value of the Retry-After header, if not empty
+   */
+  void add_failures(const std::size_t &count, const int &status, const std::string &retry_after = "");
+
+  /**
+   * @brief Delay the next responses on top of the latency, to emulate
+   *        stragglers
+   */
+  void add_delays(const std::size_t &count, const unsigned int &milliseconds);
+
+  /**
+   * @brief Tag the responses for single objects with an ETag, and answer a
+   *        matching If-None-Match with 304
+   */
+  void set_etags(const bool &enabled);
+
+  /**
+   * @brief Store an object, as a POST request would
+   *
+   * @param collection the collection name, e.g. "todo"
+   * @param object a JSON object; the id is assigned if it is missing
+   *
+   * @return the id of the object
+   */
+  long long insert(const std::string &collection, const std::string &object);
+
+  /**
+   * @brief Store a number of copies of an object, to script the payload size
+   */
+  void fill(const std::string &collection, const std::size_t &count, const std::string &object);
+
+  /**
+   * @brief Remove all objects and scripted behaviour
+   */
+  void clear();
+
+  /**
+   * @brief Number of requests answered so far
+   */
+  std::size_t request_count() const;
+
+private:
+  typedef std::map<std::string, std::string> Object;
+
+  struct Collection
+  {
+    Collection() : next_id(1) {}
+
+    long long next_id;
+    std::map<long long, Object> objects;
+    std::map<long long, std::string> documents;
+    std::set<std::string> columns;
+    std::map<std::string, std::string> validation_errors;
+  };
+
+  struct Request
+  {
+    std::string method;
+    std::string path;
+    std::string authorization;
+    std::string if_none_match;
+    std::string body;
+  };
+
+  struct Response
+  {
+    Response() : status(200) {}
+
+    int status;
+    std::string etag;
+    std::string body;
+  };
+
+  struct ConnectionStart
+  {
+    MockWebservice *server;
+    long long connection;
+  };
+
+  long long listener_;
+  unsigned short port_;
+  void *accept_thread_;
+  void *mutex_;
+  bool stopping_;
+  std::set<long long> connections_;
+
+  unsigned int latency_;
+  std::string authorization_;
+  std::vector<int> failures_;
+  std::string retry_after_;
+  std::vector<unsigned int> delays_;
+  bool etags_;
+  std::size_t request_count_;
+  std::map<std::string, Collection> collections_;
+
+  // Disallow copy, threads hold a pointer to the server
+  MockWebservice(MockWebservice const &); // Don't Implement
+  void operator=(MockWebservice const &); // Don't implement
+
+  void lock() const;
+  void unlock() const;
+
+  void accept_connections();
+  void serve_connection(const long long &connection);
+  bool read_request(const long long &connection, std::string &buffer, Request &request);
+  Response handle(const Request &request);
+
+  long long store(Collection &collection, const long long &id, const Object &fields);
+  Response validate(const Collection &collection, const Object &fields) const;
+  static std::string serialize(const Object &fields);
+
+#ifdef _WIN32
+  static unsigned long __stdcall accept_main(void *server);
+  static unsigned long __stdcall connection_main(void *start);
+#else
+  static void *accept_main(void *server);
+  static void *connection_main(void *start);
+#endif
+};
+
+#endif // RESTFUL_MAPPER_MOCK_WEBSERVICE_H
@@ -3,20 +3,43 @@
 // --------------------------------------------------------------------------------
 #include <gtest/gtest.h>
 #include <restful_mapper/api.h>
+#include "mocks/mock_api_test.h"
+
+#ifndef _WIN32
+#include <pthread.h>
+#include <unistd.h>
+#endif
 
 using namespace std;
 using namespace restful_mapper;
 
+// --------------------------------------------------------------------------------
+// Declarations
+// --------------------------------------------------------------------------------
+class ApiTest : public MockApiTest
+{
+};
+
+#ifndef _WIN32
+static void *cancel_after_50ms(void *token)
+{
+  usleep(50000);
+  static_cast<CancellationToken *>(token)->cancel();
+
+  return NULL;
+}
+#endif
+
 // --------------------------------------------------------------------------------
 // Definitions
 // --------------------------------------------------------------------------------
-TEST(ApiTest, Escape)
+TEST_F(ApiTest, Escape)
 {
   string escaped = Api::escape("Hej!#&?der");
   ASSERT_STREQ("Hej%21%23%26%3Fder", escaped.c_str());
 }
 
-TEST(ApiTest, QueryParams)
+TEST_F(ApiTest, QueryParams)
 {
   string url = "http://google.com";
   url = Api::query_param(url, "q", "test");
@@ -43,7 +66,7 @@ TEST(ApiTest, QueryParams)
   ASSERT_STREQ("http://google.com/search?q=Min%20s%C3%B8gning", url.c_str());
 }
 
-TEST(ApiTest, BadRequestErrorJson)
+TEST_F(ApiTest, BadRequestErrorJson)
 {
   BadRequestError err("{\"message\":\"Some error message...\"}");
   ASSERT_EQ(400, err.code());
@@ -53,7 +76,7 @@ TEST(ApiTest, BadRequestErrorJson)
   ASSERT_STREQ("", err2.what());
 }
 
-TEST(ApiTest, ValidationErrorJson)
+TEST_F(ApiTest, ValidationErrorJson)
 {
   ValidationError err("{\"validation_errors\":{\"age\":\"some error message...\",\"name\":\"not provided\"}}");
 
@@ -72,7 +95,7 @@ TEST(ApiTest, ValidationErrorJson)
   ASSERT_STREQ("Phone no", err4.what());
 }
 
-TEST(ApiTest, ProxyValid)
+TEST_F(ApiTest, ProxyValid)
 {
   Api::set_url("http://localhost:5000/api");
   Api::clear_proxy();
@@ -81,7 +104,7 @@ TEST(ApiTest, ProxyValid)
   ASSERT_NO_THROW(Api::get("/reload"));
 }
 
-TEST(ApiTest, ProxyInvalid)
+TEST_F(ApiTest, ProxyInvalid)
 {
   Api::set_url("http://localhost:5000/api");
   Api::set_proxy("an-invalid-hostname");
@@ -89,3 +112,542 @@ TEST(ApiTest, ProxyInvalid)
   ASSERT_THROW(Api::get("/reload"), ResponseError);
 }
 
+
+TEST_F(ApiTest, ResponseCache)
+{
+  ResponseCache cache;
+  CachedResponse response;
+  response.etag = "\"v1\"";
+
+  // Disabled by default
+  cache.store("/todo/1", response);
+  ASSERT_EQ(0, cache.count());
+
+  cache.set_capacity(30);
+
+  response.body = "{\"id\":1}";
+  cache.store("/todo/1", response); // 7 + 8 + 4 bytes
+  ASSERT_EQ(1, cache.count());
+  ASSERT_EQ(19, cache.size());
+  ASSERT_STREQ("{\"id\":1}", cache.find("/todo/1")->body.c_str());
+  ASSERT_TRUE(cache.find("/todo/2") == NULL);
+
+  // Storing the same URL replaces the entry
+  response.etag = "\"v2\"";
+  cache.store("/todo/1", response);
+  ASSERT_EQ(1, cache.count());
+  ASSERT_EQ(19, cache.size());
+  ASSERT_STREQ("\"v2\"", cache.find("/todo/1")->etag.c_str());
+
+  // Least recently used entry is evicted when over budget
+  response.body = "{}";
+  cache.store("/a", response); // 2 + 2 + 4 bytes
+  ASSERT_EQ(2, cache.count());
+
+  cache.find("/todo/1");
+  cache.store("/b", response);
+  ASSERT_EQ(2, cache.count());
+  ASSERT_TRUE(cache.find("/a") == NULL);
+  ASSERT_TRUE(cache.find("/todo/1") != NULL);
+  ASSERT_TRUE(cache.find("/b") != NULL);
+
+  // Entries larger than the budget are never stored
+  response.body = string(40, ' ');
+  cache.store("/c", response);
+  ASSERT_TRUE(cache.find("/c") == NULL);
+
+  cache.erase("/b");
+  ASSERT_EQ(1, cache.count());
+
+  cache.set_capacity(10);
+  ASSERT_EQ(0, cache.count());
+  ASSERT_EQ(0, cache.size());
+}
+
+TEST_F(ApiTest, CacheSize)
+{
+  ASSERT_EQ(0, Api::cache_size());
+
+  Api::set_cache_size(1024);
+  ASSERT_EQ(1024, Api::cache_size());
+
+  Api::set_cache_size(0);
+  ASSERT_EQ(0, Api::cache_size());
+}
+
+TEST_F(ApiTest, Retry)
+{
+  server.insert("todo", "{\"id\": 1, \"task\": \"Rest\"}");
+
+  // Disabled by default
+  server.add_failures(1, 503);
+  ASSERT_THROW(Api::get("/todo/1"), ResponseError);
+
+  RetryPolicy policy;
+  policy.max_retries   = 3;
+  policy.initial_delay = 0.001;
+  Api::set_retry_policy(policy);
+
+  RequestStatistics statistics;
+  Api::set_observer(&statistics);
+
+  // Transient statuses and connection resets are replayed
+  server.add_failures(2, 503, "0");
+  ASSERT_STREQ("{\"id\": 1, \"task\": \"Rest\"}", Api::get("/todo/1").c_str());
+
+  server.add_failures(2, 0);
+  ASSERT_NO_THROW(Api::put("/todo/1", "{\"task\": \"Sleep\"}"));
+  ASSERT_NO_THROW(Api::del("/todo/1"));
+
+  const EndpointStatistics &get = statistics.endpoints().find("GET /todo/:id")->second;
+  ASSERT_EQ(3, get.requests);
+  ASSERT_EQ(2, get.retries);
+  ASSERT_EQ(2, get.errors);
+
+  Api::set_observer(NULL);
+
+  // Giving up after the maximum number of retries
+  server.add_failures(4, 502);
+  ASSERT_THROW(Api::get("/todo"), ResponseError);
+  ASSERT_NO_THROW(Api::get("/todo"));
+
+  // Permanent errors are not retried
+  size_t request_count = server.request_count();
+  ASSERT_THROW(Api::get("/todo/1"), ResponseError);
+  ASSERT_EQ(request_count + 1, server.request_count());
+
+  // POST requests only when enabled
+  server.add_failures(1, 503);
+  ASSERT_THROW(Api::post("/todo", "{\"task\": \"Eat\"}"), ResponseError);
+
+  policy.retry_posts = true;
+  Api::set_retry_policy(policy);
+
+  server.add_failures(1, 503);
+  Api::post("/todo", "{\"task\": \"Eat\"}");
+
+  // The budget limits retries while the server keeps failing
+  policy.budget        = 1.0;
+  policy.budget_refill = 0.0;
+  Api::set_retry_policy(policy);
+
+  server.add_failures(2, 503);
+  ASSERT_THROW(Api::get("/todo"), ResponseError);
+
+  server.add_failures(1, 503);
+  ASSERT_THROW(Api::get("/todo"), ResponseError);
+}
+
+TEST_F(ApiTest, Deadline)
+{
+  server.insert("todo", "{\"id\": 1, \"task\": \"Wait\"}");
+  server.set_latency(300);
+
+  ASSERT_TRUE(Deadline::active() == NULL);
+
+  {
+    Deadline deadline(0.05);
+
+    double start = monotonic_seconds();
+    ASSERT_THROW(Api::get("/todo/1"), TimeoutError);
+    ASSERT_LT(monotonic_seconds() - start, 0.25);
+
+    // Requests after the deadline are not sent
+    size_t request_count = server.request_count();
+    while (!deadline.has_expired()) {}
+
+    ASSERT_THROW(Api::get("/todo/1"), TimeoutError);
+    ASSERT_EQ(request_count, server.request_count());
+
+    // Nested deadlines cannot extend the enclosing one
+    Deadline nested(10.0);
+    ASSERT_TRUE(nested.has_expired());
+  }
+
+  ASSERT_TRUE(Deadline::active() == NULL);
+
+  // Global timeout
+  Api::set_timeout(0.05);
+  ASSERT_THROW(Api::get("/todo/1"), TimeoutError);
+  Api::set_timeout(0.0);
+
+  {
+    Deadline deadline(5.0);
+    ASSERT_NO_THROW(Api::get("/todo/1"));
+  }
+
+  // Cancellation
+  CancellationToken token;
+  token.cancel();
+
+  {
+    Deadline deadline(token);
+    ASSERT_FALSE(deadline.is_limited());
+    ASSERT_THROW(Api::get("/todo/1"), CancelledError);
+  }
+
+#ifndef _WIN32
+  token.reset();
+  server.set_latency(2000);
+
+  {
+    Deadline deadline(token);
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, cancel_after_50ms, &token);
+
+    double start = monotonic_seconds();
+    ASSERT_THROW(Api::get("/todo/1"), CancelledError);
+    ASSERT_LT(monotonic_seconds() - start, 1.5);
+
+    pthread_join(thread, NULL);
+  }
+#endif
+}
+
+TEST_F(ApiTest, RateLimiter)
+{
+  RateLimiter limiter;
+  RateLimiter::Slot slots[4];
+
+  // Unlimited by default
+  ASSERT_TRUE(limiter.acquire("/todo", NULL, slots[0]));
+  limiter.release(slots[0]);
+
+  limiter.set_max_in_flight("/todo", 2);
+  limiter.set_max_in_flight("/todo/1", 1);
+
+  ASSERT_TRUE(limiter.acquire("/todo", NULL, slots[0]));
+  ASSERT_TRUE(limiter.acquire("/todo?page=2", NULL, slots[1]));
+  ASSERT_EQ(2, limiter.in_flight("/todo"));
+  ASSERT_FALSE(limiter.try_acquire("/todo", slots[3]));
+
+  // The longest prefix applies, on segment boundaries
+  ASSERT_TRUE(limiter.acquire("/todo/1", NULL, slots[2]));
+  ASSERT_TRUE(limiter.acquire("/todos", NULL, slots[3]));
+  ASSERT_EQ(1, limiter.in_flight("/todo/1"));
+
+  {
+    RateLimiter::Slot slot;
+    Deadline deadline(0.02);
+    ASSERT_FALSE(limiter.acquire("/todo/2", &deadline, slot));
+    ASSERT_FALSE(limiter.acquire("/todo/1", &deadline, slot));
+  }
+
+  limiter.release(slots[0]);
+  ASSERT_TRUE(limiter.acquire("/todo/2", NULL, slots[0]));
+
+  // Requests are released from the limit they were counted against, even
+  // when a longer prefix has been added since
+  limiter.set_max_in_flight("/todo/2", 1);
+
+  for (int i = 0; i < 4; i++)
+  {
+    limiter.release(slots[i]);
+  }
+
+  ASSERT_EQ(0, limiter.in_flight("/todo"));
+  ASSERT_EQ(0, limiter.in_flight("/todo/1"));
+  ASSERT_EQ(0, limiter.in_flight("/todo/2"));
+
+  // Bursts are allowed up to the bucket size, then requests are paced
+  limiter.set_rate("/citizen", 100.0, 3.0);
+
+  double start = monotonic_seconds();
+
+  for (int i = 0; i < 5; i++)
+  {
+    ASSERT_TRUE(limiter.acquire("/citizen", NULL, slots[0]));
+    limiter.release(slots[0]);
+  }
+
+  double elapsed = monotonic_seconds() - start;
+  ASSERT_GE(elapsed, 0.015);
+  ASSERT_LT(elapsed, 0.5);
+
+  {
+    Deadline deadline(0.001);
+    ASSERT_FALSE(limiter.acquire("/citizen", &deadline, slots[0]));
+  }
+
+#ifndef _WIN32
+  // A cancellation is noticed while waiting for a slow rate
+  limiter.set_rate("/citizen", 0.5, 1.0);
+  ASSERT_TRUE(limiter.acquire("/citizen", NULL, slots[0]));
+  limiter.release(slots[0]);
+
+  {
+    CancellationToken token;
+    Deadline deadline(token);
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, cancel_after_50ms, &token);
+
+    start = monotonic_seconds();
+    ASSERT_FALSE(limiter.acquire("/citizen", &deadline, slots[0]));
+    ASSERT_LT(monotonic_seconds() - start, 0.5);
+
+    pthread_join(thread, NULL);
+  }
+#endif
+
+  limiter.clear();
+  ASSERT_TRUE(limiter.acquire("/citizen", NULL, slots[0]));
+  limiter.release(slots[0]);
+}
+
+TEST_F(ApiTest, RateLimit)
+{
+  server.insert("todo", "{\"id\": 1, \"task\": \"Pace\"}");
+
+  Api::set_rate_limit("/todo", 50.0);
+  Api::set_max_in_flight("/todo", 1);
+
+  double start = monotonic_seconds();
+
+  for (int i = 0; i < 4; i++)
+  {
+    Api::get("/todo/1");
+  }
+
+  ASSERT_GE(monotonic_seconds() - start, 0.055);
+
+  // Waiting is bounded by the deadline
+  {
+    Deadline deadline(0.005);
+    ASSERT_THROW(Api::get("/todo/1"), TimeoutError);
+  }
+
+  Api::clear_limits();
+
+  Deadline deadline(1.0);
+  ASSERT_NO_THROW(Api::get("/todo/1"));
+}
+
+TEST_F(ApiTest, Hedging)
+{
+  server.insert("todo", "{\"id\": 1, \"task\": \"Hedge\"}");
+  server.set_latency(50);
+
+  HedgingPolicy policy;
+  policy.enabled     = true;
+  policy.min_samples = 5;
+  Api::set_hedging_policy(policy);
+
+  RequestStatistics statistics;
+  Api::set_observer(&statistics);
+
+  // Response times are collected before hedging
+  for (int i = 0; i < 5; i++)
+  {
+    Api::get("/todo/1");
+  }
+
+  server.set_latency(0);
+
+  size_t request_count = server.request_count();
+  Api::get("/todo/1");
+  ASSERT_EQ(request_count + 1, server.request_count());
+
+  // A straggler is overtaken by the second request
+  server.add_delays(1, 1000);
+
+  double start = monotonic_seconds();
+  ASSERT_STREQ("{\"id\": 1, \"task\": \"Hedge\"}", Api::get("/todo/1").c_str());
+  ASSERT_LT(monotonic_seconds() - start, 0.5);
+  ASSERT_EQ(request_count + 3, server.request_count());
+
+  const EndpointStatistics &get = statistics.endpoints().find("GET /todo/:id")->second;
+  ASSERT_EQ(1, get.hedges);
+  ASSERT_EQ(0, get.errors);
+
+  // Other methods are never hedged
+  server.add_delays(1, 200);
+  Api::put("/todo/1", "{\"task\": \"Wait\"}");
+  ASSERT_EQ(request_count + 4, server.request_count());
+}
+
+TEST_F(ApiTest, CircuitBreaker)
+{
+  server.insert("todo", "{\"id\": 1, \"task\": \"Break\"}");
+
+  CircuitBreakerPolicy policy;
+  policy.failure_threshold = 2;
+  policy.open_seconds      = 0.05;
+  Api::set_circuit_breaker_policy(policy);
+
+  // Client errors do not count as failures
+  ASSERT_THROW(Api::get("/todo/2"), ResponseError);
+  ASSERT_THROW(Api::get("/todo/2"), ResponseError);
+  ASSERT_EQ(CircuitBreaker::CLOSED, Api::circuit_state("GET /todo/:id"));
+
+  server.add_failures(2, 503);
+  ASSERT_THROW(Api::get("/todo/1"), ResponseError);
+  ASSERT_EQ(CircuitBreaker::CLOSED, Api::circuit_state("GET /todo/:id"));
+  ASSERT_THROW(Api::get("/todo/1"), ResponseError);
+  ASSERT_EQ(CircuitBreaker::OPEN, Api::circuit_state("GET /todo/:id"));
+
+  // Requests fail fast without being sent, other endpoints are unaffected
+  size_t request_count = server.request_count();
+  ASSERT_THROW(Api::get("/todo/1"), CircuitOpenError);
+  ASSERT_EQ(request_count, server.request_count());
+  ASSERT_NO_THROW(Api::get("/todo"));
+
+  // A failed trial opens the circuit again
+  sleep_seconds(0.05);
+  server.add_failures(1, 503);
+  ASSERT_THROW(Api::get("/todo/1"), ResponseError);
+  ASSERT_EQ(CircuitBreaker::OPEN, Api::circuit_state("GET /todo/:id"));
+  ASSERT_THROW(Api::get("/todo/1"), CircuitOpenError);
+
+  // A successful trial closes it
+  sleep_seconds(0.05);
+  ASSERT_NO_THROW(Api::get("/todo/1"));
+  ASSERT_EQ(CircuitBreaker::CLOSED, Api::circuit_state("GET /todo/:id"));
+}
+
+TEST_F(ApiTest, LoadBalancing)
+{
+  MockWebservice slow, fast;
+  slow.insert("todo", "{\"id\": 1, \"task\": \"Balance\"}");
+  fast.insert("todo", "{\"id\": 1, \"task\": \"Balance\"}");
+  slow.set_latency(50);
+
+  vector<string> urls;
+  urls.push_back(slow.url());
+  urls.push_back(fast.url());
+
+  Api::set_urls(urls);
+
+  ASSERT_EQ(2, Api::urls().size());
+  ASSERT_EQ(slow.url(), Api::url());
+
+  // Every replica is tried, after which the faster one is preferred
+  for (int i = 0; i < 10; i++)
+  {
+    ASSERT_STREQ("{\"id\": 1, \"task\": \"Balance\"}", Api::get("/todo/1").c_str());
+  }
+
+  ASSERT_EQ(1, slow.request_count());
+  ASSERT_EQ(9, fast.request_count());
+
+  // Failing requests fail over to the other replica, without retrying
+  LoadBalancingPolicy policy;
+  policy.failure_threshold = 1;
+  policy.ejection_seconds  = 10.0;
+  Api::set_load_balancing_policy(policy);
+
+  fast.add_failures(1, 503);
+  ASSERT_NO_THROW(Api::get("/todo/1"));
+  ASSERT_EQ(2, slow.request_count());
+  ASSERT_EQ(10, fast.request_count());
+
+  // The failed replica is ejected
+  ASSERT_NO_THROW(Api::get("/todo/1"));
+  ASSERT_EQ(3, slow.request_count());
+
+  // Unreachable replicas are failed over and ejected too
+  urls[1] = "http://127.0.0.1:1/api";
+  Api::set_urls(urls);
+
+  for (int i = 0; i < 3; i++)
+  {
+    ASSERT_NO_THROW(Api::put("/todo/1", "{\"task\": \"Failover\"}"));
+  }
+
+  ASSERT_EQ(6, slow.request_count());
+
+  // Permanent errors are not failed over
+  ASSERT_THROW(Api::get("/todo/2"), ResponseError);
+  ASSERT_EQ(7, slow.request_count());
+
+  Api::set_url(slow.url());
+  ASSERT_EQ(1, Api::urls().size());
+}
+
+TEST_F(ApiTest, LoadBalancingTies)
+{
+  MockWebservice first, second;
+  first.insert("todo", "{\"id\": 1, \"task\": \"Balance\"}");
+  second.insert("todo", "{\"id\": 1, \"task\": \"Balance\"}");
+  first.set_latency(20);
+  second.set_latency(20);
+
+  vector<string> urls;
+  urls.push_back(first.url());
+  urls.push_back(second.url());
+
+  Api::set_urls(urls);
+
+  // Equally fast replicas share the requests, rather than the one which
+  // happened to respond fastest receiving them all
+  for (int i = 0; i < 30; i++)
+  {
+    ASSERT_NO_THROW(Api::get("/todo/1"));
+  }
+
+  ASSERT_GE(first.request_count(), 5);
+  ASSERT_GE(second.request_count(), 5);
+}
+
+TEST_F(ApiTest, BufferPool)
+{
+  server.fill("todo", 100, "{\"task\": \"Pool\"}");
+
+  string response = Api::get("/todo");
+  const char *data = response.data();
+  size_t size = response.size();
+
+  Api::recycle(response);
+  ASSERT_TRUE(response.empty());
+  ASSERT_EQ(1, Api::pooled_buffers());
+
+  // The next response is received into the same buffer
+  string again = Api::get("/todo");
+  ASSERT_EQ(size, again.size());
+  ASSERT_EQ(data, again.data());
+  ASSERT_EQ(0, Api::pooled_buffers());
+
+  // Oversized buffers are freed
+  Api::set_buffer_pool(4, 16);
+  Api::recycle(again);
+  ASSERT_EQ(0, Api::pooled_buffers());
+}
+
+TEST_F(ApiTest, IncrementalParsing)
+{
+  server.fill("todo", 100, "{\"task\": \"Stream\", \"done\": false}");
+
+  // Left to the caller unless enabled
+  Json::Parser parser;
+  string response = Api::get("/todo", parser);
+  ASSERT_FALSE(parser.is_loaded());
+
+  Api::set_incremental_parsing(true);
+  ASSERT_TRUE(Api::incremental_parsing());
+
+  response = Api::get("/todo", parser);
+  ASSERT_TRUE(parser.is_loaded());
+  ASSERT_EQ(100, parser.find("objects").to_array().size());
+
+  Json::Parser complete(response);
+  ASSERT_STREQ(complete.root().dump().c_str(), parser.root().dump().c_str());
+
+  // Error responses are reported as before, and leave the parser unloaded
+  server.add_failures(1, 500);
+  ASSERT_THROW(Api::get("/todo", parser), ResponseError);
+  ASSERT_FALSE(parser.is_loaded());
+
+  ASSERT_THROW(Api::get("/todo/1000", parser), ResponseError);
+  ASSERT_FALSE(parser.is_loaded());
+
+  // Every attempt starts over
+  RetryPolicy policy;
+  policy.max_retries   = 1;
+  policy.initial_delay = 0.0;
+  Api::set_retry_policy(policy);
+
+  server.add_failures(1, 503);
+  Api::get("/todo/1", parser);
+  ASSERT_EQ("Stream", parser.find("task").to_string());
+}
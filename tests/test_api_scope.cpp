@@ -0,0 +1,373 @@
+// --------------------------------------------------------------------------------
+// Includes
+// --------------------------------------------------------------------------------
+#include <gtest/gtest.h>
+#include <restful_mapper/model.h>
+#include "mocks/mock_webservice.h"
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+using namespace std;
+using namespace restful_mapper;
+
+// --------------------------------------------------------------------------------
+// Declarations
+// --------------------------------------------------------------------------------
+class Ticket : public Model<Ticket>
+{
+public:
+  Primary id;
+  Field<string> title;
+
+  RESTFUL_MAPPER_FIELDS
+  {
+    map("id", id)
+       ("title", title);
+  }
+
+  virtual std::string endpoint() const
+  {
+    return "/ticket";
+  }
+
+  virtual const Primary &primary() const
+  {
+    return id;
+  }
+};
+
+#ifndef _WIN32
+struct Worker
+{
+  MockWebservice *server;
+  RateLimiter *limiter;
+  LoadBalancer *balancer;
+  Api *client;
+  string title;
+  bool ok;
+};
+
+// Configures the client of a worker, on the main thread before it starts
+static void configure(Worker &worker, Api &client)
+{
+  ApiScope scope(client);
+
+  Api::set_url(worker.server->url());
+  Api::set_proxy("");
+  Api::set_rate_limiter(worker.limiter);
+  Api::set_load_balancer(worker.balancer);
+
+  worker.client = &client;
+}
+
+static void *fetch_tickets(void *data)
+{
+  Worker *worker = static_cast<Worker *>(data);
+  worker->ok = true;
+
+  ApiScope scope(worker->client);
+
+  for (int i = 0; i < 20; i++)
+  {
+    worker->ok = worker->ok && (string(Ticket::find(1).title) == worker->title);
+  }
+
+  return NULL;
+}
+#endif
+
+// --------------------------------------------------------------------------------
+// Definitions
+// --------------------------------------------------------------------------------
+TEST(ApiScopeTest, Scope)
+{
+  MockWebservice global, tenant;
+  global.insert("ticket", "{\"id\": 1, \"title\": \"Global\"}");
+  tenant.insert("ticket", "{\"id\": 1, \"title\": \"Tenant\"}");
+  tenant.set_credentials("tenant", "secret");
+
+  Api::set_url(global.url());
+  Api::set_username("");
+  Api::set_password("");
+  Api::set_proxy("");
+
+  Api client;
+  ASSERT_TRUE(ApiScope::active() == NULL);
+
+  {
+    ApiScope scope(client);
+    ASSERT_EQ(&client, ApiScope::active());
+
+    Api::set_url(tenant.url());
+    Api::set_username("tenant");
+    Api::set_password("secret");
+    Api::set_proxy("");
+  }
+
+  ASSERT_TRUE(ApiScope::active() == NULL);
+
+  // Configuration is kept per client
+  ASSERT_EQ(global.url(), Api::url());
+  ASSERT_EQ("", Api::username());
+  ASSERT_EQ("Global", string(Ticket::find(1).title));
+
+  {
+    ApiScope scope(client);
+    ASSERT_EQ(tenant.url(), Api::url());
+    ASSERT_EQ("Tenant", string(Ticket::find(1).title));
+
+    // Binding NULL keeps the current client
+    ApiScope nested(static_cast<Api *>(NULL));
+    ASSERT_EQ("Tenant", string(Ticket::find(1).title));
+  }
+
+  ASSERT_EQ(1, global.request_count());
+  ASSERT_EQ(2, tenant.request_count());
+}
+
+TEST(ApiScopeTest, Model)
+{
+  MockWebservice global, service;
+  global.insert("ticket", "{\"id\": 1, \"title\": \"Global\"}");
+  service.insert("ticket", "{\"id\": 1, \"title\": \"Service\"}");
+
+  Api::set_url(global.url());
+  Api::set_proxy("");
+
+  Api client;
+
+  {
+    ApiScope scope(client);
+    Api::set_url(service.url());
+    Api::set_proxy("");
+    Api::set_incremental_parsing(true);
+  }
+
+  Ticket::set_api(&client);
+  ASSERT_EQ(&client, Ticket::api());
+
+  Ticket ticket = Ticket::find(1);
+  ASSERT_EQ("Service", string(ticket.title));
+  ASSERT_EQ(1, Ticket::find_all().size());
+
+  // Decoded responses are handed back to the client of the model
+  {
+    ApiScope scope(client);
+    ASSERT_EQ(1, Api::pooled_buffers());
+  }
+
+  ticket.title = "Saved";
+  ticket.save();
+  ASSERT_EQ("Saved", string(Ticket::find(1).title));
+
+  // The binding of the model class takes precedence over that of the caller
+  Api other;
+
+  {
+    ApiScope scope(other);
+    ASSERT_EQ("Saved", string(Ticket::find(1).title));
+  }
+
+  ASSERT_EQ(0, global.request_count());
+
+  Ticket::set_api(NULL);
+  ASSERT_EQ("Global", string(Ticket::find(1).title));
+}
+
+#ifndef _WIN32
+TEST(ApiScopeTest, Threads)
+{
+  MockWebservice first, second;
+  first.insert("ticket", "{\"id\": 1, \"title\": \"First\"}");
+  second.insert("ticket", "{\"id\": 1, \"title\": \"Second\"}");
+  first.set_latency(1);
+  second.set_latency(1);
+
+  Worker workers[2];
+  workers[0].server   = &first;
+  workers[0].limiter  = NULL;
+  workers[0].balancer = NULL;
+  workers[0].title    = "First";
+  workers[1].server   = &second;
+  workers[1].limiter  = NULL;
+  workers[1].balancer = NULL;
+  workers[1].title    = "Second";
+
+  Api clients[2];
+
+  for (int i = 0; i < 2; i++)
+  {
+    configure(workers[i], clients[i]);
+  }
+
+  pthread_t threads[2];
+
+  for (int i = 0; i < 2; i++)
+  {
+    pthread_create(&threads[i], NULL, fetch_tickets, &workers[i]);
+  }
+
+  for (int i = 0; i < 2; i++)
+  {
+    pthread_join(threads[i], NULL);
+  }
+
+  ASSERT_TRUE(workers[0].ok);
+  ASSERT_TRUE(workers[1].ok);
+  ASSERT_EQ(20, first.request_count());
+  ASSERT_EQ(20, second.request_count());
+  ASSERT_TRUE(ApiScope::active() == NULL);
+}
+
+TEST(ApiScopeTest, SharedRateLimiter)
+{
+  MockWebservice server;
+  server.insert("ticket", "{\"id\": 1, \"title\": \"Shared\"}");
+
+  // Two clients keep to one rate between them, instead of one rate each
+  RateLimiter limiter;
+  limiter.set_rate("/ticket", 40.0, 1.0);
+
+  Worker workers[2];
+
+  for (int i = 0; i < 2; i++)
+  {
+    workers[i].server   = &server;
+    workers[i].limiter  = &limiter;
+    workers[i].balancer = NULL;
+    workers[i].title    = "Shared";
+  }
+
+  Api clients[2];
+
+  for (int i = 0; i < 2; i++)
+  {
+    configure(workers[i], clients[i]);
+  }
+
+  pthread_t threads[2];
+  double start = monotonic_seconds();
+
+  for (int i = 0; i < 2; i++)
+  {
+    pthread_create(&threads[i], NULL, fetch_tickets, &workers[i]);
+  }
+
+  for (int i = 0; i < 2; i++)
+  {
+    pthread_join(threads[i], NULL);
+  }
+
+  // 40 requests at 40 per second, where one client alone would take half
+  ASSERT_GE(monotonic_seconds() - start, 0.9);
+  ASSERT_TRUE(workers[0].ok);
+  ASSERT_TRUE(workers[1].ok);
+  ASSERT_EQ(40, server.request_count());
+  ASSERT_EQ(0, limiter.in_flight("/ticket"));
+}
+
+TEST(ApiScopeTest, SharedLoadBalancer)
+{
+  MockWebservice first, second;
+  first.insert("ticket", "{\"id\": 1, \"title\": \"Shared\"}");
+  second.insert("ticket", "{\"id\": 1, \"title\": \"Shared\"}");
+  first.set_latency(20);
+  second.set_latency(20);
+
+  // The replicas are configured once, for both clients
+  vector<string> urls;
+  urls.push_back(first.url());
+  urls.push_back(second.url());
+
+  LoadBalancer balancer;
+  balancer.set_urls(urls);
+
+  Worker workers[2];
+
+  for (int i = 0; i < 2; i++)
+  {
+    workers[i].server   = &first;
+    workers[i].limiter  = NULL;
+    workers[i].balancer = &balancer;
+    workers[i].title    = "Shared";
+  }
+
+  Api clients[2];
+
+  for (int i = 0; i < 2; i++)
+  {
+    configure(workers[i], clients[i]);
+  }
+
+  pthread_t threads[2];
+
+  for (int i = 0; i < 2; i++)
+  {
+    pthread_create(&threads[i], NULL, fetch_tickets, &workers[i]);
+  }
+
+  for (int i = 0; i < 2; i++)
+  {
+    pthread_join(threads[i], NULL);
+  }
+
+  // Equally fast replicas share the requests
+  ASSERT_TRUE(workers[0].ok);
+  ASSERT_TRUE(workers[1].ok);
+  ASSERT_EQ(40, first.request_count() + second.request_count());
+  ASSERT_GE(first.request_count(), 5);
+  ASSERT_GE(second.request_count(), 5);
+  ASSERT_EQ(0, balancer.in_flight(0));
+  ASSERT_EQ(0, balancer.in_flight(1));
+}
+#endif
+
+TEST(ApiScopeTest, RateLimiter)
+{
+  Api client;
+  ApiScope scope(client);
+
+  RateLimiter *own = Api::rate_limiter();
+  ASSERT_TRUE(own != NULL);
+
+  RateLimiter shared;
+  Api::set_rate_limiter(&shared);
+  ASSERT_EQ(&shared, Api::rate_limiter());
+
+  // Limits are set on the shared limiter
+  Api::set_max_in_flight("/ticket", 1);
+  RateLimiter::Slot slot, other;
+  ASSERT_TRUE(shared.try_acquire("/ticket", slot));
+  ASSERT_FALSE(shared.try_acquire("/ticket", other));
+  shared.release(slot);
+
+  Api::set_rate_limiter(NULL);
+  ASSERT_EQ(own, Api::rate_limiter());
+}
+
+TEST(ApiScopeTest, LoadBalancer)
+{
+  Api client;
+  ApiScope scope(client);
+
+  Api::set_url("http://own.example.com");
+  LoadBalancer *own = Api::load_balancer();
+
+  vector<string> urls;
+  urls.push_back("http://api-1.example.com");
+  urls.push_back("http://api-2.example.com");
+
+  LoadBalancer shared;
+  shared.set_urls(urls);
+
+  Api::set_load_balancer(&shared);
+  ASSERT_EQ(&shared, Api::load_balancer());
+  ASSERT_EQ("http://api-1.example.com", Api::url());
+  ASSERT_EQ(2, Api::urls().size());
+
+  Api::set_load_balancer(NULL);
+  ASSERT_EQ(own, Api::load_balancer());
+  ASSERT_EQ("http://own.example.com", Api::url());
+}
@@ -0,0 +1,139 @@
+// --------------------------------------------------------------------------------
+// Includes
+// --------------------------------------------------------------------------------
+#include <gtest/gtest.h>
+#include <restful_mapper/model.h>
+
+using namespace std;
+using namespace restful_mapper;
+
+// --------------------------------------------------------------------------------
+// Declarations
+// --------------------------------------------------------------------------------
+class Reading : public Model<Reading>
+{
+public:
+  Primary id;
+  Foreign<Reading> previous_id;
+  Field<string> sensor;
+  Field<double> value;
+  Field<bool> valid;
+  BelongsTo<Reading> previous;
+
+  RESTFUL_MAPPER_FIELDS
+  {
+    map("id", id)
+       ("previous_id", previous_id)
+       ("sensor", sensor)
+       ("value", value)
+       ("valid", valid)
+       ("previous", previous);
+  }
+
+  virtual std::string endpoint() const
+  {
+    return "/reading";
+  }
+
+  virtual const Primary &primary() const
+  {
+    return id;
+  }
+};
+
+struct Above
+{
+  explicit Above(double limit) : limit(limit) {}
+  bool operator()(const double &value) const { return value > limit; }
+  double limit;
+};
+
+// --------------------------------------------------------------------------------
+// Definitions
+// --------------------------------------------------------------------------------
+TEST(ColumnarTest, Columns)
+{
+  const char *rows[] = {
+    "{\"id\":1,\"previous_id\":null,\"sensor\":\"a\",\"value\":2.5,\"valid\":true}",
+    "{\"id\":2,\"previous_id\":1,\"sensor\":\"b\",\"value\":null,\"valid\":false}",
+    "{\"id\":3,\"previous_id\":2,\"sensor\":\"a\",\"value\":-1.5,\"valid\":true}",
+    "{\"id\":4,\"previous_id\":3,\"sensor\":\"c\",\"value\":7.0,\"valid\":true}"
+  };
+
+  Reading::Collection readings;
+
+  for (size_t i = 0; i < 4; i++)
+  {
+    Reading r;
+    r.from_json(rows[i]);
+    readings.push_back(r);
+  }
+
+  Reading::Columns columns(readings);
+
+  ASSERT_EQ(4, columns.size());
+  ASSERT_EQ(5, columns.names().size());
+  ASSERT_STREQ("previous_id", columns.names()[1].c_str());
+
+  const Column<double> &value = columns.column<double>("value");
+
+  ASSERT_EQ(4, value.size());
+  ASSERT_EQ(1, value.null_count());
+  ASSERT_EQ(3, value.count());
+  ASSERT_TRUE(value.is_null(1));
+  ASSERT_FALSE(value.is_null(2));
+  ASSERT_DOUBLE_EQ(8.0, value.sum());
+  ASSERT_DOUBLE_EQ(-1.5, value.min());
+  ASSERT_DOUBLE_EQ(7.0, value.max());
+
+  vector<size_t> above = value.where(Above(0.0));
+  ASSERT_EQ(2, above.size());
+  ASSERT_EQ(0, above[0]);
+  ASSERT_EQ(3, above[1]);
+
+  ASSERT_EQ(3, columns.column<long long>("previous_id").count());
+  ASSERT_EQ(4, columns.column<long long>("id")[3]);
+  ASSERT_STREQ("c", columns.column<string>("sensor")[3].c_str());
+  ASSERT_EQ(3, columns.column<bool>("valid").sum());
+
+  ASSERT_THROW(columns.column<int>("value"), runtime_error);
+  ASSERT_THROW(columns.column<double>("previous"), out_of_range);
+
+  Reading::Columns copy(columns);
+  ASSERT_DOUBLE_EQ(8.0, copy.column<double>("value").sum());
+
+  Reading::Columns empty;
+  ASSERT_TRUE(empty.empty());
+}
+
+TEST(ColumnarTest, Decode)
+{
+  Json::Parser parser("[{\"id\":1,\"previous_id\":9007199254740993,\"sensor\":\"a\",\"value\":2.5,\"valid\":true},"
+    "{\"id\":2,\"previous_id\":1,\"sensor\":null,\"value\":null,\"valid\":false,\"previous\":{\"id\":1}}]");
+
+  Reading::Columns columns;
+  columns.decode(parser.root());
+
+  ASSERT_EQ(2, columns.size());
+  ASSERT_EQ(5, columns.names().size());
+  ASSERT_STREQ("a", columns.column<string>("sensor")[0].c_str());
+  ASSERT_TRUE(columns.column<string>("sensor").is_null(1));
+  ASSERT_DOUBLE_EQ(2.5, columns.column<double>("value").sum());
+  ASSERT_EQ(1, columns.column<bool>("valid").sum());
+
+  // Integers are summed exactly
+  ASSERT_EQ(9007199254740994LL, columns.column<long long>("previous_id").sum());
+
+  // Further rows are appended
+  columns.decode(parser.root());
+  ASSERT_EQ(4, columns.size());
+  ASSERT_EQ(2, columns.column<long long>("id")[3]);
+
+  // A row which cannot be decoded is dropped from every column
+  Json::Parser invalid("[{\"id\":3,\"previous_id\":null}]");
+  ASSERT_THROW(columns.decode(invalid.root()), runtime_error);
+  ASSERT_EQ(4, columns.size());
+  ASSERT_EQ(4, columns.column<long long>("id").size());
+  ASSERT_EQ(4, columns.column<long long>("previous_id").size());
+  ASSERT_EQ(0, columns.column<long long>("previous_id").null_count());
+}
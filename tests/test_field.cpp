@@ -199,6 +199,22 @@ TEST(FieldTest, TimeField)
   f = "2013-12-31T23:59:00.005-02:45";
   ASSERT_STREQ("2014-01-01T02:44:00", f.to_iso8601(false).c_str());
 
+  tm local_fields(f.local_exploded());
+  ASSERT_EQ(113, local_fields.tm_year);
+  ASSERT_EQ(11, local_fields.tm_mon);
+  ASSERT_EQ(31, local_fields.tm_mday);
+  ASSERT_EQ(21, local_fields.tm_hour);
+  ASSERT_EQ(44, local_fields.tm_min);
+  ASSERT_EQ(2, local_fields.tm_wday);
+
+  tm utc_fields(f.utc_exploded());
+  ASSERT_EQ(114, utc_fields.tm_year);
+  ASSERT_EQ(0, utc_fields.tm_mon);
+  ASSERT_EQ(1, utc_fields.tm_mday);
+  ASSERT_EQ(2, utc_fields.tm_hour);
+  ASSERT_EQ(f.utc_hour(), utc_fields.tm_hour);
+  ASSERT_EQ(f.local_hour(), local_fields.tm_hour);
+
   time_t now_ts = time(NULL);
   ASSERT_EQ(now_ts - 18000, utc_time());
 }
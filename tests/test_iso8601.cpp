@@ -0,0 +1,181 @@
+// --------------------------------------------------------------------------------
+// Includes
+// --------------------------------------------------------------------------------
+#include <gtest/gtest.h>
+#include <restful_mapper/internal/iso8601.h>
+#include <cstdio>
+#include <cstdlib>
+
+using namespace std;
+
+// --------------------------------------------------------------------------------
+// Declarations
+// --------------------------------------------------------------------------------
+
+// The previous strftime based formatter, kept as a reference
+string reference_to_iso8601(time_t timestamp, const bool &include_timezone)
+{
+  tm exploded_time(*gmtime(&timestamp));
+  char buf[sizeof "1970-01-01T00:00:00Z"];
+
+  strftime(buf, sizeof buf, include_timezone ? "%Y-%m-%dT%H:%M:%SZ" : "%Y-%m-%dT%H:%M:%S", &exploded_time);
+
+  return buf;
+}
+
+// The previous sscanf and mktime based parser, kept as a reference. It is only
+// accurate in time zones without daylight saving time.
+time_t reference_from_iso8601(const string &descriptor)
+{
+  tm t;
+
+  const char *value = descriptor.c_str();
+  const char *c     = value;
+  int year = 0, month = 0, seconds = 0, minutes = 0, hours = 0, days = 0;
+
+  if (sscanf(value, "%4u-%2u-%2u", &year, &month, &days) == 3) c += 10;
+  else if (sscanf(value, "%4u%2u%2u", &year, &month, &days) == 3) c += 8;
+  else throw runtime_error("Invalid date format");
+
+  t.tm_year = year - 1900;
+  t.tm_mon  = month - 1;
+  t.tm_mday = days;
+  t.tm_hour = t.tm_min = t.tm_sec = 0;
+
+  if (*c == 'T')
+  {
+    c++;
+
+    if (sscanf(c, "%2d%2d", &hours, &minutes) == 2) c += 4;
+    else if (sscanf(c, "%2d:%2d", &hours, &minutes) == 2) c += 5;
+    else throw runtime_error("Invalid date format");
+
+    if (*c == ':') c++;
+
+    if (*c != '\0')
+    {
+      if (sscanf(c, "%2d", &seconds) == 1) c += 2;
+      else throw runtime_error("Invalid date format");
+    }
+
+    t.tm_hour = hours;
+    t.tm_min  = minutes;
+    t.tm_sec  = seconds;
+  }
+  else if (*c != '\0')
+  {
+    throw runtime_error("Invalid date format");
+  }
+
+  if (*c == '.')
+  {
+    c++;
+    while (isdigit(*c) && *c != '\0') c++;
+  }
+
+  int tz_offset = 0;
+
+  if (*c == 'Z') c++;
+
+  if (*c != '\0')
+  {
+    int tz_direction = (*c == '+') ? 1 : -1;
+    int tz_hours = 0, tz_minutes = 0;
+
+    c++;
+
+    if (sscanf(c, "%2d", &tz_hours) == 1) c += 2;
+    if (*c == ':') c++;
+    if (*c != '\0' && sscanf(c, "%2d", &tz_minutes) == 1) c += 2;
+
+    tz_offset = tz_direction * (tz_hours * 3600 + tz_minutes * 60);
+  }
+
+  t.tm_isdst = -1;
+
+  time_t t_local = mktime(&t);
+  tm tm_utc(*gmtime(&t_local));
+  time_t t_utc = mktime(&tm_utc);
+  tz_offset += (t_utc - t_local);
+
+  return mktime(&t) - tz_offset;
+}
+
+// Deterministic pseudo random timestamps between 1970 and 2100
+time_t next_timestamp(unsigned long &state)
+{
+  state = state * 1103515245UL + 12345UL;
+  unsigned long high = (state >> 8) & 0xFFFF;
+
+  state = state * 1103515245UL + 12345UL;
+  unsigned long low = (state >> 8) & 0xFFFF;
+
+  return static_cast<time_t>((high << 16 | low) % 4102444800UL);
+}
+
+// --------------------------------------------------------------------------------
+// Definitions
+// --------------------------------------------------------------------------------
+TEST(Iso8601Test, Explode)
+{
+  const time_t samples[] = { 0, 1, 86399, 86400, 951782400, 951868800, 1234567890, 4102444799LL, -1, -86401, -2208988800LL };
+
+  for (size_t i = 0; i < sizeof(samples) / sizeof(samples[0]); i++)
+  {
+    tm expected(*gmtime(&samples[i]));
+    tm actual;
+    utc_explode(samples[i], actual);
+
+    ASSERT_EQ(expected.tm_year, actual.tm_year);
+    ASSERT_EQ(expected.tm_mon, actual.tm_mon);
+    ASSERT_EQ(expected.tm_mday, actual.tm_mday);
+    ASSERT_EQ(expected.tm_hour, actual.tm_hour);
+    ASSERT_EQ(expected.tm_min, actual.tm_min);
+    ASSERT_EQ(expected.tm_sec, actual.tm_sec);
+    ASSERT_EQ(expected.tm_wday, actual.tm_wday);
+    ASSERT_EQ(expected.tm_yday, actual.tm_yday);
+  }
+
+  ASSERT_EQ(0, days_from_civil(1970, 1, 1));
+  ASSERT_EQ(11016, days_from_civil(2000, 2, 29));
+  ASSERT_EQ(-25567, days_from_civil(1900, 1, 1));
+}
+
+TEST(Iso8601Test, MatchesReference)
+{
+  putenv("TZ=EST5");
+  tzset();
+
+  const char *offsets[] = { "", "Z", "+01:00", "-0330", "+07", "Z+0100", ".068484", ".5-02:45" };
+  unsigned long state = 20131018;
+
+  for (size_t i = 0; i < 5000; i++)
+  {
+    time_t timestamp = next_timestamp(state);
+
+    ASSERT_EQ(reference_to_iso8601(timestamp, true), to_iso8601(timestamp, true));
+    ASSERT_EQ(reference_to_iso8601(timestamp, false), to_iso8601(timestamp, false));
+
+    tm t;
+    utc_explode(timestamp, t);
+
+    char extended[64], basic[64], minutes[64];
+    const char *offset = offsets[i % (sizeof(offsets) / sizeof(offsets[0]))];
+
+    sprintf(extended, "%04d-%02d-%02dT%02d:%02d:%02d%s", t.tm_year + 1900, t.tm_mon + 1, t.tm_mday, t.tm_hour, t.tm_min, t.tm_sec, offset);
+    sprintf(basic, "%04d%02d%02dT%02d%02d%02d%s", t.tm_year + 1900, t.tm_mon + 1, t.tm_mday, t.tm_hour, t.tm_min, t.tm_sec, offset);
+    sprintf(minutes, "%04d-%02d-%02dT%02d:%02d", t.tm_year + 1900, t.tm_mon + 1, t.tm_mday, t.tm_hour, t.tm_min);
+
+    ASSERT_EQ(reference_from_iso8601(extended), from_iso8601(extended)) << extended;
+    ASSERT_EQ(reference_from_iso8601(basic), from_iso8601(basic)) << basic;
+    ASSERT_EQ(reference_from_iso8601(minutes), from_iso8601(minutes)) << minutes;
+    ASSERT_EQ(reference_from_iso8601(string(extended, 10)), from_iso8601(string(extended, 10))) << extended;
+  }
+
+  const char *invalid[] = { "", "203-12-31T23:59", "2013-12", "2013-12-31X", "2013-12-31T2359:0", "2013-13-01", "2013-12-31T23:59:00+1", (const char *) 0 };
+
+  for (const char **descriptor = invalid; *descriptor; descriptor++)
+  {
+    ASSERT_THROW(from_iso8601(*descriptor), runtime_error) << *descriptor;
+  }
+}
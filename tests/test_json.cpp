@@ -3,6 +3,7 @@
 // --------------------------------------------------------------------------------
 #include <gtest/gtest.h>
 #include <restful_mapper/json.h>
+#include <restful_mapper/internal/utf8.h>
 
 using namespace std;
 using namespace restful_mapper;
@@ -24,6 +25,54 @@ TEST(JsonTest, EncodeLiteral)
   ASSERT_STREQ("\"another string\"", Json::encode("another string").c_str());
 }
 
+TEST(JsonTest, EncodeNumber)
+{
+  // Integral doubles keep the ".0" suffix and exponents follow printf
+  ASSERT_STREQ("0.0", Json::encode(0.0).c_str());
+  ASSERT_STREQ("-0.0", Json::encode(-0.0).c_str());
+  ASSERT_STREQ("8.0", Json::encode(8.0).c_str());
+  ASSERT_STREQ("-100.0", Json::encode(-100.0).c_str());
+  ASSERT_STREQ("10000000000000000000.0", Json::encode(1e19).c_str());
+  ASSERT_STREQ("1e+20", Json::encode(1e20).c_str());
+  ASSERT_STREQ("0.0001", Json::encode(0.0001).c_str());
+  ASSERT_STREQ("1.5e-05", Json::encode(1.5e-5).c_str());
+  ASSERT_STREQ("1.7976931348623157e+308", Json::encode(1.7976931348623157e308).c_str());
+  ASSERT_STREQ("5e-324", Json::encode(4.9406564584124654e-324).c_str());
+
+  // Shortest representation that reads back as the same value
+  ASSERT_STREQ("0.1", Json::encode(0.1).c_str());
+  ASSERT_STREQ("0.001", Json::encode(0.001).c_str());
+  ASSERT_STREQ("3.141592653589793", Json::encode(3.1415926535897931).c_str());
+  ASSERT_STREQ("123456.789", Json::encode(123456.789).c_str());
+
+  const double values[] = { 0.3, 2.0 / 3.0, 1e-300, 123e45, -9.87654321e-7, 4503599627370497.0, 0.1 + 0.2 };
+
+  for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++)
+  {
+    ASSERT_EQ(values[i], Json::decode<double>(Json::encode(values[i])));
+  }
+
+  ASSERT_STREQ("0", Json::encode(0).c_str());
+  ASSERT_STREQ("-7", Json::encode(-7).c_str());
+  ASSERT_STREQ("2147483647", Json::encode(2147483647).c_str());
+  ASSERT_STREQ("9223372036854775807", Json::encode(9223372036854775807LL).c_str());
+  ASSERT_STREQ("-9223372036854775808", Json::encode(-9223372036854775807LL - 1).c_str());
+  ASSERT_STREQ("true", Json::encode(true).c_str());
+
+  double zero = 0.0;
+  ASSERT_THROW(Json::encode(zero / zero), runtime_error);
+  ASSERT_THROW(Json::encode(1.0 / zero), runtime_error);
+
+  Json::Emitter emitter;
+  emitter.emit_map_open();
+  emitter.emit("a", 1);
+  emitter.emit("b", 2.5);
+  emitter.emit("c", -3LL);
+  emitter.emit_map_close();
+
+  ASSERT_STREQ("{\"a\":1,\"b\":2.5,\"c\":-3}", emitter.dump().c_str());
+}
+
 TEST(JsonTest, EncodeVector)
 {
   vector<long long> a;
@@ -109,6 +158,23 @@ TEST(JsonTest, Emit)
   ASSERT_STREQ("", emitter.dump().c_str());
 }
 
+TEST(JsonTest, EmitKey)
+{
+  local_charset = "latin1";
+
+  Json::Emitter emitter;
+
+  // Keys are converted from the local charset like values, unless ASCII
+  emitter.emit_map_open();
+  emitter.emit_key("name");
+  emitter.emit("B\xf8rge");
+  emitter.emit_key("k\xf8" "d");
+  emitter.emit(1);
+  emitter.emit_map_close();
+
+  ASSERT_STREQ("{\"name\":\"B\xc3\xb8rge\",\"k\xc3\xb8" "d\":1}", emitter.dump().c_str());
+}
+
 TEST(JsonTest, DecodeLiteral)
 {
   ASSERT_EQ(1, Json::decode<long long>("1"));
@@ -183,3 +249,141 @@ TEST(JsonTest, Parse)
   ASSERT_STREQ("numbers[\"abc\"]", nmap.find("abc")->second.name().c_str());
 }
 
+
+TEST(JsonTest, ParserEngines)
+{
+  Json::ParserEngine engine = Json::parser_engine();
+
+  // Long enough to span several 64 byte blocks, with escapes on block boundaries
+  const char *documents[] = {
+    "{\"test\":4,\"hello\":null,\"strings\":[\"hello\",\"world\"],\"numbers\":{\"abc\":8,\"flaf\":6}}",
+    "[1,-2,0,3.25,-0.5e3,1E-2,9223372036854775807,9223372036854775808,-9223372036854775808,1e400]",
+    "  {  \"a\" : [ true , false , null , { } , [ ] ] ,\n\t\"b\" :\r\n\"\" }  ",
+    "[\"escapes \\\" \\\\ \\/ \\b \\f \\n \\r \\t\",\"\\u00e6\\u00f8\\u00e5 \\u20ac\"]",
+    "[\"..............................................................\\\\\",\"x\"]",
+    "[\"...............................................................\\\"\",\"x\"]",
+    "{\"k\\u0061y\":\"\xc3\xa6\xc3\xb8\xc3\xa5\",\"long\":\"abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789abcdefghij\"}",
+    "\"top level string\"",
+    "42",
+    (const char *) 0
+  };
+
+  for (const char **document = documents; *document; document++)
+  {
+    Json::set_parser_engine(Json::YAJL_ENGINE);
+    Json::Parser yajl(*document);
+
+    Json::set_parser_engine(Json::STRUCTURAL_ENGINE);
+    Json::Parser structural(*document);
+
+    ASSERT_STREQ(yajl.root().dump().c_str(), structural.root().dump().c_str());
+  }
+
+  Json::set_parser_engine(Json::YAJL_ENGINE);
+  Json::Parser yajl(documents[1]);
+  vector<Json::Node> yajl_numbers = yajl.root().to_array();
+
+  Json::set_parser_engine(Json::STRUCTURAL_ENGINE);
+  Json::Parser structural(documents[1]);
+  vector<Json::Node> structural_numbers = structural.root().to_array();
+
+  ASSERT_EQ(yajl_numbers.size(), structural_numbers.size());
+
+  for (size_t i = 0; i < yajl_numbers.size(); i++)
+  {
+    ASSERT_EQ(yajl_numbers[i].is_int(), structural_numbers[i].is_int());
+    ASSERT_EQ(yajl_numbers[i].is_double(), structural_numbers[i].is_double());
+  }
+
+  ASSERT_EQ(9223372036854775807LL, structural_numbers[6].to_int());
+  ASSERT_FALSE(structural_numbers[7].is_int());
+  ASSERT_FALSE(structural_numbers[9].is_double());
+  ASSERT_DOUBLE_EQ(-500.0, structural_numbers[4].to_double());
+
+  Json::Parser surrogates("[\"\\ud83d\\ude00\"]");
+  ASSERT_STREQ("[\"\xf0\x9f\x98\x80\"]", surrogates.root().dump().c_str());
+
+  const char *invalid[] = {
+    "", "   ", "{", "[1,]", "{\"a\":1,}", "{\"a\" 1}", "{1:2}", "[1 2]", "01", "1.", "-", "1e",
+    "tru", "nul", "[\"unterminated]", "\"\\x\"", "\"\\u12g4\"", "\"tab\there\"", "\"\xff\"",
+    "[1]]", "{} {}", "[\"a\"x]",
+    (const char *) 0
+  };
+
+  for (const char **document = invalid; *document; document++)
+  {
+    Json::set_parser_engine(Json::YAJL_ENGINE);
+    ASSERT_THROW(Json::Parser yajl(*document), runtime_error);
+
+    Json::set_parser_engine(Json::STRUCTURAL_ENGINE);
+    ASSERT_THROW(Json::Parser structural(*document), runtime_error);
+  }
+
+  Json::set_parser_engine(engine);
+}
+
+TEST(JsonTest, IncrementalParsing)
+{
+  const char *documents[] = {
+    "{\"test\":4,\"hello\":null,\"strings\":[\"hello\",\"world\"],\"numbers\":{\"abc\":8,\"flaf\":6}}",
+    "[1,-2,0,3.25,-0.5e3,1E-2,9223372036854775807,9223372036854775808,-9223372036854775808]",
+    "  {  \"a\" : [ true , false , null , { } , [ ] ] ,\n\t\"b\" :\r\n\"\" }  ",
+    "{\"k\\u0061y\":\"\xc3\xa6\xc3\xb8\xc3\xa5\",\"objects\":[{\"id\":1},{\"id\":2,\"tags\":[]}]}",
+    "\"top level string\"",
+    "42",
+    (const char *) 0
+  };
+
+  Json::Parser parser;
+  ASSERT_THROW(parser.feed("[]", 2), runtime_error);
+
+  // Split into single bytes and into parts across tokens
+  for (size_t part = 1; part <= 7; part += 6)
+  {
+    for (const char **document = documents; *document; document++)
+    {
+      Json::Parser complete(*document);
+      string text(*document);
+
+      parser.begin();
+      ASSERT_FALSE(parser.is_loaded());
+
+      for (size_t offset = 0; offset < text.size(); offset += part)
+      {
+        ASSERT_TRUE(parser.feed(text.data() + offset, min(part, text.size() - offset)));
+      }
+
+      parser.finish();
+      ASSERT_TRUE(parser.is_loaded());
+      ASSERT_STREQ(complete.root().dump().c_str(), parser.root().dump().c_str());
+    }
+  }
+
+  parser.begin();
+  parser.feed(documents[1], strlen(documents[1]));
+  parser.finish();
+
+  vector<Json::Node> numbers = parser.root().to_array();
+  ASSERT_EQ(-2, numbers[1].to_int());
+  ASSERT_DOUBLE_EQ(-500.0, numbers[4].to_double());
+  ASSERT_EQ(9223372036854775807LL, numbers[6].to_int());
+  ASSERT_FALSE(numbers[7].is_int());
+  ASSERT_TRUE(numbers[7].is_double());
+  ASSERT_FALSE(numbers[8].is_int());
+
+  const char *invalid[] = { "", "{", "[1,]", "[1 2]", "tru", "{\"a\":[1,2}", (const char *) 0 };
+
+  for (const char **document = invalid; *document; document++)
+  {
+    parser.begin();
+    parser.feed(*document, strlen(*document));
+    ASSERT_THROW(parser.finish(), runtime_error);
+    ASSERT_FALSE(parser.is_loaded());
+  }
+
+  // A parser loads complete text as before
+  parser.begin();
+  parser.feed("[1,", 3);
+  parser.load("[2]");
+  ASSERT_EQ(2, parser.root().to_array()[0].to_int());
+}
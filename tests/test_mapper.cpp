@@ -57,6 +57,21 @@ public:
   }
 };
 
+class Note
+{
+public:
+  Primary id;
+  Field<string> text;
+  Field<bool> pinned;
+
+  RESTFUL_MAPPER_FIELDS
+  {
+    map("id", id)
+       ("text", text)
+       ("pinned", pinned);
+  }
+};
+
 TEST(MapperTest, ParseJson)
 {
   Field<int> f_int;
@@ -536,3 +551,84 @@ TEST(MapperTest, OmitParentKeys)
   ASSERT_STREQ("{\"task\":\"Play\"}", m.dump().c_str());
 }
 
+
+TEST(MapperTest, SharedEmitter)
+{
+  Field<int> f_int;
+  Field<string> f_string;
+
+  f_int = 3;
+  f_string = "Play";
+
+  Json::Emitter emitter;
+  emitter.emit_array_open();
+
+  Mapper m(emitter);
+  m.set("revision", f_int);
+  m.set("task", f_string);
+  m.finish();
+
+  emitter.emit_null();
+  emitter.emit_array_close();
+
+  ASSERT_STREQ("[{\"revision\":3,\"task\":\"Play\"},null]", emitter.dump().c_str());
+}
+
+TEST(MapperTest, Projection)
+{
+  Primary f_id;
+  Field<int> f_int;
+  Field<string> f_string;
+  Field<time_t> f_time;
+
+  string json = "{\"id\":3,\"revision\":7,\"task\":\"Play\",\"completed_on\":null}";
+
+  Mapper m(json);
+  Projection p = fields("task");
+  m.set_projection(&p);
+
+  m.get("id", f_id);
+  m.get("revision", f_int);
+  m.get("task", f_string);
+  m.get("completed_on", f_time);
+
+  ASSERT_EQ(3, f_id.get());
+  ASSERT_STREQ("Play", f_string.c_str());
+  ASSERT_TRUE(f_string.is_loaded());
+  ASSERT_FALSE(f_int.is_loaded());
+  ASSERT_FALSE(f_int.is_dirty());
+  ASSERT_FALSE(f_time.is_loaded());
+
+  // Fields that are not loaded are never output
+  Mapper m2(IGNORE_DIRTY_FLAG);
+  m2.set("revision", f_int);
+  m2.set("task", f_string);
+  m2.set("completed_on", f_time);
+
+  ASSERT_STREQ("{\"task\":\"Play\"}", m2.dump().c_str());
+
+  f_int = 5;
+  ASSERT_TRUE(f_int.is_loaded());
+
+  ASSERT_STREQ("completed_on,task", fields("task")("completed_on").dump().c_str());
+}
+
+TEST(MapperTest, FieldList)
+{
+  Note n;
+
+  Mapper in("{\"id\":4,\"text\":\"Buy milk\",\"pinned\":true}");
+  n.map_get(in);
+
+  ASSERT_EQ(4, n.id.get());
+  ASSERT_STREQ("Buy milk", n.text.c_str());
+  ASSERT_TRUE(n.pinned.get());
+  ASSERT_FALSE(n.text.is_dirty());
+
+  n.text = "Buy bread";
+
+  Mapper out(INCLUDE_PRIMARY_KEY);
+  n.map_set(out);
+
+  ASSERT_STREQ("{\"id\":4,\"text\":\"Buy bread\"}", out.dump().c_str());
+}
@@ -0,0 +1,188 @@
+// --------------------------------------------------------------------------------
+// Includes
+// --------------------------------------------------------------------------------
+#include <gtest/gtest.h>
+#include <restful_mapper/model.h>
+#include "mocks/mock_api_test.h"
+
+using namespace std;
+using namespace restful_mapper;
+
+// --------------------------------------------------------------------------------
+// Declarations
+// --------------------------------------------------------------------------------
+class Gauge : public Model<Gauge>
+{
+public:
+  Primary id;
+  Field<string> label;
+  Field<double> reading;
+
+  RESTFUL_MAPPER_FIELDS
+  {
+    map("id", id)
+       ("label", label)
+       ("reading", reading);
+  }
+
+  virtual std::string endpoint() const
+  {
+    return "/gauge";
+  }
+
+  virtual const Primary &primary() const
+  {
+    return id;
+  }
+};
+
+class RecordingObserver : public RequestObserver
+{
+public:
+  vector<RequestMetrics> requests;
+  vector<string> decoded_models;
+
+  virtual void request_finished(const RequestMetrics &metrics)
+  {
+    requests.push_back(metrics);
+  }
+
+  virtual void response_decoded(const RequestMetrics &request, const std::string &model, const double &seconds)
+  {
+    decoded_models.push_back(request.method + " " + request.endpoint + " " + model);
+  }
+};
+
+class MetricsTest : public MockApiTest
+{
+};
+
+// --------------------------------------------------------------------------------
+// Definitions
+// --------------------------------------------------------------------------------
+TEST_F(MetricsTest, Histogram)
+{
+  Histogram histogram;
+
+  ASSERT_EQ(0, histogram.count());
+  ASSERT_EQ(0.0, histogram.percentile(50));
+
+  for (int i = 0; i < 90; i++) histogram.add(0.0001); // 100 us
+  for (int i = 0; i < 10; i++) histogram.add(0.01);   // 10 ms
+
+  ASSERT_EQ(100, histogram.count());
+  ASSERT_EQ(90, histogram.bucket(7));
+  ASSERT_EQ(10, histogram.bucket(14));
+  ASSERT_DOUBLE_EQ(0.01, histogram.max());
+  ASSERT_DOUBLE_EQ(0.00109, histogram.mean());
+  ASSERT_DOUBLE_EQ(0.000128, histogram.percentile(50));
+  ASSERT_DOUBLE_EQ(0.000128, histogram.percentile(90));
+  ASSERT_DOUBLE_EQ(0.01, histogram.percentile(99));
+}
+
+TEST_F(MetricsTest, LatencyWindow)
+{
+  LatencyWindow window(10);
+
+  ASSERT_EQ(0, window.count());
+  ASSERT_EQ(0.0, window.percentile(50));
+
+  for (int i = 10; i > 0; i--) window.add(i * 0.001);
+
+  // Percentiles are exact, not rounded up to a bucket boundary
+  ASSERT_EQ(10, window.count());
+  ASSERT_DOUBLE_EQ(0.005, window.percentile(50));
+  ASSERT_DOUBLE_EQ(0.009, window.percentile(90));
+  ASSERT_DOUBLE_EQ(0.010, window.percentile(95));
+  ASSERT_DOUBLE_EQ(0.001, window.percentile(0));
+
+  // Older durations are forgotten
+  for (int i = 0; i < 9; i++) window.add(0.1);
+
+  ASSERT_EQ(10, window.count());
+  ASSERT_DOUBLE_EQ(0.1, window.percentile(50));
+  ASSERT_DOUBLE_EQ(0.001, window.percentile(10));
+}
+
+TEST_F(MetricsTest, EndpointKey)
+{
+  ASSERT_STREQ("GET /todo", RequestStatistics::endpoint_key("GET", "/todo").c_str());
+  ASSERT_STREQ("GET /todo/:id", RequestStatistics::endpoint_key("GET", "/todo/12").c_str());
+  ASSERT_STREQ("PUT /city/:id/citizens", RequestStatistics::endpoint_key("PUT", "/city/3/citizens").c_str());
+  ASSERT_STREQ("GET /todo", RequestStatistics::endpoint_key("GET", "/todo?q=%7B%7D").c_str());
+  ASSERT_STREQ("GET /v2/todo", RequestStatistics::endpoint_key("GET", "/v2/todo").c_str());
+}
+
+TEST_F(MetricsTest, Observer)
+{
+  server.fill("gauge", 5, "{\"label\": \"Pressure\", \"reading\": 1.5}");
+
+  RecordingObserver observer;
+  Api::set_observer(&observer);
+
+  Gauge::find_all();
+  Gauge::find(3);
+  ASSERT_THROW(Gauge::find(9), ResponseError);
+
+  Api::set_observer(NULL);
+  Gauge::find_all();
+
+  ASSERT_EQ(3, observer.requests.size());
+
+  const RequestMetrics &metrics = observer.requests[0];
+  ASSERT_STREQ("GET", metrics.method.c_str());
+  ASSERT_STREQ("/gauge", metrics.endpoint.c_str());
+  ASSERT_EQ(200, metrics.status);
+  ASSERT_EQ(0, metrics.retries);
+  ASSERT_FALSE(metrics.from_cache);
+  ASSERT_GT(metrics.bytes_received, 200);
+  ASSERT_GT(metrics.total_time, 0.0);
+  ASSERT_GE(metrics.total_time, metrics.first_byte_time);
+
+  ASSERT_STREQ("/gauge/3", observer.requests[1].endpoint.c_str());
+  ASSERT_EQ(404, observer.requests[2].status);
+
+  ASSERT_EQ(2, observer.decoded_models.size());
+  ASSERT_STREQ("GET /gauge Gauge", observer.decoded_models[0].c_str());
+  ASSERT_STREQ("GET /gauge/3 Gauge", observer.decoded_models[1].c_str());
+}
+
+TEST_F(MetricsTest, Statistics)
+{
+  server.fill("gauge", 5, "{\"label\": \"Pressure\", \"reading\": 1.5}");
+
+  RequestStatistics statistics;
+  Api::set_observer(&statistics);
+
+  for (int i = 1; i <= 5; i++)
+  {
+    Gauge gauge = Gauge::find(i);
+    gauge.reading = 2.5;
+    gauge.save();
+  }
+
+  ASSERT_THROW(Gauge::find(6), ResponseError);
+
+  Api::set_observer(NULL);
+
+  ASSERT_EQ(2, statistics.endpoints().size());
+
+  const EndpointStatistics &get = statistics.endpoints().find("GET /gauge/:id")->second;
+  ASSERT_EQ(6, get.requests);
+  ASSERT_EQ(1, get.errors);
+  ASSERT_EQ(5, get.status_codes.find(200)->second);
+  ASSERT_EQ(1, get.status_codes.find(404)->second);
+  ASSERT_EQ(6, get.total_time.count());
+  ASSERT_EQ(5, get.decode_time.count());
+
+  const EndpointStatistics &put = statistics.endpoints().find("PUT /gauge/:id")->second;
+  ASSERT_EQ(5, put.requests);
+  ASSERT_EQ(0, put.errors);
+  ASSERT_GT(put.bytes_sent, 0);
+  ASSERT_EQ(5, put.decode_time.count());
+
+  Json::Parser parser(statistics.to_json());
+  ASSERT_EQ(6, parser.find("GET /gauge/:id").find("requests").to_int());
+  ASSERT_EQ(1, parser.find("GET /gauge/:id").find("status_codes").find("404").to_int());
+  ASSERT_EQ(5, parser.find("PUT /gauge/:id").find("decode_time").find("count").to_int());
+}
@@ -0,0 +1,160 @@
+// --------------------------------------------------------------------------------
+// Includes
+// --------------------------------------------------------------------------------
+#include <gtest/gtest.h>
+#include <restful_mapper/model.h>
+#include "mocks/mock_webservice.h"
+
+using namespace std;
+using namespace restful_mapper;
+
+// --------------------------------------------------------------------------------
+// Declarations
+// --------------------------------------------------------------------------------
+class Chore : public Model<Chore>
+{
+public:
+  Primary id;
+  Field<string> task;
+  Field<int> priority;
+  Field<bool> completed;
+
+  RESTFUL_MAPPER_FIELDS
+  {
+    map("id", id)
+       ("task", task)
+       ("priority", priority)
+       ("completed", completed);
+  }
+
+  virtual std::string endpoint() const
+  {
+    return "/chore";
+  }
+
+  virtual const Primary &primary() const
+  {
+    return id;
+  }
+};
+
+class MockWebserviceTest : public ::testing::Test
+{
+protected:
+  MockWebservice server;
+
+  virtual void SetUp()
+  {
+    Api::set_url(server.url());
+    Api::set_username("");
+    Api::set_password("");
+    Api::set_proxy("");
+
+    server.add_column("chore", "task");
+    server.add_column("chore", "priority");
+    server.add_column("chore", "completed");
+  }
+};
+
+// --------------------------------------------------------------------------------
+// Definitions
+// --------------------------------------------------------------------------------
+TEST_F(MockWebserviceTest, Crud)
+{
+  server.fill("chore", 3, "{\"task\": \"Sweep\", \"priority\": 2, \"completed\": false}");
+
+  Chore::Collection chores = Chore::find_all();
+  ASSERT_EQ(3, chores.size());
+  ASSERT_EQ(3, chores[2].id.get());
+  ASSERT_STREQ("Sweep", chores[2].task.get().c_str());
+
+  Chore chore = Chore::find(2);
+  ASSERT_EQ(2, chore.priority.get());
+  ASSERT_FALSE(chore.completed.get());
+
+  chore.completed = true;
+  chore.save();
+
+  ASSERT_TRUE(Chore::find(2).completed.get());
+  ASSERT_STREQ("Sweep", Chore::find(2).task.get().c_str());
+
+  Chore created;
+  created.task = "Dust";
+  created.save();
+
+  ASSERT_EQ(4, created.id.get());
+  ASSERT_TRUE(created.exists());
+  ASSERT_EQ(4, Chore::find_all().size());
+
+  created.destroy();
+
+  ASSERT_EQ(3, Chore::find_all().size());
+  try
+  {
+    Chore::find(4);
+    FAIL() << "Expected ResponseError";
+  }
+  catch (ResponseError &e)
+  {
+    ASSERT_EQ(404, e.code());
+  }
+
+  ASSERT_EQ(10, server.request_count());
+}
+
+TEST_F(MockWebserviceTest, ValidationErrors)
+{
+  server.add_validation_error("chore", "task", "must not be empty");
+
+  Chore chore;
+  chore.task = "";
+
+  try
+  {
+    chore.save();
+    FAIL() << "Expected ValidationError";
+  }
+  catch (ValidationError &e)
+  {
+    ASSERT_STREQ("must not be empty", e["task"].c_str());
+  }
+
+  ASSERT_THROW(Api::post("/chore", "[1, 2]"), BadRequestError);
+  ASSERT_THROW(Api::post("/chore", "{\"task\": "), BadRequestError);
+  ASSERT_EQ(0, Chore::find_all().size());
+}
+
+TEST_F(MockWebserviceTest, Authentication)
+{
+  server.set_credentials("admin", "test");
+  server.insert("chore", "{\"id\": 7, \"task\": \"Cook\"}");
+
+  ASSERT_THROW(Chore::find(7), AuthenticationError);
+
+  Api::set_username("admin");
+  Api::set_password("wrong");
+  ASSERT_THROW(Chore::find(7), AuthenticationError);
+
+  Api::set_password("test");
+  ASSERT_STREQ("Cook", Chore::find(7).task.get().c_str());
+}
+
+TEST_F(MockWebserviceTest, Payload)
+{
+  string task(1000, 'x');
+  server.fill("chore", 2000, "{\"task\": \"" + task + "\", \"priority\": 1}");
+  server.set_latency(1);
+
+  Chore::Collection chores = Chore::find_all();
+
+  ASSERT_EQ(2000, chores.size());
+  ASSERT_EQ(2000, chores[1999].id.get());
+  ASSERT_EQ(task, chores[1999].task.get());
+
+  // Large request bodies are announced with Expect: 100-continue
+  Chore chore;
+  chore.task = string(100000, 'y');
+  chore.save();
+
+  ASSERT_EQ(100000, Chore::find(2001).task.get().size());
+}
@@ -4,6 +4,7 @@
 #include <gtest/gtest.h>
 #include <restful_mapper/model.h>
 #include <restful_mapper/internal/utf8.h>
+#include "mocks/mock_api_test.h"
 
 using namespace std;
 using namespace restful_mapper;
@@ -266,6 +267,14 @@ protected:
   }
 };
 
+class LazyRelationTest : public MockApiTest
+{
+};
+
+class CacheTest : public MockApiTest
+{
+};
+
 TEST_F(ModelTest, ClassName)
 {
   ASSERT_STREQ("Todo", Todo::class_name().c_str());
@@ -549,6 +558,31 @@ TEST_F(ModelTest, CollectionFind)
   ASSERT_FALSE(todos.contains(5));
 }
 
+TEST_F(ModelTest, Projection)
+{
+  Todo t = Todo::find(2, fields("task"));
+
+  ASSERT_EQ(2, t.id.get());
+  ASSERT_TRUE(t.exists());
+  ASSERT_STREQ("???", t.task.c_str());
+  ASSERT_FALSE(t.priority.is_loaded());
+  ASSERT_FALSE(t.completed.is_loaded());
+
+  Todo::Collection todos = Todo::find_all(fields("task")("priority"));
+
+  ASSERT_EQ(3, todos.size());
+  ASSERT_TRUE(todos[0].priority.is_loaded());
+  ASSERT_FALSE(todos[0].time.is_loaded());
+
+  // Only loaded fields are saved
+  t.task = "Walk the cat";
+  t.save();
+
+  Todo t2 = Todo::find(2);
+  ASSERT_STREQ("Walk the cat", t2.task.c_str());
+  ASSERT_FALSE(t2.completed.is_null());
+}
+
 TEST_F(ModelTest, GetHasOne)
 {
   City c = City::find(2);
@@ -662,6 +696,33 @@ TEST_F(ModelTest, QueryMany)
   ASSERT_TRUE(todos2.empty());
 }
 
+TEST_F(ModelTest, QueryPrepared)
+{
+  Query q;
+  q("priority").gte(QueryParam(0));
+  q.order_by_asc(q.field("priority"));
+
+  PreparedQuery prepared(q);
+
+  prepared.bind(0, 3);
+  ASSERT_EQ(2, Todo::find_all(prepared).size());
+
+  prepared.bind(0, 10);
+  Todo::Collection todos = Todo::find_all(prepared);
+
+  ASSERT_EQ(1, todos.size());
+  ASSERT_STREQ("Profit!!!", todos[0].task.c_str());
+
+  q.clear();
+  q("id").eq(QueryParam(0));
+  q.single();
+
+  PreparedQuery single(q);
+
+  single.bind(0, 2);
+  ASSERT_STREQ("???", Todo::find(single).task.c_str());
+}
+
 TEST_F(ModelTest, IsDirty)
 {
   Todo t;
@@ -746,6 +807,218 @@ TEST_F(ModelTest, ReloadManyRelated)
   ASSERT_FALSE(c.name.is_dirty());
 }
 
+TEST_F(ModelTest, LazyHasMany)
+{
+  Country c;
+  c.cities.set_lazy();
+  c.from_json("{\"id\":1,\"name\":\"Denmark\"}", 0, true);
+
+  ASSERT_FALSE(c.cities.is_loaded());
+  ASSERT_STREQ("/country/1/cities", c.cities.pending_url().c_str());
+  ASSERT_FALSE(c.is_dirty());
+
+  ASSERT_EQ(2, c.cities.size());
+  ASSERT_TRUE(c.cities.is_loaded());
+  ASSERT_FALSE(c.cities.is_dirty());
+  ASSERT_STREQ("Aarhus", c.cities[1].name.c_str());
+
+  // Partial input does not defer relationships
+  c.from_json("{\"name\":\"Danmark\"}", IGNORE_MISSING_FIELDS);
+  ASSERT_TRUE(c.cities.is_loaded());
+  ASSERT_EQ(2, c.cities.size());
+}
+
+TEST_F(ModelTest, LazyBelongsTo)
+{
+  City c;
+  c.country.set_lazy();
+  c.from_json("{\"id\":3,\"country_id\":2,\"name\":\"Stockholm\"}", 0, true);
+
+  ASSERT_FALSE(c.country.is_loaded());
+  ASSERT_STREQ("Sweden", c.country->name.c_str());
+  ASSERT_TRUE(c.country.is_loaded());
+  ASSERT_FALSE(c.country.is_dirty());
+}
+
+TEST_F(ModelTest, LoadAllRelated)
+{
+  Country::Collection countries;
+
+  for (int i = 0; i < 3; i++)
+  {
+    countries.push_back(Country());
+    Country &c = countries.back();
+    c.cities.set_lazy();
+    c.from_json(Country::find(i + 1).to_json(IGNORE_DIRTY_FLAG | INCLUDE_PRIMARY_KEY | OUTPUT_SHALLOW), 0, true);
+  }
+
+  ASSERT_FALSE(countries[0].cities.is_loaded());
+
+  Country::load_all(countries, &Country::cities, "country_id");
+
+  ASSERT_TRUE(countries[0].cities.is_loaded());
+  ASSERT_EQ(2, countries[0].cities.items().size());
+  ASSERT_EQ(1, countries[1].cities.items().size());
+  ASSERT_EQ(0, countries[2].cities.items().size());
+  ASSERT_STREQ("Stockholm", countries[1].cities[0].name.c_str());
+  ASSERT_FALSE(countries[0].cities.is_dirty());
+
+  City::Collection cities;
+
+  for (int i = 0; i < 3; i++)
+  {
+    cities.push_back(City());
+    City &c = cities.back();
+    c.country.set_lazy();
+    c.from_json(City::find(i + 1).to_json(IGNORE_DIRTY_FLAG | INCLUDE_PRIMARY_KEY | OUTPUT_SHALLOW), 0, true);
+  }
+
+  City::load_all(cities, &City::country, "country_id");
+
+  ASSERT_TRUE(cities[2].country.is_loaded());
+  ASSERT_STREQ("Denmark", cities[1].country->name.c_str());
+  ASSERT_STREQ("Sweden", cities[2].country->name.c_str());
+}
+
+TEST_F(LazyRelationTest, Serialize)
+{
+  Country country;
+  country.cities.set_lazy();
+  country.from_json("{\"id\":1,\"name\":\"Denmark\"}", 0, true);
+
+  // Relationships which were never loaded are left out, without requests
+  ASSERT_EQ(string::npos, country.to_json(IGNORE_DIRTY_FLAG).find("cities"));
+  ASSERT_FALSE(country.cities.is_loaded());
+
+  City city;
+  city.country.set_lazy();
+  city.from_json("{\"id\":3,\"country_id\":2,\"name\":\"Stockholm\"}", 0, true);
+
+  ASSERT_FALSE(city.country.is_null());
+  ASSERT_EQ(string::npos, city.to_json(IGNORE_DIRTY_FLAG).find("\"country\""));
+  ASSERT_FALSE(city.country.is_loaded());
+
+  ASSERT_EQ(0, server.request_count());
+}
+
+TEST_F(LazyRelationTest, LoadAfterFailure)
+{
+  server.insert("country", "{\"id\": 1, \"name\": \"Denmark\"}");
+  server.insert("city", "{\"id\": 1, \"country_id\": 1, \"name\": \"Copenhagen\"}");
+
+  // A failed request leaves the relationship to be loaded on the next access
+  Country country;
+  country.cities.defer("/city");
+
+  server.add_failures(1, 503);
+  ASSERT_THROW(country.cities.size(), ResponseError);
+  ASSERT_FALSE(country.cities.is_loaded());
+  ASSERT_EQ(1, country.cities.size());
+  ASSERT_STREQ("Copenhagen", country.cities[0].name.c_str());
+  ASSERT_FALSE(country.cities.is_dirty());
+
+  // So does a response which cannot be decoded
+  server.insert("city", "{\"id\": 2, \"country_id\": 1}");
+  country.cities.defer("/city");
+
+  ASSERT_THROW(country.cities.size(), runtime_error);
+  ASSERT_FALSE(country.cities.is_loaded());
+  ASSERT_EQ(string::npos, country.to_json(IGNORE_DIRTY_FLAG).find("cities"));
+
+  server.insert("city", "{\"id\": 2, \"country_id\": 1, \"name\": \"Aarhus\"}");
+  ASSERT_EQ(2, country.cities.size());
+
+  City city;
+  city.country.defer("/country/1");
+
+  server.add_failures(1, 503);
+  ASSERT_THROW(city.country.get(), ResponseError);
+  ASSERT_FALSE(city.country.is_loaded());
+  ASSERT_FALSE(city.country.is_null());
+  ASSERT_STREQ("Denmark", city.country->name.c_str());
+  ASSERT_FALSE(city.country.is_dirty());
+}
+
+TEST_F(LazyRelationTest, LoadAllBatches)
+{
+  server.insert("city", "{\"id\": 1, \"country_id\": 1, \"name\": \"Copenhagen\"}");
+
+  Country::Collection countries;
+
+  for (int i = 0; i < 450; i++)
+  {
+    ostringstream json;
+    json << "{\"id\":" << (i + 1) << ",\"name\":\"Country\"}";
+
+    countries.push_back(Country());
+    Country &c = countries.back();
+    c.cities.set_lazy();
+    c.from_json(json.str(), 0, true);
+  }
+
+  Country::load_all(countries, &Country::cities, "country_id");
+
+  // One request per 200 ids, each with a URL of bounded length
+  ASSERT_EQ(3, server.request_count());
+  ASSERT_TRUE(countries[449].cities.is_loaded());
+  ASSERT_EQ(0, countries[449].cities.size());
+}
+
+class DecodeCounter : public RequestObserver
+{
+public:
+  DecodeCounter() : decodes(0) {}
+
+  virtual void response_decoded(const RequestMetrics &request, const std::string &model, const double &seconds)
+  {
+    decodes++;
+  }
+
+  int decodes;
+};
+
+TEST_F(CacheTest, ReloadUnchanged)
+{
+  server.set_etags(true);
+  server.insert("todo", "{\"id\": 1, \"task\": \"Cache\", \"priority\": 1, \"time\": 1.5, "
+      "\"completed\": false, \"completed_on\": null}");
+
+  Api::set_cache_size(1024 * 1024);
+
+  DecodeCounter counter;
+  Api::set_observer(&counter);
+
+  Todo todo = Todo::find(1);
+  ASSERT_EQ(1, counter.decodes);
+  ASSERT_FALSE(Api::response_unchanged());
+
+  // An unchanged response is not decoded again
+  todo.reload();
+  ASSERT_TRUE(Api::response_unchanged());
+  ASSERT_EQ(1, counter.decodes);
+  ASSERT_EQ("Cache", string(todo.task));
+
+  // Local changes are still discarded
+  todo.task = "Local";
+  todo.reload();
+  ASSERT_EQ(2, counter.decodes);
+  ASSERT_EQ("Cache", string(todo.task));
+
+  // Another object is decoded from the cached response
+  Todo other = Todo::find(1);
+  ASSERT_TRUE(Api::response_unchanged());
+  ASSERT_EQ(3, counter.decodes);
+  ASSERT_EQ("Cache", string(other.task));
+
+  // Changes on the server are decoded
+  other.task = "Changed";
+  other.save();
+  todo.reload();
+  ASSERT_FALSE(Api::response_unchanged());
+  ASSERT_EQ("Changed", string(todo.task));
+  ASSERT_EQ(6, server.request_count());
+}
+
 TEST_F(ModelTest, Comparison)
 {
   Country c1_1 = Country::find(1);
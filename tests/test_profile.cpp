@@ -0,0 +1,144 @@
+// --------------------------------------------------------------------------------
+// Includes
+// --------------------------------------------------------------------------------
+#include <gtest/gtest.h>
+#include <restful_mapper/model.h>
+#include <restful_mapper/profile.h>
+#include <cstring>
+
+using namespace std;
+using namespace restful_mapper;
+
+// --------------------------------------------------------------------------------
+// Declarations
+// --------------------------------------------------------------------------------
+class Shelf;
+
+class Volume : public Model<Volume>
+{
+public:
+  Primary id;
+  Foreign<Shelf> shelf_id;
+  Field<string> title;
+
+  RESTFUL_MAPPER_FIELDS
+  {
+    map("id", id)
+       ("shelf_id", shelf_id)
+       ("title", title);
+  }
+
+  virtual std::string endpoint() const
+  {
+    return "/volume";
+  }
+
+  virtual const Primary &primary() const
+  {
+    return id;
+  }
+};
+
+class Shelf : public Model<Shelf>
+{
+public:
+  Primary id;
+  Field<string> label;
+  HasMany<Volume> volumes;
+
+  RESTFUL_MAPPER_FIELDS
+  {
+    map("id", id)
+       ("label", label)
+       ("volumes", volumes);
+  }
+
+  virtual std::string endpoint() const
+  {
+    return "/shelf";
+  }
+
+  virtual const Primary &primary() const
+  {
+    return id;
+  }
+};
+
+static const char *shelf_json = "{\"id\": 1, \"label\": \"Fiction\", \"volumes\": ["
+  "{\"id\": 1, \"shelf_id\": 1, \"title\": \"Emma\"}, "
+  "{\"id\": 2, \"shelf_id\": 1, \"title\": \"Ulysses\"}]}";
+
+// --------------------------------------------------------------------------------
+// Definitions
+// --------------------------------------------------------------------------------
+TEST(ProfileTest, Disabled)
+{
+  if (Profile::enabled()) return;
+
+  Shelf shelf;
+  shelf.from_json(shelf_json);
+  shelf.to_json();
+
+  ASSERT_TRUE(Profile::models().empty());
+  ASSERT_STREQ("{}", Profile::to_json().c_str());
+}
+
+TEST(ProfileTest, Decode)
+{
+  if (!Profile::enabled()) return;
+
+  Profile::reset();
+
+  Shelf shelf;
+  shelf.from_json(shelf_json);
+
+  ASSERT_EQ(2, shelf.volumes.size());
+
+  const ModelProfile &shelf_profile = Profile::models().find(Shelf::class_name())->second;
+  const ModelProfile &volume_profile = Profile::models().find(Volume::class_name())->second;
+
+  // Counts are attributed to the innermost model
+  ASSERT_EQ(1, shelf_profile.calls[PROFILE_DECODE]);
+  ASSERT_EQ(2, shelf_profile.counters[PROFILE_FIELDS_DECODED]);
+  ASSERT_EQ(strlen(shelf_json), shelf_profile.counters[PROFILE_BYTES_PARSED]);
+  ASSERT_EQ(2, volume_profile.calls[PROFILE_DECODE]);
+  ASSERT_EQ(2, volume_profile.calls[PROFILE_PARSE]);
+  ASSERT_EQ(6, volume_profile.counters[PROFILE_FIELDS_DECODED]);
+
+  ASSERT_LT(0, shelf_profile.counters[PROFILE_NODES_VISITED]);
+  ASSERT_LT(0, shelf_profile.counters[PROFILE_ALLOCATIONS]);
+  ASSERT_LE(0.0, shelf_profile.seconds[PROFILE_DECODE]);
+  ASSERT_LE(0.0, volume_profile.seconds[PROFILE_PARSE]);
+
+  Profile::reset();
+
+  ASSERT_EQ(0, Profile::models().find(Shelf::class_name())->second.calls[PROFILE_DECODE]);
+}
+
+TEST(ProfileTest, Encode)
+{
+  if (!Profile::enabled()) return;
+
+  Shelf shelf;
+  shelf.from_json(shelf_json, TOUCH_FIELDS);
+
+  Profile::reset();
+
+  string json = shelf.to_json(INCLUDE_PRIMARY_KEY | IGNORE_DIRTY_FLAG);
+
+  const ModelProfile &shelf_profile = Profile::models().find(Shelf::class_name())->second;
+  const ModelProfile &volume_profile = Profile::models().find(Volume::class_name())->second;
+
+  ASSERT_EQ(1, shelf_profile.calls[PROFILE_ENCODE]);
+  ASSERT_EQ(2, shelf_profile.counters[PROFILE_FIELDS_ENCODED]);
+  ASSERT_EQ(2, volume_profile.calls[PROFILE_ENCODE]);
+
+  // The parent keys of the volumes are omitted
+  ASSERT_EQ(4, volume_profile.counters[PROFILE_FIELDS_ENCODED]);
+  ASSERT_EQ(json.size(), shelf_profile.counters[PROFILE_BYTES_EMITTED] + volume_profile.counters[PROFILE_BYTES_EMITTED]);
+
+  Json::Parser parser(Profile::to_json());
+
+  ASSERT_EQ(1, parser.find(Shelf::class_name()).find("encode").find("calls").to_int());
+  ASSERT_EQ(2, parser.find(Shelf::class_name()).find("fields_encoded").to_int());
+}
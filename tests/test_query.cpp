@@ -107,3 +107,79 @@ TEST(QueryTest, ClearQuery)
 
   ASSERT_STREQ("{}", q.dump().c_str());
 }
+
+TEST(QueryTest, PreparedQuery)
+{
+  Query q;
+
+  q("user_id").eq(QueryParam(0));
+  q("task").neq("Sleep & eat");
+  q("priority").in(QueryParam(1));
+  q("owner_id").eq(QueryParam(0));
+  q.limit(10);
+
+  PreparedQuery prepared(q);
+
+  ASSERT_EQ(2, prepared.size());
+  ASSERT_THROW(prepared.escaped(), runtime_error);
+  ASSERT_THROW(prepared.bind(2, 1), out_of_range);
+
+  vector<int> priorities;
+  priorities.push_back(1);
+  priorities.push_back(3);
+
+  prepared.bind(0, 5).bind(1, priorities);
+
+  Query expected;
+
+  expected("user_id").eq(5);
+  expected("task").neq("Sleep & eat");
+  expected("priority").in(priorities);
+  expected("owner_id").eq(5);
+  expected.limit(10);
+
+  ASSERT_STREQ(Api::escape(expected.dump()).c_str(), prepared.escaped().c_str());
+
+  prepared.bind(0, "Jimi");
+  expected.clear();
+
+  expected("user_id").eq("Jimi");
+  expected("task").neq("Sleep & eat");
+  expected("priority").in(priorities);
+  expected("owner_id").eq("Jimi");
+  expected.limit(10);
+
+  ASSERT_STREQ(Api::escape(expected.dump()).c_str(), prepared.escaped().c_str());
+}
+
+TEST(QueryTest, PreparedQueryLiterals)
+{
+  Query q;
+
+  // Values which look like generated JSON are not taken for parameters
+  q("task").eq("\"{{restful_mapper:param:0}}\" null");
+  q("ratio").in(QueryParam(0));
+  q("done").not_in(QueryParam(1));
+  q("note").eq("{{restful_mapper:param:");
+
+  PreparedQuery prepared(q);
+  ASSERT_EQ(2, prepared.size());
+
+  vector<double> ratios;
+  ratios.push_back(0.5);
+  ratios.push_back(1.25);
+
+  vector<bool> done;
+  done.push_back(false);
+
+  prepared.bind(0, ratios).bind(1, done);
+
+  Query expected;
+
+  expected("task").eq("\"{{restful_mapper:param:0}}\" null");
+  expected("ratio").in(ratios);
+  expected("done").not_in(done);
+  expected("note").eq("{{restful_mapper:param:");
+
+  ASSERT_STREQ(Api::escape(expected.dump()).c_str(), prepared.escaped().c_str());
+}
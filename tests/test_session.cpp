@@ -0,0 +1,251 @@
+// --------------------------------------------------------------------------------
+// Includes
+// --------------------------------------------------------------------------------
+#include <gtest/gtest.h>
+#include <restful_mapper/model.h>
+#include <restful_mapper/internal/utf8.h>
+#include "mocks/mock_api_test.h"
+
+using namespace std;
+using namespace restful_mapper;
+
+// --------------------------------------------------------------------------------
+// Declarations
+// --------------------------------------------------------------------------------
+class Land : public Model<Land>
+{
+public:
+  Primary id;
+  Field<string> name;
+
+  virtual void map_set(Mapper &mapper) const
+  {
+    mapper.set("name", name);
+    mapper.set("land_id", id);
+  }
+
+  virtual void map_get(const Mapper &mapper)
+  {
+    mapper.get("name", name);
+    mapper.get("land_id", id);
+  }
+
+  virtual std::string endpoint() const
+  {
+    return "/land";
+  }
+
+  virtual const Primary &primary() const
+  {
+    return id;
+  }
+};
+
+class Town : public Model<Town>
+{
+public:
+  Primary id;
+  Field<string> name;
+  BelongsTo<Land> land;
+
+  virtual void map_set(Mapper &mapper) const
+  {
+    mapper.set("id", id);
+    mapper.set("name", name);
+    mapper.set("land", land);
+  }
+
+  virtual void map_get(const Mapper &mapper)
+  {
+    mapper.get("id", id);
+    mapper.get("name", name);
+    mapper.get("land", land);
+  }
+
+  virtual std::string endpoint() const
+  {
+    return "/town";
+  }
+
+  virtual const Primary &primary() const
+  {
+    return id;
+  }
+};
+
+class Region : public Model<Region>
+{
+public:
+  Primary id;
+  HasMany<Town> towns;
+
+  virtual void map_set(Mapper &mapper) const
+  {
+    mapper.set("id", id);
+    mapper.set("towns", towns);
+  }
+
+  virtual void map_get(const Mapper &mapper)
+  {
+    mapper.get("id", id);
+    mapper.get("towns", towns);
+  }
+
+  virtual std::string endpoint() const
+  {
+    return "/region";
+  }
+
+  virtual const Primary &primary() const
+  {
+    return id;
+  }
+};
+
+class SessionTest : public MockApiTest
+{
+};
+
+// --------------------------------------------------------------------------------
+// Definitions
+// --------------------------------------------------------------------------------
+TEST_F(SessionTest, PrimaryKey)
+{
+  ASSERT_STREQ("id", Town::primary_key().c_str());
+  ASSERT_STREQ("land_id", Land::primary_key().c_str());
+}
+
+TEST_F(SessionTest, Scope)
+{
+  ASSERT_TRUE(Session::active() == NULL);
+
+  {
+    Session outer;
+    ASSERT_EQ(&outer, Session::active());
+
+    {
+      Session inner;
+      ASSERT_EQ(&inner, Session::active());
+    }
+
+    ASSERT_EQ(&outer, Session::active());
+  }
+
+  ASSERT_TRUE(Session::active() == NULL);
+}
+
+TEST_F(SessionTest, Store)
+{
+  Session session;
+
+  Land l;
+  l.id = 4;
+  l.name = "Denmark";
+
+  ASSERT_TRUE(session.find<Land>(4) == NULL);
+
+  session.store(4, l);
+
+  ASSERT_EQ(1, session.size());
+  ASSERT_STREQ("Denmark", session.find<Land>(4)->name.c_str());
+  ASSERT_TRUE(session.find<Town>(4) == NULL);
+
+  l.name = "Sweden";
+  session.store(4, l);
+
+  ASSERT_EQ(1, session.size());
+  ASSERT_STREQ("Sweden", session.find<Land>(4)->name.c_str());
+
+  Land found = Land::find(4);
+  ASSERT_STREQ("Sweden", found.name.c_str());
+
+  session.clear();
+  ASSERT_EQ(0, session.size());
+}
+
+TEST_F(SessionTest, SharedParent)
+{
+  local_charset = "latin1";
+
+  string json = "{\"id\":1,\"towns\":["
+    "{\"id\":1,\"name\":\"Copenhagen\",\"land\":{\"land_id\":1,\"name\":\"Denmark\"}},"
+    "{\"id\":2,\"name\":\"Aarhus\",\"land\":{\"land_id\":1,\"name\":\"Danmark\"}},"
+    "{\"id\":3,\"name\":\"Stockholm\",\"land\":{\"land_id\":2,\"name\":\"Sweden\"}}]}";
+
+  Region r1;
+  r1.from_json(json);
+
+  ASSERT_STREQ("Danmark", r1.towns[1].land->name.c_str());
+
+  Session session;
+
+  Region r2;
+  r2.from_json(json);
+
+  // The land is only decoded the first time it is encountered
+  ASSERT_EQ(3, r2.towns.size());
+  ASSERT_STREQ("Denmark", r2.towns[0].land->name.c_str());
+  ASSERT_STREQ("Denmark", r2.towns[1].land->name.c_str());
+  ASSERT_STREQ("Sweden", r2.towns[2].land->name.c_str());
+  ASSERT_FALSE(r2.towns[1].land.is_dirty());
+  ASSERT_TRUE(r2.towns[1].land->exists());
+
+  // Decoded objects are copies, changes do not propagate
+  r2.towns[0].land->name = "Changed";
+  ASSERT_STREQ("Denmark", r2.towns[1].land->name.c_str());
+
+  ASSERT_TRUE(session.find<Town>(2) != NULL);
+  ASSERT_TRUE(session.find<Land>(2) != NULL);
+}
+
+TEST_F(SessionTest, SaveAndDestroy)
+{
+  server.insert("town", "{\"id\": 1, \"name\": \"Odense\", \"land\": null}");
+
+  Session session;
+
+  Town town = Town::find(1);
+  town.name = "Aalborg";
+  town.save();
+
+  // The saved object is served from the session
+  ASSERT_STREQ("Aalborg", Town::find(1).name.c_str());
+  ASSERT_EQ(2, server.request_count());
+
+  town.destroy();
+  ASSERT_TRUE(session.find<Town>(1) == NULL);
+  ASSERT_THROW(Town::find(1), ResponseError);
+}
+
+TEST_F(SessionTest, PartialEntries)
+{
+  server.insert("land", "{\"id\": 1, \"land_id\": 1, \"name\": \"Danmark\"}");
+  server.insert("town", "{\"id\": 1, \"name\": \"Odense\", \"land\": null}");
+
+  Session session;
+
+  Region region;
+  region.from_json("{\"id\":1,\"towns\":["
+    "{\"id\":2,\"name\":\"Aarhus\",\"land\":{\"land_id\":1,\"name\":\"Denmark\"}}]}");
+
+  // Nested objects are only stored as partial
+  ASSERT_TRUE(session.find<Land>(1) != NULL);
+  ASSERT_TRUE(session.find<Land>(1, true) == NULL);
+
+  // A find requests the object, and completes the entry
+  ASSERT_STREQ("Danmark", Land::find(1).name.c_str());
+  ASSERT_EQ(1, server.request_count());
+  ASSERT_TRUE(session.find<Land>(1, true) != NULL);
+
+  ASSERT_STREQ("Danmark", Land::find(1).name.c_str());
+  ASSERT_EQ(1, server.request_count());
+
+  // Collections refresh the entries of their objects
+  ASSERT_STREQ("Odense", Town::find(1).name.c_str());
+  server.insert("town", "{\"id\": 1, \"name\": \"Aalborg\", \"land\": null}");
+
+  Town::Collection towns = Town::find_all();
+  ASSERT_STREQ("Aalborg", towns[0].name.c_str());
+  ASSERT_STREQ("Aalborg", Town::find(1).name.c_str());
+  ASSERT_EQ(3, server.request_count());
+}